@@ -0,0 +1,41 @@
+#include "mm5aot.h"
+#include "mm5rom.h"
+#include <stdexcept>
+
+namespace MM5Sound {
+
+CCompiledEngine::CCompiledEngine(const CSoundBank &bank) : CEngine(bank) {
+	if (bank.Checksum() != BANK_CRC)
+		throw std::runtime_error {"Compiled songs do not match the sound bank"};
+}
+
+void CCompiledEngine::ReadSFXHeader(bool C) {
+	if (!RunSFXHeader(C))
+		CEngine::ReadSFXHeader(C);
+}
+
+void CCompiledEngine::ReadSFXChannel() {
+	bool done = false;
+	switch (X_) {
+	case 0x00: done = RunSFXChannel<0>(); break;
+	case 0x01: done = RunSFXChannel<1>(); break;
+	case 0x02: done = RunSFXChannel<2>(); break;
+	case 0x03: done = RunSFXChannel<3>(); break;
+	}
+	if (!done)
+		CEngine::ReadSFXChannel();
+}
+
+void CCompiledEngine::ReadPattern(CMusicTrack *Chan) {
+	bool done = false;
+	switch (Chan->channelID) {
+	case 0x00: done = RunPattern<0>(Chan); break;
+	case 0x01: done = RunPattern<1>(Chan); break;
+	case 0x02: done = RunPattern<2>(Chan); break;
+	case 0x03: done = RunPattern<3>(Chan); break;
+	}
+	if (!done)
+		CEngine::ReadPattern(Chan);
+}
+
+} // namespace MM5Sound
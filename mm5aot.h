@@ -0,0 +1,47 @@
+#pragma once
+
+#include "mm5sound.h"
+
+namespace MM5Sound {
+
+// engine whose pattern and SFX streams run as straight-line code emitted by
+// mm5aotgen for one particular sound bank; any stream position the generated
+// code does not cover falls back to the interpreter
+class CCompiledEngine : public CEngine {
+public:
+	explicit CCompiledEngine(const CSoundBank &bank);
+
+	static const uint32_t BANK_CRC;
+
+protected:
+	void ReadSFXHeader(bool C) override;
+	void ReadSFXChannel() override;
+	void ReadPattern(CMusicTrack *Chan) override;
+
+private:
+	// generated, each returns false without side effects if the current
+	// stream address was not compiled
+	template <uint8_t Ch>
+	bool RunPattern(CMusicTrack *Chan);
+	template <uint8_t X>
+	bool RunSFXChannel();
+	bool RunSFXHeader(bool &C);
+
+	void Fetched(uint16_t adr) {
+		// side effects of ReadROM
+		mem_[0xC2] = adr >> 8;
+		mem_[0xC1] = adr & 0xFF;
+		Y_ = 0;
+	}
+};
+
+template <> bool CCompiledEngine::RunPattern<0>(CMusicTrack *Chan);
+template <> bool CCompiledEngine::RunPattern<1>(CMusicTrack *Chan);
+template <> bool CCompiledEngine::RunPattern<2>(CMusicTrack *Chan);
+template <> bool CCompiledEngine::RunPattern<3>(CMusicTrack *Chan);
+template <> bool CCompiledEngine::RunSFXChannel<0>();
+template <> bool CCompiledEngine::RunSFXChannel<1>();
+template <> bool CCompiledEngine::RunSFXChannel<2>();
+template <> bool CCompiledEngine::RunSFXChannel<3>();
+
+} // namespace MM5Sound
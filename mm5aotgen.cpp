@@ -0,0 +1,661 @@
+#include "mm5sound.h"
+#include "mm5rom.h"
+#include <cstdio>
+#include <cstdarg>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+using namespace MM5Sound;
+
+namespace {
+
+// CEngine's tables, so that the generator folds exactly the same constants
+struct CTables : public CEngine {
+	using CEngine::NOTE_LENGTH_TRIPLET;
+	using CEngine::NOTE_LENGTH;
+	using CEngine::OCTAVE_TABLE;
+	using CEngine::TRACK_COUNT;
+	using CEngine::SONG_TABLE;
+	using CEngine::INSTRUMENT_TABLE;
+};
+
+std::string Format(const char *fmt, ...) {
+	char buf[256];
+	va_list args;
+	va_start(args, fmt);
+	vsnprintf(buf, sizeof(buf), fmt, args);
+	va_end(args);
+	return buf;
+}
+
+// partially known octave / flag byte ($0730)
+struct CKnownBits {
+	uint8_t mask = 0x00;
+	uint8_t value = 0x00;
+
+	bool Known(uint8_t m) const { return (mask & m) == m; }
+	bool Set(uint8_t m) const { return Known(m) && (value & m); }
+	void Xor(uint8_t m) { value ^= m; }
+	void Or(uint8_t m) { mask |= m; value |= m; }
+	void And(uint8_t m) { mask |= ~m; value &= m; }
+};
+
+class CSongCompiler {
+public:
+	explicit CSongCompiler(const CSoundBank &bank) : bank_(bank) { }
+
+	void Compile();
+	void Write(FILE *f);
+
+private:
+	struct TailKey {
+		uint16_t adr;
+		uint8_t flags;
+		bool operator<(const TailKey &other) const {
+			return adr != other.adr ? adr < other.adr : flags < other.flags;
+		}
+	};
+
+	bool Byte(unsigned adr, uint8_t &x) const;
+	static unsigned PatternSize(uint8_t cmd);
+
+	void WalkPattern(uint8_t ch, uint16_t adr);
+	void WalkSFXHeader(uint16_t adr);
+	void WalkSFXTail(TailKey key);
+
+	void Emit(const char *fmt, ...);
+	void EmitPattern(uint8_t ch);
+	bool EmitCommand(uint8_t ch, uint16_t adr, CKnownBits &oct);
+	void EmitNote(uint8_t ch, uint16_t adr, uint8_t cmd, CKnownBits &oct);
+	void EmitSFXHeader();
+	void EmitSFXTail(TailKey key);
+	void EmitSFXChannel(uint8_t x);
+
+	const CSoundBank &bank_;
+	std::set<uint16_t> entries_[4];		// pattern positions after a note
+	std::set<uint16_t> targets_[4];		// branch targets within patterns
+	std::set<uint16_t> pattern_[4];		// every decoded pattern command
+	std::set<uint16_t> sfxHeaders_;
+	std::set<TailKey> sfxTails_;
+	std::set<uint16_t> sfxChannel_[4];
+	std::string out_;
+};
+
+bool CSongCompiler::Byte(unsigned adr, uint8_t &x) const {
+	if (adr < CSoundBank::BASE_ADR || adr >= CSoundBank::BASE_ADR + CSoundBank::BANK_SIZE)
+		return false;
+	x = bank_.Read(adr);
+	return true;
+}
+
+unsigned CSongCompiler::PatternSize(uint8_t cmd) {
+	if (cmd >= 0x20u || cmd < 0x04u)
+		return 1;
+	switch (cmd) {
+	case 0x05: case 0x16: return 3;
+	case 0x0E: case 0x0F: case 0x10: case 0x11:
+	case 0x12: case 0x13: case 0x14: case 0x15: return 4;
+	}
+	return 2;
+}
+
+void CSongCompiler::Compile() {
+	for (unsigned track = 0; track < CTables::TRACK_COUNT; ++track) {
+		uint8_t hi, lo, prio;
+		if (!Byte(CTables::SONG_TABLE + 2 + track * 2, hi) || !Byte(CTables::SONG_TABLE + 3 + track * 2, lo))
+			continue;
+		const uint16_t adr = (hi << 8) | lo;
+		if (!adr || !Byte(adr, prio))
+			continue;
+		if (prio) {
+			WalkSFXHeader(adr + 1);
+			continue;
+		}
+		for (int i = 0; i < 4; ++i)
+			if (Byte(adr + 1 + i * 2, hi) && Byte(adr + 2 + i * 2, lo) && (hi || lo)) {
+				entries_[3 - i].insert((hi << 8) | lo);
+				WalkPattern(3 - i, (hi << 8) | lo);
+			}
+	}
+}
+
+void CSongCompiler::WalkPattern(uint8_t ch, uint16_t adr) {
+	std::vector<uint16_t> pending {adr};
+	while (!pending.empty()) {
+		uint16_t pc = pending.back();
+		pending.pop_back();
+		while (pattern_[ch].insert(pc).second) {
+			uint8_t cmd, hi, lo;
+			if (!Byte(pc, cmd))
+				break;
+			const unsigned size = PatternSize(cmd);
+			if (cmd >= 0x20u) {
+				entries_[ch].insert(pc + 1);
+				pc += size;
+				continue;
+			}
+			if (cmd == 0x17 || cmd > 0x18u)
+				break;
+			if (cmd >= 0x0Eu && cmd <= 0x16u) {
+				if (!Byte(pc + size - 2, hi) || !Byte(pc + size - 1, lo))
+					break;
+				targets_[ch].insert((hi << 8) | lo);
+				pending.push_back((hi << 8) | lo);
+				if (cmd == 0x16)
+					break;
+			}
+			pc += size;
+		}
+	}
+}
+
+void CSongCompiler::WalkSFXHeader(uint16_t adr) {
+	if (!sfxHeaders_.insert(adr).second)
+		return;
+	uint8_t b, c, hi, lo;
+	if (!Byte(adr, b) || (b & 0x80))
+		return;
+	if (!(b & 0x01)) {
+		WalkSFXTail({static_cast<uint16_t>(adr + 1), static_cast<uint8_t>(b >> 1)});
+		return;
+	}
+	if (!Byte(adr + 1, c) || !Byte(adr + 2, hi) || !Byte(adr + 3, lo))
+		return;
+	if (static_cast<uint8_t>(c << 1))
+		WalkSFXTail({static_cast<uint16_t>(adr + 4), static_cast<uint8_t>(b >> 1)});
+	const uint16_t target = (hi << 8) | lo;
+	if (lo)
+		WalkSFXHeader(target);
+	else
+		WalkSFXTail({static_cast<uint16_t>(target + 2), static_cast<uint8_t>(b >> 1)});
+}
+
+void CSongCompiler::WalkSFXTail(TailKey key) {
+	if (!sfxTails_.insert(key).second)
+		return;
+	unsigned pc = key.adr + 1 + (key.flags & 0x01) + ((key.flags >> 1) & 0x01);
+	uint8_t mask;
+	if (!Byte(pc++, mask))
+		return;
+	for (int x = 3; x >= 0; --x) {
+		if (!(mask & (1 << (3 - x))))
+			continue;
+		uint8_t flags;
+		if (!Byte(pc, flags) || (flags & 0xE0))
+			return;
+		sfxChannel_[x].insert(pc);
+		++pc;
+		for (; flags; flags >>= 1)
+			pc += flags & 0x01;
+		++pc;
+	}
+	WalkSFXHeader(pc);
+}
+
+void CSongCompiler::Emit(const char *fmt, ...) {
+	char buf[512];
+	va_list args;
+	va_start(args, fmt);
+	vsnprintf(buf, sizeof(buf), fmt, args);
+	va_end(args);
+	out_ += buf;
+	out_ += '\n';
+}
+
+void CSongCompiler::EmitPattern(uint8_t ch) {
+	// labels are needed at entries, branch targets and broken fallthroughs
+	std::set<uint16_t> labels = entries_[ch];
+	labels.insert(targets_[ch].begin(), targets_[ch].end());
+	for (auto it = pattern_[ch].begin(); it != pattern_[ch].end(); ++it) {
+		uint8_t cmd;
+		if (!Byte(*it, cmd) || cmd == 0x16 || cmd == 0x17 || (cmd > 0x18u && cmd < 0x20u))
+			continue;
+		auto next = std::next(it);
+		const uint16_t fall = *it + PatternSize(cmd);
+		if (cmd < 0x20u && (next == pattern_[ch].end() || *next != fall))
+			labels.insert(fall);
+	}
+
+	Emit("template <>");
+	Emit("bool CCompiledEngine::RunPattern<%d>(CMusicTrack *Chan) {", ch);
+	Emit("\tswitch (Chan->patternAdr) {");
+	for (auto adr : entries_[ch])
+		Emit("\tcase 0x%04X: goto L%04X;", adr, adr);
+	Emit("\tdefault: return false;");
+	Emit("\t}");
+
+	CKnownBits oct;
+	for (auto it = pattern_[ch].begin(); it != pattern_[ch].end(); ++it) {
+		const uint16_t adr = *it;
+		if (labels.count(adr)) {
+			Emit("L%04X:", adr);
+			oct = CKnownBits { };
+		}
+		if (!EmitCommand(ch, adr, oct))
+			continue;
+		uint8_t cmd;
+		Byte(adr, cmd);
+		const uint16_t fall = adr + PatternSize(cmd);
+		auto next = std::next(it);
+		if (next == pattern_[ch].end() || *next != fall)
+			Emit("\tgoto L%04X;", fall);
+	}
+	// uncompiled positions that are only reached by fallthrough
+	for (auto adr : labels)
+		if (!pattern_[ch].count(adr))
+			Emit("L%04X:\n\tChan->patternAdr = 0x%04X;\n\treturn false;", adr, adr);
+	Emit("}");
+	Emit("");
+}
+
+// returns true if control falls through to the next command
+bool CSongCompiler::EmitCommand(uint8_t ch, uint16_t adr, CKnownBits &oct) {
+	uint8_t cmd, op = 0, lo = 0;
+	if (!Byte(adr, cmd) || (cmd > 0x18u && cmd < 0x20u) ||
+		!Byte(adr + PatternSize(cmd) - 1, lo)) {
+		Emit("\tChan->patternAdr = 0x%04X;\n\treturn false;", adr);
+		return false;
+	}
+	if (cmd >= 0x20u) {
+		EmitNote(ch, adr, cmd, oct);
+		return false;
+	}
+	Byte(adr + 1, op);
+
+	const uint16_t last = adr + PatternSize(cmd) - 1;
+	if (cmd >= 0x04u)
+		Emit("\tmem_[0xC4] = 0x%02X; mem_[0xC3] = 0x%02X;", cmd, op);
+	if (cmd < 0x0Eu || cmd > 0x15u)
+		Emit("\tFetched(0x%04X);", last);
+	const uint16_t target = (op << 8) | lo;
+	switch (cmd) {
+	case 0x00: Emit("\tChan->octaveFlag ^= 0x20;"); oct.Xor(0x20); break;
+	case 0x01: Emit("\tChan->octaveFlag ^= 0x40;"); oct.Xor(0x40); break;
+	case 0x02: Emit("\tChan->octaveFlag |= 0x10;"); oct.Or(0x10); break;
+	case 0x03: Emit("\tChan->octaveFlag ^= 0x08;"); oct.Xor(0x08); break;
+	case 0x04:
+		Emit("\tChan->octaveFlag = (Chan->octaveFlag & 0x97) | 0x%02X;", op);
+		oct.And(0x97);
+		oct.Or(op);
+		break;
+	case 0x05:
+		Emit("\tvar_tickCounter = 0;\n\tvar_tempo = 0x%04X;", target);
+		break;
+	case 0x06: Emit("\tChan->gateTime = 0x%02X;", op); break;
+	case 0x07:
+		Emit("\tA_ = Chan->volumeDuty = (Chan->volumeDuty & 0xC0) | 0x%02X;", op | 0x30);
+		break;
+	case 0x08:
+		Emit("\tA_ = mem_[0xC3] = 0x%02X;", static_cast<uint8_t>(op + 1));
+		Emit("\tif (Chan->envNumber != 0x%02X) {", static_cast<uint8_t>(op + 1));
+		Emit("\t\tChan->envNumber = 0x%02X;", static_cast<uint8_t>(op + 1));
+		Emit("\t\tChan->envState |= 0x08;");
+		Emit("\t\tY_ = 0x%02X;", op);
+		Emit("\t\tmem_[0xC3] = 0x%02X;", (op << 3) >> 8);
+		Emit("\t\tvar_envelopePtr = 0x%04X;", static_cast<uint16_t>(CTables::INSTRUMENT_TABLE + (op << 3)));
+		Emit("\t\tA_ = 0x%02X;", static_cast<uint16_t>(CTables::INSTRUMENT_TABLE + (op << 3)) >> 8);
+		Emit("\t}");
+		break;
+	case 0x09:
+		Emit("\tChan->octaveFlag = (Chan->octaveFlag & 0xF8) | 0x%02X;", op);
+		oct.And(0xF8);
+		oct.Or(op);
+		break;
+	case 0x0A: Emit("\tvar_globalTrsp = 0x%02X;", op); break;
+	case 0x0B: Emit("\tChan->transpose = 0x%02X;", op); break;
+	case 0x0C: Emit("\tA_ = Chan->detune = 0x%02X;", op); break;
+	case 0x0D: Emit("\tA_ = Chan->portamento = 0x%02X;", op); break;
+	case 0x0E: case 0x0F: case 0x10: case 0x11: {
+		uint8_t hi;
+		Byte(adr + 2, hi);
+		const int level = cmd - 0x0E;
+		Emit("\tFetched(0x%04X);", adr + 1);
+		Emit("\tif (Chan->loopCount[%d])\n\t\t--Chan->loopCount[%d];\n\telse\n\t\tChan->loopCount[%d] = 0x%02X;", level, level, level, op);
+		Emit("\tif (Chan->loopCount[%d]) {", level);
+		Emit("\t\tmem_[0xC3] = 0x%02X;\n\t\tFetched(0x%04X);\n\t\tgoto L%04X;", hi, last, (hi << 8) | lo);
+		Emit("\t}");
+		oct = CKnownBits { };
+		return true;
+	}
+	case 0x12: case 0x13: case 0x14: case 0x15: {
+		uint8_t hi;
+		Byte(adr + 2, hi);
+		const int level = cmd - 0x12;
+		Emit("\tFetched(0x%04X);", adr + 1);
+		Emit("\tif (Chan->loopCount[%d] == 1) {", level);
+		Emit("\t\t--Chan->loopCount[%d];", level);
+		Emit("\t\tChan->octaveFlag = (Chan->octaveFlag & 0x97) | 0x%02X;", op);
+		Emit("\t\tmem_[0xC3] = 0x%02X;\n\t\tFetched(0x%04X);\n\t\tgoto L%04X;", hi, last, (hi << 8) | lo);
+		Emit("\t}");
+		oct = CKnownBits { };
+		return true;
+	}
+	case 0x16:
+		Emit("\tgoto L%04X;", target);
+		return false;
+	case 0x17:
+		Emit("\tChan->patternAdr = 0;");
+		Emit("\tif (mem_[0xCF] < 0x80u)\n\t\tSilenceChannel(0x%02X);", ch);
+		Emit("\treturn true;");
+		return false;
+	case 0x18:
+		Emit("\tA_ = Chan->volumeDuty = (Chan->volumeDuty & 0x0F) | 0x%02X;", op | 0x30);
+		break;
+	}
+	return true;
+}
+
+void CSongCompiler::EmitNote(uint8_t ch, uint16_t adr, uint8_t cmd, CKnownBits &oct) {
+	const uint8_t lenMult = (cmd >> 5) - 1;
+	const uint8_t triplet = CTables::NOTE_LENGTH_TRIPLET[lenMult];
+	const uint8_t normal = CTables::NOTE_LENGTH[lenMult];
+	const uint8_t dotted = normal * 3 / 2;
+	const uint8_t note = cmd & 0x1F;
+
+	Emit("\tFetched(0x%04X);\n\tChan->patternAdr = 0x%04X;", adr, adr + 1);
+	const auto dot = [&] (const char *indent) {
+		Emit("%smem_[0xC3] = 0x%02X;", indent, normal);
+		Emit("%sChan->octaveFlag &= 0xEF;", indent);
+		Emit("%sChan->noteWait += 0x%02X;", indent, dotted);
+	};
+	if (oct.Set(0x20))
+		Emit("\tChan->noteWait += 0x%02X;", triplet);
+	else if (oct.Known(0x30)) {
+		if (oct.Set(0x10))
+			dot("\t");
+		else
+			Emit("\tChan->noteWait += 0x%02X;", normal);
+		oct.And(0xEF);
+	}
+	else {
+		const bool tripletKnown = oct.Known(0x20);
+		const char *indent = tripletKnown ? "\t" : "\t\t";
+		if (!tripletKnown)
+			Emit("\tif (Chan->octaveFlag & 0x20)\n\t\tChan->noteWait += 0x%02X;\n\telse {", triplet);
+		if (oct.Set(0x10))
+			dot(indent);
+		else if (oct.Known(0x10))
+			Emit("%sChan->noteWait += 0x%02X;", indent, normal);
+		else {
+			Emit("%sif (Chan->octaveFlag & 0x10) {", indent);
+			dot(tripletKnown ? "\t\t" : "\t\t\t");
+			Emit("%s}\n%selse\n%s\tChan->noteWait += 0x%02X;", indent, indent, indent, normal);
+		}
+		if (!tripletKnown)
+			Emit("\t}");
+		if (tripletKnown)
+			oct.And(0xEF);
+	}
+	Emit("\tY_ = Chan->noteWait;");
+
+	if (!note) {
+		Emit("\tReleaseNote(Chan->index);\n\tChan->sustainWait = 0xFF;\n\treturn true;");
+		return;
+	}
+	Emit("\tChan->sustainWait = Multiply(Chan->gateTime, Y_) >> 8;");
+	Emit("\tif (!Chan->sustainWait)\n\t\tChan->sustainWait = 1;");
+	Emit("\tY_ = 0x%02X;", note - 1);
+
+	const bool tieKnown = oct.Known(0x80);
+	const bool tied = oct.Set(0x80);
+	if (!tieKnown)
+		Emit("\tif (!(Chan->octaveFlag & 0x80)) {");
+	if (!tied) {
+		const char *indent = tieKnown ? "\t" : "\t\t";
+		Emit("%sFunc85AE();", indent);
+		Emit("%sA_ = mem_[0xCF];", indent);
+		Emit("%sif (mem_[0xCF] < 0x80u) {", indent);
+		Emit("%s\tmem_[0xC3] = 0x%02X;", indent, note - 1);
+		Emit("%s\tA_ = Chan->periodCache = 0xFF;", indent);
+		Emit("%s}", indent);
+	}
+	if (!tieKnown)
+		Emit("\t}");
+
+	std::string pitch;
+	if (!ch)
+		pitch = Format("\tFunc8636(X_, 0x%04X);", (((note - 1) & 0x0F) ^ 0x0F) << 8);
+	else {
+		pitch = Format("\tmem_[0xC3] = 0x%02X;\n", note - 1);
+		if (oct.Known(0x0F))
+			pitch += Format("\tY_ = 0x%02X;\n\tA_ = 0x%02X + var_globalTrsp + Chan->transpose;\n",
+				oct.value & 0x0F, static_cast<uint8_t>(CTables::OCTAVE_TABLE[oct.value & 0x0F] + note - 1));
+		else
+			pitch += Format("\tY_ = Chan->octaveFlag & 0x0F;\n\tA_ = OCTAVE_TABLE[Y_] + 0x%02X + var_globalTrsp + Chan->transpose;\n", note - 1);
+		pitch += "\tFunc85DE(Chan->index);";
+	}
+	if (tieKnown && !tied)
+		Emit("%s", pitch.c_str());
+	else {
+		Emit("\tif (%sChan->portamento) {", tieKnown ? "" : "!(Chan->octaveFlag & 0x80) || ");
+		std::string body;
+		for (char c : pitch) {
+			if (body.empty() || body.back() == '\n')
+				body += '\t';
+			body += c;
+		}
+		Emit("%s", body.c_str());
+		Emit("\t}\n\telse\n\t\tFunc8644(Chan->index);");
+	}
+
+	Emit("\tChan->octaveFlag &= 0x7F;");
+	if (!oct.Known(0x40))
+		Emit("\tif (Chan->octaveFlag & 0x40) {\n\t\tChan->octaveFlag |= 0x80;\n\t\tChan->sustainWait = 0xFF;\n\t}");
+	else if (oct.Set(0x40))
+		Emit("\tChan->octaveFlag |= 0x80;\n\tChan->sustainWait = 0xFF;");
+	Emit("\treturn true;");
+}
+
+void CSongCompiler::EmitSFXHeader() {
+	Emit("bool CCompiledEngine::RunSFXHeader(bool &C) {");
+	Emit("dispatch:");
+	Emit("\tswitch (sfx_currentPtr) {");
+	for (auto adr : sfxHeaders_)
+		Emit("\tcase 0x%04X: goto L%04X;", adr, adr);
+	Emit("\tdefault: return false;");
+	Emit("\t}");
+
+	for (auto adr : sfxHeaders_) {
+		uint8_t b, c, hi, lo;
+		Emit("L%04X:", adr);
+		if (!Byte(adr, b)) {
+			Emit("\treturn false;");
+			continue;
+		}
+		Emit("\tFetched(0x%04X);\n\tsfx_currentPtr = 0x%04X;\n\tA_ = mem_[0xC4] = 0x%02X;", adr, adr + 1, b);
+		if (b & 0x80) {
+			Emit("\tmem_[0xCE] = Y_;");
+			Emit("\tA_ = mem_[0xD7] >> 1;");
+			Emit("\tif (!(mem_[0xD7] & 0x01)) {\n\t\tL81C8();\n\t\treturn true;\n\t}");
+			Emit("\tFunc8118();\n\tgoto dispatch;");
+			continue;
+		}
+		Emit("\tmem_[0xC4] = 0x%02X;", b >> 1);
+		if (!(b & 0x01)) {
+			Emit("\tgoto T%04X_%02X;", adr + 1, b >> 1);
+			continue;
+		}
+		if (!Byte(adr + 1, c) || !Byte(adr + 2, hi) || !Byte(adr + 3, lo)) {
+			// reads past the bank, let the interpreter throw
+			Emit("\tsfx_currentPtr = 0x%04X;\n\tmem_[0xC4] = 0x%02X;\n\treturn false;", adr, b);
+			continue;
+		}
+		const uint8_t count = c << 1;
+		Emit("\tFetched(0x%04X);\n\tsfx_currentPtr = 0x%04X;\n\tA_ = 0x%02X;", adr + 1, adr + 2, count);
+		if (count) {
+			Emit("\tC = mem_[0xD6] >= 0x80u;");
+			Emit("\tif (static_cast<uint8_t>(mem_[0xD6] << 1) == 0x%02X) {", count);
+			Emit("\t\tA_ = (Y_ >> 1) | (C ? 0x80 : 0x00);");
+			Emit("\t\tmem_[0xD6] = A_;\n\t\tsfx_currentPtr = 0x%04X;\n\t\tgoto T%04X_%02X;", adr + 4, adr + 4, b >> 1);
+			Emit("\t}");
+			Emit("\t++mem_[0xD6];");
+		}
+		const uint16_t target = (hi << 8) | lo;
+		Emit("\tFetched(0x%04X);\n\tX_ = 0x%02X;", adr + 2, hi);
+		Emit("\tFetched(0x%04X);\n\tA_ = 0x%02X;", adr + 3, lo);
+		if (lo)
+			Emit("\tsfx_currentPtr = 0x%04X;\n\tgoto L%04X;", target, target);
+		else {
+			Emit("\tA_ = (Y_ >> 1) | (C ? 0x80 : 0x00);");
+			Emit("\tmem_[0xD6] = A_;\n\tsfx_currentPtr = 0x%04X;\n\tgoto T%04X_%02X;",
+				static_cast<uint16_t>(target + 2), static_cast<uint16_t>(target + 2), b >> 1);
+		}
+	}
+
+	for (auto key : sfxTails_)
+		EmitSFXTail(key);
+	Emit("}");
+	Emit("");
+}
+
+void CSongCompiler::EmitSFXTail(TailKey key) {
+	Emit("T%04X_%02X:", key.adr, key.flags);
+	unsigned pc = key.adr;
+	uint8_t x;
+	const auto read = [&] (const char *dest) {
+		if (!Byte(pc, x))
+			return false;
+		Emit("\tFetched(0x%04X);\n\t%s = 0x%02X;", pc, dest, x);
+		++pc;
+		return true;
+	};
+	bool ok = true;
+	if (key.flags & 0x01)
+		ok = ok && read("mem_[0xD4]");
+	if (key.flags & 0x02)
+		ok = ok && read("mem_[0xD2]");
+	ok = ok && read("mem_[0xD3]");
+	if (!ok) {
+		Emit("\tthrow std::out_of_range {\"Sound bank address out of range\"};");
+		return;
+	}
+	Emit("\tmem_[0xC4] = 0x%02X;", key.flags >> 2);
+	Emit("\tsfx_currentPtr = 0x%04X;", pc);
+	Emit("\tY_ = Multiply(mem_[0xD3], mem_[0xD4]) >> 8;");
+	Emit("\tmem_[0xD5] = Y_ + 1;");
+	Emit("\t++mem_[0xC0];");
+	if (!Byte(pc, x)) {
+		Emit("\tthrow std::out_of_range {\"Sound bank address out of range\"};");
+		return;
+	}
+	Emit("\tFetched(0x%04X);\n\tsfx_currentPtr = 0x%04X;", pc, pc + 1);
+	Emit("\tA_ = 0x%02X ^ mem_[0xCF];", x);
+	Emit("\tif (A_) {\n\t\tmem_[0xCF] = A_;\n\t\tFunc81D4();\n\t}");
+	Emit("\tmem_[0xCF] = 0x%02X;", x);
+	Emit("\treturn true;");
+}
+
+void CSongCompiler::EmitSFXChannel(uint8_t x) {
+	static const char *const COMMANDS[] = {
+		"CmdEnvelope", "CmdDuty", "CmdVolume", "CmdPortamento", "CmdDetune",
+	};
+
+	Emit("template <>");
+	Emit("bool CCompiledEngine::RunSFXChannel<%d>() {", x);
+	Emit("\tswitch (sfx_currentPtr) {");
+	for (auto adr : sfxChannel_[x])
+		Emit("\tcase 0x%04X: goto L%04X;", adr, adr);
+	Emit("\tdefault: return false;");
+	Emit("\t}");
+
+	for (auto adr : sfxChannel_[x]) {
+		unsigned pc = adr;
+		uint8_t flags, param, note;
+		Byte(pc, flags);
+		bool ok = true;
+		unsigned count = 0;
+		for (uint8_t f = flags; f; f >>= 1)
+			count += f & 0x01;
+		for (unsigned i = 0; i <= count + 1; ++i)
+			ok = ok && Byte(pc + i, param);
+		Emit("L%04X:", adr);
+		if (!ok) {
+			Emit("\treturn false;");
+			continue;
+		}
+		Emit("\tFetched(0x%04X);", pc++);
+		uint8_t index = 0;
+		for (uint8_t f = flags; f; f >>= 1, ++index) {
+			if (!(f & 0x01))
+				continue;
+			Byte(pc, param);
+			Emit("\tFetched(0x%04X);", pc++);
+			Emit("\tmem_[0xC4] = 0x%02X;\n\tmem_[0xC3] = 0x%02X;", index, param);
+			Emit("\tA_ = 0x%02X;\n\t%s(X_);", index, COMMANDS[index]);
+		}
+		Emit("\tmem_[0xC4] = 0x%02X;", flags ? index - 1 : 0);
+		Byte(pc, note);
+		Emit("\tFetched(0x%04X);\n\tsfx_currentPtr = 0x%04X;", pc, pc + 1);
+		Emit("\tY_ = A_ = 0x%02X;", note);
+		if (!note) {
+			Emit("\tmem_[0x%04X] = A_;", 0x710 + x);
+			Emit("\tmem_[0x%04X] = (mem_[0x%04X] & 0xF8) | 0x04;", 0x704 + x, 0x704 + x);
+			Emit("\tSilenceChannel(0x%02X);\n\treturn true;", x);
+			continue;
+		}
+		Emit("\tmem_[0x%04X] |= 0x20;", 0x704 + x);
+		Emit("\tmem_[0x%04X] = (mem_[0x%04X] >= 0x80u) ? 0x54 : 0x0A;", 0x71C + x, 0x718 + x);
+		if (note >= 0x80u) {
+			if (x == 0x01)
+				Emit("\tFunc85AE();");
+			Emit("\tFunc8644(X_);\n\treturn true;");
+			continue;
+		}
+		Emit("\tFunc85AE();");
+		Emit("\tmem_[0x%04X] = 0xFF;", 0x77C + x);
+		Emit("\tY_ = 0x%02X;", note - 1);
+		if (!x)
+			Emit("\tA_ = 0x00;\n\tFunc8636(X_, 0x%04X);", static_cast<uint16_t>(((note - 1) ^ 0x0F) << 8));
+		else
+			Emit("\tA_ = 0x%02X + mem_[0xD2];\n\tFunc85DE(X_);", note - 1);
+		Emit("\treturn true;");
+	}
+	Emit("}");
+	Emit("");
+}
+
+void CSongCompiler::Write(FILE *f) {
+	out_.clear();
+	Emit("// generated by mm5aotgen, do not edit");
+	Emit("");
+	Emit("#include \"mm5aot.h\"");
+	Emit("#include <stdexcept>");
+	Emit("");
+	Emit("namespace MM5Sound {");
+	Emit("");
+	Emit("const uint32_t CCompiledEngine::BANK_CRC = 0x%08Xu;", bank_.Checksum());
+	Emit("");
+	for (uint8_t ch = 0; ch < 4; ++ch)
+		EmitPattern(ch);
+	EmitSFXHeader();
+	for (uint8_t x = 0; x < 4; ++x)
+		EmitSFXChannel(x);
+	Emit("} // namespace MM5Sound");
+	fputs(out_.c_str(), f);
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+	if (argc < 3) {
+		fprintf(stderr, "usage: %s rom output.cpp\n", argv[0]);
+		return 1;
+	}
+	try {
+		const CSoundBank bank {argv[1]};
+		CSongCompiler compiler {bank};
+		compiler.Compile();
+		FILE *f = fopen(argv[2], "w");
+		if (!f)
+			throw std::runtime_error {std::string {"Cannot write "} + argv[2]};
+		compiler.Write(f);
+		fclose(f);
+	}
+	catch (std::exception &e) {
+		fprintf(stderr, "%s\n", e.what());
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,119 @@
+#include "mm5aot.h"
+#include "mm5rom.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+using namespace MM5Sound;
+
+namespace {
+
+template <class T>
+class CTraced : public T {
+public:
+	using T::T;
+
+	void Init(uint8_t track) {
+		writes_.clear();
+		T::CallINIT(track, 0);
+	}
+	void Play() {
+		writes_.clear();
+		T::CallPLAY();
+	}
+	const std::vector<uint32_t> &Writes() const {
+		return writes_;
+	}
+	const uint8_t *Memory() const {
+		return T::mem_;
+	}
+
+private:
+	void WriteCallback(uint16_t adr, uint8_t value) override {
+		writes_.push_back((adr << 8) | value);
+		T::WriteCallback(adr, value);
+	}
+
+	std::vector<uint32_t> writes_;
+};
+
+// runs both engines through the same INIT sequence, returns the first
+// mismatching tick or -1
+int Compare(const CSoundBank &bank, const std::vector<std::pair<int, uint8_t>> &inits, int ticks) {
+	CTraced<CEngine> ref {bank};
+	CTraced<CCompiledEngine> aot {bank};
+	auto next = inits.begin();
+	for (int t = 0; t < ticks; ++t) {
+		std::string refErr, aotErr;
+		const auto step = [&] (auto &eng, std::string &err) {
+			try {
+				while (next != inits.end() && next->first == t)
+					eng.Init((next++)->second);
+				eng.Play();
+			}
+			catch (std::exception &e) {
+				err = e.what();
+			}
+		};
+		auto start = next;
+		step(ref, refErr);
+		next = start;
+		step(aot, aotErr);
+		if (refErr != aotErr || ref.Writes() != aot.Writes() ||
+			memcmp(ref.Memory(), aot.Memory(), 0x800))
+			return t;
+		if (!refErr.empty())
+			break;
+	}
+	return -1;
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+	if (argc < 2) {
+		fprintf(stderr, "usage: %s rom [ticks]\n", argv[0]);
+		return 1;
+	}
+	const int ticks = argc >= 3 ? atoi(argv[2]) : 10800;
+	if (ticks <= 0) {
+		fprintf(stderr, "usage: %s rom [ticks]\n", argv[0]);
+		return 1;
+	}
+	try {
+		const CSoundBank bank {argv[1]};
+		const int TRACKS = 76;
+		int failed = 0;
+		for (int track = 0; track < TRACKS; ++track) {
+			// the track alone, then with every other track triggered over it
+			std::vector<std::pair<int, uint8_t>> inits {{0, track}};
+			int t = Compare(bank, inits, ticks);
+			if (t < 0) {
+				for (int i = 1; i < TRACKS; ++i)
+					inits.emplace_back(i * 97 % ticks, (track + i) % TRACKS);
+				std::sort(inits.begin(), inits.end(), [] (const auto &a, const auto &b) {
+					return a.first < b.first;
+				});
+				t = Compare(bank, inits, ticks);
+			}
+			if (t >= 0) {
+				printf("Track %d: mismatch at tick %d\n", track, t);
+				++failed;
+			}
+		}
+		if (failed) {
+			printf("%d tracks failed.\n", failed);
+			return 1;
+		}
+		printf("All %d tracks match the interpreter.\n", TRACKS);
+	}
+	catch (std::exception &e) {
+		fprintf(stderr, "%s\n", e.what());
+		return 1;
+	}
+	return 0;
+}
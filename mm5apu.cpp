@@ -0,0 +1,268 @@
+#include "mm5apu.h"
+#include <algorithm>
+#include <cmath>
+
+namespace MM5Sound {
+
+namespace {
+	const uint8_t LENGTH_TABLE[] = {
+		10, 254, 20,  2, 40,  4, 80,  6, 160,  8, 60, 10, 14, 12, 26, 14,
+		12,  16, 24, 18, 48, 20, 96, 22, 192, 24, 72, 26, 16, 28, 32, 30,
+	};
+	const uint8_t DUTY_TABLE[][8] = {
+		{0, 1, 0, 0, 0, 0, 0, 0},
+		{0, 1, 1, 0, 0, 0, 0, 0},
+		{0, 1, 1, 1, 1, 0, 0, 0},
+		{1, 0, 0, 1, 1, 1, 1, 1},
+	};
+	const uint16_t NOISE_PERIOD[] = {
+		4, 8, 16, 32, 64, 96, 128, 160, 202, 254, 380, 508, 762, 1016, 2034, 4068,
+	};
+	// 4-step frame sequence, quarter frames at all but the last entry
+	const uint32_t SEQ_EVENT[] = {7457, 14913, 22371, 29829, 29830};
+}
+
+
+
+const uint32_t CAPU::CPU_CLOCK = 1789773u;
+const uint32_t CAPU::FRAME_CYCLES = 29780u;
+
+uint8_t CAPU::CEnvelope::Volume() const {
+	return (reg & 0x10) ? reg & 0x0F : decay;
+}
+
+void CAPU::CEnvelope::Clock() {
+	if (start) {
+		start = false;
+		decay = 0x0F;
+		divider = reg & 0x0F;
+	}
+	else if (divider)
+		--divider;
+	else {
+		divider = reg & 0x0F;
+		if (decay)
+			--decay;
+		else if (reg & 0x20)
+			decay = 0x0F;
+	}
+}
+
+uint8_t CAPU::CPulse::Level() const {
+	if (!length || period < 8u)
+		return 0;
+	return DUTY_TABLE[duty][step] ? env.Volume() : 0;
+}
+
+uint8_t CAPU::CTriangle::Level() const {
+	return step < 16u ? 15 - step : step - 16;
+}
+
+uint8_t CAPU::CNoise::Level() const {
+	return (!length || (lfsr & 0x01)) ? 0 : env.Volume();
+}
+
+void CAPU::CNoise::Step() {
+	const uint16_t fb = (lfsr ^ (lfsr >> (mode ? 6 : 1))) & 0x01;
+	lfsr = (lfsr >> 1) | (fb << 14);
+}
+
+
+
+CAPU::CAPU(uint32_t sampleRate) : sampleRate_(sampleRate) {
+}
+
+void CAPU::Reset() {
+	frame_ = 0u;
+	seqCycle_ = 0u;
+	enable_ = 0u;
+	pulse_[0] = pulse_[1] = CPulse { };
+	tri_ = CTriangle { };
+	noise_ = CNoise { };
+}
+
+void CAPU::Write(uint16_t adr, uint8_t value) {
+	switch (adr) {
+	case 0x4000: case 0x4004: {
+		CPulse &ch = pulse_[(adr >> 2) & 0x01];
+		ch.duty = value >> 6;
+		ch.env.reg = value;
+	} break;
+	case 0x4002: case 0x4006: {
+		CPulse &ch = pulse_[(adr >> 2) & 0x01];
+		ch.period = (ch.period & 0x700) | value;
+	} break;
+	case 0x4003: case 0x4007: {
+		CPulse &ch = pulse_[(adr >> 2) & 0x01];
+		ch.period = (ch.period & 0xFF) | ((value & 0x07) << 8);
+		if (enable_ & (adr == 0x4003 ? CH_PULSE1 : CH_PULSE2))
+			ch.length = LENGTH_TABLE[value >> 3];
+		ch.step = 0;
+		ch.env.start = true;
+	} break;
+	case 0x4008:
+		tri_.control = value;
+		break;
+	case 0x400A:
+		tri_.period = (tri_.period & 0x700) | value;
+		break;
+	case 0x400B:
+		tri_.period = (tri_.period & 0xFF) | ((value & 0x07) << 8);
+		if (enable_ & CH_TRIANGLE)
+			tri_.length = LENGTH_TABLE[value >> 3];
+		tri_.reload = true;
+		break;
+	case 0x400C:
+		noise_.env.reg = value;
+		break;
+	case 0x400E:
+		noise_.mode = (value & 0x80) != 0;
+		noise_.period = NOISE_PERIOD[value & 0x0F];
+		break;
+	case 0x400F:
+		if (enable_ & CH_NOISE)
+			noise_.length = LENGTH_TABLE[value >> 3];
+		noise_.env.start = true;
+		break;
+	case 0x4015:
+		enable_ = value & CH_ALL;
+		if (!(enable_ & CH_PULSE1))
+			pulse_[0].length = 0;
+		if (!(enable_ & CH_PULSE2))
+			pulse_[1].length = 0;
+		if (!(enable_ & CH_TRIANGLE))
+			tri_.length = 0;
+		if (!(enable_ & CH_NOISE))
+			noise_.length = 0;
+		break;
+	}
+}
+
+uint64_t CAPU::SampleAt(uint64_t frame) const {
+	// first sample k with floor(k * CPU_CLOCK / rate) >= frame start
+	return (frame * FRAME_CYCLES * sampleRate_ + CPU_CLOCK - 1) / CPU_CLOCK;
+}
+
+void CAPU::RunFrame(std::vector<int16_t> *out, uint8_t mask) {
+	if (!out) {
+		Run(FRAME_CYCLES, nullptr, 0u);
+		++frame_;
+		return;
+	}
+
+	const uint64_t start = frame_ * FRAME_CYCLES;
+	const uint64_t end = start + FRAME_CYCLES;
+	uint64_t pos = start;
+	for (uint64_t k = SampleAt(frame_), n = SampleAt(frame_ + 1); k < n; ++k) {
+		// average over the sample period, cut off at the end of the frame
+		const uint64_t c0 = k * CPU_CLOCK / sampleRate_;
+		const uint64_t c1 = std::min((k + 1) * CPU_CLOCK / sampleRate_, end);
+		Run(c0 - pos, nullptr, 0u);
+		float acc[4] = { };
+		Run(c1 - c0, acc, mask);
+		pos = c1;
+
+		float level[4];
+		for (int i = 0; i < 4; ++i)
+			level[i] = acc[i] / (c1 - c0);
+		const float pulse = level[0] + level[1];
+		const float tnd = level[2] / 8227.f + level[3] / 12241.f;
+		float x = 0.f;
+		if (pulse > 0.f)
+			x += 95.88f / (8128.f / pulse + 100.f);
+		if (tnd > 0.f)
+			x += 159.79f / (1.f / tnd + 100.f);
+		out->push_back(static_cast<int16_t>(std::min(std::lround(x * 32767.f), 32767l)));
+	}
+	Run(end - pos, nullptr, 0u);
+	++frame_;
+}
+
+void CAPU::Run(uint32_t cycles, float *acc, uint8_t mask) {
+	while (cycles) {
+		const uint32_t *next = std::upper_bound(std::begin(SEQ_EVENT), std::end(SEQ_EVENT), seqCycle_);
+		const uint32_t d = std::min(cycles, *next - seqCycle_);
+		RunChannels(d, acc, mask);
+		cycles -= d;
+		seqCycle_ += d;
+		if (seqCycle_ != *next)
+			continue;
+		if (next == std::end(SEQ_EVENT) - 1)
+			seqCycle_ = 0;
+		else {
+			QuarterFrame();
+			if (next == SEQ_EVENT + 1 || next == SEQ_EVENT + 3)
+				HalfFrame();
+		}
+	}
+}
+
+template <class T, class F>
+void CAPU::RunTimer(T &chan, uint32_t cycles, float *acc, F step) {
+	if (!acc) {
+		if (cycles < chan.remain) {
+			chan.remain -= cycles;
+			return;
+		}
+		cycles -= chan.remain;
+		const uint32_t len = chan.StepCycles();
+		step(1 + cycles / len);
+		chan.remain = len - cycles % len;
+		return;
+	}
+	while (cycles) {
+		const uint32_t d = std::min(cycles, chan.remain);
+		*acc += static_cast<float>(chan.Level() * d);
+		chan.remain -= d;
+		cycles -= d;
+		if (!chan.remain) {
+			step(1u);
+			chan.remain = chan.StepCycles();
+		}
+	}
+}
+
+void CAPU::RunChannels(uint32_t cycles, float *acc, uint8_t mask) {
+	// masked out channels take the fast path that only keeps their state
+	const auto sum = [&] (int i) {
+		return acc && (mask & (1 << i)) ? acc + i : nullptr;
+	};
+	for (int i = 0; i < 2; ++i) {
+		CPulse &ch = pulse_[i];
+		RunTimer(ch, cycles, sum(i), [&] (uint32_t n) {
+			ch.step = (ch.step + n) & 0x07;
+		});
+	}
+	RunTimer(tri_, cycles, sum(2), [&] (uint32_t n) {
+		if (tri_.Active())
+			tri_.step = (tri_.step + n) & 0x1F;
+	});
+	RunTimer(noise_, cycles, sum(3), [&] (uint32_t n) {
+		while (n--)
+			noise_.Step();
+	});
+}
+
+void CAPU::QuarterFrame() {
+	pulse_[0].env.Clock();
+	pulse_[1].env.Clock();
+	noise_.env.Clock();
+	if (tri_.reload)
+		tri_.linear = tri_.control & 0x7F;
+	else if (tri_.linear)
+		--tri_.linear;
+	if (!(tri_.control & 0x80))
+		tri_.reload = false;
+}
+
+void CAPU::HalfFrame() {
+	for (auto &ch : pulse_)
+		if (ch.length && !(ch.env.reg & 0x20))
+			--ch.length;
+	if (tri_.length && !(tri_.control & 0x80))
+		--tri_.length;
+	if (noise_.length && !(noise_.env.reg & 0x20))
+		--noise_.length;
+}
+
+} // namespace MM5Sound
@@ -0,0 +1,107 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+
+namespace MM5Sound {
+
+// 2A03 pulse, triangle and noise channels (NTSC), timed in CPU cycles with
+// integer state only, so that advancing it without producing samples leaves
+// it in exactly the state that rendering would; the sound driver never uses
+// the DMC, sweeps or the 5-step frame sequence
+class CAPU {
+public:
+	static const uint32_t CPU_CLOCK; // 1789773 Hz
+	static const uint32_t FRAME_CYCLES; // one call to PLAY, 60.1 Hz
+
+	enum : uint8_t {
+		CH_PULSE1 = 0x01,
+		CH_PULSE2 = 0x02,
+		CH_TRIANGLE = 0x04,
+		CH_NOISE = 0x08,
+		CH_ALL = 0x0F,
+	};
+
+	explicit CAPU(uint32_t sampleRate = 44100u);
+
+	void Reset();
+	void Write(uint16_t adr, uint8_t value);
+
+	// runs one engine tick and appends its samples to out if it is not null;
+	// channels outside the mask are silent in the output but still advance,
+	// without the cost of synthesis
+	void RunFrame(std::vector<int16_t> *out, uint8_t mask = CH_ALL);
+
+	// samples produced by the frames before the given one
+	uint64_t SampleAt(uint64_t frame) const;
+	uint32_t SampleRate() const { return sampleRate_; }
+
+private:
+	struct CEnvelope {
+		uint8_t reg = 0u;
+		uint8_t divider = 0u;
+		uint8_t decay = 0u;
+		bool start = false;
+
+		uint8_t Volume() const;
+		void Clock();
+	};
+
+	struct CPulse {
+		CEnvelope env;
+		uint8_t duty = 0u;
+		uint8_t step = 0u;
+		uint8_t length = 0u;
+		uint16_t period = 0u;
+		uint32_t remain = 2u;
+
+		uint8_t Level() const;
+		uint32_t StepCycles() const { return (period + 1u) * 2u; }
+	};
+
+	struct CTriangle {
+		uint8_t control = 0u;
+		uint8_t linear = 0u;
+		bool reload = false;
+		uint8_t step = 0u;
+		uint8_t length = 0u;
+		uint16_t period = 0u;
+		uint32_t remain = 1u;
+
+		uint8_t Level() const;
+		bool Active() const { return linear && length; }
+		uint32_t StepCycles() const { return period + 1u; }
+	};
+
+	struct CNoise {
+		CEnvelope env;
+		bool mode = false;
+		uint8_t length = 0u;
+		uint16_t lfsr = 1u;
+		uint16_t period = 4u;
+		uint32_t remain = 4u;
+
+		uint8_t Level() const;
+		uint32_t StepCycles() const { return period; }
+		void Step();
+	};
+
+	void Run(uint32_t cycles, float *acc, uint8_t mask);
+	void RunChannels(uint32_t cycles, float *acc, uint8_t mask);
+	void QuarterFrame();
+	void HalfFrame();
+
+	template <class T, class F>
+	static void RunTimer(T &chan, uint32_t cycles, float *acc, F step);
+
+	const uint32_t sampleRate_;
+	uint64_t frame_ = 0u;
+	uint32_t seqCycle_ = 0u;
+	uint8_t enable_ = 0u;
+	CPulse pulse_[2];
+	CTriangle tri_;
+	CNoise noise_;
+};
+
+} // namespace MM5Sound
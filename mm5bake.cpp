@@ -0,0 +1,39 @@
+#include "mm5bake.h"
+#include "mm5rom.h"
+#include <stdexcept>
+
+namespace MM5Sound {
+
+CTrace Bake(const CSoundBank &bank, uint8_t track, uint8_t region, uint32_t start, uint32_t ticks) {
+	CTrace trace {-1};
+	CTraceEngine engine {bank, &trace};
+	trace.NewFrame();
+	engine.CallINIT(track, region);
+	if (start) {
+		for (uint32_t t = 0; t < start; ++t) {
+			trace.NewFrame();
+			engine.CallPLAY();
+		}
+		int last[0x18];
+		for (auto &x : last)
+			x = -1;
+		for (size_t i = 0; i < trace.Frames(); ++i)
+			for (size_t j = 0; j < trace.FrameSize(i); ++j) {
+				const uint16_t w = trace.FrameData(i)[j];
+				if ((w >> 8) < 0x18u)
+					last[w >> 8] = w & 0xFF;
+			}
+		trace.Clear(static_cast<int>(start) - 1);
+		trace.NewFrame();
+		for (uint16_t r = 0; r < 0x18u; ++r)
+			if (last[r] >= 0)
+				trace.Write(0x4000 + r, static_cast<uint8_t>(last[r]));
+	}
+	for (uint32_t t = 0; t < ticks; ++t) {
+		trace.NewFrame();
+		engine.CallPLAY();
+	}
+	return trace;
+}
+
+} // namespace MM5Sound
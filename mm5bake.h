@@ -0,0 +1,62 @@
+#pragma once
+
+#include "mm5sound.h"
+#include "mm5trace.h"
+#include <cstddef>
+
+namespace MM5Sound {
+
+// register write stream of one tick range, baked into static arrays by
+// mm5bakegen; writes use the CTrace encoding ((adr - $4000) << 8) | value and
+// ends[i] is one past the last write of frame i
+struct CBakedSong {
+	uint8_t track;
+	uint8_t region;
+	uint32_t start;		// first tick after INIT
+	uint32_t ticks;
+	const uint16_t *writes;
+	const uint32_t *ends;	// ticks + 1 frames
+};
+
+// frame 0 holds the writes from CallINIT, or for a range that starts later,
+// the last value written to each register before it in address order; the
+// other frames hold one CallPLAY each
+CTrace Bake(const CSoundBank &bank, uint8_t track, uint8_t region, uint32_t start, uint32_t ticks);
+
+// compile-time check of the generated arrays
+constexpr bool ValidEnds(const uint32_t *ends, size_t frames, size_t writes) {
+	for (size_t i = 1; i < frames; ++i)
+		if (ends[i] < ends[i - 1])
+			return false;
+	return frames && ends[frames - 1] == writes;
+}
+
+// generated
+extern const uint32_t BAKED_BANK_CRC;
+extern const CBakedSong BAKED_SONGS[];
+extern const size_t BAKED_SONG_COUNT;
+
+// walks the baked arrays without running the driver; CallINIT selects the
+// first range baked for the track and region and plays its frame 0, CallPLAY
+// plays the next frame and nothing once the range is over
+class CBakedPlayer : public ISongPlayer {
+public:
+	// the bank is only used to check that it is the one that was baked
+	explicit CBakedPlayer(const CSoundBank &bank);
+
+	void CallINIT(uint8_t track, uint8_t region) override;
+	void CallPLAY() override;
+	uint8_t ReadCallback(uint16_t adr) const override { return 0u; }
+	void WriteCallback(uint16_t adr, uint8_t value) override { }
+
+	static const CBakedSong *Find(uint8_t track, uint8_t region);
+	bool Done() const { return !song_ || frame_ > song_->ticks; }
+
+private:
+	void PlayFrame();
+
+	const CBakedSong *song_ = nullptr;
+	uint32_t frame_ = 0u;
+};
+
+} // namespace MM5Sound
@@ -0,0 +1,93 @@
+#include "mm5bake.h"
+#include "mm5rom.h"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+using namespace MM5Sound;
+
+namespace {
+
+void Usage() {
+	fprintf(stderr,
+		"usage: mm5bakegen rom out.cpp [-r region] track[:start[:ticks]]...\n"
+		"  bakes the register writes of each tick range into static arrays;\n"
+		"  ticks defaults to 600, start to 0\n");
+}
+
+void WriteSong(FILE *f, size_t n, const CTrace &trace) {
+	fprintf(f, "constexpr uint16_t WRITES_%zu[] = {", n);
+	size_t k = 0u;
+	for (size_t i = 0; i < trace.Frames(); ++i)
+		for (size_t j = 0; j < trace.FrameSize(i); ++j)
+			fprintf(f, "%s0x%04X,", k++ % 12 ? " " : "\n\t", trace.FrameData(i)[j]);
+	fprintf(f, "%s};\n", trace.Writes() ? "\n" : " 0");
+
+	fprintf(f, "constexpr uint32_t ENDS_%zu[] = {", n);
+	size_t end = 0u;
+	for (size_t i = 0; i < trace.Frames(); ++i) {
+		end += trace.FrameSize(i);
+		fprintf(f, "%s%zu,", i % 12 ? " " : "\n\t", end);
+	}
+	fprintf(f, "\n};\n");
+	fprintf(f, "static_assert(ValidEnds(ENDS_%zu, %zu, %zu), \"corrupt baked frames\");\n\n",
+		n, trace.Frames(), trace.Writes());
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+	if (argc < 3) {
+		Usage();
+		return 1;
+	}
+
+	try {
+		const CSoundBank bank {argv[1]};
+		std::string table;
+		uint8_t region = 0u;
+		size_t n = 0u;
+
+		FILE *f = fopen(argv[2], "w");
+		if (!f)
+			throw std::runtime_error {std::string {"Cannot write "} + argv[2]};
+		fprintf(f, "// generated by mm5bakegen, do not edit\n\n");
+		fprintf(f, "#include \"mm5bake.h\"\n\n");
+		fprintf(f, "namespace MM5Sound {\n\n");
+		fprintf(f, "const uint32_t BAKED_BANK_CRC = 0x%08Xu;\n\n", bank.Checksum());
+		fprintf(f, "namespace {\n\n");
+		for (int i = 3; i < argc; ++i) {
+			if (!strcmp(argv[i], "-r") && i + 1 < argc) {
+				region = static_cast<uint8_t>(strtol(argv[++i], nullptr, 0));
+				continue;
+			}
+			char *p;
+			const uint8_t track = static_cast<uint8_t>(strtol(argv[i], &p, 0));
+			const uint32_t start = *p == ':' ? strtoul(p + 1, &p, 0) : 0u;
+			const uint32_t ticks = *p == ':' ? strtoul(p + 1, &p, 0) : 600u;
+			if (*p || p == argv[i]) {
+				Usage();
+				return 1;
+			}
+			WriteSong(f, n, Bake(bank, track, region, start, ticks));
+			char row[128];
+			snprintf(row, sizeof(row), "\t{0x%02X, %u, %u, %u, WRITES_%zu, ENDS_%zu},\n",
+				track, region, start, ticks, n, n);
+			table += row;
+			++n;
+		}
+		fprintf(f, "} // namespace\n\n");
+		fprintf(f, "const CBakedSong BAKED_SONGS[] = {\n%s%s};\n", table.c_str(), n ? "" : "\t{0, 0, 0, 0, nullptr, nullptr},\n");
+		fprintf(f, "const size_t BAKED_SONG_COUNT = %zu;\n\n", n);
+		fprintf(f, "} // namespace MM5Sound\n");
+		if (fclose(f))
+			throw std::runtime_error {std::string {"Cannot write "} + argv[2]};
+	}
+	catch (std::exception &e) {
+		fprintf(stderr, "%s\n", e.what());
+		return 1;
+	}
+	return 0;
+}
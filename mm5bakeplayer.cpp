@@ -0,0 +1,39 @@
+#include "mm5bake.h"
+#include "mm5rom.h"
+#include <stdexcept>
+
+namespace MM5Sound {
+
+CBakedPlayer::CBakedPlayer(const CSoundBank &bank) {
+	if (bank.Checksum() != BAKED_BANK_CRC)
+		throw std::runtime_error {"Baked songs do not match the sound bank"};
+}
+
+const CBakedSong *CBakedPlayer::Find(uint8_t track, uint8_t region) {
+	for (size_t i = 0; i < BAKED_SONG_COUNT; ++i)
+		if (BAKED_SONGS[i].track == track && BAKED_SONGS[i].region == region)
+			return &BAKED_SONGS[i];
+	return nullptr;
+}
+
+void CBakedPlayer::CallINIT(uint8_t track, uint8_t region) {
+	song_ = Find(track, region);
+	if (!song_)
+		throw std::runtime_error {"Track was not baked"};
+	frame_ = 0u;
+	PlayFrame();
+}
+
+void CBakedPlayer::CallPLAY() {
+	if (!Done())
+		PlayFrame();
+}
+
+void CBakedPlayer::PlayFrame() {
+	const uint32_t b = frame_ ? song_->ends[frame_ - 1] : 0u;
+	for (uint32_t i = b; i < song_->ends[frame_]; ++i)
+		WriteCallback(0x4000 + (song_->writes[i] >> 8), song_->writes[i] & 0xFF);
+	++frame_;
+}
+
+} // namespace MM5Sound
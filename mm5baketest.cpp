@@ -0,0 +1,122 @@
+#include "mm5bake.h"
+#include "mm5rom.h"
+#include <cstdio>
+#include <stdexcept>
+#include <vector>
+
+using namespace MM5Sound;
+
+namespace {
+
+// writes of the current frame, in the CTrace encoding
+using CFrame = std::vector<uint16_t>;
+
+class CRecordedPlayer : public CBakedPlayer {
+public:
+	using CBakedPlayer::CBakedPlayer;
+
+	CFrame frame;
+
+private:
+	void WriteCallback(uint16_t adr, uint8_t value) override {
+		frame.push_back(((adr - 0x4000) << 8) | value);
+	}
+};
+
+// the reference is a plain engine, not Bake, so that a fault in the baking
+// itself shows up as a difference
+class CRecordedEngine : public CEngine {
+public:
+	explicit CRecordedEngine(const CSoundBank &bank) : CEngine(bank) {
+		for (auto &x : last)
+			x = -1;
+	}
+
+	using CEngine::CallINIT;
+	using CEngine::CallPLAY;
+
+	CFrame frame;
+	int last[0x18];		// the last value written to each register
+
+private:
+	void WriteCallback(uint16_t adr, uint8_t value) override {
+		frame.push_back(((adr - 0x4000) << 8) | value);
+		if (adr - 0x4000u < 0x18u)
+			last[adr - 0x4000] = value;
+	}
+};
+
+// the first tick whose writes differ, -1 for the INIT frame, or start + ticks
+// if none do
+int Compare(const CSoundBank &bank, const CBakedSong &song) {
+	CRecordedEngine engine {bank};
+	CRecordedPlayer player {bank};
+	engine.CallINIT(song.track, song.region);
+	for (uint32_t t = 0; t < song.start; ++t)
+		engine.CallPLAY();
+	if (song.start) {
+		engine.frame.clear();
+		for (uint16_t r = 0; r < 0x18u; ++r)
+			if (engine.last[r] >= 0)
+				engine.frame.push_back((r << 8) | engine.last[r]);
+	}
+	player.CallINIT(song.track, song.region);
+	if (player.frame != engine.frame)
+		return static_cast<int>(song.start) - 1;
+
+	for (uint32_t t = 0; t < song.ticks; ++t) {
+		engine.frame.clear();
+		player.frame.clear();
+		engine.CallPLAY();
+		player.CallPLAY();
+		if (player.frame != engine.frame)
+			return static_cast<int>(song.start + t);
+	}
+	// nothing past the end of the range
+	player.frame.clear();
+	player.CallPLAY();
+	return player.frame.empty() && player.Done() ? static_cast<int>(song.start + song.ticks) : -2;
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+	if (argc < 2) {
+		fprintf(stderr, "usage: %s rom\n", argv[0]);
+		return 1;
+	}
+	try {
+		const CSoundBank bank {argv[1]};
+		int failed = 0;
+		size_t played = 0u;
+		for (size_t i = 0; i < BAKED_SONG_COUNT; ++i) {
+			const CBakedSong &song = BAKED_SONGS[i];
+			if (CBakedPlayer::Find(song.track, song.region) != &song) {
+				printf("Track %d, ticks %u to %u: not played, an earlier range of the track is\n",
+					song.track, song.start, song.start + song.ticks);
+				continue;
+			}
+			++played;
+			const int t = Compare(bank, song);
+			if (t == static_cast<int>(song.start + song.ticks))
+				continue;
+			if (t == -2)
+				printf("Track %d, ticks %u to %u: baked writes run past the range\n",
+					song.track, song.start, song.start + song.ticks);
+			else
+				printf("Track %d, ticks %u to %u: baked writes differ from the engine at tick %d\n",
+					song.track, song.start, song.start + song.ticks, t);
+			++failed;
+		}
+		if (failed) {
+			printf("%d ranges failed.\n", failed);
+			return 1;
+		}
+		printf("All %zu baked ranges played match the engine.\n", played);
+	}
+	catch (std::exception &e) {
+		fprintf(stderr, "%s\n", e.what());
+		return 1;
+	}
+	return 0;
+}
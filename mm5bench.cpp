@@ -0,0 +1,100 @@
+#include "mm5sound.h"
+#include "mm5constants.h"
+#include "mm5rom.h"
+#include "mm5fingerprint.h"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <stdexcept>
+
+using namespace MM5Sound;
+
+namespace {
+
+const int TRACKS = 76;
+
+class CBenchEngine : public CEngine {
+public:
+	using CEngine::CEngine;
+
+	// every track from INIT, with a sound effect laid over it half way and
+	// every control command issued at least once
+	void Play(uint8_t track, int ticks) {
+		const uint8_t other = (track * 7 + 3) % TRACKS;
+		const struct {
+			int at;
+			uint8_t cmd;
+		} SCRIPT[] = {
+			{0, track},
+			{ticks / 4, CMD_PAUSE},
+			{ticks / 4 + 30, CMD_RESUME},
+			{ticks / 2, other},
+			{ticks * 5 / 8, CMD_TRANSPOSE},
+			{ticks * 3 / 4, CMD_FADE_OUT},
+			{ticks * 13 / 16, CMD_FADE_IN},
+			{ticks * 7 / 8, CMD_STOP_SFX},
+			{ticks * 15 / 16, CMD_STOP_MUSIC},
+			{ticks - 1, CMD_STOP_ALL},
+		};
+		size_t next = 0u;
+		for (int t = 0; t < ticks; ++t) {
+			while (next < sizeof(SCRIPT) / sizeof(*SCRIPT) && SCRIPT[next].at <= t)
+				Guard([&] { CallINIT(SCRIPT[next].cmd, 0); }), ++next;
+			Guard([&] { CallPLAY(); });
+		}
+	}
+
+	uint64_t Hash() const { return hash_.Value(); }
+	unsigned long Errors() const { return errors_; }
+
+private:
+	// tracks that stop on a driver error still count, as in verify.lua
+	template <class F>
+	void Guard(F f) {
+		try {
+			f();
+		}
+		catch (std::exception &) {
+			++errors_;
+		}
+	}
+
+	void WriteCallback(uint16_t adr, uint8_t value) override {
+		hash_.Add(adr).Add(value);
+	}
+
+	CHash64 hash_;
+	unsigned long errors_ = 0ul;
+};
+
+} // namespace
+
+int main(int argc, char **argv) {
+	if (argc < 2) {
+		fprintf(stderr, "usage: mm5bench rom [ticks] [name]\n");
+		return 1;
+	}
+	const int ticks = argc >= 3 ? atoi(argv[2]) : 10800;
+	const char *name = argc >= 4 ? argv[3] : "mm5bench";
+
+	try {
+		const CSoundBank bank {argv[1]};
+		CHash64 hash;
+		unsigned long errors = 0ul;
+		const auto t0 = std::chrono::steady_clock::now();
+		for (int track = 0; track < TRACKS; ++track) {
+			CBenchEngine engine {bank};
+			engine.Play(track, ticks);
+			hash.Add(engine.Hash());
+			errors += engine.Errors();
+		}
+		const double t = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+		printf("%-10s %10.4f s %12.0f ticks/s  %016llX  %lu errors\n", name, t, TRACKS * ticks / t,
+			static_cast<unsigned long long>(hash.Value()), errors);
+	}
+	catch (std::exception &e) {
+		fprintf(stderr, "%s\n", e.what());
+		return 1;
+	}
+	return 0;
+}
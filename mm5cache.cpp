@@ -0,0 +1,288 @@
+#include "mm5cache.h"
+#include "mm5fingerprint.h"
+#include "mm5rom.h"
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <thread>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace MM5Sound {
+
+/*
+index layout, native byte order
+0	"MM5C"
+4	version, uint32
+8	slot count, uint32
+12	entry count, uint32
+16	LRU clock, uint64
+24	bytes stored, uint64
+32	hits, uint64
+40	misses, uint64
+48	bytes saved, uint64
+64	slots, 32 bytes each: key (0 if empty), size, last use
+*/
+
+struct CRenderCache::CHeader {
+	char magic[4];
+	uint32_t version;
+	uint32_t slots;
+	uint32_t entries;
+	uint64_t clock;
+	uint64_t bytes;
+	uint64_t hits;
+	uint64_t misses;
+	uint64_t saved;
+	uint64_t reserved;
+};
+
+struct CRenderCache::CEntry {
+	uint64_t key;
+	uint64_t size;
+	uint64_t used;
+	uint64_t reserved;
+};
+
+class CRenderCache::CLock {
+public:
+	explicit CLock(const CRenderCache &cache) : lk_(cache.lock_), fd_(cache.fd_) {
+		while (flock(fd_, LOCK_EX) && errno == EINTR)
+			;
+	}
+	~CLock() {
+		flock(fd_, LOCK_UN);
+	}
+
+private:
+	std::lock_guard<std::mutex> lk_;
+	const int fd_;
+};
+
+namespace {
+	const uint32_t VERSION = 1u;
+
+}
+
+const uint32_t CRenderCache::SLOTS = 4096u;
+
+
+
+CCacheBlob::CCacheBlob(std::vector<uint8_t> data) : data_(std::move(data)) {
+}
+
+CCacheBlob::CCacheBlob(void *map, size_t size) : map_(map), size_(size) {
+}
+
+CCacheBlob::CCacheBlob(CCacheBlob &&other) noexcept :
+	map_(other.map_), size_(other.size_), data_(std::move(other.data_))
+{
+	other.map_ = nullptr;
+}
+
+CCacheBlob &CCacheBlob::operator=(CCacheBlob &&other) noexcept {
+	std::swap(map_, other.map_);
+	std::swap(size_, other.size_);
+	data_.swap(other.data_);
+	return *this;
+}
+
+CCacheBlob::~CCacheBlob() {
+	if (map_)
+		munmap(map_, size_);
+}
+
+
+
+CRenderCache::CRenderCache(const char *dir, uint64_t budget) : dir_(dir), budget_(budget) {
+	if (mkdir(dir, 0777) && errno != EEXIST)
+		throw std::runtime_error {"Cannot create cache directory " + dir_};
+	const std::string fname = dir_ + "/index";
+	fd_ = open(fname.c_str(), O_RDWR | O_CREAT, 0666);
+	if (fd_ < 0)
+		throw std::runtime_error {"Cannot open " + fname};
+
+	const size_t size = sizeof(CHeader) + SLOTS * sizeof(CEntry);
+	{
+		CLock lk {*this};
+		CHeader h { };
+		const bool valid = pread(fd_, &h, sizeof(h), 0) == sizeof(h) &&
+			!memcmp(h.magic, "MM5C", 4) && h.version == VERSION && h.slots == SLOTS;
+		if (!valid) {
+			// new or incompatible index; any files it listed become orphans
+			std::vector<char> zero(size);
+			h = CHeader { };
+			memcpy(h.magic, "MM5C", 4);
+			h.version = VERSION;
+			h.slots = SLOTS;
+			memcpy(zero.data(), &h, sizeof(h));
+			if (ftruncate(fd_, 0) || pwrite(fd_, zero.data(), size, 0) != static_cast<ssize_t>(size)) {
+				close(fd_);
+				throw std::runtime_error {"Cannot initialize " + fname};
+			}
+		}
+	}
+
+	map_ = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0);
+	if (map_ == MAP_FAILED) {
+		close(fd_);
+		throw std::runtime_error {"Cannot map " + fname};
+	}
+	header_ = static_cast<CHeader *>(map_);
+	table_ = reinterpret_cast<CEntry *>(header_ + 1);
+}
+
+CRenderCache::~CRenderCache() {
+	munmap(map_, sizeof(CHeader) + SLOTS * sizeof(CEntry));
+	close(fd_);
+}
+
+uint64_t CRenderCache::Key(const CSoundBank &bank, const CRenderJob &job) {
+	CHash64 h;
+	h.Add(bank.Data(), CSoundBank::BANK_SIZE).Add(VERSION);
+	h.Add(job.track).Add(job.region).Add(job.startTick).Add(job.ticks);
+	h.Add(job.pcm).Add(job.pcm ? job.sampleRate : 0u);
+	return h.Value() ? h.Value() : 1u;
+}
+
+CCacheBlob CRenderCache::Render(const CSegmentRenderer &renderer, const CSoundBank &bank,
+	const CRenderJob &job, unsigned threads)
+{
+	const uint64_t key = Key(bank, job);
+	{
+		CLock lk {*this};
+		if (CEntry *e = Find(key)) {
+			const int fd = open(Path(key).c_str(), O_RDONLY);
+			struct stat st;
+			void *p = MAP_FAILED;
+			if (fd >= 0 && !fstat(fd, &st) && static_cast<uint64_t>(st.st_size) == e->size)
+				p = e->size ? mmap(nullptr, e->size, PROT_READ, MAP_SHARED, fd, 0) : nullptr;
+			if (fd >= 0)
+				close(fd);
+			if (p != MAP_FAILED) {
+				e->used = ++header_->clock;
+				++header_->hits;
+				header_->saved += e->size;
+				return p ? CCacheBlob {p, e->size} : CCacheBlob { };
+			}
+			Erase(e);		// removed or damaged behind our back
+		}
+		++header_->misses;
+	}
+
+	CRenderResult out;
+	if (threads > 1u)
+		renderer.Render(job, threads, out);
+	else
+		renderer.RenderSerial(job, out);
+	std::vector<uint8_t> data;
+	if (job.pcm) {
+		data.resize(out.pcm.size() * 2u);
+		for (size_t i = 0; i < out.pcm.size(); ++i) {
+			data[i * 2] = static_cast<uint16_t>(out.pcm[i]) & 0xFF;
+			data[i * 2 + 1] = static_cast<uint16_t>(out.pcm[i]) >> 8;
+		}
+	}
+	else {
+		char *buf = nullptr;
+		size_t size = 0u;
+		FILE *f = open_memstream(&buf, &size);
+		if (!f)
+			throw std::runtime_error {"Cannot serialize trace"};
+		out.trace.Save(f);
+		fclose(f);
+		data.assign(buf, buf + size);
+		free(buf);
+	}
+
+	Store(key, data);
+	CLock lk {*this};
+	Insert(key, data.size());
+	Evict(key);
+	return CCacheBlob {std::move(data)};
+}
+
+CCacheStats CRenderCache::Stats() const {
+	CLock lk {*this};
+	return {header_->hits, header_->misses, header_->saved, header_->bytes, header_->entries};
+}
+
+CRenderCache::CEntry *CRenderCache::Find(uint64_t key) const {
+	for (uint32_t i = key % SLOTS; table_[i].key; i = (i + 1) % SLOTS)
+		if (table_[i].key == key)
+			return &table_[i];
+	return nullptr;
+}
+
+void CRenderCache::Insert(uint64_t key, uint64_t size) {
+	if (CEntry *e = Find(key))
+		Erase(e);
+	uint32_t i = key % SLOTS;
+	while (table_[i].key)
+		i = (i + 1) % SLOTS;
+	table_[i] = CEntry {key, size, ++header_->clock, 0u};
+	header_->bytes += size;
+	++header_->entries;
+}
+
+void CRenderCache::Erase(CEntry *entry) {
+	header_->bytes -= entry->size;
+	--header_->entries;
+	// backward shift deletion for linear probing
+	uint32_t i = static_cast<uint32_t>(entry - table_);
+	while (true) {
+		table_[i] = CEntry { };
+		uint32_t j = i;
+		while (true) {
+			j = (j + 1) % SLOTS;
+			if (!table_[j].key)
+				return;
+			const uint32_t home = table_[j].key % SLOTS;
+			if (i <= j ? (i < home && home <= j) : (i < home || home <= j))
+				continue;
+			table_[i] = table_[j];
+			i = j;
+			break;
+		}
+	}
+}
+
+void CRenderCache::Evict(uint64_t keep) {
+	// the table is also kept under 3/4 full so that probing ends
+	while (header_->bytes > budget_ || header_->entries >= SLOTS * 3u / 4u) {
+		CEntry *lru = nullptr;
+		for (uint32_t i = 0; i < SLOTS; ++i)
+			if (table_[i].key && table_[i].key != keep && (!lru || table_[i].used < lru->used))
+				lru = &table_[i];
+		if (!lru)
+			return;
+		unlink(Path(lru->key).c_str());
+		Erase(lru);
+	}
+}
+
+std::string CRenderCache::Path(uint64_t key) const {
+	char name[24];
+	snprintf(name, sizeof(name), "/%016llx", static_cast<unsigned long long>(key));
+	return dir_ + name;
+}
+
+void CRenderCache::Store(uint64_t key, const std::vector<uint8_t> &data) const {
+	const std::string fname = Path(key);
+	const std::string tmp = fname + ".tmp" + std::to_string(getpid()) + "." +
+		std::to_string(std::hash<std::thread::id> { }(std::this_thread::get_id()));
+	FILE *f = fopen(tmp.c_str(), "wb");
+	if (!f)
+		throw std::runtime_error {"Cannot write " + tmp};
+	const bool ok = fwrite(data.data(), 1, data.size(), f) == data.size();
+	if (fclose(f) || !ok || rename(tmp.c_str(), fname.c_str())) {
+		unlink(tmp.c_str());
+		throw std::runtime_error {"Cannot write " + fname};
+	}
+}
+
+} // namespace MM5Sound
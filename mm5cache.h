@@ -0,0 +1,91 @@
+#pragma once
+
+#include "mm5render.h"
+#include <cstdint>
+#include <cstddef>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace MM5Sound {
+
+class CSoundBank;
+
+// output of one render, either mapped from the cache or freshly produced;
+// binary traces as in CTrace::Save, PCM as signed 16-bit little-endian
+class CCacheBlob {
+public:
+	CCacheBlob() = default;
+	explicit CCacheBlob(std::vector<uint8_t> data);
+	CCacheBlob(void *map, size_t size);
+	CCacheBlob(CCacheBlob &&other) noexcept;
+	CCacheBlob &operator=(CCacheBlob &&other) noexcept;
+	~CCacheBlob();
+
+	const uint8_t *Data() const { return map_ ? static_cast<const uint8_t *>(map_) : data_.data(); }
+	size_t Size() const { return map_ ? size_ : data_.size(); }
+	bool Mapped() const { return map_ != nullptr; }
+
+private:
+	void *map_ = nullptr;
+	size_t size_ = 0u;
+	std::vector<uint8_t> data_;
+};
+
+struct CCacheStats {
+	uint64_t hits;
+	uint64_t misses;
+	uint64_t saved;			// bytes served without running the engine
+	uint64_t bytes;			// bytes currently stored
+	uint32_t entries;
+
+	double HitRate() const {
+		return hits + misses ? static_cast<double>(hits) / (hits + misses) : 0.;
+	}
+};
+
+// renders kept in a directory shared by any number of processes, named by a
+// hash of the sound bank and the render job; the index is a memory-mapped
+// hash table guarded by flock, entries are written to a temporary file and
+// renamed into place, and the least recently used ones are removed once the
+// total exceeds the byte budget
+class CRenderCache {
+public:
+	CRenderCache(const char *dir, uint64_t budget);
+	~CRenderCache();
+	CRenderCache(const CRenderCache &) = delete;
+	CRenderCache &operator=(const CRenderCache &) = delete;
+
+	// a miss renders the job with the given number of threads
+	CCacheBlob Render(const CSegmentRenderer &renderer, const CSoundBank &bank,
+		const CRenderJob &job, unsigned threads = 1u);
+
+	// counters over all processes that used this directory
+	CCacheStats Stats() const;
+
+	static uint64_t Key(const CSoundBank &bank, const CRenderJob &job);
+
+private:
+	struct CHeader;
+	struct CEntry;
+	class CLock;
+
+	CEntry *Find(uint64_t key) const;
+	void Insert(uint64_t key, uint64_t size);
+	void Erase(CEntry *entry);
+	void Evict(uint64_t keep);
+	std::string Path(uint64_t key) const;
+	void Store(uint64_t key, const std::vector<uint8_t> &data) const;
+
+	static const uint32_t SLOTS;
+
+	const std::string dir_;
+	const uint64_t budget_;
+	int fd_ = -1;
+	void *map_ = nullptr;
+	CHeader *header_ = nullptr;
+	CEntry *table_ = nullptr;
+	mutable std::mutex lock_;		// flock does not exclude threads
+};
+
+} // namespace MM5Sound
@@ -18,6 +18,19 @@ enum class CMD_INDEX : uint8_t {
 	
 };
 
+// the driver's control commands, passed to INIT as track numbers; the fades
+// take their rate and CMD_TRANSPOSE its amount in Y, see Func8106
+enum : uint8_t {
+	CMD_STOP_ALL = 0xF0,
+	CMD_STOP_SFX,
+	CMD_STOP_MUSIC,
+	CMD_PAUSE,		// $821E
+	CMD_RESUME,		// $8226
+	CMD_FADE_IN,	// $822D
+	CMD_FADE_OUT,	// $8234
+	CMD_TRANSPOSE,	// $824A
+};
+
 
 
 }
@@ -0,0 +1,332 @@
+#include "mm5cpu.h"
+#include "mm5rom.h"
+#include <cstdio>
+#include <stdexcept>
+#include <string>
+
+namespace MM5Sound {
+
+const uint16_t C6502Player::PLAY_ADR = 0x8000;
+const uint16_t C6502Player::INIT_ADR = 0x8003;
+const uint32_t C6502Player::MAX_STEPS = 1000000u;
+
+namespace {
+	// RTS from the entry point lands here
+	const uint16_t RETURN_ADR = 0x0000;
+
+	std::string Hex(uint16_t x) {
+		char buf[8];
+		snprintf(buf, sizeof(buf), "$%04X", x);
+		return buf;
+	}
+}
+
+C6502Player::C6502Player(const CSoundBank &bank) : bank_(bank) {
+}
+
+void C6502Player::CallINIT(uint8_t track, uint8_t region) {
+	A_ = track;
+	X_ = region;
+	Call(INIT_ADR);
+}
+
+void C6502Player::CallPLAY() {
+	Call(PLAY_ADR);
+}
+
+uint8_t C6502Player::ReadCallback(uint16_t adr) const {
+	return bank_.Read(adr);
+}
+
+void C6502Player::Call(uint16_t adr) {
+	Push(static_cast<uint16_t>(RETURN_ADR - 1) >> 8);
+	Push(static_cast<uint16_t>(RETURN_ADR - 1) & 0xFF);
+	PC_ = adr;
+	for (uint32_t n = 0; PC_ != RETURN_ADR; ++n) {
+		if (n >= MAX_STEPS)
+			throw std::runtime_error {"6502 call to " + Hex(adr) + " did not return"};
+		Step();
+	}
+}
+
+uint8_t C6502Player::Read(uint16_t adr) const {
+	if (adr < 0x2000u)
+		return ram_[adr & 0x7FF];
+	if (adr >= 0x8000u)
+		return ReadCallback(adr);
+	return 0u;		// open bus, no APU status
+}
+
+void C6502Player::Write(uint16_t adr, uint8_t value) {
+	if (adr < 0x2000u)
+		ram_[adr & 0x7FF] = value;
+	else if (adr >= 0x4000u && adr < 0x4018u)
+		WriteCallback(adr, value);
+}
+
+uint16_t C6502Player::Read16(uint16_t adr) const {
+	return Read(adr) | (Read(adr + 1) << 8);
+}
+
+uint16_t C6502Player::Read16ZP(uint8_t adr) const {
+	return ram_[adr] | (ram_[static_cast<uint8_t>(adr + 1)] << 8);
+}
+
+void C6502Player::Branch(bool taken) {
+	const auto offset = static_cast<int8_t>(Fetch());
+	if (taken)
+		PC_ += offset;
+}
+
+void C6502Player::ADC(uint8_t x) {
+	const unsigned sum = A_ + x + (P_ & FLAG_C);
+	const bool v = (~(A_ ^ x) & (A_ ^ sum) & 0x80) != 0;
+	P_ = v ? P_ | FLAG_V : P_ & ~FLAG_V;
+	Carry(sum > 0xFFu);
+	A_ = NZ(static_cast<uint8_t>(sum));
+}
+
+void C6502Player::Compare(uint8_t reg, uint8_t x) {
+	Carry(reg >= x);
+	NZ(static_cast<uint8_t>(reg - x));
+}
+
+uint8_t C6502Player::ASL(uint8_t x) {
+	Carry((x & 0x80) != 0);
+	return NZ(x << 1);
+}
+
+uint8_t C6502Player::LSR(uint8_t x) {
+	Carry((x & 0x01) != 0);
+	return NZ(x >> 1);
+}
+
+uint8_t C6502Player::ROL(uint8_t x) {
+	const uint8_t c = P_ & FLAG_C;
+	Carry((x & 0x80) != 0);
+	return NZ((x << 1) | c);
+}
+
+uint8_t C6502Player::ROR(uint8_t x) {
+	const uint8_t c = (P_ & FLAG_C) << 7;
+	Carry((x & 0x01) != 0);
+	return NZ((x >> 1) | c);
+}
+
+void C6502Player::Step() {
+	const uint16_t pc = PC_;
+	const uint8_t op = Fetch();
+	++count_;
+
+	// effective addresses
+	const auto zp = [&] () -> uint16_t { return Fetch(); };
+	const auto zpx = [&] () -> uint16_t { return static_cast<uint8_t>(Fetch() + X_); };
+	const auto zpy = [&] () -> uint16_t { return static_cast<uint8_t>(Fetch() + Y_); };
+	const auto abs = [&] () -> uint16_t { return Fetch16(); };
+	const auto absx = [&] () -> uint16_t { return Fetch16() + X_; };
+	const auto absy = [&] () -> uint16_t { return Fetch16() + Y_; };
+	const auto indx = [&] () -> uint16_t { return Read16ZP(Fetch() + X_); };
+	const auto indy = [&] () -> uint16_t { return Read16ZP(Fetch()) + Y_; };
+
+	// read-modify-write
+	const auto rmw = [&] (uint16_t adr, uint8_t (C6502Player::*f)(uint8_t)) {
+		Write(adr, (this->*f)(Read(adr)));
+	};
+
+	switch (op) {
+	// loads and stores
+	case 0xA9: A_ = NZ(Fetch()); break;
+	case 0xA5: A_ = NZ(Read(zp())); break;
+	case 0xB5: A_ = NZ(Read(zpx())); break;
+	case 0xAD: A_ = NZ(Read(abs())); break;
+	case 0xBD: A_ = NZ(Read(absx())); break;
+	case 0xB9: A_ = NZ(Read(absy())); break;
+	case 0xA1: A_ = NZ(Read(indx())); break;
+	case 0xB1: A_ = NZ(Read(indy())); break;
+	case 0xA2: X_ = NZ(Fetch()); break;
+	case 0xA6: X_ = NZ(Read(zp())); break;
+	case 0xB6: X_ = NZ(Read(zpy())); break;
+	case 0xAE: X_ = NZ(Read(abs())); break;
+	case 0xBE: X_ = NZ(Read(absy())); break;
+	case 0xA0: Y_ = NZ(Fetch()); break;
+	case 0xA4: Y_ = NZ(Read(zp())); break;
+	case 0xB4: Y_ = NZ(Read(zpx())); break;
+	case 0xAC: Y_ = NZ(Read(abs())); break;
+	case 0xBC: Y_ = NZ(Read(absx())); break;
+	case 0x85: Write(zp(), A_); break;
+	case 0x95: Write(zpx(), A_); break;
+	case 0x8D: Write(abs(), A_); break;
+	case 0x9D: Write(absx(), A_); break;
+	case 0x99: Write(absy(), A_); break;
+	case 0x81: Write(indx(), A_); break;
+	case 0x91: Write(indy(), A_); break;
+	case 0x86: Write(zp(), X_); break;
+	case 0x96: Write(zpy(), X_); break;
+	case 0x8E: Write(abs(), X_); break;
+	case 0x84: Write(zp(), Y_); break;
+	case 0x94: Write(zpx(), Y_); break;
+	case 0x8C: Write(abs(), Y_); break;
+
+	// transfers and stack
+	case 0xAA: X_ = NZ(A_); break;
+	case 0xA8: Y_ = NZ(A_); break;
+	case 0x8A: A_ = NZ(X_); break;
+	case 0x98: A_ = NZ(Y_); break;
+	case 0xBA: X_ = NZ(S_); break;
+	case 0x9A: S_ = X_; break;
+	case 0x48: Push(A_); break;
+	case 0x08: Push(P_ | FLAG_B | FLAG_U); break;
+	case 0x68: A_ = NZ(Pull()); break;
+	case 0x28: P_ = (Pull() & ~FLAG_B) | FLAG_U; break;
+
+	// arithmetic and logic
+	case 0x69: ADC(Fetch()); break;
+	case 0x65: ADC(Read(zp())); break;
+	case 0x75: ADC(Read(zpx())); break;
+	case 0x6D: ADC(Read(abs())); break;
+	case 0x7D: ADC(Read(absx())); break;
+	case 0x79: ADC(Read(absy())); break;
+	case 0x61: ADC(Read(indx())); break;
+	case 0x71: ADC(Read(indy())); break;
+	case 0xE9: ADC(~Fetch()); break;
+	case 0xE5: ADC(~Read(zp())); break;
+	case 0xF5: ADC(~Read(zpx())); break;
+	case 0xED: ADC(~Read(abs())); break;
+	case 0xFD: ADC(~Read(absx())); break;
+	case 0xF9: ADC(~Read(absy())); break;
+	case 0xE1: ADC(~Read(indx())); break;
+	case 0xF1: ADC(~Read(indy())); break;
+	case 0x29: A_ = NZ(A_ & Fetch()); break;
+	case 0x25: A_ = NZ(A_ & Read(zp())); break;
+	case 0x35: A_ = NZ(A_ & Read(zpx())); break;
+	case 0x2D: A_ = NZ(A_ & Read(abs())); break;
+	case 0x3D: A_ = NZ(A_ & Read(absx())); break;
+	case 0x39: A_ = NZ(A_ & Read(absy())); break;
+	case 0x21: A_ = NZ(A_ & Read(indx())); break;
+	case 0x31: A_ = NZ(A_ & Read(indy())); break;
+	case 0x09: A_ = NZ(A_ | Fetch()); break;
+	case 0x05: A_ = NZ(A_ | Read(zp())); break;
+	case 0x15: A_ = NZ(A_ | Read(zpx())); break;
+	case 0x0D: A_ = NZ(A_ | Read(abs())); break;
+	case 0x1D: A_ = NZ(A_ | Read(absx())); break;
+	case 0x19: A_ = NZ(A_ | Read(absy())); break;
+	case 0x01: A_ = NZ(A_ | Read(indx())); break;
+	case 0x11: A_ = NZ(A_ | Read(indy())); break;
+	case 0x49: A_ = NZ(A_ ^ Fetch()); break;
+	case 0x45: A_ = NZ(A_ ^ Read(zp())); break;
+	case 0x55: A_ = NZ(A_ ^ Read(zpx())); break;
+	case 0x4D: A_ = NZ(A_ ^ Read(abs())); break;
+	case 0x5D: A_ = NZ(A_ ^ Read(absx())); break;
+	case 0x59: A_ = NZ(A_ ^ Read(absy())); break;
+	case 0x41: A_ = NZ(A_ ^ Read(indx())); break;
+	case 0x51: A_ = NZ(A_ ^ Read(indy())); break;
+	case 0x24: case 0x2C: {
+		const uint8_t x = Read(op == 0x24 ? zp() : abs());
+		P_ = (P_ & ~(FLAG_N | FLAG_V | FLAG_Z)) | (x & (FLAG_N | FLAG_V)) | ((A_ & x) ? 0 : FLAG_Z);
+		break;
+	}
+
+	// comparisons
+	case 0xC9: Compare(A_, Fetch()); break;
+	case 0xC5: Compare(A_, Read(zp())); break;
+	case 0xD5: Compare(A_, Read(zpx())); break;
+	case 0xCD: Compare(A_, Read(abs())); break;
+	case 0xDD: Compare(A_, Read(absx())); break;
+	case 0xD9: Compare(A_, Read(absy())); break;
+	case 0xC1: Compare(A_, Read(indx())); break;
+	case 0xD1: Compare(A_, Read(indy())); break;
+	case 0xE0: Compare(X_, Fetch()); break;
+	case 0xE4: Compare(X_, Read(zp())); break;
+	case 0xEC: Compare(X_, Read(abs())); break;
+	case 0xC0: Compare(Y_, Fetch()); break;
+	case 0xC4: Compare(Y_, Read(zp())); break;
+	case 0xCC: Compare(Y_, Read(abs())); break;
+
+	// increments and shifts
+	case 0xE6: { const uint16_t a = zp(); Write(a, NZ(Read(a) + 1)); break; }
+	case 0xF6: { const uint16_t a = zpx(); Write(a, NZ(Read(a) + 1)); break; }
+	case 0xEE: { const uint16_t a = abs(); Write(a, NZ(Read(a) + 1)); break; }
+	case 0xFE: { const uint16_t a = absx(); Write(a, NZ(Read(a) + 1)); break; }
+	case 0xC6: { const uint16_t a = zp(); Write(a, NZ(Read(a) - 1)); break; }
+	case 0xD6: { const uint16_t a = zpx(); Write(a, NZ(Read(a) - 1)); break; }
+	case 0xCE: { const uint16_t a = abs(); Write(a, NZ(Read(a) - 1)); break; }
+	case 0xDE: { const uint16_t a = absx(); Write(a, NZ(Read(a) - 1)); break; }
+	case 0xE8: X_ = NZ(X_ + 1); break;
+	case 0xC8: Y_ = NZ(Y_ + 1); break;
+	case 0xCA: X_ = NZ(X_ - 1); break;
+	case 0x88: Y_ = NZ(Y_ - 1); break;
+	case 0x0A: A_ = ASL(A_); break;
+	case 0x06: rmw(zp(), &C6502Player::ASL); break;
+	case 0x16: rmw(zpx(), &C6502Player::ASL); break;
+	case 0x0E: rmw(abs(), &C6502Player::ASL); break;
+	case 0x1E: rmw(absx(), &C6502Player::ASL); break;
+	case 0x4A: A_ = LSR(A_); break;
+	case 0x46: rmw(zp(), &C6502Player::LSR); break;
+	case 0x56: rmw(zpx(), &C6502Player::LSR); break;
+	case 0x4E: rmw(abs(), &C6502Player::LSR); break;
+	case 0x5E: rmw(absx(), &C6502Player::LSR); break;
+	case 0x2A: A_ = ROL(A_); break;
+	case 0x26: rmw(zp(), &C6502Player::ROL); break;
+	case 0x36: rmw(zpx(), &C6502Player::ROL); break;
+	case 0x2E: rmw(abs(), &C6502Player::ROL); break;
+	case 0x3E: rmw(absx(), &C6502Player::ROL); break;
+	case 0x6A: A_ = ROR(A_); break;
+	case 0x66: rmw(zp(), &C6502Player::ROR); break;
+	case 0x76: rmw(zpx(), &C6502Player::ROR); break;
+	case 0x6E: rmw(abs(), &C6502Player::ROR); break;
+	case 0x7E: rmw(absx(), &C6502Player::ROR); break;
+
+	// control flow
+	case 0x4C: PC_ = Fetch16(); break;
+	case 0x6C: {
+		// the page wrap of the original
+		const uint16_t ptr = Fetch16();
+		PC_ = Read(ptr) | (Read((ptr & 0xFF00) | static_cast<uint8_t>(ptr + 1)) << 8);
+		break;
+	}
+	case 0x20: {
+		const uint16_t adr = Fetch16();
+		Push((PC_ - 1) >> 8);
+		Push((PC_ - 1) & 0xFF);
+		PC_ = adr;
+		break;
+	}
+	case 0x60:
+		PC_ = Pull();
+		PC_ = (PC_ | (Pull() << 8)) + 1;
+		break;
+	case 0x40:
+		P_ = (Pull() & ~FLAG_B) | FLAG_U;
+		PC_ = Pull();
+		PC_ |= Pull() << 8;
+		break;
+	case 0x10: Branch(!(P_ & FLAG_N)); break;
+	case 0x30: Branch((P_ & FLAG_N) != 0); break;
+	case 0x50: Branch(!(P_ & FLAG_V)); break;
+	case 0x70: Branch((P_ & FLAG_V) != 0); break;
+	case 0x90: Branch(!(P_ & FLAG_C)); break;
+	case 0xB0: Branch((P_ & FLAG_C) != 0); break;
+	case 0xD0: Branch(!(P_ & FLAG_Z)); break;
+	case 0xF0: Branch((P_ & FLAG_Z) != 0); break;
+
+	// flags
+	case 0x18: P_ &= ~FLAG_C; break;
+	case 0x38: P_ |= FLAG_C; break;
+	case 0x58: P_ &= ~FLAG_I; break;
+	case 0x78: P_ |= FLAG_I; break;
+	case 0xB8: P_ &= ~FLAG_V; break;
+	case 0xD8: P_ &= ~FLAG_D; break;
+	case 0xF8: P_ |= FLAG_D; break;
+	case 0xEA: break;
+
+	case 0x00:
+		throw std::runtime_error {"6502 BRK at " + Hex(pc)};
+	default: {
+		char buf[48];
+		snprintf(buf, sizeof(buf), "6502 opcode %02X at ", op);
+		throw std::runtime_error {buf + Hex(pc)};
+	}
+	}
+}
+
+} // namespace MM5Sound
@@ -0,0 +1,78 @@
+#pragma once
+
+#include "mm5sound.h"
+#include <cstdint>
+
+namespace MM5Sound {
+
+class CSoundBank;
+
+// 6502 interpreter that runs the driver code of the sound bank itself, the
+// reference for differential tests of CEngine and the engines built on it;
+// the bank is mapped at $8000 as CSoundBank sees it, with 2 KB of RAM below
+// $2000, APU writes go to WriteCallback and mapper writes are dropped
+//
+// the 2A03 has no decimal mode; BRK, the undocumented opcodes and reads
+// outside the bank throw, as does a call that runs away
+class C6502Player : public ISongPlayer {
+public:
+	explicit C6502Player(const CSoundBank &bank);
+
+	// $8003, A = track and X = region as the NSF player calls it
+	void CallINIT(uint8_t track, uint8_t region) override;
+	// $8000
+	void CallPLAY() override;
+	uint8_t ReadCallback(uint16_t adr) const override;
+	void WriteCallback(uint16_t adr, uint8_t value) override { }
+
+	const uint8_t *RAM() const { return ram_; }
+	uint64_t Instructions() const { return count_; }
+
+private:
+	static const uint16_t PLAY_ADR;		// PLAY in mm5.cfg
+	static const uint16_t INIT_ADR;		// INIT in mm5.cfg
+	static const uint32_t MAX_STEPS;	// per call
+
+	void Call(uint16_t adr);
+	void Step();
+
+	uint8_t Read(uint16_t adr) const;
+	void Write(uint16_t adr, uint8_t value);
+	uint16_t Read16(uint16_t adr) const;
+	uint16_t Read16ZP(uint8_t adr) const;
+	void Push(uint8_t value) { ram_[0x100 | S_--] = value; }
+	uint8_t Pull() { return ram_[0x100 | ++S_]; }
+
+	uint8_t Fetch() { return Read(PC_++); }
+	uint16_t Fetch16() {
+		const uint16_t x = Read16(PC_);
+		PC_ += 2;
+		return x;
+	}
+
+	uint8_t NZ(uint8_t x) {
+		P_ = (P_ & ~(FLAG_N | FLAG_Z)) | (x & FLAG_N) | (x ? 0 : FLAG_Z);
+		return x;
+	}
+	void Carry(bool c) { P_ = c ? P_ | FLAG_C : P_ & ~FLAG_C; }
+	void Branch(bool taken);
+	void ADC(uint8_t x);
+	void Compare(uint8_t reg, uint8_t x);
+	uint8_t ASL(uint8_t x);
+	uint8_t LSR(uint8_t x);
+	uint8_t ROL(uint8_t x);
+	uint8_t ROR(uint8_t x);
+
+	enum : uint8_t {
+		FLAG_C = 0x01, FLAG_Z = 0x02, FLAG_I = 0x04, FLAG_D = 0x08,
+		FLAG_B = 0x10, FLAG_U = 0x20, FLAG_V = 0x40, FLAG_N = 0x80,
+	};
+
+	const CSoundBank &bank_;
+	uint8_t ram_[0x800] = { };
+	uint8_t A_ = 0u, X_ = 0u, Y_ = 0u, S_ = 0xFDu, P_ = FLAG_I | FLAG_U;
+	uint16_t PC_ = 0u;
+	uint64_t count_ = 0u;
+};
+
+} // namespace MM5Sound
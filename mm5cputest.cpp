@@ -0,0 +1,186 @@
+#include "mm5cpu.h"
+#include "mm5rom.h"
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+using namespace MM5Sound;
+
+namespace {
+
+// INIT jumps on to $80FE, where every case starts
+const uint16_t START = 0x80FE;
+
+// PHP, STA $00, STX $01, STY $02, PLA, STA $03, RTS
+std::vector<uint8_t> End(std::vector<uint8_t> code) {
+	const uint8_t tail[] = {0x08, 0x85, 0x00, 0x86, 0x01, 0x84, 0x02, 0x68, 0x85, 0x03, 0x60};
+	code.insert(code.end(), std::begin(tail), std::end(tail));
+	return code;
+}
+
+struct CPiece {
+	uint16_t adr;
+	std::vector<uint8_t> code;
+};
+
+// programs assembled by hand; each one saves A, X, Y and P as pushed by PHP
+// ($30 always set) to $00 - $03 before it returns, and P starts as $24
+struct CCase {
+	const char *name;
+	std::vector<CPiece> code;
+	uint8_t a, x, y, p;
+};
+
+const CCase CASES[] = {
+	{"ADC overflow", {{START, End({0x18, 0xA9, 0x50, 0x69, 0x50})}}, 0xA0, 0x00, 0x00, 0xF4},
+	{"ADC carry out", {{START, End({0x38, 0xA9, 0xFF, 0x69, 0x00})}}, 0x00, 0x00, 0x00, 0x37},
+	{"ADC ignores D", {{START, End({0xF8, 0x18, 0xA9, 0x09, 0x69, 0x01})}}, 0x0A, 0x00, 0x00, 0x3C},
+	{"SBC overflow", {{START, End({0x38, 0xA9, 0x50, 0xE9, 0xB0})}}, 0xA0, 0x00, 0x00, 0xF4},
+	{"SBC borrow", {{START, End({0x18, 0xA9, 0x00, 0xE9, 0x00})}}, 0xFF, 0x00, 0x00, 0xB4},
+	{"SBC ignores D", {{START, End({0xF8, 0x38, 0xA9, 0x10, 0xE9, 0x01})}}, 0x0F, 0x00, 0x00, 0x3D},
+	{"CMP less", {{START, End({0xA9, 0x40, 0xC9, 0x41})}}, 0x40, 0x00, 0x00, 0xB4},
+	{"CPX equal", {{START, End({0xA2, 0x40, 0xE0, 0x40})}}, 0x00, 0x40, 0x00, 0x37},
+	{"CPY greater", {{START, End({0xA0, 0x90, 0xC0, 0x10})}}, 0x00, 0x00, 0x90, 0xB5},
+	{"BIT", {{START, End({0xA9, 0xC0, 0x85, 0x10, 0xA9, 0x01, 0x24, 0x10})}}, 0x01, 0x00, 0x00, 0xF6},
+	{"ROL and ROR through carry", {{START, End({0x38, 0xA9, 0x80, 0x2A, 0x6A})}}, 0x80, 0x00, 0x00, 0xB5},
+	{"LSR to zero", {{START, End({0xA9, 0x01, 0x4A})}}, 0x00, 0x00, 0x00, 0x37},
+	{"ASL in memory", {{START, End({0xA9, 0x81, 0x85, 0x10, 0x06, 0x10, 0xA5, 0x10})}}, 0x02, 0x00, 0x00, 0x35},
+	{"INX and DEY wrap", {{START, End({0xA2, 0xFF, 0xE8, 0xA0, 0x00, 0x88})}}, 0x00, 0x00, 0xFF, 0xB4},
+	{"INC and DEC in memory", {{START, End({0xE6, 0x10, 0xE6, 0x10, 0xC6, 0x10, 0xA6, 0x10})}}, 0x00, 0x01, 0x00, 0x34},
+	{"PLP", {{START, End({0xA9, 0xC3, 0x48, 0x28})}}, 0xC3, 0x00, 0x00, 0xF3},
+	{"PHA and PLA order", {{START, End({0xA9, 0x11, 0x48, 0xA9, 0x22, 0x48, 0x68, 0xAA, 0x68})}}, 0x11, 0x22, 0x00, 0x34},
+	{"TSX after JSR", {{START, {0x20, 0x00, 0x83, 0x60}}, {0x8300, End({0xBA})}}, 0x00, 0xF9, 0x00, 0xB4},
+	{"zero page X wraps", {{START, End({0xA9, 0x5A, 0x85, 0x08, 0xA2, 0x10, 0xB5, 0xF8})}}, 0x5A, 0x10, 0x00, 0x34},
+	{"RAM mirrors", {{START, End({0xA9, 0x5A, 0x8D, 0x10, 0x08, 0xA9, 0x00, 0xAD, 0x10, 0x00})}}, 0x5A, 0x00, 0x00, 0x34},
+	{"absolute X crosses a page", {{START, End({0xA9, 0x55, 0x8D, 0x05, 0x04, 0xA2, 0x10, 0xBD, 0xF5, 0x03})}},
+		0x55, 0x10, 0x00, 0x34},
+	{"(zp,X) wraps in page zero", {{START, End({0xA9, 0x77, 0x8D, 0x20, 0x03, 0xA9, 0x20, 0x85, 0x00, 0xA9, 0x03,
+		0x85, 0x01, 0xA2, 0x01, 0xA9, 0x00, 0xA1, 0xFF})}}, 0x77, 0x01, 0x00, 0x34},
+	{"(zp),Y wraps in page zero and crosses a page", {{START, End({0xA9, 0x66, 0x8D, 0x10, 0x04, 0xA9, 0xF0,
+		0x85, 0xFF, 0xA9, 0x03, 0x85, 0x00, 0xA0, 0x20, 0xB1, 0xFF})}}, 0x66, 0x00, 0x20, 0x34},
+	{"JSR and RTS", {{START, End({0x20, 0x00, 0x83, 0xA0, 0x24})}, {0x8300, {0xA2, 0x42, 0x60}}}, 0x00, 0x42, 0x24, 0x34},
+	{"branch not taken", {{START, End({0xA9, 0x01, 0xF0, 0x02, 0xA2, 0x05})}}, 0x01, 0x05, 0x00, 0x34},
+	// BEQ at $82F2, past its offset at $82F4, lands on $8314
+	{"branch forward across a page", {{START, {0x4C, 0xF0, 0x82}},
+		{0x82F0, End({0xA9, 0x00, 0xF0, 0x20, 0xA2, 0xFF})}, {0x8314, End({0xA2, 0x01})}}, 0x00, 0x01, 0x00, 0x34},
+	// BCC at $8305, past its offset at $8307, lands on $82F0
+	{"branch backward across a page", {{START, {0x4C, 0x04, 0x83}},
+		{0x8304, End({0x18, 0x90, 0xE9, 0xA2, 0xFF})}, {0x82F0, End({0xA2, 0x02})}}, 0x00, 0x02, 0x00, 0x34},
+	{"BMI, BVS and BCS taken", {{START, End({0xA9, 0xC0, 0x85, 0x10, 0x24, 0x10, 0x38, 0x30, 0x02, 0xA2, 0xFF,
+		0x70, 0x02, 0xA2, 0xFF, 0xB0, 0x02, 0xA2, 0xFF, 0xA0, 0x01})}}, 0xC0, 0x00, 0x01, 0x75},
+	{"JMP indirect", {{START, {0xA9, 0x00, 0x8D, 0x80, 0x02, 0xA9, 0x83, 0x8D, 0x81, 0x02, 0x6C, 0x80, 0x02}},
+		{0x8300, End({0xA2, 0x01})}}, 0x83, 0x01, 0x00, 0x34},
+	// the high byte of JMP ($02FF) comes from $0200, not $0300
+	{"JMP indirect wraps in its page", {{START, {0xA9, 0x00, 0x8D, 0xFF, 0x02, 0xA9, 0x83, 0x8D, 0x00, 0x02,
+		0xA9, 0x84, 0x8D, 0x00, 0x03, 0x6C, 0xFF, 0x02}}, {0x8300, End({0xA2, 0x01})}, {0x8400, End({0xA2, 0xFF})}},
+		0x84, 0x01, 0x00, 0x34},
+};
+
+// programs that must throw
+const CCase FAULTS[] = {
+	{"BRK", {{START, {0x00}}}, 0, 0, 0, 0},
+	{"undocumented opcode", {{START, {0x02}}}, 0, 0, 0, 0},
+	{"runaway loop", {{START, {0x4C, 0xFE, 0x80}}}, 0, 0, 0, 0},
+	{"read past the bank", {{START, {0xAD, 0x00, 0xE0, 0x60}}}, 0, 0, 0, 0},
+};
+
+class CRecorded6502 : public C6502Player {
+public:
+	using C6502Player::C6502Player;
+
+	std::vector<uint32_t> writes;		// adr << 8 | value
+
+private:
+	void WriteCallback(uint16_t adr, uint8_t value) override {
+		writes.push_back(static_cast<uint32_t>(adr) << 8 | value);
+	}
+};
+
+// a bank of NOPs with the driver's entry points, so that CSoundBank takes it
+std::vector<uint8_t> Bank(const std::vector<CPiece> &code) {
+	std::vector<uint8_t> rom(CSoundBank::BANK_SIZE, 0xEA);
+	const uint8_t entry[] = {0x4C, 0x6C, 0x80, 0x4C, 0xFE, 0x80};
+	memcpy(rom.data(), entry, sizeof(entry));
+	for (const CPiece &x : code)
+		memcpy(&rom[x.adr - CSoundBank::BASE_ADR], x.code.data(), x.code.size());
+	return rom;
+}
+
+int Check(const CCase &c) {
+	const std::vector<uint8_t> rom = Bank(c.code);
+	const CSoundBank bank {rom.data(), rom.size()};
+	C6502Player cpu {bank};
+	try {
+		cpu.CallINIT(0, 0);
+	}
+	catch (std::exception &e) {
+		printf("%s: %s\n", c.name, e.what());
+		return 1;
+	}
+	const uint8_t *ram = cpu.RAM();
+	if (ram[0] != c.a || ram[1] != c.x || ram[2] != c.y || ram[3] != c.p) {
+		printf("%s: A %02X X %02X Y %02X P %02X, expected A %02X X %02X Y %02X P %02X\n",
+			c.name, ram[0], ram[1], ram[2], ram[3], c.a, c.x, c.y, c.p);
+		return 1;
+	}
+	return 0;
+}
+
+int CheckFault(const CCase &c) {
+	const std::vector<uint8_t> rom = Bank(c.code);
+	const CSoundBank bank {rom.data(), rom.size()};
+	C6502Player cpu {bank};
+	try {
+		cpu.CallINIT(0, 0);
+	}
+	catch (std::exception &) {
+		return 0;
+	}
+	printf("%s: did not throw\n", c.name);
+	return 1;
+}
+
+// APU writes reach WriteCallback, mapper writes to the bank do not
+int CheckWrites() {
+	const std::vector<uint8_t> rom = Bank({{START, {0xA9, 0x3F, 0x8D, 0x00, 0x40, 0x8D, 0x00, 0x80,
+		0x8D, 0x00, 0x60, 0x8D, 0x15, 0x40, 0x60}}});
+	const CSoundBank bank {rom.data(), rom.size()};
+	CRecorded6502 cpu {bank};
+	cpu.CallINIT(0, 0);
+	const std::vector<uint32_t> expected = {0x40003F, 0x40153F};
+	if (cpu.writes != expected) {
+		printf("APU writes: %zu writes, expected 2\n", cpu.writes.size());
+		return 1;
+	}
+	return 0;
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+	if (argc > 1) {
+		fprintf(stderr, "usage: %s\n  runs hand-assembled 6502 programs on C6502Player, no ROM needed\n", argv[0]);
+		return 1;
+	}
+	try {
+		int failed = 0;
+		size_t n = 0u;
+		for (const CCase &c : CASES)
+			failed += Check(c), ++n;
+		for (const CCase &c : FAULTS)
+			failed += CheckFault(c), ++n;
+		failed += CheckWrites(), ++n;
+		if (failed) {
+			printf("%d of %zu 6502 cases failed.\n", failed, n);
+			return 1;
+		}
+		printf("All %zu 6502 cases pass.\n", n);
+		return 0;
+	}
+	catch (std::exception &e) {
+		fprintf(stderr, "%s\n", e.what());
+		return 1;
+	}
+}
@@ -0,0 +1,156 @@
+#include "mm5server.h"
+#include "mm5rom.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+using namespace MM5Sound;
+
+namespace {
+
+CRenderServer *server = nullptr;
+
+void OnSignal(int) {
+	if (server)
+		server->Stop();
+}
+
+void Usage() {
+	fprintf(stderr,
+		"usage: mm5d serve rom socket [-j workers]\n"
+		"       mm5d request socket RENDER track region start ticks kind [rate]\n"
+		"       mm5d request socket STATS\n"
+		"       mm5d load socket clients ticks [kind]\n");
+}
+
+// sends one request and calls f for each block of the reply
+template <class F>
+void Request(const char *path, const std::string &line, F f) {
+	sockaddr_un addr { };
+	addr.sun_family = AF_UNIX;
+	strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+	const int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0 || connect(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr))) {
+		const int err = errno;
+		if (fd >= 0)
+			close(fd);
+		throw std::runtime_error {std::string {"Cannot connect to "} + path + ": " + strerror(err)};
+	}
+	const std::string req = line + "\n";
+	if (write(fd, req.data(), req.size()) != static_cast<ssize_t>(req.size())) {
+		close(fd);
+		throw std::runtime_error {"Cannot send request"};
+	}
+	char buf[0x10000];
+	ssize_t n;
+	while ((n = read(fd, buf, sizeof(buf))) > 0 || (n < 0 && errno == EINTR))
+		if (n > 0)
+			f(buf, static_cast<size_t>(n));
+	close(fd);
+}
+
+int Serve(int argc, char **argv) {
+	unsigned workers = std::max(std::thread::hardware_concurrency(), 1u);
+	for (int i = 4; i < argc; ++i)
+		if (!strcmp(argv[i], "-j") && i + 1 < argc)
+			workers = static_cast<unsigned>(std::max(atoi(argv[++i]), 1));
+		else {
+			Usage();
+			return 1;
+		}
+
+	const CSoundBank bank {argv[2]};
+	CRenderServer srv {bank, argv[3], workers};
+	server = &srv;
+	signal(SIGPIPE, SIG_IGN);
+	signal(SIGINT, OnSignal);
+	signal(SIGTERM, OnSignal);
+	fprintf(stderr, "mm5d: %u workers on %s\n", workers, argv[3]);
+	srv.Run();
+	server = nullptr;
+	fputs(srv.Stats().c_str(), stderr);
+	return 0;
+}
+
+int SendRequest(int argc, char **argv) {
+	std::string line;
+	for (int i = 3; i < argc; ++i)
+		line += (i > 3 ? " " : "") + std::string {argv[i]};
+	Request(argv[2], line, [] (const char *buf, size_t n) {
+		fwrite(buf, 1, n, stdout);
+	});
+	return 0;
+}
+
+// many clients at once, each rendering a different track
+int Load(int argc, char **argv) {
+	const int clients = atoi(argv[3]);
+	const int ticks = atoi(argv[4]);
+	const std::string kind = argc >= 6 ? argv[5] : "text";
+	std::atomic<uint64_t> bytes {0u};
+	std::atomic<int> failed {0};
+	std::vector<double> latency(std::max(clients, 0));
+
+	const auto t0 = std::chrono::steady_clock::now();
+	std::vector<std::thread> pool;
+	for (int i = 0; i < clients; ++i)
+		pool.emplace_back([&, i] {
+			const auto t1 = std::chrono::steady_clock::now();
+			bool ok = false;
+			try {
+				Request(argv[2], "RENDER " + std::to_string(i % 76) + " 0 0 " + std::to_string(ticks) + " " + kind,
+					[&] (const char *buf, size_t n) {
+						if (!ok && n >= 3u && !memcmp(buf, "OK\n", 3))
+							ok = true;
+						bytes += n;
+					});
+			}
+			catch (std::exception &) {
+			}
+			if (!ok)
+				++failed;
+			latency[i] = std::chrono::duration<double>(std::chrono::steady_clock::now() - t1).count();
+		});
+	for (auto &x : pool)
+		x.join();
+	const double t = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+
+	std::sort(latency.begin(), latency.end());
+	printf("%d requests in %.3f s, %.1f req/s, %.1f MB/s, %d failed\n",
+		clients, t, clients / t, bytes / t / 1e6, failed.load());
+	if (clients > 0)
+		printf("latency p50 %.3f ms, p99 %.3f ms, max %.3f ms\n",
+			latency[clients / 2] * 1e3, latency[clients * 99 / 100] * 1e3, latency.back() * 1e3);
+	return failed ? 1 : 0;
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+	try {
+		const std::string mode = argc >= 2 ? argv[1] : "";
+		if (mode == "serve" && argc >= 4)
+			return Serve(argc, argv);
+		if (mode == "request" && argc >= 4)
+			return SendRequest(argc, argv);
+		if (mode == "load" && argc >= 5)
+			return Load(argc, argv);
+		Usage();
+		return 1;
+	}
+	catch (std::exception &e) {
+		fprintf(stderr, "%s\n", e.what());
+		return 1;
+	}
+}
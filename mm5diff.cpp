@@ -0,0 +1,239 @@
+#include "mm5diff.h"
+#include "mm5trace.h"
+#include <algorithm>
+#include <stdexcept>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+namespace MM5Sound {
+
+namespace {
+	const size_t MAX_CELLS = size_t {1} << 28;
+	const uint32_t INF = 0xFFFFFFFFu;
+
+	enum : uint8_t { MATCH, SUBST, DEL, INS };
+
+	// equal writes at the start, 8 at a time where SSE2 is there
+	size_t Common(const uint16_t *a, const uint16_t *b, size_t n) {
+		size_t i = 0;
+#ifdef __SSE2__
+		for (; i + 8u <= n; i += 8u) {
+			const __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i *>(a + i));
+			const __m128i y = _mm_loadu_si128(reinterpret_cast<const __m128i *>(b + i));
+			const unsigned ne = ~_mm_movemask_epi8(_mm_cmpeq_epi16(x, y)) & 0xFFFFu;
+			if (ne)
+				return i + __builtin_ctz(ne) / 2u;
+		}
+#endif
+		while (i < n && a[i] == b[i])
+			++i;
+		return i;
+	}
+
+	// equal writes at the end of a[0, n) and b[0, n)
+	size_t CommonBack(const uint16_t *a, const uint16_t *b, size_t n) {
+		size_t i = 0;
+#ifdef __SSE2__
+		for (; i + 8u <= n; i += 8u) {
+			const __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i *>(a + n - i - 8u));
+			const __m128i y = _mm_loadu_si128(reinterpret_cast<const __m128i *>(b + n - i - 8u));
+			const unsigned ne = ~_mm_movemask_epi8(_mm_cmpeq_epi16(x, y)) & 0xFFFFu;
+			if (ne)
+				return i + 7u - (31 - __builtin_clz(ne)) / 2u;
+		}
+#endif
+		while (i < n && a[n - 1u - i] == b[n - 1u - i])
+			++i;
+		return i;
+	}
+
+	uint64_t FrameHash(const uint16_t *x, size_t n) {
+		uint64_t h = 0xCBF29CE484222325ull ^ n;
+		for (size_t i = 0; i < n; ++i)
+			h = (h ^ x[i]) * 0x100000001B3ull;
+		return h;
+	}
+
+	class CDiffer {
+	public:
+		CDiffer(const CTrace &a, const CTrace &b, CTraceDiff &out) : a_(a), b_(b), out_(out) { }
+
+		bool Same(size_t i, size_t j) const {
+			const size_t n = a_.FrameSize(i);
+			return n == b_.FrameSize(j) && Common(a_.FrameData(i), b_.FrameData(j), n) == n;
+		}
+
+		void Shifted(const CTrace &t, size_t frame) {
+			const uint16_t *x = t.FrameData(frame);
+			for (size_t n = t.FrameSize(frame); n; --n, ++x)
+				++out_.channels[DiffChannel(*x >> 8)].shifted;
+		}
+
+		// per register, the nth write of one frame against the nth of the other
+		void Compare(size_t i, size_t j) {
+			const uint16_t *x = a_.FrameData(i), *y = b_.FrameData(j);
+			const size_t nx = a_.FrameSize(i), ny = b_.FrameSize(j);
+			used_.assign(ny, false);
+			for (size_t p = 0; p < nx; ++p) {
+				const uint8_t reg = x[p] >> 8;
+				size_t q = 0;
+				while (q < ny && (used_[q] || (y[q] >> 8) != reg))
+					++q;
+				CChannelDiff &c = out_.channels[DiffChannel(reg)];
+				if (q == ny) {
+					++c.missing;
+					Event(CDiffEvent::MISSING, reg, x[p] & 0xFF, 0u, i, j);
+					continue;
+				}
+				used_[q] = true;
+				if ((x[p] & 0xFF) != (y[q] & 0xFF)) {
+					++c.values;
+					Event(CDiffEvent::VALUE, reg, x[p] & 0xFF, y[q] & 0xFF, i, j);
+				}
+			}
+			for (size_t q = 0; q < ny; ++q)
+				if (!used_[q]) {
+					++out_.channels[DiffChannel(y[q] >> 8)].extra;
+					Event(CDiffEvent::EXTRA, y[q] >> 8, 0u, y[q] & 0xFF, i, j);
+				}
+		}
+
+		void Event(CDiffEvent::kind_t kind, uint8_t reg, uint8_t a, uint8_t b, size_t i, size_t j) {
+			out_.events.push_back({kind, reg, a, b, 0, static_cast<uint32_t>(i), static_cast<uint32_t>(j)});
+		}
+
+	private:
+		const CTrace &a_;
+		const CTrace &b_;
+		CTraceDiff &out_;
+		std::vector<bool> used_;
+	};
+}
+
+uint8_t DiffChannel(uint8_t reg) {
+	return std::min<uint8_t>(reg >> 2, DIFF_CHANNELS - 1u);
+}
+
+CTraceDiff DiffTraces(const CTrace &a, const CTrace &b, int band) {
+	CTraceDiff out;
+	const size_t na = a.Frames(), nb = b.Frames();
+	const size_t shared = std::min(na, nb);
+
+	// frames the traces share at the start, then at the end
+	const size_t writes = std::min(a.Writes(), b.Writes());
+	const size_t same = Common(a.FrameData(0), b.FrameData(0), writes);
+	size_t pre = 0u;
+	for (size_t w = 0; pre < shared && a.FrameSize(pre) == b.FrameSize(pre) && w + a.FrameSize(pre) <= same; ++pre)
+		w += a.FrameSize(pre);
+	const size_t sameBack = CommonBack(a.FrameData(0) + a.Writes() - writes, b.FrameData(0) + b.Writes() - writes, writes);
+	size_t suf = 0u;
+	for (size_t w = 0; pre + suf < shared && a.FrameSize(na - 1u - suf) == b.FrameSize(nb - 1u - suf) &&
+		w + a.FrameSize(na - 1u - suf) <= sameBack; ++suf)
+		w += a.FrameSize(na - 1u - suf);
+	const size_t n = na - pre - suf, m = nb - pre - suf;
+	out.offset = static_cast<int>(m) - static_cast<int>(n);
+	if (!n && !m)
+		return out;
+	out.identical = false;
+
+	// edit distance over the frames in between, within the band; a cell
+	// (i, j) is kept at k = j - i - lo
+	band = std::max(band, 1);
+	const long d = static_cast<long>(m) - static_cast<long>(n);
+	const long lo = std::min(0l, d) - band, hi = std::max(0l, d) + band;
+	const size_t width = hi - lo + 1;
+	if ((n + 1u) * width > MAX_CELLS)
+		throw std::runtime_error {"Traces too long or too far apart to align"};
+	CDiffer differ {a, b, out};
+	std::vector<uint8_t> dir((n + 1u) * width);
+	std::vector<uint32_t> prev(width, INF), cur(width);
+	std::vector<uint64_t> ha(n), hb(m);
+	for (size_t i = 0; i < n; ++i)
+		ha[i] = FrameHash(a.FrameData(pre + i), a.FrameSize(pre + i));
+	for (size_t j = 0; j < m; ++j)
+		hb[j] = FrameHash(b.FrameData(pre + j), b.FrameSize(pre + j));
+	for (size_t k = 0; k < width; ++k) {
+		const long j = static_cast<long>(k) + lo;
+		if (j >= 0 && j <= static_cast<long>(m)) {
+			prev[k] = static_cast<uint32_t>(j);
+			dir[k] = INS;
+		}
+	}
+	for (size_t i = 1; i <= n; ++i) {
+		uint8_t *row = &dir[i * width];
+		for (size_t k = 0; k < width; ++k) {
+			cur[k] = INF;
+			const long j = static_cast<long>(i + k) + lo;
+			if (j < 0 || j > static_cast<long>(m))
+				continue;
+			uint32_t best = INF;
+			uint8_t op = DEL;
+			if (j > 0 && prev[k] != INF) {
+				const bool eq = ha[i - 1u] == hb[j - 1] && differ.Same(pre + i - 1u, pre + j - 1);
+				best = prev[k] + !eq;
+				op = eq ? MATCH : SUBST;
+			}
+			if (k + 1u < width && prev[k + 1u] != INF && prev[k + 1u] + 1u < best) {
+				best = prev[k + 1u] + 1u;
+				op = DEL;
+			}
+			if (k > 0 && cur[k - 1u] != INF && cur[k - 1u] + 1u < best) {
+				best = cur[k - 1u] + 1u;
+				op = INS;
+			}
+			cur[k] = best;
+			row[k] = op;
+		}
+		prev.swap(cur);
+	}
+	out.distance = prev[d - lo];
+
+	std::vector<uint8_t> ops;
+	for (size_t i = n, j = m; i || j; ) {
+		const uint8_t op = dir[i * width + (static_cast<long>(j) - static_cast<long>(i) - lo)];
+		ops.push_back(op);
+		if (op != INS)
+			--i;
+		if (op != DEL)
+			--j;
+	}
+
+	// runs of frames in one trace only are one shift each
+	size_t i = pre, j = pre;
+	int run = 0;
+	bool inRun = false;
+	size_t runA = 0u, runB = 0u;
+	for (auto p = ops.rbegin(); p != ops.rend(); ++p) {
+		if (*p == DEL || *p == INS) {
+			if (!inRun) {
+				inRun = true;
+				run = 0;
+				runA = i;
+				runB = j;
+			}
+			if (*p == DEL) {
+				differ.Shifted(a, i++);
+				--run;
+			}
+			else {
+				differ.Shifted(b, j++);
+				++run;
+			}
+			continue;
+		}
+		if (inRun) {
+			inRun = false;
+			out.events.push_back({CDiffEvent::SHIFT, 0u, 0u, 0u, run, static_cast<uint32_t>(runA), static_cast<uint32_t>(runB)});
+		}
+		if (*p == SUBST)
+			differ.Compare(i, j);
+		++i;
+		++j;
+	}
+	if (inRun)
+		out.events.push_back({CDiffEvent::SHIFT, 0u, 0u, 0u, run, static_cast<uint32_t>(runA), static_cast<uint32_t>(runB)});
+	return out;
+}
+
+} // namespace MM5Sound
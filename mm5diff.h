@@ -0,0 +1,55 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+namespace MM5Sound {
+
+class CTrace;
+
+// pulse 1, pulse 2, triangle, noise, then $4010 and up
+enum : uint8_t {
+	DIFF_CHANNELS = 5,
+};
+
+struct CChannelDiff {
+	uint32_t values = 0u;		// same register written with another value
+	uint32_t missing = 0u;		// written in the first trace only
+	uint32_t extra = 0u;		// written in the second trace only
+	uint32_t shifted = 0u;		// writes in frames that only one trace has
+};
+
+struct CDiffEvent {
+	enum kind_t : uint8_t {
+		SHIFT,		// frames inserted or removed, delta frames later in the second trace
+		VALUE,
+		MISSING,
+		EXTRA,
+	};
+
+	kind_t kind;
+	uint8_t reg;		// $4000 + reg, not for SHIFT
+	uint8_t a;			// values, not for SHIFT
+	uint8_t b;
+	int delta;
+	uint32_t frameA;	// frame indices, INIT being 0 in traces that have it
+	uint32_t frameB;
+};
+
+struct CTraceDiff {
+	bool identical = true;
+	uint32_t distance = 0u;		// frames inserted, removed or changed
+	int offset = 0;				// frames the second trace is late by at the end
+	CChannelDiff channels[DIFF_CHANNELS];
+	std::vector<CDiffEvent> events;	// in order
+};
+
+// aligns the frames of two traces by edit distance within a band of frames
+// around the diagonal, after stripping the frames they share at both ends;
+// aligned frames that differ are compared write by write, per register in
+// order, and runs of frames in one trace only become timing shifts
+CTraceDiff DiffTraces(const CTrace &a, const CTrace &b, int band = 64);
+
+uint8_t DiffChannel(uint8_t reg);
+
+} // namespace MM5Sound
@@ -0,0 +1,163 @@
+#include "mm5diff.h"
+#include "mm5trace.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <dirent.h>
+#include <sys/stat.h>
+
+using namespace MM5Sound;
+
+namespace {
+
+void Usage() {
+	fprintf(stderr,
+		"usage: mm5diff [-w band] [-n events] a b\n"
+		"  compares two traces, register logs as mm5test writes them or binary\n"
+		"  traces, frame by frame after aligning them, and sorts the differences\n"
+		"  into timing shifts and value changes, missing and extra writes per\n"
+		"  channel; a and b may be directories, compared file by file by name\n");
+}
+
+const char *const CHANNEL_NAME[DIFF_CHANNELS] = {"pulse 1", "pulse 2", "triangle", "noise", "other"};
+
+void LoadTrace(const std::string &fname, CTrace &trace) {
+	FILE *f = fopen(fname.c_str(), "rb");
+	if (!f)
+		throw std::runtime_error {"Cannot open " + fname};
+	char magic[4] = { };
+	const bool binary = fread(magic, 1, 4, f) == 4 && !memcmp(magic, "MM5T", 4);
+	rewind(f);
+	try {
+		uint8_t track, region;
+		if (binary)
+			trace.Load(f);
+		else
+			trace.LoadText(f, track, region);
+	}
+	catch (...) {
+		fclose(f);
+		throw;
+	}
+	fclose(f);
+}
+
+std::string Tick(const CTrace &t, uint32_t frame) {
+	const int tick = t.FirstTick() + static_cast<int>(frame);
+	return tick < 0 ? "INIT" : std::to_string(tick);
+}
+
+// true if the traces match
+bool Diff(const std::string &fa, const std::string &fb, int band, size_t show) {
+	CTrace a, b;
+	LoadTrace(fa, a);
+	LoadTrace(fb, b);
+	const auto t0 = std::chrono::steady_clock::now();
+	const CTraceDiff d = DiffTraces(a, b, band);
+	const double ms = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count() * 1e3;
+	if (d.identical) {
+		printf("%s, %s: identical, %zu frames (%.2f ms)\n", fa.c_str(), fb.c_str(), a.Frames(), ms);
+		return true;
+	}
+
+	size_t shifts = 0u;
+	for (const auto &x : d.events)
+		shifts += x.kind == CDiffEvent::SHIFT;
+	printf("%s, %s: %u frames differ, %zu timing shifts, %+d frames at the end (%.2f ms)\n",
+		fa.c_str(), fb.c_str(), d.distance, shifts, d.offset, ms);
+	for (int c = 0; c < DIFF_CHANNELS; ++c) {
+		const CChannelDiff &x = d.channels[c];
+		if (x.values || x.missing || x.extra || x.shifted)
+			printf("  %-8s %u values changed, %u writes missing, %u extra, %u in shifted frames\n",
+				CHANNEL_NAME[c], x.values, x.missing, x.extra, x.shifted);
+	}
+	for (size_t i = 0; i < d.events.size() && i < show; ++i) {
+		const CDiffEvent &e = d.events[i];
+		const std::string at = Tick(a, e.frameA) + "/" + Tick(b, e.frameB);
+		switch (e.kind) {
+		case CDiffEvent::SHIFT:
+			printf("  %-12s %+d frames\n", at.c_str(), e.delta);
+			break;
+		case CDiffEvent::VALUE:
+			printf("  %-12s $%04X: %02X -> %02X\n", at.c_str(), 0x4000 + e.reg, e.a, e.b);
+			break;
+		case CDiffEvent::MISSING:
+			printf("  %-12s $%04X: %02X missing\n", at.c_str(), 0x4000 + e.reg, e.a);
+			break;
+		case CDiffEvent::EXTRA:
+			printf("  %-12s $%04X: %02X extra\n", at.c_str(), 0x4000 + e.reg, e.b);
+			break;
+		}
+	}
+	if (d.events.size() > show)
+		printf("  %zu more\n", d.events.size() - show);
+	return false;
+}
+
+bool IsDir(const char *path) {
+	struct stat st;
+	return !stat(path, &st) && S_ISDIR(st.st_mode);
+}
+
+std::vector<std::string> List(const char *dir) {
+	std::vector<std::string> names;
+	DIR *d = opendir(dir);
+	if (!d)
+		throw std::runtime_error {std::string {"Cannot open "} + dir};
+	while (const dirent *e = readdir(d))
+		if (e->d_name[0] != '.')
+			names.push_back(e->d_name);
+	closedir(d);
+	std::sort(names.begin(), names.end());
+	return names;
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+	int band = 64;
+	size_t show = 10u;
+	int i = 1;
+	for (; i + 1 < argc && argv[i][0] == '-'; i += 2) {
+		if (!strcmp(argv[i], "-w"))
+			band = atoi(argv[i + 1]);
+		else if (!strcmp(argv[i], "-n"))
+			show = static_cast<size_t>(atoi(argv[i + 1]));
+		else {
+			Usage();
+			return 1;
+		}
+	}
+	if (argc - i != 2) {
+		Usage();
+		return 1;
+	}
+	try {
+		if (!IsDir(argv[i]))
+			return Diff(argv[i], argv[i + 1], band, show) ? 0 : 1;
+
+		const std::string da = argv[i], db = argv[i + 1];
+		const auto names = List(argv[i + 1]);
+		size_t differ = 0u, missing = 0u, count = 0u;
+		for (const auto &x : List(argv[i])) {
+			if (!std::binary_search(names.begin(), names.end(), x)) {
+				printf("%s: only in %s\n", x.c_str(), da.c_str());
+				++missing;
+				continue;
+			}
+			++count;
+			differ += !Diff(da + "/" + x, db + "/" + x, band, show);
+		}
+		printf("%zu traces compared, %zu differ, %zu unpaired\n", count, differ, missing);
+		return differ || missing;
+	}
+	catch (std::exception &e) {
+		fprintf(stderr, "%s\n", e.what());
+		return 2;
+	}
+}
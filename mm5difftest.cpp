@@ -0,0 +1,127 @@
+#include "mm5diff.h"
+#include "mm5trace.h"
+#include "mm5rom.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <stdexcept>
+
+using namespace MM5Sound;
+
+namespace {
+
+const int TRACKS = 76;
+
+uint64_t seed_ = 0x9E3779B97F4A7C15ull;
+
+uint64_t Random() {
+	seed_ ^= seed_ << 13;
+	seed_ ^= seed_ >> 7;
+	seed_ ^= seed_ << 17;
+	return seed_;
+}
+
+// a copy of the trace with an empty frame before `at`, the value of write
+// `change` of frame `at` flipped, or write `drop` of frame `at` left out
+CTrace Mutate(const CTrace &t, size_t at, int insert, int change, int drop) {
+	CTrace out {t.FirstTick()};
+	for (size_t f = 0; f < t.Frames(); ++f) {
+		if (f == at && insert)
+			out.NewFrame();
+		out.NewFrame();
+		const uint16_t *x = t.FrameData(f);
+		for (int i = 0; i < static_cast<int>(t.FrameSize(f)); ++i) {
+			if (f == at && i == drop)
+				continue;
+			const uint8_t value = (x[i] & 0xFF) ^ (f == at && i == change ? 0x01 : 0x00);
+			out.Write(0x4000 + (x[i] >> 8), value);
+		}
+	}
+	return out;
+}
+
+// a PLAY frame with writes
+size_t Pick(const CTrace &t) {
+	for (int tries = 0; tries < 1000; ++tries) {
+		const size_t f = 1u + Random() % (t.Frames() - 1u);
+		if (t.FrameSize(f))
+			return f;
+	}
+	return t.Frames();
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+	if (argc < 2) {
+		fprintf(stderr, "usage: %s rom [ticks]\n", argv[0]);
+		return 1;
+	}
+	try {
+		const CSoundBank bank {argv[1]};
+		const int ticks = argc >= 3 ? atoi(argv[2]) : 10800;
+		int failed = 0, checked = 0;
+		double worst = 0., total = 0.;
+		for (int t = 0; t < TRACKS; ++t) {
+			CTrace trace {-1};
+			CTraceEngine engine {bank, &trace};
+			trace.NewFrame();
+			try {
+				engine.CallINIT(t, 0);
+				for (int i = 0; i < ticks; ++i) {
+					trace.NewFrame();
+					engine.CallPLAY();
+				}
+			}
+			catch (std::runtime_error &) {
+			}
+			const size_t at = Pick(trace);
+			if (at == trace.Frames())
+				continue;
+			const uint8_t reg = trace.FrameData(at)[0] >> 8;
+
+			// each mutation must come back as exactly that difference
+			const auto check = [&] (const char *what, const CTrace &other, CDiffEvent::kind_t kind, int delta) {
+				const auto t0 = std::chrono::steady_clock::now();
+				const CTraceDiff d = DiffTraces(trace, other);
+				const double s = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+				worst = std::max(worst, s);
+				total += s;
+				++checked;
+				// an empty frame may as well have gone in before empty frames
+				bool ok = d.events.size() == 1u && d.events[0].kind == kind;
+				if (ok && kind == CDiffEvent::SHIFT) {
+					ok = d.events[0].delta == delta && d.events[0].frameA <= at;
+					for (size_t f = ok ? d.events[0].frameA : at; f < at; ++f)
+						ok = ok && !trace.FrameSize(f);
+				}
+				else if (ok)
+					ok = d.events[0].frameA == at && d.events[0].reg == reg;
+				if (!ok) {
+					printf("Track %02X, %s at frame %zu: %zu events, distance %u\n", t, what, at, d.events.size(), d.distance);
+					++failed;
+				}
+			};
+			check("inserted frame", Mutate(trace, at, 1, -1, -1), CDiffEvent::SHIFT, 1);
+			check("changed value", Mutate(trace, at, 0, 0, -1), CDiffEvent::VALUE, 0);
+			check("dropped write", Mutate(trace, at, 0, -1, 0), CDiffEvent::MISSING, 0);
+			if (!DiffTraces(trace, trace).identical) {
+				printf("Track %02X: differs from itself\n", t);
+				++failed;
+			}
+		}
+		printf("%d diffs of %d-tick traces: %.2f ms on average, %.2f ms at most\n",
+			checked, ticks, checked ? total / checked * 1e3 : 0., worst * 1e3);
+		if (failed) {
+			printf("%d diffs failed.\n", failed);
+			return 1;
+		}
+		printf("All differences found.\n");
+		return 0;
+	}
+	catch (std::exception &e) {
+		fprintf(stderr, "%s\n", e.what());
+		return 1;
+	}
+}
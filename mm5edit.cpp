@@ -0,0 +1,145 @@
+#include "mm5edit.h"
+#include <algorithm>
+#include <stdexcept>
+
+namespace MM5Sound {
+
+namespace {
+	const size_t ENTRY_SIZE = 6u;	// the jump vectors at $8000 and $8003
+
+	// logs reads and faults by tick, and recovers from driver errors
+	class CLoggedEngine : public CEngine {
+	public:
+		CLoggedEngine(const CSoundBank &bank, int32_t *firstRead, std::vector<CEditFault> &faults, CTrace &trace) :
+			CEngine(bank), firstRead_(firstRead), faults_(faults), trace_(trace) { }
+
+		using CEngine::CallINIT;
+		using CEngine::CallPLAY;
+
+		int tick = -1;
+
+	private:
+		uint8_t ReadCallback(uint16_t adr) const override {
+			const uint16_t offset = adr - CSoundBank::BASE_ADR;
+			if (offset >= CSoundBank::BANK_SIZE) {
+				Fault("Sound bank address out of range");
+				return 0u;
+			}
+			if (firstRead_[offset] > tick)
+				firstRead_[offset] = tick;
+			return bank_.Data()[offset];
+		}
+		void WriteCallback(uint16_t adr, uint8_t value) override {
+			trace_.Write(adr, value);
+		}
+		void Fault(const char *what) const override {
+			faults_.push_back({tick, what});
+		}
+
+		int32_t *firstRead_;
+		std::vector<CEditFault> &faults_;
+		CTrace &trace_;
+	};
+}
+
+CLiveEditor::CLiveEditor(const CSoundBank &bank, const CRenderJob &job, int interval) :
+	job_(job), interval_(interval),
+	data_(bank.Data(), bank.Data() + CSoundBank::BANK_SIZE), bank_(data_.data(), data_.size())
+{
+	if (job.startTick)
+		throw std::runtime_error {"Live edits render from the start of the track"};
+	if (interval < 1)
+		throw std::runtime_error {"Checkpoint interval must be positive"};
+	Render();
+}
+
+CSplice CLiveEditor::Patch(const std::vector<CPatch> &patches) {
+	for (const auto &p : patches) {
+		const size_t offset = static_cast<uint16_t>(p.adr - CSoundBank::BASE_ADR);
+		if (offset < ENTRY_SIZE || offset + p.bytes.size() > CSoundBank::BANK_SIZE)
+			throw std::runtime_error {"Patch outside the sound data"};
+	}
+
+	CSplice s;
+	for (const auto &p : patches) {
+		const size_t offset = static_cast<uint16_t>(p.adr - CSoundBank::BASE_ADR);
+		for (size_t i = 0; i < p.bytes.size(); ++i)
+			if (data_[offset + i] != p.bytes[i]) {
+				data_[offset + i] = p.bytes[i];
+				s.firstRead = std::min<int>(s.firstRead, firstRead_[offset + i]);
+			}
+	}
+	if (s.firstRead == CSplice::NEVER)
+		return s;
+	if (s.firstRead < 0) {
+		s.from = -1;
+		s.ticks = job_.ticks;
+		Render();
+		return s;
+	}
+
+	const auto cp = std::upper_bound(cps_.begin(), cps_.end(), s.firstRead,
+		[] (int tick, const CCheckpoint &x) { return tick < x.tick; }) - 1;
+	s.from = cp->tick;
+	s.ticks = job_.ticks - s.from;
+	// the ticks from there on may read differently now
+	for (auto &x : firstRead_)
+		if (x >= s.from)
+			x = CSplice::NEVER;
+	faults_.erase(std::remove_if(faults_.begin(), faults_.end(),
+		[&s] (const CEditFault &x) { return x.tick >= s.from; }), faults_.end());
+	out_.trace.Truncate(1u + s.from);
+	if (job_.pcm)
+		out_.pcm.resize(cp->apu.SampleAt(s.from));
+	Run(cp - cps_.begin());
+	return s;
+}
+
+int CLiveEditor::FirstRead(uint16_t adr) const {
+	const uint16_t offset = adr - CSoundBank::BASE_ADR;
+	return offset < CSoundBank::BANK_SIZE ? firstRead_[offset] : CSplice::NEVER;
+}
+
+void CLiveEditor::Render() {
+	firstRead_.assign(CSoundBank::BANK_SIZE, int32_t {CSplice::NEVER});
+	faults_.clear();
+	cps_.clear();
+	out_.trace.Clear(-1);
+	out_.pcm.clear();
+
+	CLoggedEngine engine {bank_, firstRead_.data(), faults_, out_.trace};
+	CAPU apu {job_.sampleRate};
+	out_.trace.NewFrame();
+	engine.CallINIT(job_.track, job_.region);
+	if (job_.pcm)
+		FeedAPU(apu, out_.trace, 0);
+	cps_.push_back(CCheckpoint {0, { }, apu});
+	engine.SaveState(cps_.back().engine);
+	Run(0u);
+}
+
+void CLiveEditor::Run(size_t from) {
+	while (cps_.size() > from + 1u)
+		cps_.pop_back();
+	CLoggedEngine engine {bank_, firstRead_.data(), faults_, out_.trace};
+	engine.LoadState(cps_[from].engine);
+	CAPU apu {cps_[from].apu};
+	const int start = cps_[from].tick;
+
+	// the trace is kept for PCM jobs as well, splices need it
+	for (int t = start; t < job_.ticks; ++t) {
+		if (t > start && !(t % interval_)) {
+			cps_.push_back(CCheckpoint {t, { }, apu});
+			engine.SaveState(cps_.back().engine);
+		}
+		engine.tick = t;
+		out_.trace.NewFrame();
+		engine.CallPLAY();
+		if (job_.pcm) {
+			FeedAPU(apu, out_.trace, out_.trace.Frames() - 1);
+			apu.RunFrame(&out_.pcm);
+		}
+	}
+}
+
+} // namespace MM5Sound
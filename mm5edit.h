@@ -0,0 +1,79 @@
+#pragma once
+
+#include "mm5render.h"
+#include "mm5rom.h"
+#include <climits>
+#include <cstdint>
+#include <vector>
+
+namespace MM5Sound {
+
+// bytes to write into the sound bank from adr on
+struct CPatch {
+	uint16_t adr;
+	std::vector<uint8_t> bytes;
+};
+
+struct CSplice {
+	static const int NEVER = INT_MAX;
+
+	int firstRead = NEVER;	// earliest tick that read a changed byte, -1 for INIT
+	int from = NEVER;		// tick re-rendered from, -1 for INIT
+	int ticks = 0;			// PLAY calls made
+};
+
+// a driver error in the current output, recovered from as CEngine::Fault
+// describes
+struct CEditFault {
+	int tick;			// -1 for INIT
+	const char *what;
+};
+
+// renders one track from a private copy of the sound bank and keeps it up
+// to date as that copy is patched
+//
+// the render logs the first tick that read each byte of the bank and
+// checkpoints the engine and the APU every few ticks; everything before the
+// first tick that reads a changed byte is unaffected, so a patch restores
+// the last checkpoint at or before that tick, runs from there and splices
+// the new ticks over the old ones
+class CLiveEditor {
+public:
+	// job.startTick must be 0, the output starts with the INIT frame
+	CLiveEditor(const CSoundBank &bank, const CRenderJob &job, int interval = 60);
+	CLiveEditor(const CLiveEditor &) = delete;
+	CLiveEditor &operator=(const CLiveEditor &) = delete;
+
+	// applies all patches, then re-renders once; the driver entry points
+	// cannot be patched
+	CSplice Patch(const std::vector<CPatch> &patches);
+
+	const CSoundBank &Bank() const { return bank_; }
+	const CRenderResult &Result() const { return out_; }
+	const std::vector<CEditFault> &Faults() const { return faults_; }
+	// -1 for INIT, CSplice::NEVER if no tick has read it
+	int FirstRead(uint16_t adr) const;
+
+private:
+	struct CCheckpoint {
+		int tick;
+		CEngineState engine;
+		CAPU apu;
+	};
+
+	void Render();
+	// PLAY calls from a checkpoint to the end of the job, dropping the
+	// checkpoints after it
+	void Run(size_t from);
+
+	const CRenderJob job_;
+	const int interval_;
+	std::vector<uint8_t> data_;
+	const CSoundBank bank_;		// over data_
+	std::vector<int32_t> firstRead_;	// by bank offset
+	std::vector<CCheckpoint> cps_;	// by tick, the first one right after INIT
+	std::vector<CEditFault> faults_;
+	CRenderResult out_;
+};
+
+} // namespace MM5Sound
@@ -0,0 +1,131 @@
+#include "mm5edit.h"
+#include "mm5render.h"
+#include "mm5rom.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <stdexcept>
+#include <vector>
+
+using namespace MM5Sound;
+
+namespace {
+
+const int TRACKS = 76;
+
+uint64_t seed_ = 0x9E3779B97F4A7C15ull;
+
+uint64_t Random() {
+	seed_ ^= seed_ << 13;
+	seed_ ^= seed_ >> 7;
+	seed_ ^= seed_ << 17;
+	return seed_;
+}
+
+double Since(std::chrono::steady_clock::time_point t0) {
+	return std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+}
+
+// a patched editor against a fresh render of its patched bank, and against
+// the plain renderer while the driver runs without errors
+bool Check(const CLiveEditor &editor, const CRenderJob &job) {
+	const CLiveEditor fresh {editor.Bank(), job};
+	if (!(fresh.Result().trace == editor.Result().trace) || fresh.Result().pcm != editor.Result().pcm ||
+		fresh.Faults().size() != editor.Faults().size())
+		return false;
+	if (!editor.Faults().empty() || job.pcm)
+		return true;
+	CRenderResult ref;
+	CSegmentRenderer {editor.Bank()}.RenderSerial(job, ref);
+	return ref.trace == editor.Result().trace;
+}
+
+// bytes read in the render, by offset
+std::vector<uint16_t> ReadBytes(const CLiveEditor &editor) {
+	std::vector<uint16_t> adrs;
+	for (size_t i = 6; i < CSoundBank::BANK_SIZE; ++i) {
+		const uint16_t adr = CSoundBank::BASE_ADR + i;
+		if (editor.FirstRead(adr) != CSplice::NEVER)
+			adrs.push_back(adr);
+	}
+	return adrs;
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+	if (argc < 2) {
+		fprintf(stderr, "usage: %s rom [ticks] [patches per track]\n", argv[0]);
+		fprintf(stderr, "  checks random patches on 1800 ticks of every track, samples on the\n"
+			"  first two, then times a late patch on the register writes of each track\n");
+		return 1;
+	}
+	try {
+		const CSoundBank bank {argv[1]};
+		CRenderJob job;
+		const int ticks = argc >= 3 ? atoi(argv[2]) : 18000;
+		const int patches = argc >= 4 ? atoi(argv[3]) : 4;
+
+		// random patches to bytes the track reads, each checked against a
+		// full render of the patched bank
+		int failed = 0, checked = 0;
+		job.ticks = std::min(ticks, 1800);
+		for (int t = 0; t < TRACKS; ++t) {
+			job.track = t;
+			job.pcm = t < 2;
+			CLiveEditor editor {bank, job};
+			for (int i = 0; i < patches; ++i) {
+				const auto adrs = ReadBytes(editor);
+				if (adrs.empty())
+					break;
+				std::vector<CPatch> ps;
+				for (int n = 1 + Random() % 3; n; --n)
+					ps.push_back({adrs[Random() % adrs.size()], {static_cast<uint8_t>(Random())}});
+				const CSplice s = editor.Patch(ps);
+				++checked;
+				if (!Check(editor, job)) {
+					printf("Track %02X, patch %d at $%04X: spliced from tick %d, differs from a full render\n",
+						t, i, ps[0].adr, s.from);
+					++failed;
+					break;
+				}
+			}
+		}
+		if (failed) {
+			printf("%d of %d patches failed.\n", failed, checked);
+			return 1;
+		}
+		printf("%d patches match a full render.\n", checked);
+
+		// the latest byte each sounding track reads first, patched and
+		// restored, against rendering the whole track
+		job.ticks = ticks;
+		job.pcm = false;
+		for (int t = 0; t < TRACKS; ++t) {
+			job.track = t;
+			auto t0 = std::chrono::steady_clock::now();
+			CLiveEditor editor {bank, job};
+			const double full = Since(t0);
+			if (editor.Result().trace.Writes() == editor.Result().trace.FrameSize(0))
+				continue;
+			uint16_t last = 0u;
+			for (uint16_t adr : ReadBytes(editor))
+				if (!last || editor.FirstRead(adr) > editor.FirstRead(last))
+					last = adr;
+			const uint8_t old = editor.Bank().Read(last);
+			t0 = std::chrono::steady_clock::now();
+			const CSplice s = editor.Patch({{last, {static_cast<uint8_t>(old ^ 0x01)}}});
+			const double patch = Since(t0);
+			editor.Patch({{last, {old}}});
+			printf("Track %02X, %d ticks: full render %.1f ms; patch at $%04X, first read at tick %d, "
+				"%d ticks re-rendered in %.2f ms\n", t, job.ticks, full * 1e3, last, s.firstRead, s.ticks, patch * 1e3);
+		}
+		return 0;
+	}
+	catch (std::exception &e) {
+		fprintf(stderr, "%s\n", e.what());
+		return 1;
+	}
+}
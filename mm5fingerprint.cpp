@@ -0,0 +1,168 @@
+#include "mm5fingerprint.h"
+#include "mm5rom.h"
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+
+namespace MM5Sound {
+
+/*
+golden file layout, all integers little-endian
+0	"MM5G"
+4	version, uint32
+8	sound bank CRC32
+12	track, region, error flag, padding
+16	ticks, uint32
+20	state interval, uint32
+24	frame count, uint32
+28	state count, uint32
+32	frame hashes, then state hashes, uint64 each
+*/
+
+namespace {
+	const uint32_t VERSION = 1u;
+
+	void Put(FILE *f, uint64_t x, int bytes) {
+		for (int i = 0; i < bytes; ++i)
+			fputc((x >> (i * 8)) & 0xFF, f);
+	}
+
+	uint64_t Get(FILE *f, int bytes) {
+		uint64_t x = 0;
+		for (int i = 0; i < bytes; ++i) {
+			int c = fgetc(f);
+			if (c == EOF)
+				throw std::runtime_error {"Golden file truncated"};
+			x |= static_cast<uint64_t>(c) << (i * 8);
+		}
+		return x;
+	}
+
+	class CHashEngine : public CEngine {
+	public:
+		using CEngine::CEngine;
+		using CEngine::CallINIT;
+		using CEngine::CallPLAY;
+
+		void EndFrame() {
+			hash_.Add(count_);
+			count_ = 0u;
+		}
+		uint64_t Value() const { return hash_.Value(); }
+
+	private:
+		void WriteCallback(uint16_t adr, uint8_t value) override {
+			hash_.Add(static_cast<uint8_t>(adr)).Add(value);
+			++count_;
+		}
+
+		CHash64 hash_;
+		uint32_t count_ = 0u;
+	};
+}
+
+uint64_t StateHash(const CEngineState &state) {
+	CHash64 h;
+	h.Add(state.mem, sizeof(state.mem));
+	h.Add(state.A).Add(state.X).Add(state.Y);
+	h.Add(state.envelopePtr).Add(state.tickElapsed).Add(state.tickCounter);
+	h.Add(state.tempo).Add(state.globalTrsp).Add(state.sfxPtr);
+	for (const auto &x : state.music) {
+		h.Add(x.patternAdr).Add(x.octaveFlag).Add(x.transpose);
+		h.Add(x.noteWait).Add(x.gateTime).Add(x.sustainWait);
+		h.Add(x.loopCount, sizeof(x.loopCount));
+	}
+	return h.Value();
+}
+
+CFingerprint Fingerprint(const CSoundBank &bank, uint8_t track, uint8_t region,
+	int ticks, uint32_t stateInterval)
+{
+	CFingerprint fp;
+	fp.bankCRC = bank.Checksum();
+	fp.track = track;
+	fp.region = region;
+	fp.ticks = ticks;
+	fp.stateInterval = std::max(stateInterval, 1u);
+
+	CHashEngine engine {bank};
+	CEngineState state;
+	try {
+		for (int t = -1; t < ticks; ++t) {
+			if (t < 0)
+				engine.CallINIT(track, region);
+			else
+				engine.CallPLAY();
+			engine.EndFrame();
+			fp.frames.push_back(engine.Value());
+			if (!(static_cast<uint32_t>(t + 1) % fp.stateInterval)) {
+				engine.SaveState(state);
+				fp.states.push_back(StateHash(state));
+			}
+		}
+	}
+	catch (std::exception &) {
+		// the partial frame still counts, errors happen after some writes
+		engine.EndFrame();
+		fp.frames.push_back(engine.Value());
+		fp.error = true;
+	}
+	return fp;
+}
+
+CDivergence Compare(const CFingerprint &golden, const CFingerprint &actual) {
+	CDivergence d;
+	const auto first = [] (const std::vector<uint64_t> &a, const std::vector<uint64_t> &b) {
+		const size_t n = std::min(a.size(), b.size());
+		const size_t i = std::mismatch(a.begin(), a.begin() + n, b.begin()).first - a.begin();
+		return i < n || a.size() != b.size() ? static_cast<long>(i) : -1l;
+	};
+	d.frame = first(golden.frames, actual.frames);
+	if (d.frame < 0 && golden.error != actual.error)
+		d.frame = static_cast<long>(golden.frames.size()) - 1;
+	const long s = first(golden.states, actual.states);
+	if (s >= 0)
+		d.state = s * static_cast<long>(golden.stateInterval);
+	return d;
+}
+
+void CFingerprint::Save(FILE *f) const {
+	fputs("MM5G", f);
+	Put(f, VERSION, 4);
+	Put(f, bankCRC, 4);
+	Put(f, track, 1);
+	Put(f, region, 1);
+	Put(f, error, 1);
+	Put(f, 0u, 1);
+	Put(f, ticks, 4);
+	Put(f, stateInterval, 4);
+	Put(f, frames.size(), 4);
+	Put(f, states.size(), 4);
+	for (auto x : frames)
+		Put(f, x, 8);
+	for (auto x : states)
+		Put(f, x, 8);
+}
+
+void CFingerprint::Load(FILE *f) {
+	char magic[4];
+	if (fread(magic, 1, 4, f) != 4 || std::string(magic, 4) != "MM5G")
+		throw std::runtime_error {"Not a golden file"};
+	if (Get(f, 4) != VERSION)
+		throw std::runtime_error {"Unsupported golden file version"};
+	bankCRC = static_cast<uint32_t>(Get(f, 4));
+	track = static_cast<uint8_t>(Get(f, 1));
+	region = static_cast<uint8_t>(Get(f, 1));
+	error = Get(f, 1) != 0u;
+	Get(f, 1);
+	ticks = static_cast<int>(Get(f, 4));
+	stateInterval = static_cast<uint32_t>(Get(f, 4));
+	frames.resize(Get(f, 4));
+	states.resize(Get(f, 4));
+	for (auto &x : frames)
+		x = Get(f, 8);
+	for (auto &x : states)
+		x = Get(f, 8);
+}
+
+} // namespace MM5Sound
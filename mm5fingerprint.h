@@ -0,0 +1,65 @@
+#pragma once
+
+#include "mm5sound.h"
+#include <cstdio>
+#include <vector>
+
+namespace MM5Sound {
+
+class CSoundBank;
+
+// 64-bit FNV-1a
+class CHash64 {
+public:
+	static const uint64_t BASIS = 0xCBF29CE484222325ull;
+
+	explicit CHash64(uint64_t h = BASIS) : h_(h) { }
+
+	CHash64 &Add(const void *data, size_t size) {
+		const uint8_t *p = static_cast<const uint8_t *>(data);
+		for (size_t i = 0; i < size; ++i)
+			h_ = (h_ ^ p[i]) * 0x100000001B3ull;
+		return *this;
+	}
+	template <class T>
+	CHash64 &Add(T x) {
+		return Add(&x, sizeof(x));
+	}
+	uint64_t Value() const { return h_; }
+
+private:
+	uint64_t h_;
+};
+
+// covers every field but not the padding
+uint64_t StateHash(const CEngineState &state);
+
+// per-frame rolling hashes of a track's register writes, frame 0 being INIT,
+// and hashes of the whole driver state after every few frames
+struct CFingerprint {
+	uint32_t bankCRC = 0u;
+	uint8_t track = 0u;
+	uint8_t region = 0u;
+	int ticks = 0;
+	uint32_t stateInterval = 60u;
+	bool error = false;			// the driver threw during the last frame
+	std::vector<uint64_t> frames;
+	std::vector<uint64_t> states;	// after frames 0, interval, 2 * interval, ...
+
+	void Save(FILE *f) const;
+	void Load(FILE *f);
+};
+
+CFingerprint Fingerprint(const CSoundBank &bank, uint8_t track, uint8_t region,
+	int ticks, uint32_t stateInterval = 60u);
+
+struct CDivergence {
+	long frame = -1;		// first frame with different writes, or -1
+	long state = -1;		// first frame with a different state, or -1
+
+	explicit operator bool() const { return frame >= 0 || state >= 0; }
+};
+
+CDivergence Compare(const CFingerprint &golden, const CFingerprint &actual);
+
+} // namespace MM5Sound
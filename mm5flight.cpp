@@ -0,0 +1,323 @@
+#include "mm5flight.h"
+#include <algorithm>
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+
+namespace MM5Sound {
+
+/*
+flight record layout, native byte order
+0	"MM5F"
+4	version, uint32
+8	size of CEngineState, uint32
+12	track, region, padding
+16	reason length, uint32, then the reason
+	record data length, uint32, then the records, oldest first
+
+each record
+0	frame, uint32
+4	flags
+5	write count, uint16, then low address byte, high address byte, value
+	run count, uint16, then per run offset, uint16, length, uint16, and the
+	new bytes of CEngineState
+*/
+
+namespace {
+	const uint32_t VERSION = 1u;
+	const size_t STATE_SIZE = sizeof(CEngineState);
+	const size_t HEADER_SIZE = 7u;
+	// most a frame's runs can take, every other word changed
+	const size_t RUNS_SIZE = 2u + STATE_SIZE * 2u;
+	// room left for writes at the start of a frame
+	const size_t WRITES_SIZE = 0x300u;
+
+	uint8_t *Put16(uint8_t *p, size_t x) {
+		p[0] = x & 0xFF;
+		p[1] = (x >> 8) & 0xFF;
+		return p + 2;
+	}
+
+	size_t Get16(const uint8_t *p) {
+		return p[0] | (p[1] << 8);
+	}
+
+	void Put32(FILE *f, uint32_t x) {
+		fwrite(&x, sizeof(x), 1, f);
+	}
+
+	uint32_t Get32(FILE *f) {
+		uint32_t x;
+		if (fread(&x, sizeof(x), 1, f) != 1)
+			throw std::runtime_error {"Flight record truncated"};
+		return x;
+	}
+
+	uint64_t Word(const uint8_t *p) {
+		uint64_t x;
+		memcpy(&x, p, sizeof(x));
+		return x;
+	}
+
+	// the driver keeps its RAM in $C0 - $DF and $0700 - $077F, so between
+	// keyframes only those and the variables after it need to be compared,
+	// the RAM straight from the engine
+	struct CRange {
+		size_t begin, end;
+	};
+	const size_t MEM = offsetof(CEngineState, mem);
+	const CRange LIVE[] = {
+		{0xC0, 0xE0},
+		{0x700, 0x780},
+	};
+	const CRange VARS = {offsetof(CEngineState, A), STATE_SIZE};
+
+	// stores the 8-byte words of cur that differ from last as runs at the
+	// given offset into the state, copies them into last, and returns the end
+	// of them
+	uint8_t *Diff(uint8_t *p, size_t &runs, uint8_t *last, const uint8_t *cur, size_t offset, size_t size) {
+		const size_t words = size / 8u * 8u;
+		const auto differs = [&] (size_t i) {
+			if (i < words)
+				return Word(last + i) != Word(cur + i);
+			return memcmp(last + i, cur + i, size - i) != 0;
+		};
+		for (size_t i = 0u; i < size; ) {
+			if (!differs(i)) {
+				i += 8u;
+				continue;
+			}
+			size_t j = i + 8u;
+			while (j < size && differs(j))
+				j += 8u;
+			j = std::min(j, size);
+			p = Put16(Put16(p, offset + i), j - i);
+			memcpy(p, cur + i, j - i);
+			memcpy(last + i, cur + i, j - i);
+			p += j - i;
+			++runs;
+			i = j;
+		}
+		return p;
+	}
+}
+
+CFlightRecorder::CFlightRecorder(unsigned segments, unsigned segmentFrames) :
+	segFrames_(std::max(segmentFrames, 1u)),
+	segSize_(segFrames_ * 0x80u + HEADER_SIZE + WRITES_SIZE + RUNS_SIZE),
+	seg_(std::max(segments, 2u))
+{
+	// SaveState leaves the padding alone, so it stays zero for the diffs
+	memset(&last_, 0, sizeof(last_));
+	memset(&now_, 0, sizeof(now_));
+	for (auto &x : seg_)
+		x.data.reset(new uint8_t[segSize_]);
+	Open();
+}
+
+void CFlightRecorder::Begin(uint8_t track, uint8_t region) {
+	for (auto &x : seg_) {
+		x.done = 0u;
+		x.frames = 0u;
+	}
+	cur_ = 0u;
+	frame_ = 0u;
+	track_ = track;
+	region_ = region;
+	memset(&last_, 0, sizeof(last_));
+	Open();
+}
+
+void CFlightRecorder::Open() {
+	CSegment &seg = seg_[cur_];
+	pos_ = seg.data.get() + seg.done + HEADER_SIZE;
+	end_ = seg.data.get() + segSize_ - RUNS_SIZE;
+	lost_ = false;
+}
+
+void CFlightRecorder::EndFrame(const CEngine &engine, bool error) {
+	CSegment &seg = seg_[cur_];
+	uint8_t *start = seg.data.get() + seg.done;
+	const bool key = !seg.frames;
+
+	memcpy(start, &frame_, 4u);
+	start[4] = (key ? KEY : 0u) | (error ? ERROR : 0u) | (lost_ ? LOST : 0u);
+	Put16(start + 5, (pos_ - start - HEADER_SIZE) / 3u);
+	uint8_t *count = pos_;
+	size_t runs = 0u;
+	uint8_t *last = reinterpret_cast<uint8_t *>(&last_);
+	const uint8_t *cur = reinterpret_cast<const uint8_t *>(&now_);
+	if (key) {
+		// against an all-zero state, which last then follows
+		engine.SaveState(now_);
+		memset(&last_, 0, sizeof(last_));
+		pos_ = Diff(pos_ + 2, runs, last, cur, 0u, STATE_SIZE);
+	}
+	else {
+		pos_ += 2;
+		for (const CRange &r : LIVE)
+			pos_ = Diff(pos_, runs, last + MEM + r.begin, engine.Memory() + r.begin, MEM + r.begin, r.end - r.begin);
+		engine.SaveVariables(now_);
+		pos_ = Diff(pos_, runs, last + VARS.begin, cur + VARS.begin, VARS.begin, VARS.end - VARS.begin);
+	}
+	Put16(count, runs);
+
+	seg.done = pos_ - seg.data.get();
+	++frame_;
+	// a segment also ends early if the next frame might not fit
+	if (++seg.frames == segFrames_ || segSize_ - seg.done < HEADER_SIZE + WRITES_SIZE + RUNS_SIZE) {
+		cur_ = (cur_ + 1u) % seg_.size();
+		seg_[cur_].done = 0u;
+		seg_[cur_].frames = 0u;
+	}
+	Open();
+}
+
+void CFlightRecorder::Dump(const char *fname, const std::string &reason) const {
+	FILE *f = fopen(fname, "wb");
+	if (!f)
+		throw std::runtime_error {std::string {"Cannot write "} + fname};
+	fwrite("MM5F", 4, 1, f);
+	Put32(f, VERSION);
+	Put32(f, STATE_SIZE);
+	const uint8_t id[] = {track_, region_, 0u, 0u};
+	fwrite(id, sizeof(id), 1, f);
+	Put32(f, static_cast<uint32_t>(reason.size()));
+	fwrite(reason.data(), reason.size(), 1, f);
+
+	size_t size = 0u;
+	for (const auto &x : seg_)
+		size += x.done;
+	Put32(f, static_cast<uint32_t>(size));
+	for (size_t i = 1; i <= seg_.size(); ++i) {
+		const CSegment &seg = seg_[(cur_ + i) % seg_.size()];
+		fwrite(seg.data.get(), 1, seg.done, f);
+	}
+	if (fclose(f))
+		throw std::runtime_error {std::string {"Cannot write "} + fname};
+}
+
+CFlightEngine::CFlightEngine(const CSoundBank &bank, const char *dumpFile,
+	unsigned segments, unsigned segmentFrames) :
+	CEngine(bank), rec_(segments, segmentFrames), dumpFile_(dumpFile ? dumpFile : "")
+{
+}
+
+template <class F>
+void CFlightEngine::Frame(F f) {
+	try {
+		f();
+	}
+	catch (std::exception &e) {
+		rec_.EndFrame(*this, true);
+		if (!dumpFile_.empty())
+			rec_.Dump(dumpFile_.c_str(), e.what());
+		throw;
+	}
+	rec_.EndFrame(*this);
+}
+
+void CFlightEngine::CallINIT(uint8_t track, uint8_t region) {
+	rec_.Begin(track, region);
+	Frame([&] { CEngine::CallINIT(track, region); });
+}
+
+void CFlightEngine::CallPLAY() {
+	Frame([&] { CEngine::CallPLAY(); });
+}
+
+void CFlightEngine::WriteCallback(uint16_t adr, uint8_t value) {
+	rec_.Write(adr, value);
+	CEngine::WriteCallback(adr, value);
+}
+
+CFlightLog::CFlightLog(const char *fname) {
+	FILE *f = fopen(fname, "rb");
+	if (!f)
+		throw std::runtime_error {std::string {"Cannot open "} + fname};
+	try {
+		char magic[4];
+		if (fread(magic, 4, 1, f) != 1 || memcmp(magic, "MM5F", 4))
+			throw std::runtime_error {std::string {"Not a flight record: "} + fname};
+		if (Get32(f) != VERSION || Get32(f) != STATE_SIZE)
+			throw std::runtime_error {std::string {"Flight record from another version: "} + fname};
+		uint8_t id[4];
+		if (fread(id, sizeof(id), 1, f) != 1)
+			throw std::runtime_error {"Flight record truncated"};
+		track_ = id[0];
+		region_ = id[1];
+		reason_.resize(Get32(f));
+		if (!reason_.empty() && fread(&reason_[0], reason_.size(), 1, f) != 1)
+			throw std::runtime_error {"Flight record truncated"};
+		data_.resize(Get32(f));
+		if (!data_.empty() && fread(data_.data(), data_.size(), 1, f) != 1)
+			throw std::runtime_error {"Flight record truncated"};
+	}
+	catch (...) {
+		fclose(f);
+		throw;
+	}
+	fclose(f);
+
+	// every segment opens with a keyframe, so the oldest record is one
+	std::vector<uint16_t> writes;
+	std::vector<uint8_t> scratch(STATE_SIZE);
+	size_t key = 0u;
+	for (size_t pos = 0u; pos < data_.size(); ) {
+		if (pos + HEADER_SIZE > data_.size())
+			throw std::runtime_error {"Flight record truncated"};
+		CFrame x;
+		memcpy(&x.frame, &data_[pos], 4u);
+		x.flags = data_[pos + 4];
+		x.offset = pos;
+		if (x.flags & CFlightRecorder::KEY)
+			key = frames_.size();
+		else if (frames_.empty())
+			throw std::runtime_error {"Flight record does not start with a keyframe"};
+		x.key = key;
+		frames_.push_back(x);
+		pos = Apply(pos, scratch.data(), writes);
+	}
+}
+
+size_t CFlightLog::Apply(size_t pos, uint8_t *state, std::vector<uint16_t> &writes) const {
+	const auto need = [&] (size_t n) {
+		if (pos + n > data_.size())
+			throw std::runtime_error {"Flight record truncated"};
+	};
+	need(HEADER_SIZE);
+	const uint8_t flags = data_[pos + 4];
+	const size_t count = Get16(&data_[pos + 5]);
+	pos += HEADER_SIZE;
+	need(count * 3u + 2u);
+	writes.clear();
+	for (size_t i = 0; i < count; ++i, pos += 3u)
+		writes.push_back(((Get16(&data_[pos]) - 0x4000) << 8) | data_[pos + 2]);
+
+	if (flags & CFlightRecorder::KEY)
+		memset(state, 0, STATE_SIZE);
+	const size_t runs = Get16(&data_[pos]);
+	pos += 2u;
+	for (size_t i = 0; i < runs; ++i) {
+		need(4u);
+		const size_t offset = Get16(&data_[pos]);
+		const size_t length = Get16(&data_[pos + 2]);
+		pos += 4u;
+		need(length);
+		if (offset + length > STATE_SIZE)
+			throw std::runtime_error {"Flight record damaged"};
+		memcpy(state + offset, &data_[pos], length);
+		pos += length;
+	}
+	return pos;
+}
+
+void CFlightLog::StateAt(size_t index, CEngineState &state, std::vector<uint16_t> &writes) const {
+	uint8_t *p = reinterpret_cast<uint8_t *>(&state);
+	const CFrame &x = frames_.at(index);
+	for (size_t i = x.key; i <= index; ++i)
+		Apply(frames_[i].offset, p, writes);
+}
+
+} // namespace MM5Sound
@@ -0,0 +1,122 @@
+#pragma once
+
+#include "mm5sound.h"
+#include <cstdint>
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace MM5Sound {
+
+// always-on history of the driver: after every frame the bytes of the
+// engine state that changed since the last one, plus the register writes
+// made during it, go into a ring of fixed-size segments that each open with
+// a full keyframe, so that the oldest segment is dropped whole; frame 0 is
+// INIT
+class CFlightRecorder {
+public:
+	enum : uint8_t {
+		KEY = 0x01,		// the runs are against an all-zero state
+		ERROR = 0x02,	// the driver threw during the frame
+		LOST = 0x04,	// not all writes fit
+	};
+
+	explicit CFlightRecorder(unsigned segments = 8u, unsigned segmentFrames = 256u);
+
+	void Begin(uint8_t track, uint8_t region);
+	void Write(uint16_t adr, uint8_t value) {
+		if (pos_ + 3 > end_) {
+			lost_ = true;
+			return;
+		}
+		pos_[0] = adr & 0xFF;
+		pos_[1] = adr >> 8;
+		pos_[2] = value;
+		pos_ += 3;
+	}
+	void EndFrame(const CEngine &engine, bool error = false);
+
+	// writes everything still held, oldest frame first
+	void Dump(const char *fname, const std::string &reason) const;
+	uint32_t Frames() const { return frame_; }
+
+private:
+	struct CSegment {
+		std::unique_ptr<uint8_t[]> data;
+		size_t done = 0u;		// bytes of finished frames
+		unsigned frames = 0u;
+	};
+
+	void Open();
+
+	const unsigned segFrames_;
+	const size_t segSize_;
+	std::vector<CSegment> seg_;
+	unsigned cur_ = 0u;
+	uint8_t *pos_ = nullptr;	// next write
+	uint8_t *end_ = nullptr;	// writes stop here, leaving room for the state
+	bool lost_ = false;
+	uint32_t frame_ = 0u;
+	uint8_t track_ = 0u;
+	uint8_t region_ = 0u;
+	CEngineState last_;		// as recorded so far
+	CEngineState now_;
+};
+
+// engine that keeps a flight recorder running, and dumps it when the driver
+// throws if it was given a file name
+class CFlightEngine : public CEngine {
+public:
+	explicit CFlightEngine(const CSoundBank &bank, const char *dumpFile = nullptr,
+		unsigned segments = 8u, unsigned segmentFrames = 256u);
+
+	void CallINIT(uint8_t track, uint8_t region) override;
+	void CallPLAY() override;
+
+	const CFlightRecorder &Recorder() const { return rec_; }
+
+protected:
+	void WriteCallback(uint16_t adr, uint8_t value) override;
+
+private:
+	template <class F>
+	void Frame(F f);
+
+	CFlightRecorder rec_;
+	std::string dumpFile_;
+};
+
+// a dumped flight record
+class CFlightLog {
+public:
+	explicit CFlightLog(const char *fname);
+
+	struct CFrame {
+		uint32_t frame;
+		uint8_t flags;
+		size_t offset;		// into the record data
+		size_t key;			// index of the keyframe it builds on
+	};
+
+	uint8_t Track() const { return track_; }
+	uint8_t Region() const { return region_; }
+	const std::string &Reason() const { return reason_; }
+	const std::vector<CFrame> &Frames() const { return frames_; }
+
+	// the state after Frames()[index], and the writes made during it as
+	// ((adr - $4000) << 8) | value
+	void StateAt(size_t index, CEngineState &state, std::vector<uint16_t> &writes) const;
+
+private:
+	// applies one record, returns the offset past it
+	size_t Apply(size_t pos, uint8_t *state, std::vector<uint16_t> &writes) const;
+
+	uint8_t track_ = 0u;
+	uint8_t region_ = 0u;
+	std::string reason_;
+	std::vector<uint8_t> data_;
+	std::vector<CFrame> frames_;
+};
+
+} // namespace MM5Sound
@@ -0,0 +1,131 @@
+#include "mm5flight.h"
+#include "mm5rom.h"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+using namespace MM5Sound;
+
+namespace {
+
+void Usage() {
+	fprintf(stderr,
+		"usage: mm5flight record rom track ticks out.mm5f\n"
+		"       mm5flight show file.mm5f [frame]\n"
+		"  record plays a track with the flight recorder on and dumps it at the\n"
+		"  end, or as soon as the driver throws; show lists the frames a dump\n"
+		"  holds, or rebuilds the whole driver state after one of them (frame 0\n"
+		"  is INIT) and marks the bytes that changed during it\n");
+}
+
+// the same rows BREAK prints, changed bytes marked
+void Row(const CEngineState &s, const CEngineState *prev, unsigned adr) {
+	printf("%04X:", adr);
+	for (unsigned n = adr + 0x10; adr < n; ++adr)
+		printf("%c%02X", prev && prev->mem[adr] != s.mem[adr] ? '*' : ' ', s.mem[adr]);
+	putchar('\n');
+}
+
+void Print(const CEngineState &s, const CEngineState *prev, const std::vector<uint16_t> &writes) {
+	for (unsigned adr = 0x700; adr < 0x780; adr += 0x10)
+		Row(s, prev, adr);
+	Row(s, prev, 0xC0);
+	Row(s, prev, 0xD0);
+	printf("A: %02X    X: %02X    Y: %02X\n", s.A, s.X, s.Y);
+	printf("envelope %04X  elapsed %02X  counter %02X  tempo %04X  transpose %02X  sfx %04X\n",
+		s.envelopePtr, s.tickElapsed, s.tickCounter, s.tempo, s.globalTrsp, s.sfxPtr);
+	for (int i = 0; i < 4; ++i) {
+		const auto &x = s.music[i];
+		printf("music %d: pattern %04X  octave %02X  transpose %02X  wait %02X  gate %02X  sustain %02X  loops %02X %02X %02X %02X\n",
+			i, x.patternAdr, x.octaveFlag, x.transpose, x.noteWait, x.gateTime, x.sustainWait,
+			x.loopCount[0], x.loopCount[1], x.loopCount[2], x.loopCount[3]);
+	}
+	for (uint16_t w : writes)
+		printf("WRITE(%04X,%02X)\n", 0x4000 + (w >> 8), w & 0xFF);
+}
+
+int Record(int argc, char **argv) {
+	if (argc < 6) {
+		Usage();
+		return 1;
+	}
+	const CSoundBank bank {argv[2]};
+	const uint8_t track = static_cast<uint8_t>(strtol(argv[3], nullptr, 0));
+	const int ticks = atoi(argv[4]);
+	CFlightEngine engine {bank, argv[5]};
+	const auto t0 = std::chrono::steady_clock::now();
+	try {
+		engine.CallINIT(track, 0);
+		for (int t = 0; t < ticks; ++t)
+			engine.CallPLAY();
+	}
+	catch (std::exception &e) {
+		fprintf(stderr, "%s, frame %u dumped to %s\n", e.what(), engine.Recorder().Frames() - 1, argv[5]);
+		return 1;
+	}
+	const double s = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+	engine.Recorder().Dump(argv[5], "end of run");
+	fprintf(stderr, "%u frames in %.3f s (%.0f ns per frame)\n", engine.Recorder().Frames(), s,
+		s * 1e9 / engine.Recorder().Frames());
+	return 0;
+}
+
+int Show(int argc, char **argv) {
+	const CFlightLog log {argv[2]};
+	const auto &frames = log.Frames();
+	if (frames.empty())
+		throw std::runtime_error {"Flight record is empty"};
+	CEngineState state;
+	std::vector<uint16_t> writes;
+
+	if (argc < 4) {
+		printf("track %02X, region %u: %s\n", log.Track(), log.Region(), log.Reason().c_str());
+		printf("frames %u to %u\n", frames.front().frame, frames.back().frame);
+		for (size_t i = 0; i < frames.size(); ++i)
+			if (frames[i].flags & CFlightRecorder::ERROR) {
+				log.StateAt(i, state, writes);
+				printf("frame %u threw after %zu writes\n", frames[i].frame, writes.size());
+			}
+		return 0;
+	}
+
+	const long frame = strtol(argv[3], nullptr, 0);
+	size_t i = 0u;
+	while (i < frames.size() && frames[i].frame != frame)
+		++i;
+	if (i == frames.size())
+		throw std::runtime_error {"Frame " + std::to_string(frame) + " is not in the record"};
+	CEngineState prev;
+	std::vector<uint16_t> unused;
+	if (i)
+		log.StateAt(i - 1, prev, unused);
+	log.StateAt(i, state, writes);
+	printf("frame %u (%s)%s\n", frames[i].frame,
+		frames[i].frame ? ("PLAY(" + std::to_string(frames[i].frame - 1) + ")").c_str() : "INIT",
+		frames[i].flags & CFlightRecorder::ERROR ? ", threw" : "");
+	Print(state, i ? &prev : nullptr, writes);
+	return 0;
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+	if (argc < 3) {
+		Usage();
+		return 1;
+	}
+	try {
+		if (!strcmp(argv[1], "record"))
+			return Record(argc, argv);
+		if (!strcmp(argv[1], "show"))
+			return Show(argc, argv);
+		Usage();
+	}
+	catch (std::exception &e) {
+		fprintf(stderr, "%s\n", e.what());
+	}
+	return 1;
+}
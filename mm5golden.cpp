@@ -0,0 +1,152 @@
+#include "mm5fingerprint.h"
+#include "mm5flight.h"
+#include "mm5trace.h"
+#include "mm5rom.h"
+#include <chrono>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <stdexcept>
+#include <string>
+#include <sys/stat.h>
+
+using namespace MM5Sound;
+
+namespace {
+
+const int TRACKS = 76;
+
+std::string FileName(const char *dir, int track, const char *ext = "mm5g") {
+	char name[16];
+	snprintf(name, sizeof(name), "/%02X.%s", track, ext);
+	return dir + std::string {name};
+}
+
+// the writes of the first divergent frame, as mm5test would print them
+void ShowFrame(const CSoundBank &bank, uint8_t track, uint8_t region, long frame) {
+	CTrace trace {-1};
+	CTraceEngine engine {bank, &trace};
+	try {
+		for (long t = -1; t < frame; ++t) {
+			trace.Clear(static_cast<int>(t));
+			trace.NewFrame();
+			if (t < 0)
+				engine.CallINIT(track, region);
+			else
+				engine.CallPLAY();
+		}
+	}
+	catch (std::exception &e) {
+		printf("    %s\n", e.what());
+	}
+	trace.WriteText(stdout, track, region);
+}
+
+// the engine's recent history up to the divergent frame, for mm5flight
+void DumpFlight(const CSoundBank &bank, uint8_t track, uint8_t region, long frame,
+	const std::string &fname, const std::string &reason)
+{
+	CFlightEngine engine {bank, fname.c_str()};
+	try {
+		for (long t = -1; t < frame; ++t) {
+			if (t < 0)
+				engine.CallINIT(track, region);
+			else
+				engine.CallPLAY();
+		}
+		engine.Recorder().Dump(fname.c_str(), reason);
+	}
+	catch (std::exception &) {
+		// dumped by the engine
+	}
+	printf("    flight record in %s\n", fname.c_str());
+}
+
+int Make(const CSoundBank &bank, const char *dir, int ticks) {
+	if (mkdir(dir, 0777) && errno != EEXIST)
+		throw std::runtime_error {std::string {"Cannot create "} + dir};
+	for (int track = 0; track < TRACKS; ++track) {
+		const CFingerprint fp = Fingerprint(bank, track, 0, ticks);
+		const std::string fname = FileName(dir, track);
+		FILE *f = fopen(fname.c_str(), "wb");
+		if (!f)
+			throw std::runtime_error {"Cannot write " + fname};
+		fp.Save(f);
+		if (fclose(f))
+			throw std::runtime_error {"Cannot write " + fname};
+	}
+	printf("Wrote %d golden files of %d ticks to %s\n", TRACKS, ticks, dir);
+	return 0;
+}
+
+int Check(const CSoundBank &bank, const char *dir) {
+	const auto t0 = std::chrono::steady_clock::now();
+	int failed = 0;
+	for (int track = 0; track < TRACKS; ++track) {
+		const std::string fname = FileName(dir, track);
+		FILE *f = fopen(fname.c_str(), "rb");
+		if (!f)
+			throw std::runtime_error {"Cannot open " + fname};
+		CFingerprint golden;
+		try {
+			golden.Load(f);
+		}
+		catch (...) {
+			fclose(f);
+			throw;
+		}
+		fclose(f);
+		if (golden.bankCRC != bank.Checksum())
+			throw std::runtime_error {fname + " was made from a different sound bank"};
+
+		const CFingerprint actual = Fingerprint(bank, golden.track, golden.region,
+			golden.ticks, golden.stateInterval);
+		if (const CDivergence d = Compare(golden, actual)) {
+			++failed;
+			printf("Track %02X: ", track);
+			if (d.frame >= 0)
+				printf("writes differ at frame %ld (%s)", d.frame,
+					d.frame ? ("PLAY(" + std::to_string(d.frame - 1) + ")").c_str() : "INIT");
+			if (d.frame >= 0 && d.state >= 0)
+				printf(", ");
+			if (d.state >= 0)
+				printf("state differs by frame %ld", d.state);
+			putchar('\n');
+			if (d.frame >= 0)
+				ShowFrame(bank, golden.track, golden.region, d.frame);
+			DumpFlight(bank, golden.track, golden.region, d.frame >= 0 ? d.frame : d.state,
+				FileName(dir, track, "mm5f"), d.frame >= 0 ? "writes differ from the golden file" :
+				"state differs from the golden file");
+		}
+	}
+	const double t = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+	if (failed)
+		printf("%d of %d tracks differ (%.2f s)\n", failed, TRACKS, t);
+	else
+		printf("All %d tracks match the golden files (%.2f s)\n", TRACKS, t);
+	return failed ? 1 : 0;
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+	if (argc < 4) {
+		fprintf(stderr,
+			"usage: mm5golden make rom dir [ticks]\n"
+			"       mm5golden check rom dir\n");
+		return 1;
+	}
+	try {
+		const std::string mode = argv[1];
+		const CSoundBank bank {argv[2]};
+		if (mode == "make")
+			return Make(bank, argv[3], argc >= 5 ? atoi(argv[4]) : 10800);
+		if (mode == "check")
+			return Check(bank, argv[3]);
+		fprintf(stderr, "Unknown mode %s\n", argv[1]);
+	}
+	catch (std::exception &e) {
+		fprintf(stderr, "%s\n", e.what());
+	}
+	return 1;
+}
@@ -0,0 +1,258 @@
+#include "mm5index.h"
+#include "mm5fingerprint.h"
+#include "mm5tap.h"
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace MM5Sound {
+
+/*
+index layout, native byte order
+0	"MM5I"
+4	version, uint32
+8	sound bank CRC32
+12	track count, uint32
+16	record size, uint32
+20	ticks each track was followed for at most, uint32
+24	CTrackInfo records
+*/
+
+struct CCorpusIndex::CHeader {
+	char magic[4];
+	uint32_t version;
+	uint32_t bankCRC;
+	uint32_t count;
+	uint32_t recordSize;
+	uint32_t maxTicks;
+};
+
+namespace {
+	const uint32_t VERSION = 1u;
+
+	class CIndexEngine : public CPatternTap {
+	public:
+		using CPatternTap::CPatternTap;
+
+		CTrackInfo Run(uint8_t track, uint32_t maxTicks) {
+			info_ = CTrackInfo { };
+			info_.track = track;
+			std::fill(std::begin(info_.lowest), std::end(info_.lowest), 0xFF);
+			const uint8_t x = track << 1;
+			const uint16_t adr = chain(ReadCallback(SONG_TABLE + 2 + x), ReadCallback(SONG_TABLE + 3 + x));
+			if (!adr)
+				return info_;
+			const uint8_t head = ReadCallback(adr);
+			info_.kind = head ? CTrackInfo::SFX : CTrackInfo::MUSIC;
+			info_.priority = head & 0x7F;
+			info_.tempoMin = 0xFFFF;
+
+			std::unordered_map<uint64_t, uint32_t> seen;
+			try {
+				CallINIT(track, 0);
+				for (uint32_t t = 0; t < maxTicks; ++t) {
+					if (Ended()) {
+						info_.flags |= CTrackInfo::ENDS;
+						info_.duration = t;
+						break;
+					}
+					const auto it = seen.emplace(Key(), t);
+					if (!it.second) {
+						info_.flags |= CTrackInfo::LOOPS;
+						info_.loopStart = it.first->second;
+						info_.loopLength = t - it.first->second;
+						info_.duration = t;
+						break;
+					}
+					CallPLAY();
+					info_.duration = t + 1;
+					Sample();
+				}
+			}
+			catch (std::exception &) {
+				info_.flags |= CTrackInfo::ERROR;
+			}
+			if (info_.tempoMin > info_.tempoMax)
+				info_.tempoMin = info_.tempoMax = 0u;
+			for (int i = 0; i < 4; ++i)
+				if (!info_.notes[i])
+					info_.lowest[i] = 0u;
+			return info_;
+		}
+
+	private:
+		bool Ended() const {
+			if (info_.kind == CTrackInfo::SFX)
+				return !sfx_currentPtr;
+			return std::none_of(std::begin(mus_), std::end(mus_), [] (const CMusicTrack *x) { return x->patternAdr; });
+		}
+
+		// everything that decides what the streams do next, but not the
+		// envelopes, which may not have settled when the loop comes round
+		uint64_t Key() const {
+			CHash64 h;
+			for (const CMusicTrack *x : mus_) {
+				h.Add(x->patternAdr).Add(x->octaveFlag).Add(x->transpose).Add(x->noteWait).Add(x->sustainWait);
+				h.Add(x->loopCount, sizeof(x->loopCount));
+			}
+			h.Add(var_tickCounter).Add(var_tempo).Add(var_globalTrsp).Add(sfx_currentPtr);
+			h.Add(mem_ + 0xCE, 0x0A);
+			return h.Value();
+		}
+
+		void Sample() {
+			if (info_.kind == CTrackInfo::MUSIC) {
+				info_.tempoMin = std::min(info_.tempoMin, var_tempo);
+				info_.tempoMax = std::max(info_.tempoMax, var_tempo);
+				return;
+			}
+			// channel mask of the SFX header, bit n for register slot n
+			info_.channels |= mem_[0xCF] & 0x0F;
+			for (uint8_t id = 0; id < 4; ++id) {
+				const CSFXTrack *Chan = GetSFXTrack(id);
+				if ((mem_[0xCF] & (1 << (3 - id))) && Chan->envNumber)
+					Instrument(Chan->envNumber - 1);
+			}
+		}
+
+		void Instrument(uint8_t n) {
+			info_.instruments[n >> 3] |= 1 << (n & 0x07);
+		}
+
+		void Transpose(int x) {
+			info_.transposeMin = static_cast<int8_t>(std::min<int>(info_.transposeMin, x));
+			info_.transposeMax = static_cast<int8_t>(std::max<int>(info_.transposeMax, x));
+		}
+
+		// noting every command and note
+		void OnCommand(CMusicTrack *Chan, uint8_t cmd) override {
+			info_.commands |= 1u << cmd;
+			switch (cmd) {
+			case 0x08: Instrument(Chan->envNumber - 1); break;
+			case 0x0A: Transpose(static_cast<int8_t>(var_globalTrsp)); break;
+			case 0x0B: Transpose(static_cast<int8_t>(Chan->transpose)); break;
+			case 0x0E: case 0x0F: case 0x10: case 0x11:
+				info_.loopDepth = std::max<uint8_t>(info_.loopDepth, cmd - 0x0D); break;
+			case 0x17: run_[Chan->channelID ^ 0x03] = 0u; break;
+			}
+		}
+
+		void OnNote(CMusicTrack *Chan, uint8_t cmd, bool tied, uint8_t wait) override {
+			const uint8_t ch = Chan->channelID ^ 0x03;
+			const uint8_t length = Chan->noteWait - wait;
+			if (!(cmd & 0x1F)) {
+				run_[ch] = 0u;
+				return;
+			}
+			info_.channels |= 1 << ch;
+			// as mm5midi numbers them, but the noise keeps its period index
+			const uint8_t key = ch == 3 ? ((cmd & 0x1F) - 1) & 0x0F : 23 + Chan->note - (ch == 2 ? 12 : 0);
+			if (tied && run_[ch] && key == runKey_[ch])
+				run_[ch] += length;
+			else {
+				++info_.notes[ch];
+				run_[ch] = length;
+				runKey_[ch] = key;
+			}
+			info_.longest[ch] = static_cast<uint16_t>(std::min<uint32_t>(std::max<uint32_t>(info_.longest[ch], run_[ch]), 0xFFFF));
+			info_.lowest[ch] = std::min(info_.lowest[ch], key);
+			info_.highest[ch] = std::max(info_.highest[ch], key);
+		}
+
+		CTrackInfo info_;
+		uint32_t run_[4] = { };
+		uint8_t runKey_[4] = { };
+	};
+}
+
+std::vector<CTrackInfo> CCorpusIndex::Build(const CSoundBank &bank, unsigned threads, uint32_t maxTicks) {
+	std::vector<CTrackInfo> out(TRACKS);
+	std::atomic<int> next {0};
+	const auto worker = [&] {
+		for (int track; (track = next++) < TRACKS; )
+			out[track] = CIndexEngine {bank}.Run(static_cast<uint8_t>(track), maxTicks);
+	};
+	std::vector<std::thread> pool;
+	for (unsigned i = 1; i < threads; ++i)
+		pool.emplace_back(worker);
+	worker();
+	for (auto &x : pool)
+		x.join();
+	return out;
+}
+
+void CCorpusIndex::Save(const char *fname, uint32_t bankCRC, uint32_t maxTicks, const std::vector<CTrackInfo> &tracks) {
+	CHeader h;
+	memcpy(h.magic, "MM5I", 4);
+	h.version = VERSION;
+	h.bankCRC = bankCRC;
+	h.count = static_cast<uint32_t>(tracks.size());
+	h.recordSize = sizeof(CTrackInfo);
+	h.maxTicks = maxTicks;
+
+	const std::string tmp = fname + std::string {".tmp"};
+	FILE *f = fopen(tmp.c_str(), "wb");
+	if (!f)
+		throw std::runtime_error {"Cannot write " + tmp};
+	fwrite(&h, sizeof(h), 1, f);
+	fwrite(tracks.data(), sizeof(CTrackInfo), tracks.size(), f);
+	if (fclose(f) || rename(tmp.c_str(), fname))
+		throw std::runtime_error {std::string {"Cannot write "} + fname};
+}
+
+CCorpusIndex::CCorpusIndex(const char *fname) {
+	const int fd = open(fname, O_RDONLY);
+	if (fd < 0)
+		throw std::runtime_error {std::string {"Cannot open "} + fname};
+	struct stat st;
+	if (fstat(fd, &st) || static_cast<size_t>(st.st_size) < sizeof(CHeader)) {
+		close(fd);
+		throw std::runtime_error {std::string {"Not an index: "} + fname};
+	}
+	size_ = st.st_size;
+	map_ = mmap(nullptr, size_, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (map_ == MAP_FAILED) {
+		map_ = nullptr;
+		throw std::runtime_error {std::string {"Cannot map "} + fname};
+	}
+	const CHeader &h = *static_cast<const CHeader *>(map_);
+	if (memcmp(h.magic, "MM5I", 4) || h.version != VERSION || h.recordSize != sizeof(CTrackInfo) ||
+		size_ < sizeof(CHeader) + static_cast<size_t>(h.count) * sizeof(CTrackInfo)) {
+		munmap(map_, size_);
+		map_ = nullptr;
+		throw std::runtime_error {std::string {"Not an index or an older version: "} + fname};
+	}
+}
+
+CCorpusIndex::~CCorpusIndex() {
+	if (map_)
+		munmap(map_, size_);
+}
+
+uint32_t CCorpusIndex::BankCRC() const {
+	return static_cast<const CHeader *>(map_)->bankCRC;
+}
+
+uint32_t CCorpusIndex::MaxTicks() const {
+	return static_cast<const CHeader *>(map_)->maxTicks;
+}
+
+size_t CCorpusIndex::Size() const {
+	return static_cast<const CHeader *>(map_)->count;
+}
+
+const CTrackInfo *CCorpusIndex::begin() const {
+	return reinterpret_cast<const CTrackInfo *>(static_cast<const uint8_t *>(map_) + sizeof(CHeader));
+}
+
+} // namespace MM5Sound
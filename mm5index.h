@@ -0,0 +1,78 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+
+namespace MM5Sound {
+
+class CSoundBank;
+
+// what one track does, from a quick engine pass over its streams; channels
+// are indexed pulse 1, pulse 2, triangle, noise
+struct CTrackInfo {
+	enum kind_t : uint8_t {
+		NONE,
+		MUSIC,
+		SFX,
+	};
+	enum : uint8_t {
+		ERROR = 0x01,	// stopped on a driver error
+		LOOPS = 0x02,	// the driver state repeats
+		ENDS = 0x04,	// every stream halted
+	};
+
+	uint8_t track;
+	kind_t kind;
+	uint8_t priority;		// sound effects only
+	uint8_t flags;
+	uint8_t channels;		// bit n: channel n plays notes, or is claimed by the SFX
+	uint8_t loopDepth;		// nested loop levels used, 0 to 4
+	int8_t transposeMin;	// channel and global transpose
+	int8_t transposeMax;
+	uint32_t duration;		// ticks to the end or through one pass of the loop
+	uint32_t loopStart;		// ticks
+	uint32_t loopLength;
+	uint32_t commands;		// bit n: pattern command n was used
+	uint16_t tempoMin;
+	uint16_t tempoMax;
+	uint16_t notes[4];
+	uint16_t longest[4];	// longest note in driver ticks, ties joined
+	uint8_t lowest[4];		// MIDI keys as mm5midi writes them; noise period indices
+	uint8_t highest[4];
+	uint8_t instruments[32];	// bit n: envelope n was used
+
+	bool Uses(uint8_t instrument) const {
+		return instruments[instrument >> 3] & (1 << (instrument & 0x07));
+	}
+};
+
+// index of the whole corpus, one fixed-size record per track behind a small
+// header, mapped read-only for queries
+class CCorpusIndex {
+public:
+	static const int TRACKS = 76;
+
+	// every track for at most maxTicks, on as many threads
+	static std::vector<CTrackInfo> Build(const CSoundBank &bank, unsigned threads, uint32_t maxTicks);
+	static void Save(const char *fname, uint32_t bankCRC, uint32_t maxTicks, const std::vector<CTrackInfo> &tracks);
+
+	explicit CCorpusIndex(const char *fname);
+	~CCorpusIndex();
+	CCorpusIndex(const CCorpusIndex &) = delete;
+	CCorpusIndex &operator=(const CCorpusIndex &) = delete;
+
+	uint32_t BankCRC() const;
+	uint32_t MaxTicks() const;
+	size_t Size() const;
+	const CTrackInfo *begin() const;
+	const CTrackInfo *end() const { return begin() + Size(); }
+
+private:
+	struct CHeader;
+
+	void *map_ = nullptr;
+	size_t size_ = 0u;
+};
+
+} // namespace MM5Sound
@@ -0,0 +1,238 @@
+#include "mm5index.h"
+#include "mm5rom.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace MM5Sound;
+
+namespace {
+
+using clock = std::chrono::steady_clock;
+
+const char *const CHANNELS[] = {"pulse1", "pulse2", "triangle", "noise"};
+
+// pattern commands by name, as in the driver's dispatch table
+const char *const COMMANDS[] = {
+	"triplet", "tie", "dot", "15va", "flags", "tempo", "gate", "volume",
+	"envelope", "octave", "globaltrsp", "transpose", "detune", "portamento",
+	"loop1", "loop2", "loop3", "loop4", "break1", "break2", "break3", "break4",
+	"goto", "halt", "duty",
+};
+
+void Usage() {
+	fprintf(stderr,
+		"usage: mm5index build rom index [-j threads] [-t ticks]\n"
+		"       mm5index show index [track]\n"
+		"       mm5index query index [music|sfx] [instrument N] [uses COMMAND]\n"
+		"                [channel CHANNEL] [longest CHANNEL | sort duration]\n"
+		"  build follows every track on a few threads and records what it uses;\n"
+		"  queries read the mapped index only. Channels are pulse1, pulse2,\n"
+		"  triangle and noise; commands are named or numbered:\n"
+		"  ");
+	for (const char *x : COMMANDS)
+		fprintf(stderr, " %s", x);
+	fprintf(stderr, "\n");
+}
+
+int Channel(const char *str) {
+	for (int i = 0; i < 4; ++i)
+		if (!strcmp(str, CHANNELS[i]))
+			return i;
+	throw std::runtime_error {std::string {"Unknown channel: "} + str};
+}
+
+int Command(const char *str) {
+	for (size_t i = 0; i < sizeof(COMMANDS) / sizeof(*COMMANDS); ++i)
+		if (!strcmp(str, COMMANDS[i]))
+			return static_cast<int>(i);
+	char *end;
+	const long x = strtol(str, &end, 0);
+	if (*end || x < 0 || x >= 0x20)
+		throw std::runtime_error {std::string {"Unknown command: "} + str};
+	return static_cast<int>(x);
+}
+
+void PrintRow(const CTrackInfo &x) {
+	const char *const KINDS[] = {"-", "music", "sfx"};
+	printf("%02X %-5s", x.track, KINDS[x.kind]);
+	if (x.kind == CTrackInfo::NONE) {
+		printf("\n");
+		return;
+	}
+	if (x.flags & CTrackInfo::LOOPS)
+		printf(" %6u ticks, loops from %u", x.duration, x.loopStart);
+	else
+		printf(" %6u ticks%s", x.duration, x.flags & CTrackInfo::ENDS ? ", ends" : "");
+	if (x.flags & CTrackInfo::ERROR)
+		printf(", error");
+	printf(", channels");
+	for (int i = 0; i < 4; ++i)
+		if (x.channels & (1 << i))
+			printf(" %s", CHANNELS[i]);
+	printf("\n");
+}
+
+void PrintFull(const CTrackInfo &x) {
+	PrintRow(x);
+	if (x.kind == CTrackInfo::NONE)
+		return;
+	if (x.kind == CTrackInfo::SFX)
+		printf("   priority %u\n", x.priority);
+	else {
+		printf("   tempo %u to %u, transpose %+d to %+d, loops nested %u deep\n",
+			x.tempoMin, x.tempoMax, x.transposeMin, x.transposeMax, x.loopDepth);
+		for (int i = 0; i < 4; ++i)
+			if (x.notes[i])
+				printf("   %-8s %5u notes, keys %3u to %3u, longest %u ticks\n",
+					CHANNELS[i], x.notes[i], x.lowest[i], x.highest[i], x.longest[i]);
+		printf("   commands");
+		for (int i = 0; i < 0x20; ++i)
+			if (x.commands & (1u << i))
+				i < static_cast<int>(sizeof(COMMANDS) / sizeof(*COMMANDS)) ? printf(" %s", COMMANDS[i]) : printf(" %02X", i);
+		printf("\n");
+	}
+	printf("   instruments");
+	for (int i = 0; i < 0x100; ++i)
+		if (x.Uses(static_cast<uint8_t>(i)))
+			printf(" %02X", i);
+	printf("\n");
+}
+
+int Build(int argc, char **argv) {
+	if (argc < 4) {
+		Usage();
+		return 1;
+	}
+	unsigned threads = std::max(std::thread::hardware_concurrency(), 1u);
+	uint32_t ticks = 216000u;		// an hour
+	for (int i = 4; i < argc; ++i) {
+		if (!strcmp(argv[i], "-j") && i + 1 < argc)
+			threads = std::max(atoi(argv[++i]), 1);
+		else if (!strcmp(argv[i], "-t") && i + 1 < argc)
+			ticks = static_cast<uint32_t>(atol(argv[++i]));
+		else {
+			Usage();
+			return 1;
+		}
+	}
+
+	const CSoundBank bank {argv[2]};
+	const auto t0 = clock::now();
+	const auto tracks = CCorpusIndex::Build(bank, threads, ticks);
+	const double seconds = std::chrono::duration<double>(clock::now() - t0).count();
+	CCorpusIndex::Save(argv[3], bank.Checksum(), ticks, tracks);
+	fprintf(stderr, "%zu tracks in %.3f s on %u threads, %zu bytes\n",
+		tracks.size(), seconds, threads, tracks.size() * sizeof(CTrackInfo));
+	return 0;
+}
+
+int Show(int argc, char **argv) {
+	const CCorpusIndex index {argv[2]};
+	if (argc > 3) {
+		const long track = strtol(argv[3], nullptr, 0);
+		if (track < 0 || static_cast<size_t>(track) >= index.Size())
+			throw std::runtime_error {std::string {"No such track: "} + argv[3]};
+		PrintFull(index.begin()[track]);
+		return 0;
+	}
+	printf("bank %08X, tracks followed for %u ticks at most\n", index.BankCRC(), index.MaxTicks());
+	for (const CTrackInfo &x : index)
+		PrintRow(x);
+	return 0;
+}
+
+int Query(int argc, char **argv) {
+	const auto t0 = clock::now();
+	const CCorpusIndex index {argv[2]};
+
+	int kind = -1;
+	int instrument = -1;
+	uint32_t uses = 0u;
+	uint8_t channels = 0u;
+	int longest = -1;
+	bool byDuration = false;
+	for (int i = 3; i < argc; ++i) {
+		const bool hasValue = i + 1 < argc;
+		if (!strcmp(argv[i], "music"))
+			kind = CTrackInfo::MUSIC;
+		else if (!strcmp(argv[i], "sfx"))
+			kind = CTrackInfo::SFX;
+		else if (!strcmp(argv[i], "instrument") && hasValue)
+			instrument = static_cast<int>(strtol(argv[++i], nullptr, 0)) & 0xFF;
+		else if (!strcmp(argv[i], "uses") && hasValue)
+			uses |= 1u << Command(argv[++i]);
+		else if (!strcmp(argv[i], "channel") && hasValue)
+			channels |= 1 << Channel(argv[++i]);
+		else if (!strcmp(argv[i], "longest") && hasValue)
+			longest = Channel(argv[++i]);
+		else if (!strcmp(argv[i], "sort") && hasValue && !strcmp(argv[i + 1], "duration")) {
+			byDuration = true;
+			++i;
+		}
+		else {
+			Usage();
+			return 1;
+		}
+	}
+
+	std::vector<const CTrackInfo *> hits;
+	for (const CTrackInfo &x : index) {
+		if (x.kind == CTrackInfo::NONE || (kind >= 0 && x.kind != kind))
+			continue;
+		if ((instrument >= 0 && !x.Uses(static_cast<uint8_t>(instrument))) ||
+			(x.commands & uses) != uses || (x.channels & channels) != channels)
+			continue;
+		if (longest >= 0 && !x.notes[longest])
+			continue;
+		hits.push_back(&x);
+	}
+	if (longest >= 0)
+		std::stable_sort(hits.begin(), hits.end(), [longest] (const CTrackInfo *a, const CTrackInfo *b) {
+			return a->longest[longest] > b->longest[longest];
+		});
+	else if (byDuration)
+		std::stable_sort(hits.begin(), hits.end(), [] (const CTrackInfo *a, const CTrackInfo *b) {
+			return a->duration > b->duration;
+		});
+	const double ms = std::chrono::duration<double, std::milli>(clock::now() - t0).count();
+
+	for (const CTrackInfo *x : hits) {
+		if (longest >= 0)
+			printf("%02X longest %s note %u ticks, key %u to %u\n", x->track, CHANNELS[longest],
+				x->longest[longest], x->lowest[longest], x->highest[longest]);
+		else
+			PrintRow(*x);
+	}
+	fprintf(stderr, "%zu of %zu tracks in %.3f ms\n", hits.size(), index.Size(), ms);
+	return 0;
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+	if (argc < 3) {
+		Usage();
+		return 1;
+	}
+	try {
+		if (!strcmp(argv[1], "build"))
+			return Build(argc, argv);
+		if (!strcmp(argv[1], "show"))
+			return Show(argc, argv);
+		if (!strcmp(argv[1], "query"))
+			return Query(argc, argv);
+		Usage();
+		return 1;
+	}
+	catch (std::exception &e) {
+		fprintf(stderr, "%s\n", e.what());
+		return 1;
+	}
+}
@@ -0,0 +1,141 @@
+#include "mm5log.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <unistd.h>
+
+namespace MM5Sound {
+
+const char CLogWriter::HEX_TABLE[] =
+	"000102030405060708090A0B0C0D0E0F101112131415161718191A1B1C1D1E1F"
+	"202122232425262728292A2B2C2D2E2F303132333435363738393A3B3C3D3E3F"
+	"404142434445464748494A4B4C4D4E4F505152535455565758595A5B5C5D5E5F"
+	"606162636465666768696A6B6C6D6E6F707172737475767778797A7B7C7D7E7F"
+	"808182838485868788898A8B8C8D8E8F909192939495969798999A9B9C9D9E9F"
+	"A0A1A2A3A4A5A6A7A8A9AAABACADAEAFB0B1B2B3B4B5B6B7B8B9BABBBCBDBEBF"
+	"C0C1C2C3C4C5C6C7C8C9CACBCCCDCECFD0D1D2D3D4D5D6D7D8D9DADBDCDDDEDF"
+	"E0E1E2E3E4E5E6E7E8E9EAEBECEDEEEFF0F1F2F3F4F5F6F7F8F9FAFBFCFDFEFF";
+
+CLogWriter::CLogWriter(int fd, bool async, size_t bufSize) :
+	fd_(fd), size_(std::max(bufSize, size_t {64u}))
+{
+	buf_[0].reset(new char[size_]);
+	if (async) {
+		buf_[1].reset(new char[size_]);
+		thread_ = std::thread {[this] { Worker(); }};
+	}
+	pos_ = buf_[0].get();
+	end_ = pos_ + size_;
+}
+
+CLogWriter::~CLogWriter() {
+	try {
+		Flush();
+	}
+	catch (...) {
+	}
+	if (thread_.joinable()) {
+		{
+			std::lock_guard<std::mutex> lk {lock_};
+			quit_ = true;
+		}
+		cv_.notify_all();
+		thread_.join();
+	}
+}
+
+void CLogWriter::Init(uint8_t track, uint8_t region) {
+	if (pos_ + 16 > end_)
+		Swap();
+	char *p = pos_;
+	*p++ = 'I'; *p++ = 'N'; *p++ = 'I'; *p++ = 'T'; *p++ = '(';
+	p = Hex(p, track);
+	*p++ = ',';
+	p = Hex(p, region);
+	*p++ = ')'; *p++ = '\n';
+	pos_ = p;
+}
+
+void CLogWriter::Play(int tick) {
+	if (pos_ + 24 > end_)
+		Swap();
+	char digits[12];
+	char *d = std::end(digits);
+	unsigned x = tick < 0 ? 0u - static_cast<unsigned>(tick) : static_cast<unsigned>(tick);
+	do
+		*--d = '0' + x % 10u;
+	while (x /= 10u);
+	char *p = pos_;
+	*p++ = 'P'; *p++ = 'L'; *p++ = 'A'; *p++ = 'Y'; *p++ = '(';
+	if (tick < 0)
+		*p++ = '-';
+	p = std::copy(d, std::end(digits), p);
+	*p++ = ')'; *p++ = '\n';
+	pos_ = p;
+}
+
+void CLogWriter::Flush() {
+	Swap();
+	if (thread_.joinable())
+		Wait();
+	if (error_)
+		throw std::runtime_error {std::string {"Cannot write log: "} + strerror(error_)};
+}
+
+void CLogWriter::Swap() {
+	char *buf = buf_[cur_].get();
+	const size_t size = pos_ - buf;
+	done_ += size;
+	if (!thread_.joinable())
+		WriteOut(buf, size);
+	else if (size) {
+		Wait();
+		{
+			std::lock_guard<std::mutex> lk {lock_};
+			pending_ = size;
+			cur_ ^= 1;
+		}
+		cv_.notify_all();
+		buf = buf_[cur_].get();
+	}
+	pos_ = buf;
+	end_ = buf + size_;
+}
+
+void CLogWriter::Wait() {
+	std::unique_lock<std::mutex> lk {lock_};
+	cv_.wait(lk, [this] { return !pending_; });
+}
+
+void CLogWriter::WriteOut(const char *buf, size_t size) {
+	while (size && !error_) {
+		const ssize_t n = ::write(fd_, buf, size);
+		if (n < 0) {
+			if (errno != EINTR)
+				error_ = errno;
+			continue;
+		}
+		buf += n;
+		size -= n;
+	}
+}
+
+void CLogWriter::Worker() {
+	std::unique_lock<std::mutex> lk {lock_};
+	while (true) {
+		cv_.wait(lk, [this] { return pending_ || quit_; });
+		if (!pending_)
+			return;
+		const char *buf = buf_[cur_ ^ 1].get();
+		const size_t size = pending_;
+		lk.unlock();
+		WriteOut(buf, size);
+		lk.lock();
+		pending_ = 0u;
+		cv_.notify_all();
+	}
+}
+
+} // namespace MM5Sound
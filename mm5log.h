@@ -0,0 +1,75 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+namespace MM5Sound {
+
+// NSFPlay-compatible register log; lines are formatted into a large buffer
+// and handed to write(2) in big blocks, and with async set a background thread
+// writes out one buffer while the other one fills
+class CLogWriter {
+public:
+	explicit CLogWriter(int fd, bool async = false, size_t bufSize = 0x40000u);
+	~CLogWriter();
+	CLogWriter(const CLogWriter &) = delete;
+	CLogWriter &operator=(const CLogWriter &) = delete;
+
+	// INIT(tt,rr)
+	void Init(uint8_t track, uint8_t region);
+	// PLAY(n)
+	void Play(int tick);
+	// WRITE(aaaa,vv)
+	void Write(uint16_t adr, uint8_t value) {
+		if (pos_ + 16 > end_)
+			Swap();
+		char *p = pos_;
+		*p++ = 'W'; *p++ = 'R'; *p++ = 'I'; *p++ = 'T'; *p++ = 'E'; *p++ = '(';
+		p = Hex(p, adr >> 8);
+		p = Hex(p, adr & 0xFF);
+		*p++ = ',';
+		p = Hex(p, value);
+		*p++ = ')'; *p++ = '\n';
+		pos_ = p;
+	}
+
+	// writes out everything so far; throws if any earlier write failed
+	void Flush();
+	// bytes formatted so far
+	uint64_t Bytes() const { return done_ + (pos_ - buf_[cur_].get()); }
+
+private:
+	static char *Hex(char *p, uint8_t x) {
+		const char *h = HEX_TABLE + x * 2;
+		*p++ = h[0];
+		*p++ = h[1];
+		return p;
+	}
+	static const char HEX_TABLE[];
+
+	void Swap();
+	void Wait();
+	void WriteOut(const char *buf, size_t size);
+	void Worker();
+
+	const int fd_;
+	const size_t size_;
+	std::unique_ptr<char[]> buf_[2];
+	int cur_ = 0;
+	char *pos_;
+	char *end_;
+	uint64_t done_ = 0u;
+
+	std::thread thread_;
+	std::mutex lock_;
+	std::condition_variable cv_;
+	size_t pending_ = 0u;		// bytes of the other buffer not yet written
+	bool quit_ = false;
+	int error_ = 0;
+};
+
+} // namespace MM5Sound
@@ -0,0 +1,131 @@
+#include "mm5sound.h"
+#include "mm5rom.h"
+#include "mm5log.h"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <stdexcept>
+#include <vector>
+
+using namespace MM5Sound;
+
+namespace {
+
+const int TRACKS = 76;
+
+// the printf path mm5test used before CLogWriter
+class CPrintfLog : public CEngine {
+public:
+	CPrintfLog(const CSoundBank &bank, FILE *f) : CEngine(bank), f_(f) { }
+
+	void Play(int track, int ticks) {
+		fprintf(f_, "INIT(%02X,%02X)\n", track, 0);
+		CallINIT(track, 0);
+		for (int t = 0; t < ticks; ++t) {
+			fprintf(f_, "PLAY(%d)\n", t);
+			CallPLAY();
+		}
+	}
+
+private:
+	void WriteCallback(uint16_t adr, uint8_t value) override {
+		fprintf(f_, "WRITE(%04X,%02X)\n", adr, value);
+	}
+
+	FILE *f_;
+};
+
+class CWriterLog : public CEngine {
+public:
+	CWriterLog(const CSoundBank &bank, CLogWriter &log) : CEngine(bank), log_(log) { }
+
+	void Play(int track, int ticks) {
+		log_.Init(track, 0);
+		CallINIT(track, 0);
+		for (int t = 0; t < ticks; ++t) {
+			log_.Play(t);
+			CallPLAY();
+		}
+	}
+
+private:
+	void WriteCallback(uint16_t adr, uint8_t value) override {
+		log_.Write(adr, value);
+	}
+
+	CLogWriter &log_;
+};
+
+// tracks that stop on a driver error still count, as in verify.lua
+template <class F>
+void Guard(F f) {
+	try {
+		f();
+	}
+	catch (std::exception &) {
+	}
+}
+
+std::vector<char> Contents(FILE *f) {
+	std::vector<char> buf(static_cast<size_t>(ftell(f)));
+	rewind(f);
+	if (fread(buf.data(), 1, buf.size(), f) != buf.size())
+		throw std::runtime_error {"Cannot read back log"};
+	return buf;
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+	if (argc < 2) {
+		fprintf(stderr, "usage: mm5logbench rom [ticks]\n");
+		return 1;
+	}
+	const int ticks = argc >= 3 ? atoi(argv[2]) : 10800;
+
+	try {
+		const CSoundBank bank {argv[1]};
+		std::vector<char> ref;
+		double refTime = 0.;
+
+		printf("%-8s %10s %10s %8s\n", "writer", "time (s)", "MB/s", "speedup");
+		for (int mode = 0; mode < 3; ++mode) {
+			const char *name[] = {"printf", "sync", "async"};
+			FILE *f = tmpfile();
+			if (!f)
+				throw std::runtime_error {"Cannot create temporary file"};
+
+			const auto t0 = std::chrono::steady_clock::now();
+			if (!mode) {
+				for (int track = 0; track < TRACKS; ++track)
+					Guard([&] { CPrintfLog {bank, f}.Play(track, ticks); });
+				fflush(f);
+			}
+			else {
+				CLogWriter log {fileno(f), mode == 2};
+				for (int track = 0; track < TRACKS; ++track)
+					Guard([&] { CWriterLog {bank, log}.Play(track, ticks); });
+				log.Flush();
+			}
+			const double t = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+
+			fseek(f, 0, SEEK_END);
+			const auto out = Contents(f);
+			fclose(f);
+			if (!mode) {
+				ref = out;
+				refTime = t;
+			}
+			printf("%-8s %10.4f %10.1f %8.2f%s\n", name[mode], t, out.size() / t / 1e6, refTime / t,
+				out == ref ? "" : "  MISMATCH");
+			if (out != ref)
+				return 1;
+		}
+		printf("%d tracks, %d ticks each, %zu bytes of log\n", TRACKS, ticks, ref.size());
+	}
+	catch (std::exception &e) {
+		fprintf(stderr, "%s\n", e.what());
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,279 @@
+#include "mm5memo.h"
+#include <algorithm>
+#include <cstring>
+
+namespace MM5Sound {
+
+namespace {
+	// by 8-byte words, the key is hashed on every miss
+	uint64_t Hash(const uint8_t *key, size_t size) {
+		uint64_t h = 0x9E3779B97F4A7C15ull;
+		for (size_t i = 0; i < size; i += 8u) {
+			uint64_t w;
+			memcpy(&w, key + i, 8u);
+			h = (h ^ w) * 0xFF51AFD7ED558CCDull;
+			h ^= h >> 32;
+		}
+		return h;
+	}
+
+	template <class T>
+	uint8_t *Put(uint8_t *p, const T &x) {
+		memcpy(p, &x, sizeof(x));
+		return p + sizeof(x);
+	}
+
+	template <class T>
+	const uint8_t *Get(const uint8_t *p, T &x) {
+		memcpy(&x, p, sizeof(x));
+		return p + sizeof(x);
+	}
+}
+
+CMemoEngine::CMemoEngine(const CSoundBank &bank, size_t budget) :
+	CEngine(bank), capacity_(std::max<size_t>(budget / (sizeof(CTick) + 2u * sizeof(uint32_t)), 2u))
+{
+	size_t size = 4u;
+	while (size < capacity_ * 2u)
+		size <<= 1;
+	table_.assign(size, uint32_t {NONE});
+	ticks_.reserve(capacity_);
+	capture_.reserve(0x100);
+}
+
+void CMemoEngine::CallINIT(uint8_t track, uint8_t region) {
+	cur_ = NONE;
+	streak_ = 0u;
+	live_ = 0u;
+	rest_ = MIN_REST;
+	CEngine::CallINIT(track, region);
+}
+
+void CMemoEngine::LoadState(const CEngineState &state) {
+	cur_ = NONE;
+	CEngine::LoadState(state);
+}
+
+void CMemoEngine::CallPLAY() {
+	// cur_ is only set while the state is its key, after a cached or stored
+	// tick, so following a link needs no lookup
+	if (cur_ != NONE && Follow())
+		return;
+
+	// a stretch that does not repeat costs more memoized than live, so after
+	// MAX_STREAK misses the driver plays live for a while, looking the state
+	// up every PROBE_TICKS ticks to find a loop coming round to stored ticks;
+	// the live stretches double up to MAX_REST as long as nothing hits
+	if (live_ && --live_ % PROBE_TICKS) {
+		++stats_.misses;
+		CEngine::CallPLAY();
+		return;
+	}
+
+	uint8_t key[KEY_SIZE];
+	Pack(key);
+	uint64_t hash;
+	if (cur_ != NONE)
+		hash = ticks_[cur_].hash;	// stored, but not run or its successor gone
+	else {
+		hash = Hash(key, KEY_SIZE);
+		cur_ = Find(key, hash);
+		if (cur_ != NONE && Follow()) {
+			live_ = 0u;
+			rest_ = MIN_REST;
+			return;
+		}
+	}
+
+	++stats_.misses;
+	if (live_ || ++streak_ > MAX_STREAK) {
+		if (!live_) {
+			live_ = rest_;
+			rest_ = rest_ < MAX_REST / 2u ? rest_ * 2u : MAX_REST;
+			streak_ = 0u;
+		}
+		cur_ = NONE;
+		CEngine::CallPLAY();
+		return;
+	}
+	capture_.clear();
+	capturing_ = true;
+	try {
+		CEngine::CallPLAY();
+	}
+	catch (...) {
+		capturing_ = false;
+		cur_ = NONE;
+		throw;
+	}
+	capturing_ = false;
+	if (capture_.size() > MAX_WRITES) {
+		++stats_.uncacheable;
+		cur_ = NONE;
+		return;
+	}
+
+	if (cur_ == NONE)
+		cur_ = Insert(key, hash, NONE);
+	const uint32_t pre = cur_;
+	uint8_t post[KEY_SIZE];
+	Pack(post);
+	const uint64_t postHash = Hash(post, KEY_SIZE);
+	uint32_t next = Find(post, postHash);
+	if (next == NONE)
+		next = Insert(post, postHash, pre);
+
+	CTick &t = ticks_[pre];
+	t.count = static_cast<uint8_t>(capture_.size());
+	std::copy(capture_.begin(), capture_.end(), t.writes);
+	t.next = next;
+	t.nextGen = ticks_[next].gen;
+	t.used = true;
+	cur_ = next;
+}
+
+bool CMemoEngine::Follow() {
+	CTick &t = ticks_[cur_];
+	if (t.count == PENDING || t.next == NONE || ticks_[t.next].gen != t.nextGen)
+		return false;
+	t.used = true;
+	streak_ = 0u;
+	++stats_.hits;
+	for (uint8_t i = 0; i < t.count; ++i)
+		Output(0x4000 + (t.writes[i] >> 8), t.writes[i] & 0xFF);
+	cur_ = t.next;
+	Unpack(ticks_[cur_].key);
+	return true;
+}
+
+CMemoStats CMemoEngine::Stats() const {
+	CMemoStats s = stats_;
+	s.entries = static_cast<uint32_t>(ticks_.size());
+	s.bytes = ticks_.capacity() * sizeof(CTick) + table_.size() * sizeof(uint32_t) + capture_.capacity() * sizeof(uint16_t);
+	return s;
+}
+
+void CMemoEngine::WriteCallback(uint16_t adr, uint8_t value) {
+	if (capturing_)
+		capture_.push_back(((adr - 0x4000) << 8) | value);
+	Output(adr, value);
+}
+
+void CMemoEngine::Pack(uint8_t *key) const {
+	// the driver RAM, then everything kept outside it
+	memcpy(key, mem_ + 0xC0, 0x20);
+	memcpy(key + 0x20, mem_ + 0x700, 0x50);
+	memcpy(key + 0x70, mem_ + 0x77C, 0x04);
+	uint8_t *p = key + 0x74;
+	p = Put(p, A_);
+	p = Put(p, X_);
+	p = Put(p, Y_);
+	p = Put(p, var_envelopePtr);
+	p = Put(p, var_tickElapsed);
+	p = Put(p, var_tickCounter);
+	p = Put(p, var_tempo);
+	p = Put(p, var_globalTrsp);
+	p = Put(p, sfx_currentPtr);
+	for (const CMusicTrack *Chan : mus_) {
+		p = Put(p, Chan->patternAdr);
+		p = Put(p, Chan->octaveFlag);
+		p = Put(p, Chan->transpose);
+		p = Put(p, Chan->noteWait);
+		p = Put(p, Chan->gateTime);
+		p = Put(p, Chan->sustainWait);
+		p = Put(p, Chan->loopCount);
+	}
+	memset(p, 0, key + KEY_SIZE - p);
+}
+
+void CMemoEngine::Unpack(const uint8_t *key) {
+	memcpy(mem_ + 0xC0, key, 0x20);
+	memcpy(mem_ + 0x700, key + 0x20, 0x50);
+	memcpy(mem_ + 0x77C, key + 0x70, 0x04);
+	const uint8_t *p = key + 0x74;
+	p = Get(p, A_);
+	p = Get(p, X_);
+	p = Get(p, Y_);
+	p = Get(p, var_envelopePtr);
+	p = Get(p, var_tickElapsed);
+	p = Get(p, var_tickCounter);
+	p = Get(p, var_tempo);
+	p = Get(p, var_globalTrsp);
+	p = Get(p, sfx_currentPtr);
+	for (CMusicTrack *Chan : mus_) {
+		p = Get(p, Chan->patternAdr);
+		p = Get(p, Chan->octaveFlag);
+		p = Get(p, Chan->transpose);
+		p = Get(p, Chan->noteWait);
+		p = Get(p, Chan->gateTime);
+		p = Get(p, Chan->sustainWait);
+		p = Get(p, Chan->loopCount);
+	}
+}
+
+uint32_t CMemoEngine::Find(const uint8_t *key, uint64_t hash) const {
+	const size_t mask = table_.size() - 1u;
+	for (size_t p = hash & mask; table_[p] != NONE; p = (p + 1u) & mask) {
+		const CTick &t = ticks_[table_[p]];
+		if (t.hash == hash && !memcmp(t.key, key, KEY_SIZE))
+			return table_[p];
+	}
+	return NONE;
+}
+
+void CMemoEngine::Unlink(uint32_t i) {
+	// linear probing, so the entries after it that would have landed at or
+	// before it move back
+	const size_t mask = table_.size() - 1u;
+	size_t p = ticks_[i].hash & mask;
+	while (table_[p] != i)
+		p = (p + 1u) & mask;
+	for (size_t j = (p + 1u) & mask; table_[j] != NONE; j = (j + 1u) & mask) {
+		const size_t k = ticks_[table_[j]].hash & mask;
+		if (p <= j ? (p < k && k <= j) : (p < k || k <= j))
+			continue;
+		table_[p] = table_[j];
+		p = j;
+	}
+	table_[p] = NONE;
+}
+
+uint32_t CMemoEngine::Insert(const uint8_t *key, uint64_t hash, uint32_t keep) {
+	uint32_t i;
+	if (ticks_.size() < capacity_) {
+		i = static_cast<uint32_t>(ticks_.size());
+		ticks_.emplace_back();
+		ticks_[i].gen = 0u;
+	}
+	else {
+		while (true) {
+			CTick &t = ticks_[hand_];
+			if (hand_ != keep && !t.used)
+				break;
+			t.used = false;
+			if (++hand_ == ticks_.size())
+				hand_ = 0u;
+		}
+		i = hand_;
+		if (++hand_ == ticks_.size())
+			hand_ = 0u;
+		Unlink(i);
+		++ticks_[i].gen;
+		++stats_.evictions;
+	}
+
+	CTick &t = ticks_[i];
+	memcpy(t.key, key, KEY_SIZE);
+	t.hash = hash;
+	t.count = PENDING;
+	t.used = false;
+	t.next = NONE;
+	const size_t mask = table_.size() - 1u;
+	size_t p = hash & mask;
+	while (table_[p] != NONE)
+		p = (p + 1u) & mask;
+	table_[p] = i;
+	return i;
+}
+
+} // namespace MM5Sound
@@ -0,0 +1,92 @@
+#pragma once
+
+#include "mm5sound.h"
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace MM5Sound {
+
+struct CMemoStats {
+	uint64_t hits = 0u;
+	uint64_t misses = 0u;
+	uint64_t evictions = 0u;
+	uint64_t uncacheable = 0u;	// ticks with too many writes to keep
+	uint32_t entries = 0u;
+	size_t bytes = 0u;			// memory held by the cache
+};
+
+// engine that remembers the writes of every tick by the driver state before
+// it, and where that tick led; a tick whose state and successor are known
+// replays the writes and loads the successor instead of running the driver,
+// so a looping song settles into following links from one tick to the next
+//
+// the state is the driver RAM ($C0 - $DF, $0700 - $074F, $077C - $077F),
+// registers, variables and music channels, compared in full before every
+// cached tick; the cache holds as many ticks as fit the budget and evicts
+// the ones least recently used, roughly, on the clock algorithm; a run of
+// misses sends it back to live playback for a while, see CallPLAY
+class CMemoEngine : public CEngine {
+public:
+	explicit CMemoEngine(const CSoundBank &bank, size_t budget = 16u << 20);
+
+	void CallINIT(uint8_t track, uint8_t region) override;
+	void CallPLAY() override;
+	// forgets where it was, the state need not be a stored one
+	void LoadState(const CEngineState &state);
+
+	CMemoStats Stats() const;
+
+protected:
+	// register writes, live or cached
+	virtual void Output(uint16_t adr, uint8_t value) { }
+
+private:
+	// $C0 - $DF, $0700 - $074F, $077C - $077F, the rest, padded for Hash
+	static const size_t KEY_SIZE = (0x74u + 12u + 4u * 11u + 7u) & ~7u;
+	static const size_t MAX_WRITES = 24u;
+	static const uint32_t NONE = 0xFFFFFFFFu;
+	static const uint8_t PENDING = 0xFFu;
+	// misses before playing live, how often to look for a loop meanwhile,
+	// and the bounds of a live stretch, in ticks
+	static const uint32_t MAX_STREAK = 256u;
+	static const uint32_t PROBE_TICKS = 32u;
+	static const uint32_t MIN_REST = 1024u;
+	static const uint32_t MAX_REST = 65536u;
+
+	struct CTick {
+		uint8_t key[KEY_SIZE];
+		uint8_t count;		// writes, or PENDING before the tick has run
+		bool used;			// second chance for the clock
+		uint16_t writes[MAX_WRITES];
+		uint32_t next;		// the tick that follows
+		uint32_t nextGen;
+		uint32_t gen;		// bumped when the slot is reused
+		uint64_t hash;
+	};
+
+	void WriteCallback(uint16_t adr, uint8_t value) final;
+
+	// replays cur_ and moves on to the tick after it, if both are known
+	bool Follow();
+	void Pack(uint8_t *key) const;
+	void Unpack(const uint8_t *key);
+	uint32_t Find(const uint8_t *key, uint64_t hash) const;
+	void Unlink(uint32_t i);
+	// takes a free slot or evicts one, never `keep`
+	uint32_t Insert(const uint8_t *key, uint64_t hash, uint32_t keep);
+
+	const size_t capacity_;
+	std::vector<CTick> ticks_;
+	std::vector<uint32_t> table_;	// open addressing, by hash
+	uint32_t hand_ = 0u;
+	uint32_t cur_ = NONE;		// the tick whose key is the state, if any
+	std::vector<uint16_t> capture_;
+	bool capturing_ = false;
+	uint32_t streak_ = 0u;		// misses since the last hit or INIT call
+	uint32_t live_ = 0u;		// ticks left to play live
+	uint32_t rest_ = MIN_REST;	// the next live stretch
+	CMemoStats stats_;
+};
+
+} // namespace MM5Sound
@@ -0,0 +1,152 @@
+#include "mm5memo.h"
+#include "mm5session.h"
+#include "mm5trace.h"
+#include "mm5rom.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <stdexcept>
+#include <vector>
+
+using namespace MM5Sound;
+
+namespace {
+
+const int TRACKS = 76;
+
+class CTracedMemo : public CMemoEngine {
+public:
+	CTracedMemo(const CSoundBank &bank, CTrace *trace, size_t budget) : CMemoEngine(bank, budget), trace_(trace) { }
+
+private:
+	void Output(uint16_t adr, uint8_t value) override {
+		if (trace_)
+			trace_->Write(adr, value);
+	}
+
+	CTrace *trace_;
+};
+
+// one frame for the INIT calls before the first PLAY, then one per tick;
+// tracks that stop on a driver error stop the same way on both engines
+void Play(ISongPlayer &player, CTrace &trace, const CSession &s) {
+	trace.Clear(-1);
+	trace.NewFrame();
+	auto next = s.events.begin();
+	try {
+		for (uint32_t t = 0; t < s.ticks; ++t) {
+			for (; next != s.events.end() && next->tick == t; ++next)
+				player.CallINIT(next->track, next->region);
+			trace.NewFrame();
+			player.CallPLAY();
+		}
+	}
+	catch (std::exception &) {
+		trace.NewFrame();
+	}
+}
+
+// every track alone and a few game sessions, on one memo engine so that
+// the cache carries over from run to run as it would in a player
+int Check(const CSoundBank &bank, size_t budget, uint32_t ticks, unsigned sessions) {
+	std::vector<CSession> work;
+	for (int t = 0; t < TRACKS; ++t) {
+		CSession s;
+		s.ticks = ticks;
+		s.events.push_back({0u, static_cast<uint8_t>(t), 0u});
+		work.push_back(s);
+	}
+	CSessionConfig cfg;
+	cfg.ticks = ticks;
+	for (unsigned i = 0; i < sessions; ++i)
+		work.push_back(GenerateSession(bank, cfg, i + 1u));
+
+	CTrace out;
+	CTracedMemo memo {bank, &out, budget};
+	CEngineState fresh;
+	memo.SaveState(fresh);
+	int failed = 0;
+	for (size_t i = 0; i < work.size(); ++i) {
+		CTrace ref;
+		CTraceEngine engine {bank, &ref};
+		memo.LoadState(fresh);
+		Play(engine, ref, work[i]);
+		Play(memo, out, work[i]);
+		if (!(ref == out)) {
+			if (i < TRACKS)
+				printf("Track %02zX: writes differ from CEngine\n", i);
+			else
+				printf("Session %zu: writes differ from CEngine\n", i - TRACKS + 1);
+			++failed;
+		}
+	}
+	const auto s = memo.Stats();
+	printf("%zu runs with a %zu KB budget: %.1f%% hits, %llu evictions, %llu uncacheable, %u ticks cached\n",
+		work.size(), budget >> 10, 100. * s.hits / std::max<uint64_t>(s.hits + s.misses, 1u),
+		static_cast<unsigned long long>(s.evictions), static_cast<unsigned long long>(s.uncacheable), s.entries);
+	return failed;
+}
+
+template <class T>
+double Time(T &engine, uint8_t track, uint32_t ticks) {
+	const auto t0 = std::chrono::steady_clock::now();
+	engine.CallINIT(track, 0);
+	try {
+		for (uint32_t t = 0; t < ticks; ++t)
+			engine.CallPLAY();
+	}
+	catch (std::exception &) {
+	}
+	return std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+	if (argc < 2) {
+		fprintf(stderr, "usage: %s rom [ticks] [sessions] [budget KB]\n", argv[0]);
+		return 1;
+	}
+	try {
+		const CSoundBank bank {argv[1]};
+		const uint32_t ticks = argc >= 3 ? atoi(argv[2]) : 20000;
+		const unsigned sessions = argc >= 4 ? atoi(argv[3]) : 16;
+		const size_t budget = (argc >= 5 ? atoi(argv[4]) : 65536) << 10;
+
+		// the given budget, then one small enough to keep evicting
+		int failed = Check(bank, budget, ticks, sessions);
+		failed += Check(bank, 64u << 10, ticks, sessions);
+		if (failed) {
+			printf("%d runs failed.\n", failed);
+			return 1;
+		}
+		printf("All runs match CEngine.\n");
+
+		// each sounding track on its own, from a cold cache and again
+		const uint32_t n = ticks * 10u;
+		for (int t = 0; t < TRACKS; ++t) {
+			CTrace probe;
+			probe.NewFrame();
+			CTraceEngine engine {bank, &probe};
+			Time(engine, t, 60u);
+			if (!probe.Writes())
+				continue;
+			engine.SetTrace(nullptr);
+			CTracedMemo memo {bank, nullptr, budget};
+			const double live = Time(engine, t, n);
+			const double cold = Time(memo, t, n);
+			const double warm = Time(memo, t, n);
+			const auto s = memo.Stats();
+			printf("Track %02X, %u ticks: live %.0f ns, memoized %.0f ns cold, %.0f ns warm per tick; "
+				"%.1f%% hits, %u ticks cached in %zu KB\n",
+				t, n, live / n * 1e9, cold / n * 1e9, warm / n * 1e9,
+				100. * s.hits / std::max<uint64_t>(s.hits + s.misses, 1u), s.entries, s.bytes >> 10);
+		}
+		return 0;
+	}
+	catch (std::exception &e) {
+		fprintf(stderr, "%s\n", e.what());
+		return 1;
+	}
+}
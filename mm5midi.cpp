@@ -0,0 +1,231 @@
+#include "mm5midi.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <initializer_list>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <utility>
+
+namespace MM5Sound {
+
+namespace {
+	const double CPU_CLOCK = 1789773.;
+	const double FRAME_RATE = CPU_CLOCK / 29780.;
+	const uint32_t NEVER = std::numeric_limits<uint32_t>::max();
+
+	class CTrackWriter {
+	public:
+		void Delta(uint32_t time) {
+			uint32_t d = time - last_;
+			last_ = time;
+			uint8_t buf[5];
+			int n = 0;
+			do
+				buf[n++] = d & 0x7F;
+			while (d >>= 7);
+			while (n--)
+				data_.push_back(buf[n] | (n ? 0x80 : 0x00));
+		}
+		void Bytes(std::initializer_list<uint8_t> x) {
+			data_.insert(data_.end(), x);
+		}
+		void Meta(uint32_t time, uint8_t type, const std::string &text) {
+			Delta(time);
+			Bytes({0xFF, type, static_cast<uint8_t>(text.size())});
+			data_.insert(data_.end(), text.begin(), text.end());
+		}
+		void Save(FILE *f) {
+			Meta(last_, 0x2F, "");
+			fputs("MTrk", f);
+			for (int i = 3; i >= 0; --i)
+				fputc((data_.size() >> (i * 8)) & 0xFF, f);
+			fwrite(data_.data(), 1, data_.size(), f);
+		}
+
+	private:
+		std::vector<uint8_t> data_;
+		uint32_t last_ = 0u;
+	};
+}
+
+std::vector<CNoteEvent> CNoteTap::Run(uint8_t track, uint8_t region, int ticks) {
+	events_.clear();
+	for (auto &x : voice_)
+		x = CVoice { };
+	now_ = 0u;
+
+	CallINIT(track, region);
+	if (var_tempo)
+		Add(0u, CNoteEvent::TEMPO, 0u, 0u, var_tempo);
+	tempo_ = var_tempo;
+	for (uint8_t id = 0x28; id < 0x2C; ++id)
+		voice_[Slot(GetMusicTrack(id)->channelID)].env = GetMusicTrack(id)->envNumber;
+	for (int t = 0; t < ticks; ++t) {
+		const bool paused = mem_[0xC0] & 0x01;
+		CallPLAY();
+		if (!paused)
+			now_ += var_tickElapsed;
+		MeasureBends();
+	}
+	for (uint8_t ch = 0; ch < 4; ++ch)
+		Release(ch, now_);
+
+	std::stable_sort(events_.begin(), events_.end(), [] (const CNoteEvent &a, const CNoteEvent &b) {
+		return a.time < b.time;
+	});
+	return std::move(events_);
+}
+
+void CNoteTap::OnCommand(CMusicTrack *Chan, uint8_t cmd) {
+	const uint8_t ch = Slot(Chan->channelID);
+	// a note that was due part way through the frame has a negative wait
+	const uint32_t when = now_ + var_tickElapsed + static_cast<int8_t>(Chan->noteWait);
+	CVoice &v = voice_[ch];
+	if (cmd == 0x05 && var_tempo != tempo_)
+		Add(when, CNoteEvent::TEMPO, ch, 0u, var_tempo);
+	else if (cmd == 0x08 && Chan->envNumber != v.env)
+		Add(when, CNoteEvent::PROGRAM, ch, 0u, Chan->envNumber - 1);
+	else if (cmd == 0x17)
+		Release(ch, when);
+	tempo_ = var_tempo;
+	v.env = Chan->envNumber;
+}
+
+void CNoteTap::OnNote(CMusicTrack *Chan, uint8_t cmd, bool tied, uint8_t wait) {
+	const uint8_t ch = Slot(Chan->channelID);
+	const uint32_t when = now_ + var_tickElapsed + static_cast<int8_t>(wait);
+	const uint8_t note = cmd & 0x1F;
+	if (!note) {
+		Release(ch, when);
+		return;
+	}
+
+	CVoice &v = voice_[ch];
+	uint8_t key;
+	if (ch == 3)
+		key = 36 + ((note - 1) & 0x0F);
+	else
+		key = 23 + Chan->note - (ch == 2 ? 12 : 0); // note 1 is C1, an octave lower on the triangle
+	const uint32_t off = Chan->sustainWait == 0xFF ? NEVER : now_ + var_tickElapsed + Chan->sustainWait;
+	if (!(tied && v.on && v.key == key)) {
+		Release(ch, when);
+		const int vol = ch == 2 ? 12 : Chan->volumeDuty & 0x0F;
+		Add(when, CNoteEvent::NOTE_ON, ch, key, std::max(1, vol * 127 / 15));
+		v.on = true;
+		v.key = key;
+		v.bend = 0;
+	}
+	v.off = off;
+}
+
+void CNoteTap::WriteCallback(uint16_t adr, uint8_t value) {
+	CVoice &v = voice_[(adr >> 2) & 0x03];
+	switch (adr & 0x03) {
+	case 0x02: v.period = (v.period & 0x700) | value; v.written = true; break;
+	case 0x03: v.period = (v.period & 0xFF) | ((value & 0x07) << 8); v.written = true; break;
+	}
+}
+
+void CNoteTap::Add(uint32_t time, CNoteEvent::type_t type, uint8_t ch, uint8_t key, int32_t value) {
+	events_.push_back({time, type, ch, key, value});
+}
+
+void CNoteTap::Release(uint8_t ch, uint32_t time) {
+	CVoice &v = voice_[ch];
+	if (!v.on)
+		return;
+	Add(std::min(v.off, time), CNoteEvent::NOTE_OFF, ch, v.key, 0);
+	v.on = false;
+}
+
+void CNoteTap::MeasureBends() {
+	for (uint8_t ch = 0; ch < 4; ++ch) {
+		CVoice &v = voice_[ch];
+		if (v.on && v.off <= now_)
+			Release(ch, v.off);
+		if (ch == 3 || !v.on || !v.written)
+			continue;
+		v.written = false;
+		const double freq = CPU_CLOCK / ((ch == 2 ? 32. : 16.) * (v.period + 1));
+		const double semitones = 69. + 12. * std::log2(freq / 440.) - v.key;
+		const int32_t bend = static_cast<int32_t>(std::lround(semitones * 4096.));
+		if (bend != v.bend) {
+			Add(now_, CNoteEvent::BEND, ch, v.key, bend);
+			v.bend = bend;
+		}
+	}
+}
+
+void WriteMIDI(const char *fname, const std::vector<CNoteEvent> &events) {
+	const char *const NAMES[] = {"Pulse 1", "Pulse 2", "Triangle", "Noise"};
+	const uint8_t MIDI_CHANNEL[] = {0, 1, 2, 9};
+	const int BEND_RANGE = 12;
+
+	CTrackWriter tracks[5];
+	tracks[0].Meta(0u, 0x03, "Mega Man 5");
+	for (int i = 0; i < 4; ++i) {
+		CTrackWriter &w = tracks[i + 1];
+		const uint8_t c = MIDI_CHANNEL[i];
+		w.Meta(0u, 0x03, NAMES[i]);
+		if (i == 3)
+			continue;
+		// RPN 0, pitch bend sensitivity
+		for (auto x : {std::make_pair(101, 0), {100, 0}, {6, BEND_RANGE}, {38, 0}, {101, 127}, {100, 127}}) {
+			w.Delta(0u);
+			w.Bytes({static_cast<uint8_t>(0xB0 | c), static_cast<uint8_t>(x.first), static_cast<uint8_t>(x.second)});
+		}
+	}
+
+	for (const auto &e : events) {
+		const uint8_t c = MIDI_CHANNEL[e.channel];
+		if (e.type == CNoteEvent::TEMPO) {
+			if (!e.value)
+				continue;
+			const uint32_t us = static_cast<uint32_t>(std::lround(
+				CNoteTap::QUARTER * 256. * 1e6 / (e.value * FRAME_RATE)));
+			tracks[0].Delta(e.time);
+			tracks[0].Bytes({0xFF, 0x51, 0x03, static_cast<uint8_t>(us >> 16),
+				static_cast<uint8_t>(us >> 8), static_cast<uint8_t>(us)});
+			continue;
+		}
+		CTrackWriter &w = tracks[e.channel + 1];
+		switch (e.type) {
+		case CNoteEvent::NOTE_ON:
+			w.Delta(e.time);
+			w.Bytes({static_cast<uint8_t>(0x90 | c), e.key, static_cast<uint8_t>(e.value)});
+			break;
+		case CNoteEvent::NOTE_OFF:
+			w.Delta(e.time);
+			w.Bytes({static_cast<uint8_t>(0x80 | c), e.key, 0x40});
+			break;
+		case CNoteEvent::PROGRAM:
+			if (e.channel == 3)
+				break;
+			w.Delta(e.time);
+			w.Bytes({static_cast<uint8_t>(0xC0 | c), static_cast<uint8_t>(e.value & 0x7F)});
+			break;
+		case CNoteEvent::BEND: {
+			const long x = std::max(0l, std::min(16383l, 8192l + std::lround(e.value * 8192. / (4096. * BEND_RANGE))));
+			w.Delta(e.time);
+			w.Bytes({static_cast<uint8_t>(0xE0 | c), static_cast<uint8_t>(x & 0x7F), static_cast<uint8_t>(x >> 7)});
+		} break;
+		default:
+			break;
+		}
+	}
+
+	FILE *f = fopen(fname, "wb");
+	if (!f)
+		throw std::runtime_error {std::string {"Cannot write "} + fname};
+	fputs("MThd", f);
+	for (int x : {0, 0, 0, 6, 0, 1, 0, 5, 0, +CNoteTap::QUARTER})
+		fputc(x, f);
+	for (auto &x : tracks)
+		x.Save(f);
+	if (fclose(f))
+		throw std::runtime_error {std::string {"Cannot write "} + fname};
+}
+
+} // namespace MM5Sound
@@ -0,0 +1,70 @@
+#pragma once
+
+#include "mm5tap.h"
+#include <vector>
+
+namespace MM5Sound {
+
+// one musical event; times are in driver ticks, 48 to a quarter note, with
+// the driver's own rounding of tempo into frames left out
+struct CNoteEvent {
+	enum type_t : uint8_t {
+		NOTE_ON,	// key, value is the velocity
+		NOTE_OFF,	// key
+		PROGRAM,	// value is the instrument number
+		TEMPO,		// value is the driver tempo, 1/256 ticks per frame
+		BEND,		// value in semitones * 4096 from the key last played
+	};
+
+	uint32_t time;
+	type_t type;
+	uint8_t channel;	// 0 to 3: pulse 1, pulse 2, triangle, noise
+	uint8_t key;		// MIDI key, or 36 + noise period index on the noise channel
+	int32_t value;
+};
+
+// taps the pattern interpreter for notes, rests, instrument and tempo
+// commands, and derives pitch bends from the periods written after every
+// tick, so vibrato, portamento and detune come out as bends; sound effects
+// are not followed
+class CNoteTap : public CPatternTap {
+public:
+	static const int QUARTER = 48;
+
+	using CPatternTap::CPatternTap;
+
+	std::vector<CNoteEvent> Run(uint8_t track, uint8_t region, int ticks);
+
+private:
+	struct CVoice {
+		bool on = false;
+		uint8_t key = 0u;
+		uint32_t off = 0u;		// scheduled release, or UINT32_MAX when tied
+		int32_t bend = 0;
+		uint16_t period = 0u;
+		bool written = false;
+		uint8_t env = 0u;		// envelope as of the last pattern read
+	};
+
+	void OnCommand(CMusicTrack *Chan, uint8_t cmd) override;
+	void OnNote(CMusicTrack *Chan, uint8_t cmd, bool tied, uint8_t wait) override;
+	void WriteCallback(uint16_t adr, uint8_t value) override;
+
+	void Add(uint32_t time, CNoteEvent::type_t type, uint8_t ch, uint8_t key, int32_t value);
+	void Release(uint8_t ch, uint32_t time);
+	void MeasureBends();
+
+	static uint8_t Slot(uint8_t channelID) { return channelID ^ 0x03; }
+
+	std::vector<CNoteEvent> events_;
+	CVoice voice_[4];
+	uint32_t now_ = 0u;		// driver ticks before the current frame
+	uint16_t tempo_ = 0u;	// tempo as of the last pattern read
+};
+
+// Standard MIDI File, format 1: a tempo track and one track per channel,
+// the noise channel on MIDI channel 10 and the pitch bend range set to an
+// octave so that portamento fits
+void WriteMIDI(const char *fname, const std::vector<CNoteEvent> &events);
+
+} // namespace MM5Sound
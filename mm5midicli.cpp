@@ -0,0 +1,76 @@
+#include "mm5midi.h"
+#include "mm5rom.h"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+
+using namespace MM5Sound;
+
+namespace {
+
+void Usage() {
+	fprintf(stderr,
+		"usage: mm5midi rom track [ticks] [-o file.mid]\n"
+		"  extracts the notes of a music track without rendering audio; prints\n"
+		"  the event stream, or writes a Standard MIDI File with -o\n");
+}
+
+void Print(const std::vector<CNoteEvent> &events) {
+	const char *const NAMES[] = {"on", "off", "program", "tempo", "bend"};
+	for (const auto &e : events) {
+		printf("%8u %d %-7s", e.time, e.channel, NAMES[e.type]);
+		switch (e.type) {
+		case CNoteEvent::NOTE_ON:
+			printf(" %3d %3d\n", e.key, e.value); break;
+		case CNoteEvent::NOTE_OFF:
+			printf(" %3d\n", e.key); break;
+		case CNoteEvent::BEND:
+			printf(" %3d %+.3f\n", e.key, e.value / 4096.); break;
+		default:
+			printf(" %d\n", e.value); break;
+		}
+	}
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+	if (argc < 3) {
+		Usage();
+		return 1;
+	}
+
+	int ticks = 10800;
+	const char *fname = nullptr;
+	for (int i = 3; i < argc; ++i) {
+		if (!strcmp(argv[i], "-o") && i + 1 < argc)
+			fname = argv[++i];
+		else if (argv[i][0] != '-' && i == 3)
+			ticks = atoi(argv[i]);
+		else {
+			Usage();
+			return 1;
+		}
+	}
+
+	try {
+		const CSoundBank bank {argv[1]};
+		CNoteTap tap {bank};
+		const auto t0 = std::chrono::steady_clock::now();
+		const std::vector<CNoteEvent> events = tap.Run(static_cast<uint8_t>(strtol(argv[2], nullptr, 0)), 0, ticks);
+		const double t = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+		if (!fname) {
+			Print(events);
+			return 0;
+		}
+		WriteMIDI(fname, events);
+		fprintf(stderr, "%zu events from %d ticks in %.3f s\n", events.size(), ticks, t);
+	}
+	catch (std::exception &e) {
+		fprintf(stderr, "%s\n", e.what());
+		return 1;
+	}
+	return 0;
+}
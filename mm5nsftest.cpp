@@ -1,7 +1,10 @@
 #include "mm5sound.h"
+#include "mm5rom.h"
+#include "mm5log.h"
 #include <cstdio>
 #include <cstdlib>
 #include <memory>
+#include <unistd.h>
 
 using namespace MM5Sound;
 
@@ -16,7 +19,12 @@ auto make_unique(Arg&&... args) {
 } // namespace
 
 class CEngineNSFLog : public CEngine {
+public:
+	CEngineNSFLog(const CSoundBank &bank, CLogWriter &log) : CEngine(bank), log_(log) { }
+
+private:
 	void BREAK() const override {
+		log_.Flush();
 		const auto fn = [&] (unsigned adr) {
 			printf("%04X:", adr);
 			for (unsigned n = adr + 0x10; adr < n; ++adr) {
@@ -43,31 +51,42 @@ class CEngineNSFLog : public CEngine {
 		return CEngine::ReadCallback(adr);
 	}
 	void WriteCallback(uint16_t adr, uint8_t value) override {
-		printf("WRITE(%04X,%02X)\n", adr, value);
+		log_.Write(adr, value);
 		CEngine::WriteCallback(adr, value);
 	}
+
+	CLogWriter &log_;
 };
 
 
 
 template <class T>
-void PlayNSF(int track, int region, int ticks) {
-	std::unique_ptr<ISongPlayer> mm5 = make_unique<T>();
-	printf("INIT(%02X,%02X)\n", track, region);
+void PlayNSF(const CSoundBank &bank, CLogWriter &log, int track, int region, int ticks) {
+	std::unique_ptr<ISongPlayer> mm5 = make_unique<T>(bank, log);
+	log.Init(track, region);
 	mm5->CallINIT(track, region);
 //	mm5->BREAK();
 	for (int t = 0; t < ticks; ++t) {
-		printf("PLAY(%d)\n", t);
+		log.Play(t);
 		mm5->CallPLAY();
 //		mm5->BREAK();
 	}
 }
 
 int main(int argc, char **argv) {
-	PlayNSF<CEngineNSFLog>(
-		argc >= 2 ? atoi(argv[1]) : 0,
-		0,
-		argc >= 3 ? atoi(argv[2]) : 1800
-	);
+	try {
+		const CSoundBank bank {argc >= 4 ? argv[3] : "mm5.nes"};
+		CLogWriter log {STDOUT_FILENO};
+		PlayNSF<CEngineNSFLog>(bank, log,
+			argc >= 2 ? atoi(argv[1]) : 0,
+			0,
+			argc >= 3 ? atoi(argv[2]) : 1800
+		);
+		log.Flush();
+	}
+	catch (std::exception &e) {
+		fprintf(stderr, "%s\n", e.what());
+		return 1;
+	}
 	return 0;
 }
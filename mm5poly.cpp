@@ -0,0 +1,217 @@
+#include "mm5poly.h"
+#include <algorithm>
+
+namespace MM5Sound {
+
+CPolySFXEngine::CPolySFXEngine(const CSoundBank &bank, size_t voices) :
+	CEngine(bank), voices_(std::max<size_t>(std::min<size_t>(voices, NONE), 1u))
+{
+	order_.reserve(voices_.size());
+	pending_.reserve(0x100);
+}
+
+void CPolySFXEngine::CallINIT(uint8_t track, uint8_t region) {
+	if (IsSFX(track)) {
+		Trigger(track, region);
+		return;
+	}
+	// music and control commands see the voices' channels as the SFX mask
+	mem_[0xCF] = owned_;
+	CEngine::CallINIT(track, region);
+	if (track == 0xF0 || track == 0xF1)
+		StopVoices();
+}
+
+void CPolySFXEngine::StepSFXHeader() {
+	// headers first, holding back their writes until the channels are assigned
+	uint8_t cache[4];
+	for (int X = 0; X < 4; ++X)
+		cache[X] = mem_[0x77C + X];
+	buffering_ = true;
+	for (size_t i = 0; i < voices_.size(); ++i) {
+		CVoice &v = voices_[i];
+		if (!v.active)
+			continue;
+		current_ = static_cast<uint8_t>(i);
+		Load(v);
+		Func8252();
+		v.fresh = (mem_[0xC0] & 0x01) != 0;
+		mem_[0xC0] &= 0xFE;
+		v.cacheSet = 0u;
+		for (int X = 0; X < 4; ++X)
+			if (mem_[0x77C + X] != cache[X]) {
+				v.cacheSet |= 1 << (3 - X);
+				mem_[0x77C + X] = cache[X];
+			}
+		Save(v, true);
+		v.active = sfx_currentPtr != 0u;
+	}
+	buffering_ = false;
+	AssignChannels();
+	for (uint32_t x : pending_) {
+		const uint16_t adr = x >> 8 & 0xFFFF;
+		const uint8_t who = owner_[adr >> 2 & 0x03];
+		if (adr >= 0x4010u || who == NONE || who == x >> 24)
+			Output(adr, x & 0xFF);
+	}
+	pending_.clear();
+	// the driver's channel loop then sees the voices' channels as the SFX mask
+	mem_[0xCF] = owned_;
+}
+
+void CPolySFXEngine::StepSFXChannel() {
+	// every voice on the channel, only the owner heard
+	const uint8_t X = X_;
+	const uint8_t bit = 1 << (3 - X);
+	const uint8_t mask = mem_[0xCF];
+	for (uint8_t i : order_) {
+		CVoice &v = voices_[i];
+		if (!(v.zp[1] & bit))
+			continue;
+		Load(v);
+		const uint8_t period = mem_[0x77C + X];
+		const bool heard = owner_[3 - X] == i;
+		blocked_ = heard ? 0u : bit;
+		mem_[0xCF] = 0x80;
+		mem_[0xC0] |= v.fresh ? 0x01 : 0x00;
+		X_ = X;
+		Func82DE();
+		mem_[0xC0] &= 0xFE;
+		if (!heard)
+			mem_[0x77C + X] = period;
+		Save(v, false);
+	}
+	blocked_ = 0u;
+	X_ = X;
+	mem_[0xCF] = mask;
+}
+
+size_t CPolySFXEngine::ActiveVoices() const {
+	return std::count_if(voices_.begin(), voices_.end(), [] (const CVoice &v) { return v.active; });
+}
+
+void CPolySFXEngine::WriteCallback(uint16_t adr, uint8_t value) {
+	if (buffering_)
+		pending_.push_back(static_cast<uint32_t>(current_) << 24 | adr << 8 | value);
+	else if (adr >= 0x4010u || !(blocked_ & (1 << (adr >> 2 & 0x03))))
+		Output(adr, value);
+}
+
+bool CPolySFXEngine::IsSFX(uint8_t track) const {
+	return track < 0xF0u && SFXHeader(track);
+}
+
+uint8_t CPolySFXEngine::SFXHeader(uint8_t track) const {
+	// same lookup as Func8118, the priority byte of a sound effect or 0
+	while (track >= TRACK_COUNT)
+		track -= TRACK_COUNT;
+	const uint8_t x = track << 1;
+	const uint16_t adr = chain(ReadCallback(SONG_TABLE + 2 + x), ReadCallback(SONG_TABLE + 3 + x));
+	return adr ? ReadCallback(adr) : 0u;
+}
+
+void CPolySFXEngine::Trigger(uint8_t track, uint8_t region) {
+	auto it = std::find_if(voices_.begin(), voices_.end(), [] (const CVoice &v) { return !v.active; });
+	if (it == voices_.end()) {
+		it = std::min_element(voices_.begin(), voices_.end(), [&] (const CVoice &a, const CVoice &b) {
+			return Outranks(b, a);
+		});
+		// the newcomer wins ties, as the driver lets an SFX of equal priority in
+		if ((SFXHeader(track) & 0x7F) < it->zp[0])
+			return;
+		const uint8_t i = static_cast<uint8_t>(it - voices_.begin());
+		for (int s = 0; s < 4; ++s)
+			if (owner_[s] == i)
+				orphaned_ |= 1 << s;
+	}
+
+	CVoice &v = *it;
+	v = CVoice { };
+	Load(v);
+	A_ = track;
+	X_ = region;
+	InitDriver();
+	Save(v, true);
+	v.active = sfx_currentPtr != 0u;
+	v.serial = ++serial_;
+}
+
+void CPolySFXEngine::StopVoices() {
+	for (auto &v : voices_)
+		v.active = false;
+	for (auto &x : owner_)
+		x = NONE;
+	order_.clear();
+	owned_ = orphaned_ = 0u;
+}
+
+void CPolySFXEngine::Load(const CVoice &v) {
+	sfx_currentPtr = v.ptr;
+	mem_[0xCE] = v.zp[0];
+	mem_[0xCF] = v.zp[1];
+	std::copy(v.zp + 2, v.zp + 8, mem_ + 0xD2);
+	for (int X = 0; X < 4; ++X)
+		for (int k = 0; k < 10; ++k)
+			mem_[0x700 + X + 4 * k] = v.chan[X][k];
+}
+
+void CPolySFXEngine::Save(CVoice &v, bool mask) {
+	v.ptr = sfx_currentPtr;
+	v.zp[0] = mem_[0xCE];
+	if (mask)
+		v.zp[1] = mem_[0xCF];
+	std::copy(mem_ + 0xD2, mem_ + 0xD8, v.zp + 2);
+	for (int X = 0; X < 4; ++X)
+		for (int k = 0; k < 10; ++k)
+			v.chan[X][k] = mem_[0x700 + X + 4 * k];
+}
+
+void CPolySFXEngine::AssignChannels() {
+	order_.clear();
+	for (size_t i = 0; i < voices_.size(); ++i)
+		if (voices_[i].active)
+			order_.push_back(static_cast<uint8_t>(i));
+	std::sort(order_.begin(), order_.end(), [&] (uint8_t a, uint8_t b) {
+		return Outranks(voices_[a], voices_[b]);
+	});
+
+	uint8_t owner[4] = {NONE, NONE, NONE, NONE};
+	uint8_t taken = 0u;
+	for (uint8_t i : order_) {
+		const uint8_t mask = voices_[i].zp[1] & 0x0F & ~taken;
+		for (int s = 0; s < 4; ++s)
+			if (mask & (1 << s))
+				owner[s] = i;
+		taken |= mask;
+	}
+
+	for (int s = 0; s < 4; ++s) {
+		uint8_t &period = mem_[0x77C + (s ^ 0x03)];
+		// a channel changing hands has its period rewritten in full
+		if (owner_[s] != NONE && owner[s] != NONE && owner_[s] != owner[s])
+			period = 0xFF;
+		// Func81D4 of the voice that dropped it, unless another voice has it
+		for (size_t i = 0; i < voices_.size(); ++i)
+			if ((voices_[i].cacheSet & (1 << s)) && (owner[s] == NONE || owner[s] == i))
+				period = 0xFF;
+		owner_[s] = owner[s];
+	}
+	for (auto &v : voices_)
+		v.cacheSet = 0u;
+	owned_ = taken;
+
+	// nobody else took the channels of an evicted voice, give them back to
+	// the music as Func81D4 would
+	for (int s = 0; s < 4; ++s)
+		if ((orphaned_ & (1 << s)) && owner_[s] == NONE) {
+			SilenceChannel(s ^ 0x03);
+			mem_[0x77C + (s ^ 0x03)] = 0xFF;
+		}
+	orphaned_ = 0u;
+}
+
+bool CPolySFXEngine::Outranks(const CVoice &a, const CVoice &b) const {
+	return a.zp[0] != b.zp[0] ? a.zp[0] > b.zp[0] : a.serial > b.serial;
+}
+
+} // namespace MM5Sound
@@ -0,0 +1,73 @@
+#pragma once
+
+#include "mm5sound.h"
+#include <cstddef>
+#include <vector>
+
+namespace MM5Sound {
+
+// engine with any number of concurrent sound effects instead of the driver's
+// single SFX stream; each voice keeps its own stream pointer, priority,
+// channel mask, timers ($CE - $D7 except $D0 - $D1) and SFX channel memory,
+// and runs every tick whether or not it is heard; each hardware channel goes
+// to the highest priority voice that wants it, the newest on ties, and the
+// others have their writes dropped until it is free again
+//
+// a sound effect started when no other one is playing sounds exactly as on
+// CEngine; voices beyond the pool size steal the slot of the lowest priority,
+// oldest voice, or are dropped if that one outranks them
+class CPolySFXEngine : public CEngine {
+public:
+	CPolySFXEngine(const CSoundBank &bank, size_t voices = 16u);
+
+	// music, control commands and sound effects alike
+	void CallINIT(uint8_t track, uint8_t region) override;
+	using CEngine::CallPLAY;
+
+	size_t ActiveVoices() const;
+	bool IsSFX(uint8_t track) const;
+
+protected:
+	// register writes that are heard
+	virtual void Output(uint16_t adr, uint8_t value) { }
+
+private:
+	static const uint8_t NONE = 0xFF;
+
+	struct CVoice {
+		bool active = false;
+		bool fresh = false;		// read a new header this tick
+		uint8_t cacheSet = 0u;	// channels whose period cache the header reset
+		uint32_t serial = 0u;
+		uint16_t ptr = 0u;
+		uint8_t zp[8] = { };	// $CE, $CF, $D2 - $D7
+		uint8_t chan[4][10] = { };	// $0700 + X, every 4 bytes up to $0727
+	};
+
+	void WriteCallback(uint16_t adr, uint8_t value) final;
+	// the SFX parts of StepDriver, run for every voice
+	void StepSFXHeader() override;
+	void StepSFXChannel() override;
+
+	uint8_t SFXHeader(uint8_t track) const;
+
+	void Trigger(uint8_t track, uint8_t region);
+	void StopVoices();
+	void Load(const CVoice &v);
+	void Save(CVoice &v, bool mask);
+	void AssignChannels();
+	bool Outranks(const CVoice &a, const CVoice &b) const;
+
+	std::vector<CVoice> voices_;
+	std::vector<uint8_t> order_;			// active voices, highest priority first
+	std::vector<uint32_t> pending_;		// header writes, voice << 24 | adr << 8 | value
+	uint8_t owner_[4] = {NONE, NONE, NONE, NONE};	// by register slot
+	uint8_t owned_ = 0u;		// $CF style mask of channels held by voices
+	uint8_t orphaned_ = 0u;	// held by a voice that was evicted
+	uint8_t blocked_ = 0u;		// slots the running voice may not write
+	bool buffering_ = false;
+	uint8_t current_ = 0u;
+	uint32_t serial_ = 0u;
+};
+
+} // namespace MM5Sound
@@ -0,0 +1,130 @@
+#include "mm5poly.h"
+#include "mm5trace.h"
+#include "mm5rom.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <stdexcept>
+#include <vector>
+
+using namespace MM5Sound;
+
+namespace {
+
+const int TRACKS = 76;
+
+class CTracedPoly : public CPolySFXEngine {
+public:
+	CTracedPoly(const CSoundBank &bank, CTrace *trace, size_t voices = 16u) :
+		CPolySFXEngine(bank, voices), trace_(trace) { }
+
+private:
+	void Output(uint16_t adr, uint8_t value) override {
+		if (trace_)
+			trace_->Write(adr, value);
+	}
+
+	CTrace *trace_;
+};
+
+// the first track, then the second one at tick `at`
+template <class T>
+void Play(T &engine, CTrace &trace, uint8_t first, uint8_t second, int at, int ticks) {
+	trace.Clear(-1);
+	trace.NewFrame();
+	engine.CallINIT(first, 0);
+	for (int t = 0; t < ticks; ++t) {
+		trace.NewFrame();
+		if (t == at)
+			engine.CallINIT(second, 0);
+		engine.CallPLAY();
+	}
+}
+
+// with at most one sound effect at a time the voices must sound exactly
+// like the driver's own SFX stream
+int CheckSingle(const CSoundBank &bank, int ticks) {
+	CTracedPoly probe {bank, nullptr};
+	int failed = 0;
+	for (int a = 0; a < TRACKS; ++a)
+		for (int b = 0; b < TRACKS; ++b) {
+			if (probe.IsSFX(a) && probe.IsSFX(b))
+				continue;
+			CTrace ref, poly;
+			CTraceEngine engine {bank, &ref};
+			CTracedPoly voices {bank, &poly};
+			try {
+				Play(engine, ref, a, b, ticks / 4, ticks);
+				Play(voices, poly, a, b, ticks / 4, ticks);
+			}
+			catch (std::exception &) {
+				// tracks that stop on a driver error still count, as in verify.lua
+				continue;
+			}
+			if (!(ref == poly)) {
+				printf("Tracks %02X, %02X: writes differ from CEngine\n", a, b);
+				++failed;
+			}
+		}
+	return failed;
+}
+
+// a music track with sound effects triggered at random at the given rate
+int Storm(const CSoundBank &bank, int ticks, int rate, size_t voices) {
+	CTracedPoly probe {bank, nullptr};
+	std::vector<uint8_t> sfx, music;
+	for (int i = 0; i < TRACKS; ++i)
+		(probe.IsSFX(i) ? sfx : music).push_back(i);
+	if (sfx.empty() || music.empty())
+		throw std::runtime_error {"Sound bank has no music or no sound effects"};
+
+	CTracedPoly engine {bank, nullptr, voices};
+	engine.CallINIT(music.front(), 0);
+	srand(1);
+	const double perTick = rate / 60.0988;
+	double due = 0.;
+	size_t peak = 0u, triggers = 0u;
+	double worst = 0.;
+	const auto t0 = std::chrono::steady_clock::now();
+	for (int t = 0; t < ticks; ++t) {
+		const auto t1 = std::chrono::steady_clock::now();
+		for (due += perTick; due >= 1.; due -= 1.) {
+			engine.CallINIT(sfx[rand() % sfx.size()], 0);
+			++triggers;
+		}
+		engine.CallPLAY();
+		worst = std::max(worst, std::chrono::duration<double>(std::chrono::steady_clock::now() - t1).count());
+		peak = std::max(peak, engine.ActiveVoices());
+	}
+	const double total = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+	printf("%zu triggers over %d ticks with %zu voices: %.0f ticks/s, worst tick %.1f us, at most %zu voices\n",
+		triggers, ticks, voices, ticks / total, worst * 1e6, peak);
+	return 0;
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+	if (argc < 2) {
+		fprintf(stderr, "usage: %s rom [ticks] [triggers per second] [voices]\n", argv[0]);
+		return 1;
+	}
+	try {
+		const CSoundBank bank {argv[1]};
+		const int ticks = argc >= 3 ? atoi(argv[2]) : 1200;
+		const int rate = argc >= 4 ? atoi(argv[3]) : 300;
+		const size_t voices = argc >= 5 ? atoi(argv[4]) : 16;
+		const int failed = CheckSingle(bank, ticks);
+		if (failed) {
+			printf("%d track pairs failed.\n", failed);
+			return 1;
+		}
+		printf("All track pairs with at most one sound effect match CEngine.\n");
+		return Storm(bank, ticks * 9, rate, voices);
+	}
+	catch (std::exception &e) {
+		fprintf(stderr, "%s\n", e.what());
+		return 1;
+	}
+}
@@ -0,0 +1,142 @@
+#include "mm5preview.h"
+#include "mm5sound.h"
+#include <algorithm>
+#include <cmath>
+
+namespace MM5Sound {
+
+namespace {
+	// AC RMS of a 0/1 pulse with each duty setting
+	const float DUTY_RMS[] = {.3307f, .4330f, .5f, .4330f};
+	// triangle stepping through 0 to 15
+	const float TRIANGLE_RMS = 4.330f;
+	// slopes of the mixer at silence
+	const float PULSE_GAIN = 95.88f / 8128.f;
+	const float TRIANGLE_GAIN = 159.79f / 8227.f;
+	const float NOISE_GAIN = 159.79f / 12241.f;
+
+	float Mix(float pulse, float tri, float noise) {
+		float x = 0.f;
+		if (pulse > 0.f)
+			x += 95.88f / (8128.f / pulse + 100.f);
+		const float tnd = tri / 8227.f + noise / 12241.f;
+		if (tnd > 0.f)
+			x += 159.79f / (1.f / tnd + 100.f);
+		return x;
+	}
+
+	class CPreviewEngine : public CEngine {
+	public:
+		using CEngine::CEngine;
+		using CEngine::CallINIT;
+		using CEngine::CallPLAY;
+
+		void Measure(CPreview &out) const {
+			float peak[4] = { };
+			float rms[4] = { };
+			for (int i = 0; i < 2; ++i) {
+				const uint8_t *r = reg_ + i * 4;
+				const unsigned period = r[2] | ((r[3] & 0x07) << 8);
+				if ((enable_ & (1 << i)) && period >= 8u) {
+					peak[i] = (r[0] & 0x10) ? r[0] & 0x0F : 15.f;
+					rms[i] = peak[i] * DUTY_RMS[r[0] >> 6];
+				}
+			}
+			const unsigned triPeriod = reg_[0xA] | ((reg_[0xB] & 0x07) << 8);
+			if ((enable_ & 0x04) && (reg_[0x8] & 0x7F) && triPeriod >= 2u) {
+				peak[2] = 15.f;
+				rms[2] = TRIANGLE_RMS;
+			}
+			if (enable_ & 0x08) {
+				peak[3] = (reg_[0xC] & 0x10) ? reg_[0xC] & 0x0F : 15.f;
+				rms[3] = peak[3] / 2.f;
+			}
+
+			const float p = Mix(peak[0] + peak[1], peak[2], peak[3]);
+			const float linear = PULSE_GAIN * (peak[0] + peak[1]) + TRIANGLE_GAIN * peak[2] + NOISE_GAIN * peak[3];
+			const float a = PULSE_GAIN * rms[0];
+			const float b = PULSE_GAIN * rms[1];
+			const float c = TRIANGLE_GAIN * rms[2];
+			const float d = NOISE_GAIN * rms[3];
+			// the mixer compresses loud passages by about as much as the peaks
+			out.peak.push_back(p);
+			out.rms.push_back(std::sqrt(a * a + b * b + c * c + d * d) * (linear > 0.f ? p / linear : 1.f));
+			for (int i = 0; i < 4; ++i)
+				out.volume[i].push_back(static_cast<uint8_t>(peak[i]));
+		}
+
+	private:
+		void WriteCallback(uint16_t adr, uint8_t value) override {
+			if (adr == 0x4015)
+				enable_ = value;
+			else if (adr < 0x4010)
+				reg_[adr & 0x0F] = value;
+		}
+
+		uint8_t reg_[0x10] = { };
+		uint8_t enable_ = 0u;
+	};
+}
+
+float CPreview::Peak() const {
+	return peak.empty() ? 0.f : *std::max_element(peak.begin(), peak.end());
+}
+
+float CPreview::Loudness() const {
+	// 400 ms blocks overlapping by 75%, at 60.1 ticks per second
+	const size_t BLOCK = 24u, STEP = 6u;
+	std::vector<double> blocks;
+	for (size_t i = 0; i + BLOCK <= rms.size(); i += STEP) {
+		double power = 0.;
+		for (size_t j = i; j < i + BLOCK; ++j)
+			power += static_cast<double>(rms[j]) * rms[j];
+		blocks.push_back(power / BLOCK);
+	}
+	const auto gated = [&] (double threshold) {
+		double sum = 0.;
+		size_t n = 0u;
+		for (double x : blocks)
+			if (x > 0. && -.691 + 10. * std::log10(x) > threshold) {
+				sum += x;
+				++n;
+			}
+		return n ? sum / n : 0.;
+	};
+	const double absolute = gated(-70.);
+	if (absolute <= 0.)
+		return -INFINITY;
+	const double relative = gated(-.691 + 10. * std::log10(absolute) - 10.);
+	return static_cast<float>(-.691 + 10. * std::log10(relative > 0. ? relative : absolute));
+}
+
+void CPreview::Envelope(size_t width, std::vector<float> &outPeak, std::vector<float> &outRMS) const {
+	outPeak.assign(width, 0.f);
+	outRMS.assign(width, 0.f);
+	if (peak.empty())
+		return;
+	for (size_t i = 0; i < width; ++i) {
+		const size_t b = i * peak.size() / width;
+		const size_t e = std::max((i + 1) * peak.size() / width, b + 1);
+		outPeak[i] = *std::max_element(peak.begin() + b, peak.begin() + e);
+		double power = 0.;
+		for (size_t j = b; j < e; ++j)
+			power += static_cast<double>(rms[j]) * rms[j];
+		outRMS[i] = static_cast<float>(std::sqrt(power / (e - b)));
+	}
+}
+
+CPreview Preview(const CSoundBank &bank, uint8_t track, uint8_t region, int ticks) {
+	CPreview out;
+	out.track = track;
+	out.peak.reserve(ticks);
+	out.rms.reserve(ticks);
+	CPreviewEngine engine {bank};
+	engine.CallINIT(track, region);
+	for (int t = 0; t < ticks; ++t) {
+		engine.CallPLAY();
+		engine.Measure(out);
+	}
+	return out;
+}
+
+} // namespace MM5Sound
@@ -0,0 +1,29 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+
+namespace MM5Sound {
+
+class CSoundBank;
+
+// levels estimated from the register writes alone: each channel's volume,
+// duty and period after every tick, weighted by the 2A03 mixer; 1.0 is the
+// full scale of CAPU's output, but levels are AC, without the mixer offset
+struct CPreview {
+	uint8_t track = 0u;
+	std::vector<float> peak;		// per tick
+	std::vector<float> rms;			// per tick
+	std::vector<uint8_t> volume[4];	// per tick, 0 to 15; pulse 1, pulse 2, triangle, noise
+
+	float Peak() const;
+	// BS.1770 style gated loudness, without K-weighting; a rough LUFS figure
+	float Loudness() const;
+	// max of peaks and RMS of RMS values over width equal buckets
+	void Envelope(size_t width, std::vector<float> &peak, std::vector<float> &rms) const;
+};
+
+CPreview Preview(const CSoundBank &bank, uint8_t track, uint8_t region, int ticks);
+
+} // namespace MM5Sound
@@ -0,0 +1,136 @@
+#include "mm5preview.h"
+#include "mm5rom.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace MM5Sound;
+
+namespace {
+
+const int TRACKS = 76;
+
+void Usage() {
+	fprintf(stderr,
+		"usage: mm5preview rom track [ticks] [-w width]\n"
+		"       mm5preview rom --all [ticks] [-w width] [-j threads] [-o dir]\n"
+		"  prints peak and loudness, and a CSV waveform of width buckets; --all\n"
+		"  prints a table for every track and writes the CSVs to dir if given\n");
+}
+
+float Decibels(float x) {
+	return x > 0.f ? 20.f * std::log10(x) : -INFINITY;
+}
+
+void WriteCSV(FILE *f, const CPreview &pv, size_t width) {
+	std::vector<float> peak, rms;
+	pv.Envelope(width, peak, rms);
+	fprintf(f, "bucket,peak,rms\n");
+	for (size_t i = 0; i < width; ++i)
+		fprintf(f, "%zu,%.5f,%.5f\n", i, peak[i], rms[i]);
+}
+
+int All(const CSoundBank &bank, int ticks, size_t width, unsigned threads, const char *dir) {
+	struct CRow {
+		float peak = 0.f;
+		float loudness = 0.f;
+		std::string error;
+	};
+	std::vector<CRow> rows(TRACKS);
+	std::atomic<int> next {0};
+	const auto t0 = std::chrono::steady_clock::now();
+	const auto worker = [&] {
+		for (int track; (track = next++) < TRACKS; ) {
+			try {
+				const CPreview pv = Preview(bank, track, 0, ticks);
+				rows[track].peak = pv.Peak();
+				rows[track].loudness = pv.Loudness();
+				if (dir) {
+					char name[16];
+					snprintf(name, sizeof(name), "/%02X.csv", track);
+					const std::string fname = dir + std::string {name};
+					FILE *f = fopen(fname.c_str(), "w");
+					if (!f)
+						throw std::runtime_error {"Cannot write " + fname};
+					WriteCSV(f, pv, width);
+					fclose(f);
+				}
+			}
+			catch (std::exception &e) {
+				rows[track].error = e.what();
+			}
+		}
+	};
+	std::vector<std::thread> pool;
+	for (unsigned i = 1; i < threads; ++i)
+		pool.emplace_back(worker);
+	worker();
+	for (auto &x : pool)
+		x.join();
+	const double t = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+
+	printf("%-6s %10s %10s\n", "track", "peak dBFS", "LUFS*");
+	int failed = 0;
+	for (int track = 0; track < TRACKS; ++track) {
+		if (!rows[track].error.empty()) {
+			printf("%02X     %s\n", track, rows[track].error.c_str());
+			++failed;
+		}
+		else
+			printf("%02X     %10.1f %10.1f\n", track, Decibels(rows[track].peak), rows[track].loudness);
+	}
+	printf("%d tracks of %d ticks in %.3f s (%.0f ticks/s)\n", TRACKS, ticks, t, TRACKS * ticks / t);
+	return failed ? 1 : 0;
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+	if (argc < 3) {
+		Usage();
+		return 1;
+	}
+
+	const bool all = !strcmp(argv[2], "--all");
+	int ticks = 10800;
+	size_t width = 200u;
+	unsigned threads = std::max(std::thread::hardware_concurrency(), 1u);
+	const char *dir = nullptr;
+	for (int i = 3; i < argc; ++i) {
+		const bool hasValue = i + 1 < argc;
+		if (!strcmp(argv[i], "-w") && hasValue)
+			width = std::max(atoi(argv[++i]), 1);
+		else if (!strcmp(argv[i], "-j") && hasValue)
+			threads = std::max(atoi(argv[++i]), 1);
+		else if (!strcmp(argv[i], "-o") && hasValue && all)
+			dir = argv[++i];
+		else if (argv[i][0] != '-' && i == 3)
+			ticks = atoi(argv[i]);
+		else {
+			Usage();
+			return 1;
+		}
+	}
+
+	try {
+		const CSoundBank bank {argv[1]};
+		if (all)
+			return All(bank, ticks, width, threads, dir);
+		const CPreview pv = Preview(bank, static_cast<uint8_t>(strtol(argv[2], nullptr, 0)), 0, ticks);
+		fprintf(stderr, "peak %.1f dBFS, loudness %.1f LUFS (unweighted)\n", Decibels(pv.Peak()), pv.Loudness());
+		WriteCSV(stdout, pv, width);
+	}
+	catch (std::exception &e) {
+		fprintf(stderr, "%s\n", e.what());
+		return 1;
+	}
+	return 0;
+}
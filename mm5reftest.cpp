@@ -0,0 +1,224 @@
+#include "mm5cpu.h"
+#include "mm5sfxcache.h"
+#include "mm5session.h"
+#include "mm5trace.h"
+#include "mm5rom.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace MM5Sound;
+
+namespace {
+
+const int TRACKS = 76;
+
+void Usage() {
+	fprintf(stderr,
+		"usage: mm5reftest rom [-t ticks] [-n sessions] [-j threads] [-e engine|sfxcache]\n"
+		"  runs every track alone, then -n generated game sessions, on the driver\n"
+		"  code of the sound bank under a 6502 interpreter and on the chosen engine,\n"
+		"  and compares their register writes tick by tick\n");
+}
+
+class CTraced6502 : public C6502Player {
+public:
+	CTraced6502(const CSoundBank &bank, CTrace &trace) : C6502Player(bank), trace_(trace) { }
+
+private:
+	void WriteCallback(uint16_t adr, uint8_t value) override {
+		trace_.Write(adr, value);
+	}
+
+	CTrace &trace_;
+};
+
+class CTracedCache : public CSFXCacheEngine {
+public:
+	CTracedCache(const CSoundBank &bank, CTrace &trace) : CSFXCacheEngine(bank), trace_(trace) { }
+
+private:
+	void Output(uint16_t adr, uint8_t value) override {
+		trace_.Write(adr, value);
+	}
+
+	CTrace &trace_;
+};
+
+enum class EEngine { ENGINE, SFXCACHE };
+
+std::unique_ptr<ISongPlayer> MakeEngine(EEngine kind, const CSoundBank &bank, CTrace &trace) {
+	switch (kind) {
+	case EEngine::ENGINE: return std::unique_ptr<ISongPlayer> {new CTraceEngine {bank, &trace}};
+	case EEngine::SFXCACHE: return std::unique_ptr<ISongPlayer> {new CTracedCache {bank, trace}};
+	}
+	return nullptr;
+}
+
+struct CResult {
+	uint64_t ticks = 0u;
+	uint64_t writes = 0u;
+	std::string error;		// the first difference, empty if none
+};
+
+// one frame for the INIT calls before the first PLAY, then one per tick; a
+// driver error ends the run and counts only if the two players disagree on it
+void Play(ISongPlayer &player, CTrace &trace, const CSession &s, std::string &error) {
+	trace.Clear(-1);
+	trace.NewFrame();
+	auto next = s.events.begin();
+	try {
+		for (uint32_t t = 0; t < s.ticks; ++t) {
+			for (; next != s.events.end() && next->tick == t; ++next)
+				player.CallINIT(next->track, next->region);
+			trace.NewFrame();
+			player.CallPLAY();
+		}
+	}
+	catch (std::exception &e) {
+		error = e.what();
+	}
+}
+
+CResult Compare(const CSoundBank &bank, EEngine kind, const CSession &s) {
+	CTrace ref, out;
+	CTraced6502 cpu {bank, ref};
+	auto engine = MakeEngine(kind, bank, out);
+	std::string refError, outError;
+	Play(cpu, ref, s, refError);
+	Play(*engine, out, s, outError);
+
+	CResult r;
+	const size_t frames = std::min(ref.Frames(), out.Frames());
+	for (size_t f = 0; f < frames && r.error.empty(); ++f) {
+		const size_t n = ref.FrameSize(f), m = out.FrameSize(f);
+		const uint16_t *a = ref.FrameData(f), *b = out.FrameData(f);
+		r.writes += std::min(n, m);
+		for (size_t i = 0; i < std::max(n, m); ++i) {
+			if (i < n && i < m && a[i] == b[i])
+				continue;
+			const auto show = [] (char *p, size_t size, const uint16_t *w, size_t i, size_t n) {
+				if (i < n)
+					snprintf(p, size, "$%04X <- %02X", 0x4000 + (w[i] >> 8), w[i] & 0xFF);
+				else
+					snprintf(p, size, "nothing");
+			};
+			char x[32], y[32];
+			show(x, sizeof(x), a, i, n);
+			show(y, sizeof(y), b, i, m);
+			r.error = (f ? "tick " + std::to_string(f - 1) : std::string {"INIT"}) + ", write " + std::to_string(i) +
+				": 6502 " + x + ", engine " + y;
+			break;
+		}
+		r.ticks = f;
+	}
+	if (r.error.empty() && (ref.Frames() != out.Frames() || refError != outError)) {
+		const auto tick = static_cast<long>(frames) - 1;
+		r.error = "tick " + std::to_string(tick) + ": 6502 " + (refError.empty() ? "runs on" : "stops: " + refError) +
+			", engine " + (outError.empty() ? "runs on" : "stops: " + outError);
+	}
+	return r;
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+	if (argc < 2) {
+		Usage();
+		return 1;
+	}
+	try {
+		CSessionConfig cfg;
+		unsigned sessions = 64u;
+		unsigned threads = std::max(std::thread::hardware_concurrency(), 1u);
+		EEngine kind = EEngine::ENGINE;
+		for (int i = 2; i < argc; ++i) {
+			if (i + 1 >= argc) {
+				Usage();
+				return 1;
+			}
+			const char *value = argv[++i];
+			if (!strcmp(argv[i - 1], "-t"))
+				cfg.ticks = static_cast<uint32_t>(strtoul(value, nullptr, 10));
+			else if (!strcmp(argv[i - 1], "-n"))
+				sessions = static_cast<unsigned>(atoi(value));
+			else if (!strcmp(argv[i - 1], "-j"))
+				threads = std::max(atoi(value), 1);
+			else if (!strcmp(argv[i - 1], "-e") && !strcmp(value, "engine"))
+				kind = EEngine::ENGINE;
+			else if (!strcmp(argv[i - 1], "-e") && !strcmp(value, "sfxcache"))
+				kind = EEngine::SFXCACHE;
+			else {
+				Usage();
+				return 1;
+			}
+		}
+
+		const CSoundBank bank {argv[1]};
+		std::vector<std::string> names;
+		std::vector<CSession> work;
+		for (int t = 0; t < TRACKS; ++t) {
+			CSession s;
+			s.ticks = cfg.ticks;
+			s.events.push_back({0u, static_cast<uint8_t>(t), 0u});
+			work.push_back(s);
+			char buf[32];
+			snprintf(buf, sizeof(buf), "track %02X", t);
+			names.push_back(buf);
+		}
+		for (unsigned i = 0; i < sessions; ++i) {
+			work.push_back(GenerateSession(bank, cfg, i + 1u));
+			names.push_back("session " + std::to_string(i + 1u));
+		}
+
+		std::vector<CResult> results(work.size());
+		std::atomic<size_t> next {0u};
+		std::mutex lock;
+		const auto worker = [&] {
+			for (size_t i; (i = next++) < work.size(); ) {
+				results[i] = Compare(bank, kind, work[i]);
+				if (!results[i].error.empty()) {
+					std::lock_guard<std::mutex> guard {lock};
+					printf("%s: %s\n", names[i].c_str(), results[i].error.c_str());
+				}
+			}
+		};
+		const auto t0 = std::chrono::steady_clock::now();
+		std::vector<std::thread> pool;
+		for (unsigned i = 1; i < threads; ++i)
+			pool.emplace_back(worker);
+		worker();
+		for (auto &x : pool)
+			x.join();
+		const double t = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+
+		uint64_t ticks = 0u, writes = 0u;
+		size_t failed = 0u;
+		for (const auto &r : results) {
+			ticks += r.ticks;
+			writes += r.writes;
+			failed += !r.error.empty();
+		}
+		printf("%zu runs, %llu ticks, %llu writes compared on %u threads in %.3f s\n", work.size(),
+			static_cast<unsigned long long>(ticks), static_cast<unsigned long long>(writes), threads, t);
+		if (failed) {
+			printf("%zu runs differ from the 6502 driver.\n", failed);
+			return 1;
+		}
+		printf("All runs match the 6502 driver.\n");
+		return 0;
+	}
+	catch (std::exception &e) {
+		fprintf(stderr, "%s\n", e.what());
+		return 1;
+	}
+}
@@ -0,0 +1,182 @@
+#include "mm5render.h"
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <mutex>
+#include <thread>
+
+namespace MM5Sound {
+
+void FeedAPU(CAPU &apu, const CTrace &trace, size_t frame) {
+	const uint16_t *x = trace.FrameData(frame);
+	for (size_t n = trace.FrameSize(frame); n; --n, ++x)
+		apu.Write(0x4000 + (*x >> 8), *x & 0xFF);
+}
+
+void CSegmentRenderer::RenderSerial(const CRenderJob &job, CRenderResult &out) const {
+	const int first = job.startTick ? job.startTick : -1;
+	out.trace.Clear(first);
+	out.pcm.clear();
+	CTraceEngine engine {bank_};
+	CAPU apu {job.sampleRate};
+	CTrace scratch;
+
+	for (int t = -1; t < job.startTick + job.ticks; ++t) {
+		const bool keep = !job.pcm && t >= first;
+		CTrace &dest = keep ? out.trace : scratch;
+		if (!keep)
+			scratch.Clear(0);
+		dest.NewFrame();
+		engine.SetTrace(&dest);
+		if (t < 0)
+			engine.CallINIT(job.track, job.region);
+		else
+			engine.CallPLAY();
+		if (job.pcm) {
+			FeedAPU(apu, dest, dest.Frames() - 1);
+			if (t >= 0)
+				apu.RunFrame(t >= job.startTick ? &out.pcm : nullptr);
+		}
+	}
+}
+
+void CSegmentRenderer::Render(const CRenderJob &job, unsigned threads, CRenderResult &out) const {
+	// the checkpoint pass runs the driver over the whole job, which is all a
+	// trace costs, so only samples gain from splitting
+	if (!job.pcm || threads <= 1u) {
+		RenderSerial(job, out);
+		return;
+	}
+	const unsigned segments = std::min(threads * 4u, static_cast<unsigned>(std::max(job.ticks, 1)));
+	const auto cps = Checkpoint(job, segments, out);
+	if (job.ticks <= 0)
+		return;
+
+	std::vector<CRenderResult> parts(cps.size());
+	std::atomic<size_t> next {0u};
+	std::exception_ptr error;
+	std::mutex errorLock;
+	const auto worker = [&] {
+		try {
+			for (size_t i; (i = next++) < cps.size(); ) {
+				const int end = i + 1 < cps.size() ? cps[i + 1].tick : job.startTick + job.ticks;
+				RenderSegment(job, cps[i], end - cps[i].tick, parts[i]);
+			}
+		}
+		catch (...) {
+			std::lock_guard<std::mutex> lock {errorLock};
+			error = std::current_exception();
+		}
+	};
+	std::vector<std::thread> pool;
+	for (unsigned i = 1; i < threads; ++i)
+		pool.emplace_back(worker);
+	worker();
+	for (auto &x : pool)
+		x.join();
+	if (error)
+		std::rethrow_exception(error);
+
+	for (const auto &x : parts) {
+		out.trace.Append(x.trace);
+		out.pcm.insert(out.pcm.end(), x.pcm.begin(), x.pcm.end());
+	}
+}
+
+void CSegmentRenderer::RenderStems(const CRenderJob &job, CStemResult &out) const {
+	CRenderJob full = job;
+	full.pcm = false;
+	full.startTick = 0;
+	full.ticks = job.startTick + job.ticks;
+	CRenderResult writes;
+	RenderSerial(full, writes);
+
+	const auto synth = [&] (uint8_t mask, std::vector<int16_t> &pcm) {
+		CAPU apu {job.sampleRate};
+		pcm.clear();
+		pcm.reserve(apu.SampleAt(full.ticks) - apu.SampleAt(job.startTick));
+		FeedAPU(apu, writes.trace, 0);
+		for (int t = 0; t < full.ticks; ++t) {
+			FeedAPU(apu, writes.trace, t + 1);
+			apu.RunFrame(t >= job.startTick ? &pcm : nullptr, mask);
+		}
+	};
+	std::exception_ptr error[4];
+	std::vector<std::thread> pool;
+	for (int i = 0; i < 4; ++i)
+		pool.emplace_back([&, i] {
+			try {
+				synth(1u << i, out.channel[i]);
+			}
+			catch (...) {
+				error[i] = std::current_exception();
+			}
+		});
+	synth(CAPU::CH_ALL, out.mix);
+	for (auto &x : pool)
+		x.join();
+	for (auto &x : error)
+		if (x)
+			std::rethrow_exception(x);
+}
+
+std::vector<CSegmentRenderer::CCheckpoint>
+CSegmentRenderer::Checkpoint(const CRenderJob &job, unsigned segments, CRenderResult &out) const {
+	out.trace.Clear(job.startTick ? job.startTick : -1);
+	out.pcm.clear();
+	CTraceEngine engine {bank_};
+	CAPU apu {job.sampleRate};
+	CTrace scratch;
+
+	// only the INIT frame is kept from this pass
+	CTrace &init = !job.pcm && !job.startTick ? out.trace : scratch;
+	init.NewFrame();
+	engine.SetTrace(&init);
+	engine.CallINIT(job.track, job.region);
+	if (job.pcm)
+		FeedAPU(apu, init, init.Frames() - 1);
+	engine.SetTrace(job.pcm ? &scratch : nullptr);
+
+	std::vector<CCheckpoint> cps;
+	const int len = (job.ticks + segments - 1) / segments;
+	for (int t = 0; t < job.startTick + job.ticks; ++t) {
+		if (t >= job.startTick && !((t - job.startTick) % len)) {
+			cps.push_back(CCheckpoint {t, { }, apu});
+			engine.SaveState(cps.back().engine);
+		}
+		if (job.pcm) {
+			scratch.Clear(0);
+			scratch.NewFrame();
+		}
+		engine.CallPLAY();
+		if (job.pcm) {
+			FeedAPU(apu, scratch, 0);
+			apu.RunFrame(nullptr);
+		}
+	}
+	return cps;
+}
+
+void CSegmentRenderer::RenderSegment(const CRenderJob &job, const CCheckpoint &from, int ticks, CRenderResult &out) const {
+	CTraceEngine engine {bank_};
+	engine.LoadState(from.engine);
+	CAPU apu {from.apu};
+	CTrace scratch;
+	out.trace.Clear(from.tick);
+	out.pcm.clear();
+
+	CTrace &dest = job.pcm ? scratch : out.trace;
+	engine.SetTrace(&dest);
+	for (int t = 0; t < ticks; ++t) {
+		if (job.pcm)
+			scratch.Clear(0);
+		dest.NewFrame();
+		engine.CallPLAY();
+		if (job.pcm) {
+			FeedAPU(apu, scratch, 0);
+			apu.RunFrame(&out.pcm);
+		}
+	}
+}
+
+} // namespace MM5Sound
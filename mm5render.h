@@ -0,0 +1,60 @@
+#pragma once
+
+#include "mm5trace.h"
+#include "mm5apu.h"
+#include <vector>
+
+namespace MM5Sound {
+
+class CSoundBank;
+
+// sends the register writes of one trace frame to the APU
+void FeedAPU(CAPU &apu, const CTrace &trace, size_t frame);
+
+struct CRenderJob {
+	uint8_t track = 0u;
+	uint8_t region = 0u;
+	int startTick = 0;		// first PLAY tick in the output
+	int ticks = 1800;
+	bool pcm = false;		// samples instead of register writes
+	uint32_t sampleRate = 44100u;
+};
+
+struct CRenderResult {
+	CTrace trace;			// includes the INIT frame if startTick is 0
+	std::vector<int16_t> pcm;	// tick 0 starts at sample 0
+};
+
+struct CStemResult {
+	std::vector<int16_t> channel[4];	// pulse 1, pulse 2, triangle, noise
+	std::vector<int16_t> mix;		// not the sum of the stems, the mixer is nonlinear
+};
+
+// renders one long track either serially, or by running a state-only pass
+// that checkpoints the engine and the APU at segment boundaries and then
+// rendering the segments concurrently; both give identical output, and
+// Render falls back to the serial loop for traces and a single thread
+class CSegmentRenderer {
+public:
+	explicit CSegmentRenderer(const CSoundBank &bank) : bank_(bank) { }
+
+	void RenderSerial(const CRenderJob &job, CRenderResult &out) const;
+	void Render(const CRenderJob &job, unsigned threads, CRenderResult &out) const;
+	// runs the driver once, then synthesizes each channel and the mix from
+	// its register writes on separate threads; job.pcm is ignored
+	void RenderStems(const CRenderJob &job, CStemResult &out) const;
+
+private:
+	struct CCheckpoint {
+		int tick;
+		CEngineState engine;
+		CAPU apu;
+	};
+
+	std::vector<CCheckpoint> Checkpoint(const CRenderJob &job, unsigned segments, CRenderResult &out) const;
+	void RenderSegment(const CRenderJob &job, const CCheckpoint &from, int ticks, CRenderResult &out) const;
+
+	const CSoundBank &bank_;
+};
+
+} // namespace MM5Sound
@@ -0,0 +1,173 @@
+#include "mm5render.h"
+#include "mm5cache.h"
+#include "mm5rom.h"
+#include "mm5wav.h"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+using namespace MM5Sound;
+
+namespace {
+
+void Usage() {
+	fprintf(stderr,
+		"usage: mm5render rom track ticks [-s start] [-j threads] [-r rate] [-o file]\n"
+		"                 [-c cachedir [-b megabytes]]\n"
+		"       mm5render rom track ticks --stems prefix [-s start] [-r rate]\n"
+		"       mm5render rom track ticks --bench [-r rate] [-p]\n"
+		"  -o  .wav renders PCM, .log or .txt a text trace, anything else a binary\n"
+		"      trace; without -o the text trace goes to stdout\n"
+		"  -p  with --bench only, benchmark PCM rendering instead of register writes\n"
+		"  --stems  writes prefix-pulse1.wav, -pulse2, -triangle, -noise and -mix\n"
+		"  -c  reuse earlier renders from a shared cache directory, 256 MB by default\n");
+}
+
+bool EndsWith(const std::string &str, const char *suffix) {
+	const size_t n = strlen(suffix);
+	return str.size() >= n && !str.compare(str.size() - n, n, suffix);
+}
+
+template <class F>
+double Time(F f) {
+	const auto t0 = std::chrono::steady_clock::now();
+	f();
+	return std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+}
+
+int Bench(const CSegmentRenderer &renderer, const CRenderJob &job) {
+	CRenderResult ref;
+	const double serial = Time([&] { renderer.RenderSerial(job, ref); });
+	printf("%-8s %10s %12s %8s\n", "threads", "time (s)", "ticks/s", "speedup");
+	printf("%-8s %10.4f %12.0f %8.2f\n", "serial", serial, job.ticks / serial, 1.);
+
+	int status = 0;
+	for (unsigned threads : {1u, 2u, 4u, 8u, 16u}) {
+		CRenderResult out;
+		const double t = Time([&] { renderer.Render(job, threads, out); });
+		const bool same = out.trace == ref.trace && out.pcm == ref.pcm;
+		printf("%-8u %10.4f %12.0f %8.2f%s\n", threads, t, job.ticks / t, serial / t,
+			same ? "" : "  MISMATCH");
+		if (!same)
+			status = 1;
+	}
+	return status;
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+	if (argc < 4) {
+		Usage();
+		return 1;
+	}
+
+	CRenderJob job;
+	job.track = static_cast<uint8_t>(strtol(argv[2], nullptr, 0));
+	job.ticks = atoi(argv[3]);
+	unsigned threads = 1u;
+	std::string outName;
+	std::string cacheDir;
+	std::string stems;
+	uint64_t cacheBudget = 256u;
+	bool bench = false;
+	for (int i = 4; i < argc; ++i) {
+		const std::string arg = argv[i];
+		const bool hasValue = i + 1 < argc;
+		if (arg == "-s" && hasValue)
+			job.startTick = atoi(argv[++i]);
+		else if (arg == "-j" && hasValue)
+			threads = static_cast<unsigned>(atoi(argv[++i]));
+		else if (arg == "-r" && hasValue)
+			job.sampleRate = static_cast<uint32_t>(atoi(argv[++i]));
+		else if (arg == "-o" && hasValue)
+			outName = argv[++i];
+		else if (arg == "-c" && hasValue)
+			cacheDir = argv[++i];
+		else if (arg == "-b" && hasValue)
+			cacheBudget = strtoull(argv[++i], nullptr, 0);
+		else if (arg == "--stems" && hasValue)
+			stems = argv[++i];
+		else if (arg == "-p")
+			job.pcm = true;
+		else if (arg == "--bench")
+			bench = true;
+		else {
+			Usage();
+			return 1;
+		}
+	}
+	// outside --bench the output name picks PCM or a trace
+	if (job.ticks < 0 || job.startTick < 0 || !job.sampleRate || (job.pcm && !bench)) {
+		Usage();
+		return 1;
+	}
+
+	try {
+		const CSoundBank bank {argv[1]};
+		const CSegmentRenderer renderer {bank};
+		if (bench)
+			return Bench(renderer, job);
+		if (!stems.empty()) {
+			const char *const NAMES[] = {"pulse1", "pulse2", "triangle", "noise"};
+			CStemResult out;
+			renderer.RenderStems(job, out);
+			for (int i = 0; i < 4; ++i)
+				WriteWAV((stems + "-" + NAMES[i] + ".wav").c_str(),
+					out.channel[i].data(), out.channel[i].size(), job.sampleRate);
+			WriteWAV((stems + "-mix.wav").c_str(), out.mix.data(), out.mix.size(), job.sampleRate);
+			return 0;
+		}
+
+		const bool text = outName.empty() || EndsWith(outName, ".log") || EndsWith(outName, ".txt");
+		job.pcm = EndsWith(outName, ".wav");
+		CRenderResult out;
+		if (!cacheDir.empty()) {
+			CRenderCache cache {cacheDir.c_str(), cacheBudget << 20};
+			const CCacheBlob blob = cache.Render(renderer, bank, job, threads);
+			if (job.pcm) {
+				out.pcm.resize(blob.Size() / 2u);
+				for (size_t i = 0; i < out.pcm.size(); ++i)
+					out.pcm[i] = static_cast<int16_t>(blob.Data()[i * 2] | (blob.Data()[i * 2 + 1] << 8));
+			}
+			else {
+				FILE *f = fmemopen(const_cast<uint8_t *>(blob.Data()), blob.Size(), "rb");
+				if (!f)
+					throw std::runtime_error {"Cannot read cached trace"};
+				out.trace.Load(f);
+				fclose(f);
+			}
+			const CCacheStats st = cache.Stats();
+			fprintf(stderr, "cache %s: %llu hits, %llu misses (%.1f%%), %.1f MB saved, %u entries, %.1f MB stored\n",
+				blob.Mapped() ? "hit" : "miss",
+				static_cast<unsigned long long>(st.hits), static_cast<unsigned long long>(st.misses),
+				st.HitRate() * 100., st.saved / 1e6, st.entries, st.bytes / 1e6);
+		}
+		else if (threads > 1u)
+			renderer.Render(job, threads, out);
+		else
+			renderer.RenderSerial(job, out);
+
+		if (job.pcm)
+			WriteWAV(outName.c_str(), out.pcm.data(), out.pcm.size(), job.sampleRate);
+		else {
+			FILE *f = outName.empty() ? stdout : fopen(outName.c_str(), text ? "w" : "wb");
+			if (!f)
+				throw std::runtime_error {"Cannot open " + outName};
+			if (text)
+				out.trace.WriteText(f, job.track, job.region);
+			else
+				out.trace.Save(f);
+			if (f != stdout && fclose(f))
+				throw std::runtime_error {"Cannot write " + outName};
+		}
+	}
+	catch (std::exception &e) {
+		fprintf(stderr, "%s\n", e.what());
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstddef>
+#include <memory>
+
+namespace MM5Sound {
+
+// single-producer, single-consumer ring buffer; Push is only called from one
+// thread and Pop from one other thread, neither ever blocks or locks, and the
+// running totals let the producer see how far the consumer has got
+template <class T>
+class CSPSCRing {
+public:
+	// rounded up to a power of two
+	explicit CSPSCRing(size_t capacity) {
+		size_t n = 1u;
+		while (n < capacity)
+			n <<= 1;
+		buf_.reset(new T[n]);
+		mask_ = n - 1;
+	}
+	CSPSCRing(const CSPSCRing &) = delete;
+	CSPSCRing &operator=(const CSPSCRing &) = delete;
+
+	// producer; returns how many elements fit
+	size_t Push(const T *data, size_t count) {
+		const uint64_t head = head_.load(std::memory_order_relaxed);
+		const uint64_t tail = tail_.load(std::memory_order_acquire);
+		const size_t n = std::min<size_t>(count, Capacity() - (head - tail));
+		for (size_t i = 0; i < n; ++i)
+			buf_[(head + i) & mask_] = data[i];
+		head_.store(head + n, std::memory_order_release);
+		return n;
+	}
+
+	// consumer; returns how many elements were there
+	size_t Pop(T *data, size_t count) {
+		const uint64_t tail = tail_.load(std::memory_order_relaxed);
+		const uint64_t head = head_.load(std::memory_order_acquire);
+		const size_t n = std::min<size_t>(count, head - tail);
+		for (size_t i = 0; i < n; ++i)
+			data[i] = buf_[(tail + i) & mask_];
+		tail_.store(tail + n, std::memory_order_release);
+		return n;
+	}
+
+	size_t Size() const {
+		return head_.load(std::memory_order_acquire) - tail_.load(std::memory_order_acquire);
+	}
+	size_t Capacity() const { return mask_ + 1; }
+	// elements ever pushed and popped
+	uint64_t Pushed() const { return head_.load(std::memory_order_acquire); }
+	uint64_t Popped() const { return tail_.load(std::memory_order_acquire); }
+
+private:
+	std::unique_ptr<T[]> buf_;
+	size_t mask_;
+	// on separate cache lines, each written by one side only
+	char pad0_[64];
+	std::atomic<uint64_t> head_ {0u};
+	char pad1_[64 - sizeof(std::atomic<uint64_t>)];
+	std::atomic<uint64_t> tail_ {0u};
+	char pad2_[64 - sizeof(std::atomic<uint64_t>)];
+};
+
+} // namespace MM5Sound
@@ -0,0 +1,155 @@
+#include "mm5rom.h"
+#include <algorithm>
+#include <cstring>
+#include <string>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace MM5Sound {
+
+namespace {
+	const size_t INES_HEADER_SIZE = 0x10;
+	const size_t INES_TRAINER_SIZE = 0x200;
+	const size_t INES_BANK_OFFSET = 0x30000; // PRG offset of the sound bank
+	const size_t NSF_HEADER_SIZE = 0x80;
+
+	unsigned Word(const uint8_t *x) {
+		return x[0] | (x[1] << 8);
+	}
+
+	[[noreturn]] void Fail(const std::string &msg) {
+		throw std::runtime_error {msg};
+	}
+}
+
+
+
+const uint16_t CSoundBank::BASE_ADR = 0x8000;
+const size_t CSoundBank::BANK_SIZE = 0x6000;
+
+CSoundBank::CSoundBank(const char *fname, uint32_t crc) {
+	int fd = open(fname, O_RDONLY);
+	if (fd == -1)
+		Fail(std::string {"Cannot open "} + fname);
+	struct stat st;
+	if (fstat(fd, &st) == -1 || st.st_size < 0x10) {
+		close(fd);
+		Fail(std::string {"Cannot read "} + fname);
+	}
+	mapSize_ = st.st_size;
+	map_ = mmap(nullptr, mapSize_, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (map_ == MAP_FAILED) {
+		map_ = nullptr;
+		Fail(std::string {"Cannot map "} + fname);
+	}
+
+	try {
+		const auto file = static_cast<const uint8_t *>(map_);
+		if (!memcmp(file, "NES\x1A", 4))
+			LoadNES(file, mapSize_);
+		else if (!memcmp(file, "NESM\x1A", 5))
+			LoadNSF(file, mapSize_);
+		else
+			Fail(std::string {fname} + " is neither an iNES ROM nor an NSF");
+		Validate(crc);
+	}
+	catch (...) {
+		munmap(map_, mapSize_);
+		throw;
+	}
+}
+
+CSoundBank::CSoundBank(const uint8_t *data, size_t size) {
+	if (size < BANK_SIZE)
+		Fail("Sound bank buffer too small");
+	data_ = data;
+	Validate(0u);
+}
+
+CSoundBank::~CSoundBank() {
+	if (map_)
+		munmap(map_, mapSize_);
+}
+
+void CSoundBank::LoadNES(const uint8_t *file, size_t size) {
+	size_t offset = INES_HEADER_SIZE;
+	if (file[6] & 0x04)
+		offset += INES_TRAINER_SIZE;
+	if (file[4] * 0x4000u < INES_BANK_OFFSET + BANK_SIZE)
+		Fail("PRG ROM too small to contain the sound bank");
+	offset += INES_BANK_OFFSET;
+	if (size < offset + BANK_SIZE)
+		Fail("ROM image truncated");
+	data_ = file + offset;
+}
+
+void CSoundBank::LoadNSF(const uint8_t *file, size_t size) {
+	if (size < NSF_HEADER_SIZE)
+		Fail("NSF header truncated");
+	const unsigned loadAdr = Word(file + 0x08);
+	const uint8_t *banks = file + 0x70;
+	const uint8_t *body = file + NSF_HEADER_SIZE;
+	const size_t bodySize = size - NSF_HEADER_SIZE;
+
+	if (!std::any_of(banks, banks + 8, [] (uint8_t x) { return x != 0; })) {
+		// flat image
+		if (loadAdr > BASE_ADR || bodySize < BASE_ADR + BANK_SIZE - loadAdr)
+			Fail("NSF does not cover $8000 - $DFFF");
+		data_ = body + (BASE_ADR - loadAdr);
+		return;
+	}
+
+	// bankswitched image, banks 0 - 5 cover the sound bank
+	const size_t pad = loadAdr & 0xFFF;
+	bool contiguous = banks[0] * 0x1000u >= pad;
+	for (int i = 0; i < 6; ++i) {
+		if (banks[i] * 0x1000u + 0x1000u > pad + bodySize)
+			Fail("NSF bank out of range");
+		if (i && banks[i] != banks[0] + i)
+			contiguous = false;
+	}
+	if (contiguous) {
+		data_ = body + (banks[0] * 0x1000u - pad);
+		return;
+	}
+	copy_.assign(BANK_SIZE, 0);
+	for (int i = 0; i < 6; ++i)
+		for (size_t j = 0; j < 0x1000u; ++j) {
+			const size_t v = banks[i] * 0x1000u + j;
+			if (v >= pad)
+				copy_[i * 0x1000u + j] = body[v - pad];
+		}
+	data_ = copy_.data();
+}
+
+void CSoundBank::Validate(uint32_t crc) {
+	// PLAY and INIT are jump vectors at $8000 and $8003
+	static const uint8_t ENTRY[] = {0x4C, 0x6C, 0x80, 0x4C, 0xFE, 0x80};
+	if (memcmp(data_, ENTRY, sizeof(ENTRY)))
+		Fail("Sound driver entry points not found");
+	crc_ = CRC32(data_, BANK_SIZE);
+	if (crc && crc != crc_)
+		Fail("Sound bank checksum mismatch");
+}
+
+uint32_t CSoundBank::CRC32(const uint8_t *data, size_t size) noexcept {
+	static const auto TABLE = [] {
+		std::vector<uint32_t> t(256);
+		for (uint32_t i = 0; i < 256; ++i) {
+			uint32_t x = i;
+			for (int j = 0; j < 8; ++j)
+				x = (x >> 1) ^ ((x & 1) ? 0xEDB88320u : 0u);
+			t[i] = x;
+		}
+		return t;
+	}();
+	uint32_t x = 0xFFFFFFFFu;
+	while (size--)
+		x = (x >> 8) ^ TABLE[(x ^ *data++) & 0xFF];
+	return ~x;
+}
+
+} // namespace MM5Sound
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <stdexcept>
+#include <vector>
+
+namespace MM5Sound {
+
+// read-only view of the $8000 - $DFFF sound bank, either memory-mapped from a
+// Mega Man 5 ROM image / NSF file or borrowed from an existing buffer
+class CSoundBank {
+public:
+	static const uint16_t BASE_ADR; // $8000
+	static const size_t BANK_SIZE; // $6000
+
+	explicit CSoundBank(const char *fname, uint32_t crc = 0u);
+	CSoundBank(const uint8_t *data, size_t size);
+	CSoundBank(const CSoundBank &) = delete;
+	CSoundBank &operator=(const CSoundBank &) = delete;
+	~CSoundBank();
+
+	uint8_t Read(uint16_t adr) const {
+		if (static_cast<uint16_t>(adr - BASE_ADR) >= BANK_SIZE)
+			throw std::out_of_range {"Sound bank address out of range"};
+		return data_[adr - BASE_ADR];
+	}
+	const uint8_t *Data() const noexcept { return data_; }
+	uint32_t Checksum() const noexcept { return crc_; }
+
+	static uint32_t CRC32(const uint8_t *data, size_t size) noexcept;
+
+private:
+	void LoadNES(const uint8_t *file, size_t size);
+	void LoadNSF(const uint8_t *file, size_t size);
+	void Validate(uint32_t crc);
+
+	const uint8_t *data_ = nullptr;
+	uint32_t crc_ = 0u;
+	void *map_ = nullptr;
+	size_t mapSize_ = 0u;
+	std::vector<uint8_t> copy_; // non-contiguous NSF banks only
+};
+
+} // namespace MM5Sound
@@ -0,0 +1,38 @@
+#include "mm5rt.h"
+#include "mm5rom.h"
+
+namespace MM5Sound {
+
+void CRealtimeEngine::CallINIT(uint8_t track, uint8_t region) noexcept {
+	CEngine::CallINIT(track, region);
+}
+
+void CRealtimeEngine::CallPLAY() noexcept {
+	CEngine::CallPLAY();
+}
+
+void CRealtimeEngine::ClearFaults() noexcept {
+	faults_.store(0u, std::memory_order_relaxed);
+	first_.store(nullptr, std::memory_order_release);
+}
+
+uint8_t CRealtimeEngine::ReadCallback(uint16_t adr) const {
+	if (static_cast<uint16_t>(adr - CSoundBank::BASE_ADR) >= CSoundBank::BANK_SIZE) {
+		Fault("Sound bank address out of range");
+		return 0u;
+	}
+	return bank_.Data()[adr - CSoundBank::BASE_ADR];
+}
+
+void CRealtimeEngine::WriteCallback(uint16_t adr, uint8_t value) {
+	Output(adr, value);
+}
+
+void CRealtimeEngine::Fault(const char *what) const {
+	// keeps the first error even if ClearFaults runs on another thread
+	const char *none = nullptr;
+	first_.compare_exchange_strong(none, what, std::memory_order_release, std::memory_order_relaxed);
+	faults_.fetch_add(1u, std::memory_order_relaxed);
+}
+
+} // namespace MM5Sound
@@ -0,0 +1,40 @@
+#pragma once
+
+#include "mm5sound.h"
+#include <atomic>
+#include <cstdint>
+
+namespace MM5Sound {
+
+// engine for the audio thread: CallINIT and CallPLAY never throw and never
+// allocate, and a tick takes bounded time on any sound bank
+//
+// a driver error is counted and recovered from the way CEngine::Fault
+// describes, reads outside the sound bank return 0; the caller may poll
+// Faults() and FirstFault() from another thread
+class CRealtimeEngine : public CEngine {
+public:
+	explicit CRealtimeEngine(const CSoundBank &bank) : CEngine(bank) { }
+
+	void CallINIT(uint8_t track, uint8_t region) noexcept override;
+	void CallPLAY() noexcept override;
+
+	uint32_t Faults() const noexcept { return faults_.load(std::memory_order_relaxed); }
+	// the first error since the last ClearFaults, nullptr if none
+	const char *FirstFault() const noexcept { return first_.load(std::memory_order_acquire); }
+	void ClearFaults() noexcept;
+
+protected:
+	// register writes
+	virtual void Output(uint16_t adr, uint8_t value) { }
+
+private:
+	uint8_t ReadCallback(uint16_t adr) const final;
+	void WriteCallback(uint16_t adr, uint8_t value) final;
+	void Fault(const char *what) const final;
+
+	mutable std::atomic<uint32_t> faults_ {0u};
+	mutable std::atomic<const char *> first_ {nullptr};
+};
+
+} // namespace MM5Sound
@@ -0,0 +1,277 @@
+#include "mm5rt.h"
+#include "mm5session.h"
+#include "mm5rom.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <memory>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <time.h>
+#include <unistd.h>
+
+using namespace MM5Sound;
+
+// every allocation goes through here; armed_ is set around the engine calls
+// only, so that the harness itself may allocate
+namespace {
+	bool armed_ = false;
+	uint64_t allocations_ = 0u;
+}
+
+void *operator new(size_t size) {
+	if (armed_)
+		++allocations_;
+	if (void *p = malloc(size ? size : 1u))
+		return p;
+	throw std::bad_alloc { };
+}
+
+void *operator new[](size_t size) {
+	return operator new(size);
+}
+
+// out of line, or GCC pairs the free inlined into a delete expression with
+// the new expression and warns at -O2 (-Wmismatched-new-delete)
+__attribute__((noinline)) void operator delete(void *p) noexcept {
+	free(p);
+}
+
+void operator delete[](void *p) noexcept {
+	operator delete(p);
+}
+
+void operator delete(void *p, size_t) noexcept {
+	operator delete(p);
+}
+
+void operator delete[](void *p, size_t) noexcept {
+	operator delete(p);
+}
+
+namespace {
+
+const int TRACKS = 76;
+
+void Usage() {
+	fprintf(stderr,
+		"usage: mm5rttest rom [-t ticks] [-n sessions] [-f banks] [-b budget us]\n"
+		"  runs every track alone, -n generated game sessions and every track on -f\n"
+		"  corrupted copies of the sound bank through the real-time engine; fails if\n"
+		"  a tick allocates, throws or takes longer than the budget\n");
+}
+
+// register writes folded into a checksum, which needs no memory
+class CHashedRealtime : public CRealtimeEngine {
+public:
+	using CRealtimeEngine::CRealtimeEngine;
+
+	uint64_t hash = 0u;
+
+private:
+	void Output(uint16_t adr, uint8_t value) override {
+		hash = (hash ^ ((adr << 8) | value)) * 0x100000001B3ull;
+	}
+};
+
+class CHashedEngine : public CEngine {
+public:
+	using CEngine::CEngine;
+	using CEngine::CallINIT;
+	using CEngine::CallPLAY;
+
+	uint64_t hash = 0u;
+
+private:
+	void WriteCallback(uint16_t adr, uint8_t value) override {
+		hash = (hash ^ ((adr << 8) | value)) * 0x100000001B3ull;
+	}
+};
+
+struct CRun {
+	std::string name;
+	const CSoundBank *bank;
+	CSession session;
+};
+
+struct CStats {
+	uint64_t ticks = 0u;
+	uint64_t faulted = 0u;		// runs with driver errors
+	uint64_t overruns = 0u;		// ticks over the budget
+	uint64_t mismatches = 0u;	// runs whose writes differ from CEngine
+	std::vector<uint32_t> ns;	// every tick, for the percentiles
+};
+
+// in CPU time of this thread, so that preemption does not count against the
+// engine and one measurement is enough
+uint32_t Tick(CHashedRealtime &engine) {
+	timespec t0, t1;
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &t0);
+	armed_ = true;
+	engine.CallPLAY();
+	armed_ = false;
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &t1);
+	const long long ns = (t1.tv_sec - t0.tv_sec) * 1000000000ll + (t1.tv_nsec - t0.tv_nsec);
+	return static_cast<uint32_t>(std::min<long long>(ns, 0xFFFFFFFFll));
+}
+
+void Play(const CRun &run, uint32_t budget, CStats &stats) {
+	CHashedRealtime engine {*run.bank};
+	uint32_t faults = 0u;
+	auto next = run.session.events.begin();
+	for (uint32_t t = 0; t < run.session.ticks; ++t) {
+		for (; next != run.session.events.end() && next->tick == t; ++next) {
+			armed_ = true;
+			engine.CallINIT(next->track, next->region);
+			armed_ = false;
+		}
+		const uint32_t ns = Tick(engine);
+		stats.ns.push_back(ns);
+		if (ns > budget) {
+			++stats.overruns;
+			printf("%s: tick %u took %.1f us\n", run.name.c_str(), t, ns / 1e3);
+		}
+		faults += engine.Faults();
+		engine.ClearFaults();
+	}
+	stats.ticks += run.session.ticks;
+	if (faults) {
+		++stats.faulted;
+		return;
+	}
+
+	// a run without driver errors writes the same as CEngine
+	CHashedEngine ref {*run.bank};
+	next = run.session.events.begin();
+	for (uint32_t t = 0; t < run.session.ticks; ++t) {
+		for (; next != run.session.events.end() && next->tick == t; ++next)
+			ref.CallINIT(next->track, next->region);
+		ref.CallPLAY();
+	}
+	if (ref.hash != engine.hash) {
+		++stats.mismatches;
+		printf("%s: writes differ from CEngine\n", run.name.c_str());
+	}
+}
+
+[[noreturn]] void Escaped() {
+	// CallINIT and CallPLAY are noexcept, so a throw from the driver ends up here
+	const char *what = "unknown exception";
+	try {
+		if (auto e = std::current_exception())
+			std::rethrow_exception(e);
+	}
+	catch (std::exception &e) {
+		what = e.what();
+	}
+	catch (...) {
+	}
+	fprintf(stderr, "exception escaped the real-time engine: %s\n", what);
+	fflush(stdout);
+	_exit(1);
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+	if (argc < 2) {
+		Usage();
+		return 1;
+	}
+	std::set_terminate(Escaped);
+	try {
+		CSessionConfig cfg;
+		cfg.ticks = 3600u;
+		unsigned sessions = 16u;
+		unsigned banks = 16u;
+		double budgetUs = 200.;
+		for (int i = 2; i < argc; ++i) {
+			if (i + 1 >= argc) {
+				Usage();
+				return 1;
+			}
+			const char *value = argv[++i];
+			if (!strcmp(argv[i - 1], "-t"))
+				cfg.ticks = static_cast<uint32_t>(strtoul(value, nullptr, 10));
+			else if (!strcmp(argv[i - 1], "-n"))
+				sessions = static_cast<unsigned>(atoi(value));
+			else if (!strcmp(argv[i - 1], "-f"))
+				banks = static_cast<unsigned>(atoi(value));
+			else if (!strcmp(argv[i - 1], "-b"))
+				budgetUs = atof(value);
+			else {
+				Usage();
+				return 1;
+			}
+		}
+		const uint32_t budget = static_cast<uint32_t>(budgetUs * 1e3);
+
+		const CSoundBank bank {argv[1]};
+		std::vector<CRun> runs;
+		const auto alone = [&] (const CSoundBank &b, const std::string &prefix) {
+			for (int t = 0; t < TRACKS; ++t) {
+				char buf[32];
+				snprintf(buf, sizeof(buf), "track %02X", t);
+				CRun r {prefix + buf, &b, { }};
+				r.session.ticks = cfg.ticks;
+				r.session.events.push_back({0u, static_cast<uint8_t>(t), 0u});
+				runs.push_back(r);
+			}
+		};
+		alone(bank, "");
+		for (unsigned i = 0; i < sessions; ++i)
+			runs.push_back({"session " + std::to_string(i + 1u), &bank, GenerateSession(bank, cfg, i + 1u)});
+
+		// corrupted banks: random bytes anywhere past the entry points, so that
+		// the driver follows garbage pointers, commands and envelopes
+		std::vector<std::vector<uint8_t>> data;
+		std::vector<std::unique_ptr<CSoundBank>> fuzzed;
+		uint64_t seed = 0x9E3779B97F4A7C15ull;
+		const auto random = [&seed] {
+			seed ^= seed << 13;
+			seed ^= seed >> 7;
+			seed ^= seed << 17;
+			return seed;
+		};
+		for (unsigned i = 0; i < banks; ++i) {
+			data.emplace_back(bank.Data(), bank.Data() + CSoundBank::BANK_SIZE);
+			for (int j = 0; j < 0x100; ++j)
+				data.back()[6u + random() % (CSoundBank::BANK_SIZE - 6u)] = static_cast<uint8_t>(random());
+			fuzzed.emplace_back(new CSoundBank {data.back().data(), data.back().size()});
+		}
+		for (unsigned i = 0; i < banks; ++i)
+			alone(*fuzzed[i], "bank " + std::to_string(i + 1u) + " ");
+
+		CStats stats;
+		stats.ns.reserve(runs.size() * cfg.ticks);
+		for (const auto &r : runs)
+			Play(r, budget, stats);
+
+		if (allocations_) {
+			printf("%llu allocations in the engine.\n", static_cast<unsigned long long>(allocations_));
+			return 1;
+		}
+		std::sort(stats.ns.begin(), stats.ns.end());
+		const auto pct = [&stats] (double p) {
+			return stats.ns.empty() ? 0. : stats.ns[std::min(stats.ns.size() - 1u, static_cast<size_t>(p * stats.ns.size()))] / 1e3;
+		};
+		printf("%zu runs, %llu ticks, %llu with driver errors: median %.2f us, p99 %.2f us, p99.99 %.2f us, worst %.2f us per tick\n",
+			runs.size(), static_cast<unsigned long long>(stats.ticks), static_cast<unsigned long long>(stats.faulted),
+			pct(.5), pct(.99), pct(.9999), pct(1.));
+		if (stats.overruns || stats.mismatches) {
+			printf("%llu ticks over the %.0f us budget, %llu runs differ from CEngine.\n",
+				static_cast<unsigned long long>(stats.overruns), budgetUs, static_cast<unsigned long long>(stats.mismatches));
+			return 1;
+		}
+		printf("No allocations, exceptions or overruns.\n");
+		return 0;
+	}
+	catch (std::exception &e) {
+		fprintf(stderr, "%s\n", e.what());
+		return 1;
+	}
+}
@@ -0,0 +1,409 @@
+#include "mm5server.h"
+#include "mm5render.h"
+#include "mm5log.h"
+#include "mm5rom.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace MM5Sound {
+
+namespace {
+	const size_t MAX_LINE = 256u;
+
+	void SendAll(int fd, const char *buf, size_t size) {
+		while (size) {
+			const ssize_t n = ::write(fd, buf, size);
+			if (n < 0) {
+				if (errno == EINTR)
+					continue;
+				throw std::runtime_error {std::string {"Cannot send: "} + strerror(errno)};
+			}
+			buf += n;
+			size -= n;
+		}
+	}
+
+	void SendAll(int fd, const std::string &str) {
+		SendAll(fd, str.data(), str.size());
+	}
+
+	void SetTimeout(int fd, int option, int seconds) {
+		timeval tv { };
+		tv.tv_sec = seconds;
+		setsockopt(fd, SOL_SOCKET, option, &tv, sizeof(tv));
+	}
+}
+
+
+
+CEnginePool::CEnginePool(const CSoundBank &bank, size_t count) {
+	for (size_t i = 0; i < count; ++i)
+		free_.emplace_back(new CTraceEngine {bank});
+	if (!free_.empty())
+		free_.front()->SaveState(clean_);
+}
+
+std::unique_ptr<CTraceEngine> CEnginePool::Acquire() {
+	std::unique_lock<std::mutex> lk {lock_};
+	cv_.wait(lk, [this] { return !free_.empty(); });
+	auto engine = std::move(free_.back());
+	free_.pop_back();
+	lk.unlock();
+	engine->LoadState(clean_);
+	return engine;
+}
+
+void CEnginePool::Release(std::unique_ptr<CTraceEngine> engine) {
+	engine->SetTrace(nullptr);
+	{
+		std::lock_guard<std::mutex> lk {lock_};
+		free_.push_back(std::move(engine));
+	}
+	cv_.notify_one();
+}
+
+
+
+const size_t CRenderServer::MAX_QUEUED = 512u;
+const int CRenderServer::BLOCK_TICKS = 256;
+
+CRenderServer::CRenderServer(const CSoundBank &bank, const char *path, unsigned workers) :
+	bank_(bank), path_(path), pool_(bank, std::max(workers, 1u)), started_(clock::now())
+{
+	for (auto &x : latencyHist_)
+		x = 0u;
+
+	sockaddr_un addr { };
+	addr.sun_family = AF_UNIX;
+	if (path_.size() >= sizeof(addr.sun_path))
+		throw std::runtime_error {"Socket path too long"};
+	strcpy(addr.sun_path, path_.c_str());
+	listen_ = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (listen_ < 0)
+		throw std::runtime_error {std::string {"Cannot create socket: "} + strerror(errno)};
+	unlink(path_.c_str());
+	if (bind(listen_, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) || listen(listen_, SOMAXCONN)) {
+		const int err = errno;
+		close(listen_);
+		throw std::runtime_error {"Cannot listen on " + path_ + ": " + strerror(err)};
+	}
+
+	for (unsigned i = std::max(workers, 1u); i; --i)
+		workers_.emplace_back([this] { Worker(); });
+}
+
+CRenderServer::~CRenderServer() {
+	{
+		std::lock_guard<std::mutex> lk {lock_};
+		quit_ = true;
+	}
+	cv_.notify_all();
+	for (auto &x : workers_)
+		x.join();
+	for (const auto &x : queue_)
+		close(x.fd);
+	close(listen_);
+	unlink(path_.c_str());
+}
+
+void CRenderServer::Run() {
+	// request lines are read here, so that a slow client never holds a worker
+	std::vector<CConnection> pending;
+	std::vector<pollfd> pfds;
+	while (!stop_) {
+		// stop reading while the workers are this far behind; a signal handler
+		// cannot notify, so look at the stop flag every 200 ms
+		{
+			std::unique_lock<std::mutex> lk {lock_};
+			while (!stop_ && queue_.size() >= MAX_QUEUED)
+				cv_.wait_for(lk, std::chrono::milliseconds {200});
+		}
+		if (stop_)
+			break;
+
+		pfds.clear();
+		for (const auto &x : pending)
+			pfds.push_back({x.fd, POLLIN, 0});
+		if (pending.size() < MAX_QUEUED)
+			pfds.push_back({listen_, POLLIN, 0});
+		if (poll(pfds.data(), pfds.size(), 200) < 0)
+			continue;
+
+		const auto now = clock::now();
+		std::vector<CConnection> ready;
+		for (size_t i = 0; i < pending.size(); ) {
+			CConnection &conn = pending[i];
+			bool done = now - conn.accepted > std::chrono::seconds {5};
+			if (pfds[i].revents) {
+				char buf[MAX_LINE];
+				const ssize_t n = recv(conn.fd, buf, MAX_LINE - conn.line.size(), MSG_DONTWAIT);
+				if (n > 0)
+					conn.line.append(buf, n);
+				else if (!n || (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR))
+					done = true;
+			}
+			const size_t eol = conn.line.find('\n');
+			if (eol != std::string::npos)
+				conn.line.resize(eol);
+			else if (conn.line.size() >= MAX_LINE)
+				conn.overlong = true;
+			if (done || eol != std::string::npos || conn.overlong) {
+				ready.push_back(std::move(conn));
+				if (i + 1u < pending.size()) {
+					pending[i] = std::move(pending.back());
+					pfds[i] = pfds[pending.size() - 1u];
+				}
+				pending.pop_back();
+			}
+			else
+				++i;
+		}
+		if (pending.size() < MAX_QUEUED && (pfds.back().fd == listen_ && pfds.back().revents)) {
+			const int fd = accept(listen_, nullptr, nullptr);
+			if (fd >= 0) {
+				SetTimeout(fd, SO_SNDTIMEO, 30);		// drop clients that stop reading
+				pending.push_back({fd, now, { }, false});
+			}
+		}
+
+		if (!ready.empty()) {
+			{
+				std::lock_guard<std::mutex> lk {lock_};
+				for (auto &x : ready)
+					queue_.push_back(std::move(x));
+			}
+			cv_.notify_all();
+		}
+	}
+	for (const auto &x : pending)
+		close(x.fd);
+}
+
+void CRenderServer::Worker() {
+	while (true) {
+		std::unique_lock<std::mutex> lk {lock_};
+		cv_.wait(lk, [this] { return quit_ || !queue_.empty(); });
+		if (quit_)
+			return;
+		const CConnection conn = queue_.front();
+		queue_.pop_front();
+		lk.unlock();
+		cv_.notify_all();
+		Handle(conn);
+		close(conn.fd);
+	}
+}
+
+void CRenderServer::Handle(const CConnection &conn) {
+	++active_;
+	bool ok = false;
+	bool stats = false;
+	bool binary = false;		// set once a binary body has started
+	try {
+		if (conn.overlong)
+			throw std::runtime_error {"Request too long"};
+		const std::string &line = conn.line;
+		stats = line == "STATS";
+		if (stats)
+			SendAll(conn.fd, "OK\n" + Stats());
+		else {
+			CRequest req;
+			char kind[16] = { };
+			const int n = sscanf(line.c_str(), "RENDER %u %u %d %d %15s %u",
+				&req.track, &req.region, &req.start, &req.ticks, kind, &req.rate);
+			req.kind = kind;
+			if (n < 5 || req.track > 0xFFu || req.region > 0xFFu || req.start < 0 || req.ticks < 0 || !req.rate ||
+				(req.kind != "text" && req.kind != "trace" && req.kind != "pcm"))
+				throw std::runtime_error {"Bad request"};
+
+			auto engine = pool_.Acquire();
+			try {
+				bytes_ += Render(conn.fd, *engine, req, binary);
+			}
+			catch (...) {
+				pool_.Release(std::move(engine));
+				throw;
+			}
+			pool_.Release(std::move(engine));
+			ticks_ += req.ticks;
+			ok = true;
+		}
+	}
+	catch (std::exception &e) {
+		// an error line would pass for data in a binary body, which the
+		// client sees cut short when the connection closes instead
+		try {
+			if (!binary)
+				SendAll(conn.fd, std::string {"ERR "} + e.what() + "\n");
+		}
+		catch (...) {
+		}
+	}
+	--active_;
+	// stats queries are not counted as requests
+	if (!stats)
+		Record(conn.accepted, ok);
+}
+
+uint64_t CRenderServer::Render(int fd, CTraceEngine &engine, const CRequest &req, bool &binary) {
+	const bool pcm = req.kind == "pcm";
+	const int first = req.start ? req.start : -1;
+	CTrace trace;
+	CAPU apu {req.rate};
+	std::vector<int16_t> samples;
+	std::vector<uint8_t> bytes;
+
+	// a failed INIT is reported before anything is sent
+	trace.Clear(-1);
+	trace.NewFrame();
+	engine.SetTrace(&trace);
+	engine.CallINIT(req.track, req.region);
+	if (pcm)
+		FeedAPU(apu, trace, 0);
+	SendAll(fd, "OK\n");
+	binary = req.kind != "text";
+
+	std::unique_ptr<CLogWriter> log;
+	std::unique_ptr<FILE, int (*)(FILE *)> f {nullptr, fclose};
+	if (req.kind == "text")
+		log.reset(new CLogWriter {fd, false, 0x10000u});
+	else if (!pcm) {
+		const int dupfd = dup(fd);
+		f.reset(dupfd < 0 ? nullptr : fdopen(dupfd, "wb"));
+		if (!f)
+			throw std::runtime_error {"Cannot open connection"};
+		CTrace::SaveHeader(f.get(), first, req.ticks + (first < 0));
+	}
+	uint64_t sent = f ? 12u : 0u;
+
+	const auto emit = [&] {
+		if (log) {
+			for (size_t i = 0; i < trace.Frames(); ++i) {
+				const int tick = trace.FirstTick() + static_cast<int>(i);
+				if (tick < 0)
+					log->Init(req.track, req.region);
+				else
+					log->Play(tick);
+				const uint16_t *x = trace.FrameData(i);
+				for (size_t j = trace.FrameSize(i); j; --j, ++x)
+					log->Write(0x4000 + (*x >> 8), *x & 0xFF);
+			}
+			log->Flush();
+		}
+		else if (f) {
+			trace.SaveFrames(f.get());
+			sent += (trace.Frames() + trace.Writes()) * 2u;
+			if (fflush(f.get()))
+				throw std::runtime_error {"Cannot send trace"};
+		}
+		else {
+			bytes.resize(samples.size() * 2u);
+			for (size_t i = 0; i < samples.size(); ++i) {
+				bytes[i * 2] = static_cast<uint16_t>(samples[i]) & 0xFF;
+				bytes[i * 2 + 1] = static_cast<uint16_t>(samples[i]) >> 8;
+			}
+			SendAll(fd, reinterpret_cast<const char *>(bytes.data()), bytes.size());
+			sent += bytes.size();
+			samples.clear();
+		}
+	};
+
+	if (first < 0 && !pcm)
+		emit();
+	engine.SetTrace(pcm ? &trace : nullptr);
+	for (int t = 0; t < req.start; ++t) {
+		if (pcm) {
+			trace.Clear(t);
+			trace.NewFrame();
+		}
+		engine.CallPLAY();
+		if (pcm) {
+			FeedAPU(apu, trace, 0);
+			apu.RunFrame(nullptr);
+		}
+	}
+
+	// blocking sends on a full socket hold back the renderer
+	engine.SetTrace(&trace);
+	for (int t = req.start, end = req.start + req.ticks; t < end; ) {
+		trace.Clear(t);
+		for (const int n = std::min(t + BLOCK_TICKS, end); t < n; ++t) {
+			trace.NewFrame();
+			engine.CallPLAY();
+			if (pcm) {
+				FeedAPU(apu, trace, trace.Frames() - 1);
+				apu.RunFrame(&samples);
+			}
+		}
+		emit();
+	}
+	return log ? log->Bytes() + 3u : sent + 3u;
+}
+
+void CRenderServer::Record(clock::time_point accepted, bool ok) {
+	const uint64_t us = std::chrono::duration_cast<std::chrono::microseconds>(clock::now() - accepted).count();
+	++requests_;
+	if (!ok)
+		++failed_;
+	latencySum_ += us;
+	uint64_t prev = latencyMax_;
+	while (prev < us && !latencyMax_.compare_exchange_weak(prev, us))
+		;
+	int bucket = 0;
+	while (bucket < 31 && (us >> bucket) > 1u)
+		++bucket;
+	++latencyHist_[bucket];
+}
+
+std::string CRenderServer::Stats() const {
+	const double uptime = std::chrono::duration<double>(clock::now() - started_).count();
+	const uint64_t requests = requests_;
+	const auto percentile = [&] (double p) {
+		uint64_t n = 0u;
+		for (int i = 0; i < 32; ++i)
+			if ((n += latencyHist_[i]) >= p * requests)
+				return (uint64_t {2u} << i) / 1000.;		// upper bound of the bucket
+		return 0.;
+	};
+
+	size_t queued;
+	{
+		std::lock_guard<std::mutex> lk {lock_};
+		queued = queue_.size();
+	}
+	char buf[512];
+	snprintf(buf, sizeof(buf),
+		"uptime_s %.1f\n"
+		"workers %zu\n"
+		"requests %llu\n"
+		"failed %llu\n"
+		"active %llu\n"
+		"queued %zu\n"
+		"ticks %llu\n"
+		"bytes %llu\n"
+		"ticks_per_s %.0f\n"
+		"bytes_per_s %.0f\n"
+		"latency_mean_ms %.3f\n"
+		"latency_p50_ms %.3f\n"
+		"latency_p99_ms %.3f\n"
+		"latency_max_ms %.3f\n",
+		uptime, workers_.size(),
+		static_cast<unsigned long long>(requests), static_cast<unsigned long long>(failed_),
+		static_cast<unsigned long long>(active_), queued,
+		static_cast<unsigned long long>(ticks_), static_cast<unsigned long long>(bytes_),
+		ticks_ / uptime, bytes_ / uptime,
+		requests ? latencySum_ / 1000. / requests : 0.,
+		requests ? percentile(.5) : 0., requests ? percentile(.99) : 0.,
+		latencyMax_ / 1000.);
+	return buf;
+}
+
+} // namespace MM5Sound
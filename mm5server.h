@@ -0,0 +1,107 @@
+#pragma once
+
+#include "mm5trace.h"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <csignal>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace MM5Sound {
+
+class CSoundBank;
+
+// engines constructed up front and handed out in their power-on state
+class CEnginePool {
+public:
+	CEnginePool(const CSoundBank &bank, size_t count);
+
+	std::unique_ptr<CTraceEngine> Acquire();
+	void Release(std::unique_ptr<CTraceEngine> engine);
+
+private:
+	CEngineState clean_;
+	std::mutex lock_;
+	std::condition_variable cv_;
+	std::vector<std::unique_ptr<CTraceEngine>> free_;
+};
+
+/*
+one request per connection, a single line:
+	RENDER track region start ticks kind [rate]
+	STATS
+kind is "text" (the mm5test log), "trace" (binary trace as in mm5trace.cpp)
+or "pcm" (signed 16-bit little-endian mono); the reply is "OK\n" followed by
+the output until the server closes the connection, or "ERR message\n"; a
+driver error part way through ends a text log with such a line, and cuts a
+binary body short by closing the connection
+*/
+class CRenderServer {
+public:
+	CRenderServer(const CSoundBank &bank, const char *path, unsigned workers);
+	~CRenderServer();
+
+	// accepts connections until Stop is called, possibly from a signal handler
+	void Run();
+	void Stop() { stop_ = true; }
+
+	std::string Stats() const;
+
+private:
+	using clock = std::chrono::steady_clock;
+
+	struct CConnection {
+		int fd;
+		clock::time_point accepted;
+		std::string line;		// the request, read before a worker takes it
+		bool overlong;
+	};
+
+	struct CRequest {
+		unsigned track = 0u;
+		unsigned region = 0u;
+		int start = 0;
+		int ticks = 0;
+		std::string kind;
+		unsigned rate = 44100u;
+	};
+
+	void Worker();
+	void Handle(const CConnection &conn);
+	// binary is set once the body of a trace or PCM reply has started
+	uint64_t Render(int fd, CTraceEngine &engine, const CRequest &req, bool &binary);
+	void Record(clock::time_point accepted, bool ok);
+
+	static const size_t MAX_QUEUED;
+	static const int BLOCK_TICKS;
+
+	const CSoundBank &bank_;
+	const std::string path_;
+	int listen_ = -1;
+	CEnginePool pool_;
+	std::vector<std::thread> workers_;
+
+	mutable std::mutex lock_;
+	std::condition_variable cv_;
+	std::deque<CConnection> queue_;
+	volatile std::sig_atomic_t stop_ = 0;
+	bool quit_ = false;
+
+	// counters
+	const clock::time_point started_;
+	std::atomic<uint64_t> requests_ {0u};
+	std::atomic<uint64_t> failed_ {0u};
+	std::atomic<uint64_t> active_ {0u};
+	std::atomic<uint64_t> bytes_ {0u};
+	std::atomic<uint64_t> ticks_ {0u};
+	std::atomic<uint64_t> latencySum_ {0u};		// microseconds
+	std::atomic<uint64_t> latencyMax_ {0u};
+	std::atomic<uint64_t> latencyHist_[32];		// by log2 of microseconds
+};
+
+} // namespace MM5Sound
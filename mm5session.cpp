@@ -0,0 +1,191 @@
+#include "mm5session.h"
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+namespace MM5Sound {
+
+/*
+session scripts are text
+	# comment
+	ticks 10800
+	0 05
+	1200 pause
+	1320 resume
+	1400 2A 01
+one INIT call per line after the PLAY call count: the tick it comes before,
+the track number or command name, and the region if not 0
+*/
+
+namespace {
+	const char *const COMMANDS[] = {
+		"stop", "stop-sfx", "stop-music", "pause", "resume", "fade-in", "fade-out", "transpose",
+	};
+
+	const double TICKS_PER_MINUTE = 3600.;
+
+	uint8_t ParseTrack(const char *str) {
+		for (int i = 0; i < 8; ++i)
+			if (!strcmp(str, COMMANDS[i]))
+				return static_cast<uint8_t>(CMD_STOP_ALL + i);
+		char *end;
+		const long x = strtol(str, &end, 16);
+		if (*end || x < 0 || x > 0xFF)
+			throw std::runtime_error {std::string {"Bad track in session: "} + str};
+		return static_cast<uint8_t>(x);
+	}
+
+	// splitmix64, the same sequence everywhere
+	class CRandom {
+	public:
+		explicit CRandom(uint64_t seed) : x_(seed) { }
+
+		uint64_t Next() {
+			uint64_t z = (x_ += 0x9E3779B97F4A7C15ull);
+			z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+			z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+			return z ^ (z >> 31);
+		}
+		// [0, 1)
+		double Real() {
+			return (Next() >> 11) * (1. / 9007199254740992.);
+		}
+		// [lo, hi]
+		uint32_t Range(uint32_t lo, uint32_t hi) {
+			return lo + static_cast<uint32_t>(Next() % (hi - lo + 1u));
+		}
+		template <class T>
+		const T &Pick(const std::vector<T> &v) {
+			return v[Next() % v.size()];
+		}
+
+	private:
+		uint64_t x_;
+	};
+
+	class CTrackTable : public CEngine {
+	public:
+		using CEngine::CEngine;
+
+		// music and sound effects, by the first byte of the song header
+		void Split(std::vector<uint8_t> &music, std::vector<uint8_t> &sfx) const {
+			for (uint8_t track = 0; track < TRACK_COUNT; ++track) {
+				const uint8_t x = track << 1;
+				const uint16_t adr = chain(ReadCallback(SONG_TABLE + 2 + x), ReadCallback(SONG_TABLE + 3 + x));
+				if (adr)
+					(ReadCallback(adr) ? sfx : music).push_back(track);
+			}
+		}
+	};
+}
+
+void CSession::Save(FILE *f) const {
+	fprintf(f, "ticks %u\n", ticks);
+	for (const auto &x : events) {
+		if (x.track >= CMD_STOP_ALL && x.track <= CMD_TRANSPOSE)
+			fprintf(f, "%u %s", x.tick, COMMANDS[x.track - CMD_STOP_ALL]);
+		else
+			fprintf(f, "%u %02X", x.tick, x.track);
+		if (x.region)
+			fprintf(f, " %02X", x.region);
+		fputc('\n', f);
+	}
+}
+
+void CSession::Load(FILE *f) {
+	ticks = 0u;
+	events.clear();
+	char line[256];
+	while (fgets(line, sizeof(line), f)) {
+		char a[64], b[64], c[64];
+		const int n = sscanf(line, "%63s %63s %63s", a, b, c);
+		if (n <= 0 || a[0] == '#')
+			continue;
+		if (!strcmp(a, "ticks") && n == 2) {
+			ticks = static_cast<uint32_t>(strtoul(b, nullptr, 10));
+			continue;
+		}
+		if (n < 2)
+			throw std::runtime_error {std::string {"Bad line in session: "} + line};
+		char *end;
+		const unsigned long tick = strtoul(a, &end, 10);
+		if (*end || (!events.empty() && tick < events.back().tick))
+			throw std::runtime_error {std::string {"Bad tick in session: "} + a};
+		events.push_back({static_cast<uint32_t>(tick), ParseTrack(b),
+			static_cast<uint8_t>(n >= 3 ? strtoul(c, nullptr, 16) : 0u)});
+	}
+	if (!events.empty())
+		ticks = std::max(ticks, events.back().tick + 1u);
+}
+
+void CSession::LoadLog(FILE *f) {
+	ticks = 0u;
+	events.clear();
+	char line[256];
+	while (fgets(line, sizeof(line), f)) {
+		unsigned track, region;
+		int tick;
+		if (sscanf(line, "INIT(%x,%x)", &track, &region) == 2)
+			events.push_back({ticks, static_cast<uint8_t>(track), static_cast<uint8_t>(region)});
+		else if (sscanf(line, "PLAY(%d)", &tick) == 1)
+			++ticks;
+	}
+}
+
+CSession GenerateSession(const CSoundBank &bank, const CSessionConfig &config, uint64_t seed) {
+	std::vector<uint8_t> music, sfx;
+	CTrackTable {bank}.Split(music, sfx);
+	if (music.empty())
+		throw std::runtime_error {"No music tracks in the sound bank"};
+
+	CRandom rng {seed};
+	CSession s;
+	s.ticks = config.ticks;
+	const auto add = [&] (uint32_t tick, uint8_t track) {
+		if (tick < s.ticks)
+			s.events.push_back({tick, track, config.region});
+	};
+	const double pSFX = config.sfxPerMinute / TICKS_PER_MINUTE;
+	const double pPause = config.pausesPerHour / (TICKS_PER_MINUTE * 60.);
+	const double pSwitch = config.switchesPerHour / (TICKS_PER_MINUTE * 60.);
+
+	add(0u, rng.Pick(music));
+	uint32_t busy = 0u;		// no pause or switch until then
+	for (uint32_t t = 1u; t < s.ticks; ++t) {
+		if (!sfx.empty() && rng.Real() < pSFX) {
+			const unsigned n = rng.Range(1u, std::max(config.maxBurst, 1u));
+			for (uint32_t i = 0, at = t; i < n; ++i, at += rng.Range(2u, 12u))
+				add(at, rng.Pick(sfx));
+		}
+		if (t < busy)
+			continue;
+		if (rng.Real() < pPause) {
+			const uint32_t resume = t + rng.Range(30u, 600u);
+			add(t, CMD_PAUSE);
+			add(resume, CMD_RESUME);
+			busy = resume + 1u;
+		}
+		else if (rng.Real() < pSwitch) {
+			// stage changes fade out first, boss and jingle cuts do not
+			uint32_t at = t;
+			if (rng.Real() < .75) {
+				add(t, CMD_FADE_OUT);
+				at += rng.Range(60u, 240u);
+			}
+			if (rng.Real() < .1)
+				add(at, CMD_STOP_SFX);
+			add(at, rng.Pick(music));
+			if (rng.Real() < .1)
+				add(at + 1u, CMD_FADE_IN);
+			busy = at + 2u;
+		}
+	}
+	std::stable_sort(s.events.begin(), s.events.end(), [] (const CSessionEvent &a, const CSessionEvent &b) {
+		return a.tick < b.tick;
+	});
+	return s;
+}
+
+} // namespace MM5Sound
@@ -0,0 +1,78 @@
+#pragma once
+
+#include "mm5sound.h"
+#include "mm5constants.h"
+#include <cstdint>
+#include <cstdio>
+#include <vector>
+
+namespace MM5Sound {
+
+class CSoundBank;
+
+// INIT calls made before PLAY(tick)
+struct CSessionEvent {
+	uint32_t tick;
+	uint8_t track;
+	uint8_t region;
+};
+
+// a game session as the driver sees it: a timed list of INIT calls over a
+// number of PLAY calls
+struct CSession {
+	uint32_t ticks = 0u;
+	std::vector<CSessionEvent> events;	// by tick, in call order
+
+	// text, one "tick track [region]" line per call; control commands may
+	// be given by name, see mm5session.cpp
+	void Save(FILE *f) const;
+	void Load(FILE *f);
+	// INIT(tt,rr) and PLAY(n) lines of an NSFPlay-style log, as mm5test
+	// writes them; other lines are skipped
+	void LoadLog(FILE *f);
+};
+
+struct CSessionConfig {
+	uint32_t ticks = 10800u;
+	uint8_t region = 0u;
+	double sfxPerMinute = 30.;		// bursts of sound effects
+	unsigned maxBurst = 4u;			// effects per burst
+	double pausesPerHour = 12.;
+	double switchesPerHour = 40.;	// music changes, most of them after a fade
+};
+
+// a random session over the music and sound effects of the bank, the same
+// for the same seed
+CSession GenerateSession(const CSoundBank &bank, const CSessionConfig &config, uint64_t seed);
+
+// passes calls through to another player and notes the INIT calls
+class CSessionRecorder : public ISongPlayer {
+public:
+	explicit CSessionRecorder(ISongPlayer &player) : player_(player) { }
+
+	void CallINIT(uint8_t track, uint8_t region) override {
+		session_.events.push_back({session_.ticks, track, region});
+		player_.CallINIT(track, region);
+	}
+	void CallPLAY() override {
+		++session_.ticks;
+		player_.CallPLAY();
+	}
+	void BREAK() const override {
+		player_.BREAK();
+	}
+	uint8_t ReadCallback(uint16_t adr) const override {
+		return player_.ReadCallback(adr);
+	}
+	void WriteCallback(uint16_t adr, uint8_t value) override {
+		player_.WriteCallback(adr, value);
+	}
+
+	const CSession &Session() const { return session_; }
+
+private:
+	ISongPlayer &player_;
+	CSession session_;
+};
+
+} // namespace MM5Sound
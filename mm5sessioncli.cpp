@@ -0,0 +1,281 @@
+#include "mm5session.h"
+#include "mm5fingerprint.h"
+#include "mm5rom.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace MM5Sound;
+
+namespace {
+
+using clock = std::chrono::steady_clock;
+
+void Usage() {
+	fprintf(stderr,
+		"usage: mm5session gen rom out [-t ticks] [-d sfx/min] [-b burst] [-p pauses/h]\n"
+		"                  [-m switches/h] [-s seed]\n"
+		"       mm5session capture log out\n"
+		"       mm5session bench rom [session...] [-n sessions] [-j threads] [gen options]\n"
+		"  gen writes a random game session: music, bursts of sound effects, pauses,\n"
+		"  fades and music changes; capture turns an NSFPlay-style log of INIT and\n"
+		"  PLAY calls into a session; bench replays the given sessions, or -n\n"
+		"  generated ones, on a pool of threads and reports the time of each tick\n");
+}
+
+// log-linear buckets, 32 per power of two, exact below 64 ns
+class CLatency {
+public:
+	void Add(uint64_t ns) {
+		++counts_[Bucket(ns)];
+		max_ = std::max(max_, ns);
+		++total_;
+	}
+	void Merge(const CLatency &other) {
+		for (size_t i = 0; i < BUCKETS; ++i)
+			counts_[i] += other.counts_[i];
+		max_ = std::max(max_, other.max_);
+		total_ += other.total_;
+	}
+	uint64_t Percentile(double p) const {
+		const uint64_t rank = static_cast<uint64_t>(std::ceil(p / 100. * total_));
+		uint64_t seen = 0u;
+		for (size_t i = 0; i < BUCKETS; ++i)
+			if ((seen += counts_[i]) >= rank && counts_[i])
+				return std::min(Value(i), max_);
+		return max_;
+	}
+	uint64_t Max() const { return max_; }
+	uint64_t Count() const { return total_; }
+
+private:
+	static const size_t BUCKETS = 64u + 58u * 32u;
+
+	static size_t Bucket(uint64_t ns) {
+		if (ns < 64u)
+			return static_cast<size_t>(ns);
+		int log = 63 - __builtin_clzll(ns);
+		if (log > 63)
+			log = 63;
+		return 64u + (log - 6) * 32u + ((ns >> (log - 5)) & 31u);
+	}
+	// upper end of a bucket
+	static uint64_t Value(size_t i) {
+		if (i < 64u)
+			return i;
+		const int log = static_cast<int>((i - 64u) / 32u) + 6;
+		return ((32u + (i - 64u) % 32u + 1u) << (log - 5)) - 1u;
+	}
+
+	uint64_t counts_[BUCKETS] = { };
+	uint64_t max_ = 0u;
+	uint64_t total_ = 0u;
+};
+
+class CReplayEngine : public CEngine {
+public:
+	using CEngine::CEngine;
+
+	// the INIT calls of a tick count towards its time, as a host sees it
+	void Play(const CSession &s, CLatency &latency) {
+		auto next = s.events.begin();
+		for (uint32_t t = 0; t < s.ticks; ++t) {
+			const auto t0 = clock::now();
+			for (; next != s.events.end() && next->tick == t; ++next)
+				Guard([&] { CallINIT(next->track, next->region); });
+			Guard([&] { CallPLAY(); });
+			latency.Add(std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() - t0).count());
+		}
+	}
+
+	uint64_t Hash() const { return hash_.Value(); }
+	unsigned long Errors() const { return errors_; }
+
+private:
+	template <class F>
+	void Guard(F f) {
+		try {
+			f();
+		}
+		catch (std::exception &) {
+			++errors_;
+		}
+	}
+
+	void WriteCallback(uint16_t adr, uint8_t value) override {
+		hash_.Add(adr).Add(value);
+	}
+
+	CHash64 hash_;
+	unsigned long errors_ = 0ul;
+};
+
+// the options gen and bench share; true if argv[i] was one of them
+bool GenOption(int argc, char **argv, int &i, CSessionConfig &cfg, uint64_t &seed) {
+	if (i + 1 >= argc)
+		return false;
+	const char *value = argv[i + 1];
+	if (!strcmp(argv[i], "-t"))
+		cfg.ticks = static_cast<uint32_t>(strtoul(value, nullptr, 10));
+	else if (!strcmp(argv[i], "-d"))
+		cfg.sfxPerMinute = atof(value);
+	else if (!strcmp(argv[i], "-b"))
+		cfg.maxBurst = static_cast<unsigned>(atoi(value));
+	else if (!strcmp(argv[i], "-p"))
+		cfg.pausesPerHour = atof(value);
+	else if (!strcmp(argv[i], "-m"))
+		cfg.switchesPerHour = atof(value);
+	else if (!strcmp(argv[i], "-s"))
+		seed = strtoull(value, nullptr, 0);
+	else
+		return false;
+	++i;
+	return true;
+}
+
+void Save(const CSession &s, const char *fname) {
+	FILE *f = fopen(fname, "w");
+	if (!f)
+		throw std::runtime_error {std::string {"Cannot write "} + fname};
+	fprintf(f, "# mm5session: %zu INIT calls over %u ticks\n", s.events.size(), s.ticks);
+	s.Save(f);
+	if (fclose(f))
+		throw std::runtime_error {std::string {"Cannot write "} + fname};
+}
+
+int Gen(int argc, char **argv) {
+	CSessionConfig cfg;
+	uint64_t seed = 1u;
+	for (int i = 4; i < argc; ++i)
+		if (!GenOption(argc, argv, i, cfg, seed)) {
+			Usage();
+			return 1;
+		}
+	const CSoundBank bank {argv[2]};
+	Save(GenerateSession(bank, cfg, seed), argv[3]);
+	return 0;
+}
+
+int Capture(int argc, char **argv) {
+	FILE *f = fopen(argv[2], "r");
+	if (!f)
+		throw std::runtime_error {std::string {"Cannot open "} + argv[2]};
+	CSession s;
+	s.LoadLog(f);
+	fclose(f);
+	Save(s, argv[3]);
+	fprintf(stderr, "%zu INIT calls over %u ticks\n", s.events.size(), s.ticks);
+	return 0;
+}
+
+int Bench(int argc, char **argv) {
+	CSessionConfig cfg;
+	uint64_t seed = 1u;
+	unsigned count = 1000u;
+	unsigned threads = std::max(std::thread::hardware_concurrency(), 1u);
+	std::vector<CSession> sessions;
+	for (int i = 3; i < argc; ++i) {
+		if (GenOption(argc, argv, i, cfg, seed))
+			continue;
+		if (!strcmp(argv[i], "-n") && i + 1 < argc)
+			count = static_cast<unsigned>(atoi(argv[++i]));
+		else if (!strcmp(argv[i], "-j") && i + 1 < argc)
+			threads = std::max(atoi(argv[++i]), 1);
+		else if (argv[i][0] != '-') {
+			FILE *f = fopen(argv[i], "r");
+			if (!f)
+				throw std::runtime_error {std::string {"Cannot open "} + argv[i]};
+			sessions.emplace_back();
+			try {
+				sessions.back().Load(f);
+			}
+			catch (...) {
+				fclose(f);
+				throw;
+			}
+			fclose(f);
+		}
+		else {
+			Usage();
+			return 1;
+		}
+	}
+
+	const CSoundBank bank {argv[2]};
+	if (sessions.empty())
+		for (unsigned i = 0; i < count; ++i)
+			sessions.push_back(GenerateSession(bank, cfg, seed + i));
+	uint64_t ticks = 0u, calls = 0u;
+	for (const auto &s : sessions) {
+		ticks += s.ticks;
+		calls += s.events.size();
+	}
+
+	std::vector<uint64_t> hashes(sessions.size());
+	std::vector<CLatency> latency(threads);
+	std::atomic<size_t> next {0u};
+	std::atomic<unsigned long> errors {0ul};
+	const auto worker = [&] (unsigned id) {
+		for (size_t i; (i = next++) < sessions.size(); ) {
+			CReplayEngine engine {bank};
+			engine.Play(sessions[i], latency[id]);
+			hashes[i] = engine.Hash();
+			errors += engine.Errors();
+		}
+	};
+	const auto t0 = clock::now();
+	std::vector<std::thread> pool;
+	for (unsigned i = 1; i < threads; ++i)
+		pool.emplace_back(worker, i);
+	worker(0);
+	for (auto &x : pool)
+		x.join();
+	const double t = std::chrono::duration<double>(clock::now() - t0).count();
+
+	CLatency all;
+	for (const auto &x : latency)
+		all.Merge(x);
+	CHash64 hash;
+	for (uint64_t x : hashes)
+		hash.Add(x);
+	printf("%zu sessions, %llu ticks, %llu INIT calls on %u threads in %.3f s\n",
+		sessions.size(), static_cast<unsigned long long>(ticks), static_cast<unsigned long long>(calls), threads, t);
+	printf("%.0f ticks/s  %016llX  %lu errors\n", ticks / t,
+		static_cast<unsigned long long>(hash.Value()), errors.load());
+	printf("tick latency ns: p50 %llu  p90 %llu  p99 %llu  p99.9 %llu  max %llu\n",
+		static_cast<unsigned long long>(all.Percentile(50.)), static_cast<unsigned long long>(all.Percentile(90.)),
+		static_cast<unsigned long long>(all.Percentile(99.)), static_cast<unsigned long long>(all.Percentile(99.9)),
+		static_cast<unsigned long long>(all.Max()));
+	return 0;
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+	if (argc < 3) {
+		Usage();
+		return 1;
+	}
+	try {
+		const std::string mode = argv[1];
+		if (mode == "gen" && argc >= 4)
+			return Gen(argc, argv);
+		if (mode == "capture" && argc >= 4)
+			return Capture(argc, argv);
+		if (mode == "bench")
+			return Bench(argc, argv);
+		Usage();
+	}
+	catch (std::exception &e) {
+		fprintf(stderr, "%s\n", e.what());
+	}
+	return 1;
+}
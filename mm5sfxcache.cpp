@@ -0,0 +1,242 @@
+#include "mm5sfxcache.h"
+#include "mm5fingerprint.h"
+#include <chrono>
+#include <cstring>
+
+namespace MM5Sound {
+
+namespace {
+	const uint32_t UNCACHEABLE = 0xFFFFFFFEu;
+	const int WARM_TICKS = 3600;
+}
+
+CSFXCacheEngine::CSFXCacheEngine(const CSoundBank &bank, size_t maxEntries) :
+	CEngine(bank), maxEntries_(maxEntries)
+{
+	const auto t0 = std::chrono::steady_clock::now();
+	uint8_t music = 0xFF;
+	for (uint8_t track = 0; track < TRACK_COUNT && music == 0xFF; ++track) {
+		const uint8_t x = track << 1;
+		const uint16_t adr = chain(ReadCallback(SONG_TABLE + 2 + x), ReadCallback(SONG_TABLE + 3 + x));
+		if (adr && !ReadCallback(adr))
+			music = track;
+	}
+	for (uint8_t track = 0; track < TRACK_COUNT; ++track)
+		if (IsSFX(track)) {
+			Warm(0xFF, track);
+			if (music != 0xFF)
+				Warm(music, track);
+		}
+	stats_ = CSFXCacheStats { };
+	stats_.warmup = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+}
+
+void CSFXCacheEngine::StepSFXChannel() {
+	Step();
+}
+
+bool CSFXCacheEngine::IsSFX(uint8_t track) const {
+	// same lookup as Func8118
+	if (track >= 0xF0u)
+		return false;
+	while (track >= TRACK_COUNT)
+		track -= TRACK_COUNT;
+	const uint8_t x = track << 1;
+	const uint16_t adr = chain(ReadCallback(SONG_TABLE + 2 + x), ReadCallback(SONG_TABLE + 3 + x));
+	return adr && ReadCallback(adr);
+}
+
+CSFXCacheStats CSFXCacheEngine::Stats() const {
+	CSFXCacheStats s = stats_;
+	s.entries = static_cast<uint32_t>(steps_.size());
+	s.bytes = steps_.capacity() * sizeof(CStep) + writes_.capacity() * sizeof(uint16_t) +
+		index_.bucket_count() * sizeof(void *) + index_.size() * (sizeof(uint64_t) + sizeof(uint32_t) + sizeof(void *));
+	return s;
+}
+
+void CSFXCacheEngine::WriteCallback(uint16_t adr, uint8_t value) {
+	if (capture_)
+		capture_->push_back(((adr - 0x4000) << 8) | value);
+	else if (!quiet_)
+		Output(adr, value);
+}
+
+void CSFXCacheEngine::Warm(uint8_t music, uint8_t sfx) {
+	CEngineState fresh;
+	SaveState(fresh);
+	quiet_ = true;
+	try {
+		if (music != 0xFF)
+			CallINIT(music, 0);
+		CallINIT(sfx, 0);
+		for (int t = 0; t < WARM_TICKS && sfx_currentPtr; ++t)
+			CallPLAY();
+	}
+	catch (std::exception &) {
+		// as far as it goes
+	}
+	quiet_ = false;
+	LoadState(fresh);
+	for (auto &x : last_)
+		x = NONE;
+}
+
+void CSFXCacheEngine::MakeKey(uint8_t *key) const {
+	// everything $82DE reads apart from the ROM and scratch bytes
+	*key++ = X_;
+	for (int k = 0; k < 10; ++k)
+		*key++ = mem_[0x700 + X_ + k * 4];
+	*key++ = mem_[0x77C + X_];
+	*key++ = mem_[0xC0];
+	*key++ = mem_[0xCC];
+	*key++ = mem_[0xCF];
+	for (int i = 0xD2; i <= 0xD8; ++i)
+		*key++ = mem_[i];
+	*key++ = sfx_currentPtr & 0xFF;
+	*key++ = sfx_currentPtr >> 8;
+	// without an instrument the step uses the envelope left by the last one
+	const uint16_t env = mem_[0x700 + X_] ? 0u : var_envelopePtr;
+	*key++ = env & 0xFF;
+	*key++ = env >> 8;
+}
+
+void CSFXCacheEngine::Run(uint8_t fill, std::vector<uint16_t> &writes, CStep &post) {
+	A_ = Y_ = fill;
+	for (int i = 0xC1; i <= 0xC4; ++i)
+		mem_[i] = fill;
+	if (mem_[0x700 + X_])
+		var_envelopePtr = fill * 0x101u;
+	writes.clear();
+	capture_ = &writes;
+	try {
+		Func82DE();
+	}
+	catch (...) {
+		capture_ = nullptr;
+		throw;
+	}
+	capture_ = nullptr;
+
+	for (int k = 0; k < 10; ++k)
+		post.chan[k] = mem_[0x700 + X_ + k * 4];
+	post.period = mem_[0x77C + (X_ & 0x03)];
+	post.zp[0] = mem_[0xC0];
+	post.zp[1] = mem_[0xCF];
+	for (int i = 0; i < 7; ++i)
+		post.zp[2 + i] = mem_[0xD2 + i];
+	post.x = X_;
+	post.scratch[0] = A_;
+	post.scratch[1] = Y_;
+	for (int i = 0; i < 4; ++i)
+		post.scratch[2 + i] = mem_[0xC1 + i];
+	post.envelopePtr = var_envelopePtr;
+	post.ptr = sfx_currentPtr;
+}
+
+void CSFXCacheEngine::Apply(const CStep &s) {
+	if (!quiet_)
+		for (uint32_t i = 0; i < s.count; ++i) {
+			const uint16_t w = writes_[s.writes + i];
+			Output(0x4000 + (w >> 8), w & 0xFF);
+		}
+	const uint8_t X = X_;
+	for (int k = 0; k < 10; ++k)
+		mem_[0x700 + X + k * 4] = s.chan[k];
+	mem_[0x77C + X] = s.period;
+	mem_[0xC0] = s.zp[0];
+	mem_[0xCF] = s.zp[1];
+	for (int i = 0; i < 7; ++i)
+		mem_[0xD2 + i] = s.zp[2 + i];
+	X_ = s.x;
+	if (!(s.keep & 0x01))
+		A_ = s.scratch[0];
+	if (!(s.keep & 0x02))
+		Y_ = s.scratch[1];
+	for (int i = 0; i < 4; ++i)
+		if (!(s.keep & (0x04 << i)))
+			mem_[0xC1 + i] = s.scratch[2 + i];
+	if (!(s.keep & 0x40))
+		var_envelopePtr = s.envelopePtr;
+	sfx_currentPtr = s.ptr;
+}
+
+void CSFXCacheEngine::Step() {
+	const uint8_t X = X_;
+	uint8_t key[KEY_SIZE];
+	MakeKey(key);
+
+	// most steps follow the one that followed last time
+	const uint32_t prev = last_[X];
+	uint32_t i = prev != NONE ? steps_[prev].next : NONE;
+	if (i == NONE || memcmp(steps_[i].key, key, KEY_SIZE)) {
+		const uint64_t h = CHash64 { }.Add(key, KEY_SIZE).Value();
+		const auto it = index_.find(h);
+		if (it != index_.end())
+			i = it->second != UNCACHEABLE && !memcmp(steps_[it->second].key, key, KEY_SIZE) ? it->second : NONE;
+		else if (steps_.size() < maxEntries_) {
+			// run it twice with different scratch contents to see what the
+			// step writes and whether it depends on anything beyond its key;
+			// this is a heuristic, not a proof: a step that reads a scratch
+			// byte and happens to do the same for $00 and $FF is cached
+			// as if it did not, which only the comparison against CEngine
+			// in mm5sfxcachetest would catch
+			CEngineState s0;
+			SaveState(s0);
+			CStep a, b;
+			std::vector<uint16_t> wa, wb;
+			try {
+				Run(0x00, wa, a);
+				LoadState(s0);
+				Run(0xFF, wb, b);
+				LoadState(s0);
+			}
+			catch (std::exception &) {
+				// let the live step throw where the driver would
+				LoadState(s0);
+				last_[X] = NONE;
+				Func82DE();
+				return;
+			}
+			bool same = wa == wb && !memcmp(a.chan, b.chan, sizeof(a.chan)) && a.period == b.period &&
+				!memcmp(a.zp, b.zp, sizeof(a.zp)) && a.x == b.x && a.ptr == b.ptr;
+			a.keep = 0u;
+			for (int k = 0; k < 6; ++k)
+				if (a.scratch[k] == 0x00 && b.scratch[k] == 0xFF)
+					a.keep |= 1 << k;
+				else if (a.scratch[k] != b.scratch[k])
+					same = false;
+			if (a.envelopePtr == 0x0000 && b.envelopePtr == 0xFFFF && mem_[0x700 + X])
+				a.keep |= 0x40;
+			else if (a.envelopePtr != b.envelopePtr)
+				same = false;
+
+			if (same) {
+				memcpy(a.key, key, KEY_SIZE);
+				a.writes = static_cast<uint32_t>(writes_.size());
+				a.count = static_cast<uint32_t>(wa.size());
+				writes_.insert(writes_.end(), wa.begin(), wa.end());
+				i = static_cast<uint32_t>(steps_.size());
+				steps_.push_back(a);
+				index_.emplace(h, i);
+			}
+			else {
+				index_.emplace(h, UNCACHEABLE);
+				++stats_.uncacheable;
+			}
+		}
+		if (i == NONE) {
+			++stats_.misses;
+			last_[X] = NONE;
+			Func82DE();
+			return;
+		}
+	}
+
+	++stats_.hits;
+	if (prev != NONE)
+		steps_[prev].next = i;
+	last_[X] = i;
+	Apply(steps_[i]);
+}
+
+} // namespace MM5Sound
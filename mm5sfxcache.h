@@ -0,0 +1,84 @@
+#pragma once
+
+#include "mm5sound.h"
+#include <cstddef>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+namespace MM5Sound {
+
+struct CSFXCacheStats {
+	uint64_t hits = 0u;
+	uint64_t misses = 0u;
+	uint64_t uncacheable = 0u;	// steps that read more than their key
+	uint32_t entries = 0u;
+	size_t bytes = 0u;			// memory held by the cache
+	double warmup = 0.;			// seconds spent pre-rendering
+};
+
+// engine that remembers what each SFX channel step ($82DE) did and replays
+// its register writes and state changes instead of running the sequencer and
+// envelope code again; a step is keyed by the SFX channel memory, its period
+// cache and the zero page it reads, and everything else, headers, music,
+// masking and fades, runs as on CEngine; whether a step also depends on the
+// scratch state outside its key is only probed, by running it with two
+// different fills, see Step
+//
+// every sound effect is pre-rendered at construction, once over silence and
+// once over music, and steps met later are learned as they run
+class CSFXCacheEngine : public CEngine {
+public:
+	explicit CSFXCacheEngine(const CSoundBank &bank, size_t maxEntries = 0x10000u);
+
+	using CEngine::CallINIT;
+	using CEngine::CallPLAY;
+
+	bool IsSFX(uint8_t track) const;
+	CSFXCacheStats Stats() const;
+
+protected:
+	// register writes, live or cached
+	virtual void Output(uint16_t adr, uint8_t value) { }
+
+private:
+	static const size_t KEY_SIZE = 26u;
+	static const uint32_t NONE = 0xFFFFFFFFu;
+
+	struct CStep {
+		uint8_t key[KEY_SIZE];
+		uint8_t chan[10];		// $0700 + X, every 4 bytes
+		uint8_t period;
+		uint8_t zp[9];			// $C0, $CF, $D2 - $D8
+		uint8_t x;
+		uint8_t scratch[6];		// A, Y, $C1 - $C4
+		uint16_t envelopePtr;
+		uint8_t keep;			// bit n: scratch[n] is left alone, bit 6: envelopePtr
+		uint16_t ptr;
+		uint32_t writes;		// into writes_
+		uint32_t count;
+		uint32_t next = NONE;	// the step that followed last time
+	};
+
+	void WriteCallback(uint16_t adr, uint8_t value) final;
+	// $82DE taken from the cache where it can be
+	void StepSFXChannel() override;
+
+	void Warm(uint8_t music, uint8_t sfx);
+	void Step();
+	void MakeKey(uint8_t *key) const;
+	// runs $82DE with the scratch state set to `fill`
+	void Run(uint8_t fill, std::vector<uint16_t> &writes, CStep &post);
+	void Apply(const CStep &s);
+
+	std::vector<CStep> steps_;
+	std::vector<uint16_t> writes_;
+	std::unordered_map<uint64_t, uint32_t> index_;
+	const size_t maxEntries_;
+	uint32_t last_[4] = {NONE, NONE, NONE, NONE};
+	std::vector<uint16_t> *capture_ = nullptr;
+	bool quiet_ = false;
+	CSFXCacheStats stats_;
+};
+
+} // namespace MM5Sound
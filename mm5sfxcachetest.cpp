@@ -0,0 +1,158 @@
+#include "mm5sfxcache.h"
+#include "mm5trace.h"
+#include "mm5rom.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <stdexcept>
+#include <vector>
+
+using namespace MM5Sound;
+
+namespace {
+
+const int TRACKS = 76;
+
+using clock = std::chrono::steady_clock;
+
+class CTracedCache : public CSFXCacheEngine {
+public:
+	CTracedCache(const CSoundBank &bank, CTrace *trace) : CSFXCacheEngine(bank), trace_(trace) { }
+
+	void SetTrace(CTrace *trace) { trace_ = trace; }
+
+private:
+	void Output(uint16_t adr, uint8_t value) override {
+		if (trace_)
+			trace_->Write(adr, value);
+	}
+
+	CTrace *trace_;
+};
+
+// the first track, then the second one at tick `at`
+template <class T>
+void Play(T &engine, CTrace &trace, uint8_t first, uint8_t second, int at, int ticks) {
+	trace.Clear(-1);
+	trace.NewFrame();
+	engine.CallINIT(first, 0);
+	for (int t = 0; t < ticks; ++t) {
+		trace.NewFrame();
+		if (t == at)
+			engine.CallINIT(second, 0);
+		engine.CallPLAY();
+	}
+}
+
+// every sound effect over every track, and over itself, at a few trigger
+// times must give exactly the writes of CEngine
+int CheckPairs(const CSoundBank &bank, CTracedCache &cache, int ticks) {
+	CEngineState fresh;
+	cache.SaveState(fresh);
+	int failed = 0;
+	for (int b = 0; b < TRACKS; ++b) {
+		if (!cache.IsSFX(b))
+			continue;
+		for (int a = 0; a < TRACKS; ++a)
+			for (int at : {0, ticks / 4 + 1, ticks / 2 + 3}) {
+				CTrace ref, out;
+				CTraceEngine engine {bank, &ref};
+				cache.LoadState(fresh);
+				cache.SetTrace(&out);
+				bool threw = false;
+				try {
+					Play(engine, ref, a, b, at, ticks);
+				}
+				catch (std::exception &) {
+					threw = true;
+				}
+				try {
+					Play(cache, out, a, b, at, ticks);
+				}
+				catch (std::exception &) {
+					threw = !threw;
+				}
+				// a driver error has to come at the same write
+				if (threw || !(ref == out)) {
+					printf("Tracks %02X, %02X at tick %d: writes differ from CEngine\n", a, b, at);
+					++failed;
+				}
+			}
+	}
+	cache.SetTrace(nullptr);
+	cache.LoadState(fresh);
+	return failed;
+}
+
+// random sound effects over music, the same triggers on both engines
+template <class T>
+double Storm(T &engine, const std::vector<uint8_t> &music, const std::vector<uint8_t> &sfx, int ticks, int rate) {
+	engine.CallINIT(music.front(), 0);
+	srand(1);
+	const double perTick = rate / 60.0988;
+	double due = 0.;
+	const auto t0 = clock::now();
+	for (int t = 0; t < ticks; ++t) {
+		for (due += perTick; due >= 1.; due -= 1.)
+			engine.CallINIT(sfx[rand() % sfx.size()], 0);
+		try {
+			engine.CallPLAY();
+		}
+		catch (std::exception &) {
+			engine.CallINIT(music.front(), 0);
+		}
+	}
+	return std::chrono::duration<double>(clock::now() - t0).count();
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+	if (argc < 2) {
+		fprintf(stderr, "usage: %s rom [ticks] [triggers per second]\n", argv[0]);
+		return 1;
+	}
+	try {
+		const CSoundBank bank {argv[1]};
+		const int ticks = argc >= 3 ? atoi(argv[2]) : 600;
+		const int rate = argc >= 4 ? atoi(argv[3]) : 4;
+
+		CTracedCache cache {bank, nullptr};
+		auto s = cache.Stats();
+		printf("Warmup %.1f ms: %u steps, %zu bytes\n", s.warmup * 1e3, s.entries, s.bytes);
+
+		const int failed = CheckPairs(bank, cache, ticks);
+		if (failed) {
+			printf("%d track pairs failed.\n", failed);
+			return 1;
+		}
+		s = cache.Stats();
+		printf("All sound effects over all tracks match CEngine: %llu hits, %llu misses, %llu uncacheable, %u steps\n",
+			static_cast<unsigned long long>(s.hits), static_cast<unsigned long long>(s.misses),
+			static_cast<unsigned long long>(s.uncacheable), s.entries);
+
+		std::vector<uint8_t> sfx, music;
+		for (int i = 0; i < TRACKS; ++i)
+			(cache.IsSFX(i) ? sfx : music).push_back(i);
+		if (sfx.empty() || music.empty())
+			throw std::runtime_error {"Sound bank has no music or no sound effects"};
+		CTraceEngine live {bank};
+		CTracedCache cold {bank, nullptr};
+		const int n = ticks * 100;
+		const double tLive = Storm(live, music, sfx, n, rate);
+		const double tCache = Storm(cold, music, sfx, n, rate);
+		s = cold.Stats();
+		const double triggers = n * rate / 60.0988;
+		printf("%d ticks, %.0f triggers per second: live %.0f ticks/s, cached %.0f ticks/s\n",
+			n, rate * 1., n / tLive, n / tCache);
+		printf("per trigger: live %.2f us, cached %.2f us; %.1f%% of SFX steps cached, %u steps, %zu bytes\n",
+			tLive / triggers * 1e6, tCache / triggers * 1e6,
+			100. * s.hits / std::max<uint64_t>(s.hits + s.misses, 1u), s.entries, s.bytes);
+		return 0;
+	}
+	catch (std::exception &e) {
+		fprintf(stderr, "%s\n", e.what());
+		return 1;
+	}
+}
@@ -1,6 +1,8 @@
 #include "mm5sound.h"
-#include "mm5sndrom.h"
+#include "mm5rom.h"
 #include "mm5constants.h"
+#include <algorithm>
+#include <iterator>
 #include <stdexcept>
 
 
@@ -20,6 +22,10 @@ namespace {
 		x <<= 1;
 		return C;
 	}
+
+	// the driver hangs on longer runs; no valid stream comes near either
+	const unsigned MAX_COMMANDS = 0x400u;		// before a note
+	const unsigned MAX_HEADER_JUMPS = 0x100u;
 }
 
 
@@ -103,7 +109,7 @@ const uint16_t CEngine::INSTRUMENT_TABLE = 0x8ADB;
 
 
 
-CEngine::CEngine() {
+CEngine::CEngine(const CSoundBank &bank) : bank_(bank) {
 	for (int i = 0; i < 4; ++i) {
 		sfx_[3 - i] = new CSFXTrack(mem_, i);
 		mus_[3 - i] = new CMusicTrack(mem_, i | 0x28);
@@ -117,6 +123,58 @@ CEngine::~CEngine() {
 	}
 }
 
+void CEngine::SaveState(CEngineState &state) const {
+	std::copy(std::begin(mem_), std::end(mem_), state.mem);
+	SaveVariables(state);
+}
+
+void CEngine::SaveVariables(CEngineState &state) const {
+	state.A = A_;
+	state.X = X_;
+	state.Y = Y_;
+	state.envelopePtr = var_envelopePtr;
+	state.tickElapsed = var_tickElapsed;
+	state.tickCounter = var_tickCounter;
+	state.tempo = var_tempo;
+	state.globalTrsp = var_globalTrsp;
+	state.sfxPtr = sfx_currentPtr;
+	for (int i = 0; i < 4; ++i) {
+		const CMusicTrack &Chan = *mus_[i];
+		auto &x = state.music[i];
+		x.patternAdr = Chan.patternAdr;
+		x.octaveFlag = Chan.octaveFlag;
+		x.transpose = Chan.transpose;
+		x.noteWait = Chan.noteWait;
+		x.gateTime = Chan.gateTime;
+		x.sustainWait = Chan.sustainWait;
+		std::copy(std::begin(Chan.loopCount), std::end(Chan.loopCount), x.loopCount);
+	}
+}
+
+void CEngine::LoadState(const CEngineState &state) {
+	std::copy(std::begin(state.mem), std::end(state.mem), mem_);
+	A_ = state.A;
+	X_ = state.X;
+	Y_ = state.Y;
+	var_envelopePtr = state.envelopePtr;
+	var_tickElapsed = state.tickElapsed;
+	var_tickCounter = state.tickCounter;
+	var_tempo = state.tempo;
+	var_globalTrsp = state.globalTrsp;
+	sfx_currentPtr = state.sfxPtr;
+	for (int i = 0; i < 4; ++i) {
+		CMusicTrack &Chan = *mus_[i];
+		const auto &x = state.music[i];
+		Chan.patternAdr = x.patternAdr;
+		Chan.octaveFlag = x.octaveFlag;
+		Chan.transpose = x.transpose;
+		Chan.noteWait = x.noteWait;
+		Chan.gateTime = x.gateTime;
+		Chan.sustainWait = x.sustainWait;
+		std::copy(std::begin(x.loopCount), std::end(x.loopCount), Chan.loopCount);
+	}
+}
+
 void CEngine::CallINIT(uint8_t track, uint8_t region) {
 	// $8003 - $8005
 	A_ = track;
@@ -133,7 +191,11 @@ void CEngine::WriteCallback(uint16_t adr, uint8_t value) {
 }
 
 uint8_t CEngine::ReadCallback(uint16_t adr) const {
-	return MM5ROM.at(adr - 0x8000);
+	return bank_.Read(adr);
+}
+
+void CEngine::Fault(const char *what) const {
+	throw std::runtime_error {what};
 }
 
 CSFXTrack *CEngine::GetSFXTrack(uint8_t id) const {
@@ -168,6 +230,25 @@ uint16_t CEngine::Multiply(uint8_t a, uint8_t b) {
 	return res;
 }
 
+uint8_t CEngine::EnvRate(uint8_t rate) const {
+	// $8933, the 6502 reads on into the pitch table
+	if (rate >= sizeof(ENV_RATE_TABLE)) {
+		Fault("Envelope rate out of range");
+		rate = sizeof(ENV_RATE_TABLE) - 1;
+	}
+	return ENV_RATE_TABLE[rate];
+}
+
+uint16_t CEngine::NotePitch(uint8_t note) const {
+	// $895B, from note 1
+	const size_t n = sizeof(PITCH_TABLE) / sizeof(*PITCH_TABLE);
+	if (!note || note > n) {
+		Fault("Note out of range");
+		note = note ? n : 1;
+	}
+	return PITCH_TABLE[note - 1];
+}
+
 /*
 void CEngine::SwitchDispatch(FuncList_t funcs) {
 	// $8023 - $8039
@@ -187,8 +268,7 @@ void CEngine::StepDriver() {
 	// $806C - $80D7
 	if (mem_[0xC0] & 0x01)
 		return;
-	if (sfx_currentPtr)
-		Func8252();
+	StepSFXHeader();
 
 	var_tickElapsed = 0;
 	chain(var_tickElapsed, var_tickCounter) += var_tempo;
@@ -197,7 +277,7 @@ void CEngine::StepDriver() {
 	for (X_ = 0x03; X_ < 0x80; --X_) {
 		if (lsr(mem_[0xCF])) {
 			mem_[0xCF] |= 0x80;
-			Func82DE();
+			StepSFXChannel();
 		}
 		if (!(mem_[0xC0] & 0x02)) {
 			X_ = X_ | 0x28;
@@ -222,6 +302,15 @@ void CEngine::StepDriver() {
 	A_ = mem_[0xCD];
 }
 
+void CEngine::StepSFXHeader() {
+	if (sfx_currentPtr)
+		Func8252();
+}
+
+void CEngine::StepSFXChannel() {
+	Func82DE();
+}
+
 void CEngine::SilenceChannel(uint8_t id) {
 	// $80D8 - $80EB
 	uint16_t adr = 0x4000 | (((id & 0x03) ^ 0x03) << 2);
@@ -408,8 +497,18 @@ void CEngine::Func8252() {
 	}
 
 	A_ = 0;
-	bool C = false; // php/plp
-	while (true) {
+	ReadSFXHeader(false);
+}
+
+void CEngine::ReadSFXHeader(bool C) {
+	// $825D - $82DD
+	// C is the carry saved by php/plp
+	for (unsigned n = 0; ; ++n) {
+		if (n == MAX_HEADER_JUMPS) {
+			Fault("Runaway SFX header");
+			L81C8();
+			return;
+		}
 		A_ = mem_[0xC4] = GetSFXData();
 		if (asl(A_)) {
 			mem_[0xCE] = Y_;
@@ -495,7 +594,10 @@ void CEngine::Func82DE() {
 		ReleaseNote(X_);
 		return;
 	}
+	ReadSFXChannel();
+}
 
+void CEngine::ReadSFXChannel() {
 	// $830A - $8325
 	mem_[0xC4] = 0;
 	A_ = GetSFXData();
@@ -554,7 +656,7 @@ void CEngine::Func8326() {
 	case 0x02: CmdVolume(X_); break;
 	case 0x03: CmdPortamento(X_); break;
 	case 0x04: CmdDetune(X_); break;
-	default: throw std::runtime_error {"Unknown SFX command"};
+	default: Fault("Unknown SFX command"); break;	// ignored
 	}
 }
 
@@ -583,18 +685,29 @@ void CEngine::ProcessChannel(uint8_t id) {
 		}
 		Chan->noteWait -= var_tickElapsed;
 	}
+	ReadPattern(Chan);
+}
 
+void CEngine::ReadPattern(CMusicTrack *Chan) {
 	// $83CD - $83D9
 	uint8_t cmd;
-	while (true) {
+	for (unsigned n = 0; ; ++n) {
 		cmd = GetTrackData(Chan->index);
 		if (cmd >= 0x20u)
 			break;
+		if (n == MAX_COMMANDS) {
+			Fault("Runaway pattern");
+			CmdHalt(Chan->index);
+			return;
+		}
 		CommandDispatch(Chan->index, cmd);
-		if (cmd == 0x17)
+		if (cmd == 0x17 || !Chan->patternAdr)
 			return;
 	}
+	PlayNote(Chan, cmd);
+}
 
+void CEngine::PlayNote(CMusicTrack *Chan, uint8_t cmd) {
 	// $83DA - $840D
 	uint8_t lenMult = (cmd >> 5) - 1;
 	uint8_t ticks = NOTE_LENGTH_TRIPLET[lenMult];
@@ -679,7 +792,10 @@ void CEngine::CommandDispatch(uint8_t id, uint8_t fx) {
 	case 0x16: CmdGoto(id); break;
 	case 0x17: CmdHalt(id); break;
 	case 0x18: CmdDuty(id); break;
-	default: throw std::runtime_error {"Unknown command"};
+	default:
+		Fault("Unknown command");
+		CmdHalt(id);
+		break;
 	}
 }
 
@@ -903,7 +1019,7 @@ void CEngine::Func85DE(uint8_t id) {
 	}
 
 	// $862A - $8635
-	Func8636(id, PITCH_TABLE[mem_[0xC3] - 1]);
+	Func8636(id, NotePitch(mem_[0xC3]));
 }
 
 void CEngine::Func8636(uint8_t id, uint16_t pitch) {
@@ -947,7 +1063,7 @@ void CEngine::Func86BA(uint8_t id) {
 	case 2: break;
 	case 3: EnvelopeRelease(Chan->index); break;
 	case 4: return;
-	default: throw std::runtime_error {"unknown envelope state"};
+	default: Fault("unknown envelope state"); return;	// as if off
 	}
 
 	L8720(Chan->index); // merged
@@ -956,41 +1072,41 @@ void CEngine::Func86BA(uint8_t id) {
 void CEngine::EnvelopeAttack(uint8_t id) {
 	// $86D1 - $86E5
 	CSFXTrack *Chan = GetSFXTrack(id);
-	const auto attRate = ReadCallback(var_envelopePtr);
+	const auto attRate = EnvRate(ReadCallback(var_envelopePtr));
 
-	if (Chan->envLevel + ENV_RATE_TABLE[attRate] >= 0xF0u) {
+	if (Chan->envLevel + attRate >= 0xF0u) {
 		++Chan->envState;
 		Chan->envLevel = 0xF0;
 	}
 	else
-		Chan->envLevel += ENV_RATE_TABLE[attRate];
+		Chan->envLevel += attRate;
 }
 
 void CEngine::EnvelopeDecay(uint8_t id) {
 	// $86E6 - $8701
 	CSFXTrack *Chan = GetSFXTrack(id);
-	const auto decayRate = ReadCallback(var_envelopePtr + 1);
+	const auto decayRate = EnvRate(ReadCallback(var_envelopePtr + 1));
 	const auto sustainLv = ReadCallback(var_envelopePtr + 2);
 
-	if (!decayRate || Chan->envLevel < sustainLv + ENV_RATE_TABLE[decayRate]) {
+	if (!decayRate || Chan->envLevel < sustainLv + decayRate) {
 		++Chan->envState;
 		Chan->envLevel = sustainLv;
 	}
 	else
-		Chan->envLevel -= ENV_RATE_TABLE[decayRate];
+		Chan->envLevel -= decayRate;
 }
 
 void CEngine::EnvelopeRelease(uint8_t id) {
 	// $8702 - $871F
 	CSFXTrack *Chan = GetSFXTrack(id);
-	const auto relRate = ReadCallback(var_envelopePtr + 3);
+	const auto relRate = EnvRate(ReadCallback(var_envelopePtr + 3));
 
-	if (Chan->channelID == 0x01 || (relRate && Chan->envLevel < ENV_RATE_TABLE[relRate])) {
+	if (Chan->channelID == 0x01 || (relRate && Chan->envLevel < relRate)) {
 		++Chan->envState;
 		Chan->envLevel = 0;
 	}
 	else if (relRate)
-		Chan->envLevel -= ENV_RATE_TABLE[relRate];
+		Chan->envLevel -= relRate;
 }
 
 void CEngine::L8720(uint8_t id) {
@@ -1153,7 +1269,7 @@ void CEngine::L88A0(uint8_t id) {
 	if (Chan->envState & 0x20) {
 		if (Chan->portamento) {
 			auto &current = Chan->pitch;
-			const auto target = PITCH_TABLE[Chan->note - 1];
+			const auto target = NotePitch(Chan->note);
 
 			bool C = (Chan->portamento & 0x80) != 0;
 			uint8_t rate = Chan->portamento & 0x7F;
@@ -5,6 +5,8 @@
 
 namespace MM5Sound {
 
+class CSoundBank;
+
 struct CSFXTrack {
 	CSFXTrack(uint8_t *memory, uint8_t id);
 	virtual ~CSFXTrack() = default;
@@ -31,13 +33,34 @@ struct CMusicTrack : public CSFXTrack {
 
 	void Reset() override;
 
-	uint16_t patternAdr;	// $0728
-	uint8_t octaveFlag;	// $0730
-	uint8_t transpose;	// $0734
-	uint8_t noteWait;	// $0738
-	uint8_t gateTime;	// $073C
-	uint8_t sustainWait;	// $0740
-	uint8_t loopCount[4];	// $0744
+	uint16_t patternAdr = 0u;	// $0728
+	uint8_t octaveFlag = 0u;	// $0730
+	uint8_t transpose = 0u;	// $0734
+	uint8_t noteWait = 0u;	// $0738
+	uint8_t gateTime = 0u;	// $073C
+	uint8_t sustainWait = 0u;	// $0740
+	uint8_t loopCount[4] = { };	// $0744
+};
+
+// everything the driver keeps between calls, for checkpoints and forks
+struct CEngineState {
+	uint8_t mem[0x800];
+	uint8_t A, X, Y;
+	uint16_t envelopePtr;
+	uint8_t tickElapsed;
+	uint8_t tickCounter;
+	uint16_t tempo;
+	uint8_t globalTrsp;
+	uint16_t sfxPtr;
+	struct {
+		uint16_t patternAdr;
+		uint8_t octaveFlag;
+		uint8_t transpose;
+		uint8_t noteWait;
+		uint8_t gateTime;
+		uint8_t sustainWait;
+		uint8_t loopCount[4];
+	} music[4];
 };
 
 struct ISongPlayer {
@@ -51,17 +74,40 @@ struct ISongPlayer {
 
 class CEngine : public ISongPlayer {
 public:
-	CEngine();
+	explicit CEngine(const CSoundBank &bank);
 	~CEngine() override;
 
+	void SaveState(CEngineState &state) const;
+	void LoadState(const CEngineState &state);
+	// the driver RAM in place, and SaveState without it, for callers that
+	// follow only part of the state
+	const uint8_t *Memory() const { return mem_; }
+	void SaveVariables(CEngineState &state) const;
+
 protected:
 	void CallINIT(uint8_t track, uint8_t region) override;
 	void CallPLAY() override;
 	uint8_t ReadCallback(uint16_t adr) const override;
 	void WriteCallback(uint16_t adr, uint8_t value) override;
+	// driver errors: throws std::runtime_error unless overridden; if it
+	// returns, the driver skips the command, halts the channel or stops the
+	// sound effect, see the callers
+	virtual void Fault(const char *what) const;
+
+	// stream readers, overridden by the ahead-of-time compiled engine
+	virtual void ReadSFXHeader(bool C);
+	virtual void ReadSFXChannel();
+	virtual void ReadPattern(CMusicTrack *Chan);
+	// sound effect steps of StepDriver, overridden by engines that keep their
+	// own SFX state: the header read, then each channel the SFX holds, with X_
+	// the channel and $CF bit 7 set
+	virtual void StepSFXHeader();
+	virtual void StepSFXChannel();
 
-private:
 	uint16_t Multiply(uint8_t a, uint8_t b);
+	// table lookups by bank data, faulted and clamped past the end of the table
+	uint8_t EnvRate(uint8_t rate) const;
+	uint16_t NotePitch(uint8_t note) const;
 	uint8_t ReadROM(uint16_t adr);
 	void StepDriver();
 	void SilenceChannel(uint8_t id);
@@ -77,7 +123,9 @@ private:
 	void Func8326();
 	uint8_t GetSFXData();
 	void ProcessChannel(uint8_t id);
-	void CommandDispatch(uint8_t id, uint8_t fx);
+	// virtual for CPatternTap
+	virtual void PlayNote(CMusicTrack *Chan, uint8_t cmd);
+	virtual void CommandDispatch(uint8_t id, uint8_t fx);
 	uint8_t GetTrackData(uint8_t id);
 	void ReleaseNote(uint8_t id);
 	void Func85AE();
@@ -128,12 +176,12 @@ private:
 	CMusicTrack *GetMusicTrack(uint8_t id) const;
 
 protected:
-	uint16_t var_envelopePtr; // $C5 - $C6
-	uint8_t var_tickElapsed; // $C7
-	uint8_t var_tickCounter; // $C8
-	uint16_t var_tempo; // $C9 - $CA
-	uint8_t var_globalTrsp; // $CB
-	uint16_t sfx_currentPtr; // $D0 - $D1
+	uint16_t var_envelopePtr = 0u; // $C5 - $C6
+	uint8_t var_tickElapsed = 0u; // $C7
+	uint8_t var_tickCounter = 0u; // $C8
+	uint16_t var_tempo = 0u; // $C9 - $CA
+	uint8_t var_globalTrsp = 0u; // $CB
+	uint16_t sfx_currentPtr = 0u; // $D0 - $D1
 
 	static const uint8_t NOTE_LENGTH_TRIPLET[];
 	static const uint8_t NOTE_LENGTH[];
@@ -144,6 +192,8 @@ protected:
 	static const uint16_t SONG_TABLE;
 	static const uint16_t INSTRUMENT_TABLE;
 
+	const CSoundBank &bank_;
+
 	uint8_t mem_[0x800] = { };
 	uint8_t A_ = 0u, X_ = 0u, Y_ = 0u;
 
@@ -0,0 +1,450 @@
+#include "mm5store.h"
+#include "mm5fingerprint.h"
+#include "mm5trace.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace MM5Sound {
+
+/*
+archive layout, native byte order
+0	CHeader
+	CChunk[chunks], sorted by nothing in particular
+	uint32 chunk indices of all entries in turn, padded to 8 bytes
+	CStoreEntry[entries]
+	compressed chunks, at the offsets of the chunk table
+
+a compressed chunk is a run of sequences, each a token byte whose high
+nibble is a literal count and low nibble a match length - 4, either one
+continued by bytes up to 255 while it is 15; then the literals, then the
+match offset back into the output as 2 bytes; the last sequence has
+literals only
+*/
+
+struct CChunkStore::CHeader {
+	char magic[4];
+	uint32_t version;
+	uint32_t entries;
+	uint32_t chunks;
+	uint64_t refs;
+	uint64_t dataSize;
+};
+
+struct CChunkStore::CChunk {
+	uint64_t offset;	// from the start of the compressed data
+	uint64_t hash;		// FNV-1a of the raw bytes
+	uint32_t size;
+	uint32_t rawSize;
+};
+
+namespace {
+	const uint32_t VERSION = 1u;
+
+	// content-defined cuts on a gear hash over the last 64 bytes: about
+	// 1 KB on average between the bounds, so that a shifted loop or a
+	// shared tail falls into the same chunks
+	const size_t MIN_CHUNK = 0x100u;
+	const size_t MAX_CHUNK = 0x2000u;
+	const int CUT_BITS = 10;
+
+	const size_t MIN_MATCH = 4u;
+	const size_t MAX_OFFSET = 0xFFFFu;
+	const int HASH_BITS = 12;
+
+	size_t Cut(const uint8_t *p, size_t n) {
+		static const auto GEAR = [] {
+			std::vector<uint64_t> t(256);
+			uint64_t x = 0u;
+			for (auto &g : t) {
+				// splitmix64
+				uint64_t z = (x += 0x9E3779B97F4A7C15ull);
+				z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+				z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+				g = z ^ (z >> 31);
+			}
+			return t;
+		}();
+		if (n <= MIN_CHUNK)
+			return n;
+		const size_t end = std::min(n, MAX_CHUNK);
+		uint64_t h = 0u;
+		for (size_t i = MIN_CHUNK; i < end; ++i) {
+			h = (h << 1) + GEAR[p[i]];
+			if (!(h >> (64 - CUT_BITS)))
+				return i + 1u;
+		}
+		return end;
+	}
+
+	void PutLength(std::vector<uint8_t> &out, size_t n) {
+		for (; n >= 0xFFu; n -= 0xFFu)
+			out.push_back(0xFFu);
+		out.push_back(static_cast<uint8_t>(n));
+	}
+
+	void Compress(const uint8_t *src, size_t n, std::vector<uint8_t> &out) {
+		out.clear();
+		std::vector<uint32_t> table(size_t {1} << HASH_BITS, 0xFFFFFFFFu);
+		size_t anchor = 0u, i = 0u;
+		const auto emit = [&] (size_t literals, size_t offset, size_t match) {
+			const size_t m = match ? match - MIN_MATCH : 0u;
+			out.push_back(static_cast<uint8_t>((std::min<size_t>(literals, 15u) << 4) | std::min<size_t>(m, 15u)));
+			if (literals >= 15u)
+				PutLength(out, literals - 15u);
+			out.insert(out.end(), src + anchor, src + anchor + literals);
+			if (!match)
+				return;
+			out.push_back(static_cast<uint8_t>(offset));
+			out.push_back(static_cast<uint8_t>(offset >> 8));
+			if (m >= 15u)
+				PutLength(out, m - 15u);
+		};
+		while (i + MIN_MATCH <= n) {
+			uint32_t v;
+			memcpy(&v, src + i, 4u);
+			uint32_t &slot = table[(v * 2654435761u) >> (32 - HASH_BITS)];
+			const uint32_t cand = slot;
+			slot = static_cast<uint32_t>(i);
+			if (cand == 0xFFFFFFFFu || i - cand > MAX_OFFSET || memcmp(src + cand, src + i, MIN_MATCH)) {
+				++i;
+				continue;
+			}
+			size_t len = MIN_MATCH;
+			while (i + len < n && src[cand + len] == src[i + len])
+				++len;
+			emit(i - anchor, i - cand, len);
+			i += len;
+			anchor = i;
+		}
+		if (anchor < n)
+			emit(n - anchor, 0u, 0u);
+	}
+
+	void Decompress(const uint8_t *src, size_t n, size_t rawSize, std::vector<uint8_t> &out) {
+		out.clear();
+		out.reserve(rawSize);
+		const uint8_t *const end = src + n;
+		const auto fail = [] {
+			throw std::runtime_error {"Corrupt chunk in the archive"};
+		};
+		const auto length = [&] (size_t x) {
+			if (x == 15u)
+				for (uint8_t b = 0xFFu; b == 0xFFu; x += b) {
+					if (src == end)
+						fail();
+					b = *src++;
+				}
+			return x;
+		};
+		while (out.size() < rawSize) {
+			if (src == end)
+				fail();
+			const uint8_t token = *src++;
+			const size_t literals = length(token >> 4);
+			if (static_cast<size_t>(end - src) < literals || out.size() + literals > rawSize)
+				fail();
+			out.insert(out.end(), src, src + literals);
+			src += literals;
+			if (out.size() == rawSize)
+				break;
+			if (end - src < 2)
+				fail();
+			const size_t offset = src[0] | (src[1] << 8);
+			src += 2;
+			const size_t match = length(token & 0x0F) + MIN_MATCH;
+			if (!offset || offset > out.size() || out.size() + match > rawSize)
+				fail();
+			for (size_t i = out.size() - offset, j = 0; j < match; ++j)
+				out.push_back(out[i + j]);
+		}
+	}
+
+	uint64_t Hash(const uint8_t *data, size_t size) {
+		return CHash64 {}.Add(data, size).Value();
+	}
+
+	size_t Align8(size_t x) {
+		return (x + 7u) & ~size_t {7};
+	}
+}
+
+CChunkStore::CChunkStore(const char *fname) {
+	const int fd = open(fname, O_RDONLY);
+	if (fd < 0)
+		throw std::runtime_error {std::string {"Cannot open "} + fname};
+	struct stat st;
+	if (fstat(fd, &st) || static_cast<size_t>(st.st_size) < sizeof(CHeader)) {
+		close(fd);
+		throw std::runtime_error {std::string {"Not an archive: "} + fname};
+	}
+	size_ = st.st_size;
+	map_ = mmap(nullptr, size_, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (map_ == MAP_FAILED) {
+		map_ = nullptr;
+		throw std::runtime_error {std::string {"Cannot map "} + fname};
+	}
+	const CHeader &h = Header();
+	const size_t tables = sizeof(CHeader) + h.chunks * sizeof(CChunk) + Align8(h.refs * sizeof(uint32_t)) +
+		h.entries * sizeof(CStoreEntry);
+	if (memcmp(h.magic, "MM5S", 4) || h.version != VERSION || h.refs > size_ || size_ < tables + h.dataSize) {
+		munmap(map_, size_);
+		map_ = nullptr;
+		throw std::runtime_error {std::string {"Not an archive or an older version: "} + fname};
+	}
+}
+
+CChunkStore::~CChunkStore() {
+	if (map_)
+		munmap(map_, size_);
+}
+
+const CChunkStore::CHeader &CChunkStore::Header() const {
+	return *static_cast<const CHeader *>(map_);
+}
+
+const CChunkStore::CChunk *CChunkStore::Chunks() const {
+	return reinterpret_cast<const CChunk *>(static_cast<const uint8_t *>(map_) + sizeof(CHeader));
+}
+
+size_t CChunkStore::Size() const {
+	return Header().entries;
+}
+
+const CStoreEntry *CChunkStore::begin() const {
+	const auto refs = reinterpret_cast<const uint8_t *>(Chunks() + Header().chunks);
+	return reinterpret_cast<const CStoreEntry *>(refs + Align8(Header().refs * sizeof(uint32_t)));
+}
+
+const CStoreEntry *CChunkStore::Find(const char *name) const {
+	for (const auto &x : *this)
+		if (!strncmp(x.name, name, sizeof(x.name)))
+			return &x;
+	return nullptr;
+}
+
+uint32_t CChunkStore::Ref(uint32_t i) const {
+	if (i >= Header().refs)
+		throw std::runtime_error {"Corrupt chunk list in the archive"};
+	uint32_t x;
+	memcpy(&x, reinterpret_cast<const uint8_t *>(Chunks() + Header().chunks) + i * sizeof(uint32_t), sizeof(x));
+	if (x >= Header().chunks)
+		throw std::runtime_error {"Corrupt chunk list in the archive"};
+	return x;
+}
+
+void CChunkStore::Chunk(uint32_t i, std::vector<uint8_t> &out) const {
+	const CChunk &c = Chunks()[i];
+	const uint8_t *data = reinterpret_cast<const uint8_t *>(end());
+	if (c.offset > Header().dataSize || c.size > Header().dataSize - c.offset)
+		throw std::runtime_error {"Corrupt chunk table in the archive"};
+	Decompress(data + c.offset, c.size, c.rawSize, out);
+}
+
+void CChunkStore::Read(const CStoreEntry &entry, std::vector<uint8_t> &out) const {
+	out.clear();
+	out.reserve(entry.size);
+	Stream(entry, [&out] (const uint8_t *data, size_t size) {
+		out.insert(out.end(), data, data + size);
+	});
+}
+
+void CChunkStore::ReadTrace(const CStoreEntry &entry, CTrace &trace) const {
+	if (entry.kind != CStoreEntry::TRACE)
+		throw std::runtime_error {std::string {"Not a trace: "} + entry.name};
+	std::vector<uint8_t> data;
+	Read(entry, data);
+	FILE *f = fmemopen(data.data(), data.size(), "rb");
+	if (!f)
+		throw std::runtime_error {"Cannot read a trace from memory"};
+	try {
+		trace.Load(f);
+	}
+	catch (...) {
+		fclose(f);
+		throw;
+	}
+	fclose(f);
+}
+
+bool CChunkStore::Verify(const CStoreEntry &entry) const {
+	CHash64 h;
+	uint64_t size = 0u;
+	Stream(entry, [&] (const uint8_t *data, size_t n) {
+		h.Add(data, n);
+		size += n;
+	});
+	return size == entry.size && h.Value() == entry.hash;
+}
+
+CStoreStats CChunkStore::Stats() const {
+	CStoreStats s;
+	s.entries = Header().entries;
+	s.chunks = Header().chunks;
+	s.file = size_;
+	for (const auto &x : *this) {
+		s.refs += x.chunks;
+		s.logical += x.size;
+	}
+	for (uint32_t i = 0; i < s.chunks; ++i) {
+		s.unique += Chunks()[i].rawSize;
+		s.stored += Chunks()[i].size;
+	}
+	return s;
+}
+
+CChunkWriter::CChunkWriter(const char *fname) : fname_(fname) {
+	if (access(fname, F_OK))
+		return;
+	const CChunkStore store {fname};
+	const uint8_t *data = reinterpret_cast<const uint8_t *>(store.end());
+	for (uint32_t i = 0; i < store.Header().chunks; ++i) {
+		const auto &c = store.Chunks()[i];
+		if (c.offset > store.Header().dataSize || c.size > store.Header().dataSize - c.offset)
+			throw std::runtime_error {"Corrupt chunk table in the archive"};
+		chunks_.push_back({c.hash, c.rawSize, {data + c.offset, data + c.offset + c.size}, 0u});
+		byHash_.emplace(c.hash, i);
+	}
+	for (const auto &x : store) {
+		std::vector<uint32_t> list;
+		for (uint32_t i = 0; i < x.chunks; ++i) {
+			list.push_back(store.Ref(x.firstRef + i));
+			++chunks_[list.back()].refs;
+		}
+		entries_.push_back(x);
+		lists_.push_back(std::move(list));
+	}
+}
+
+void CChunkWriter::Add(const char *name, const uint8_t *data, size_t size) {
+	Add(name, CStoreEntry::RAW, 0u, 0u, data, size);
+}
+
+void CChunkWriter::AddTrace(const char *name, const CTrace &trace, uint8_t track, uint8_t region) {
+	char *buf = nullptr;
+	size_t size = 0u;
+	FILE *f = open_memstream(&buf, &size);
+	if (!f)
+		throw std::runtime_error {"Cannot write a trace to memory"};
+	trace.Save(f);
+	fclose(f);
+	std::unique_ptr<char, decltype(&free)> hold {buf, &free};
+	Add(name, CStoreEntry::TRACE, track, region, reinterpret_cast<const uint8_t *>(buf), size);
+}
+
+void CChunkWriter::Add(const char *name, CStoreEntry::kind_t kind, uint8_t track, uint8_t region,
+	const uint8_t *data, size_t size)
+{
+	CStoreEntry e { };
+	if (strlen(name) >= sizeof(e.name))
+		throw std::runtime_error {std::string {"Entry name too long: "} + name};
+	strcpy(e.name, name);
+	e.kind = kind;
+	e.track = track;
+	e.region = region;
+	e.size = size;
+	e.hash = Hash(data, size);
+
+	std::vector<uint32_t> list;
+	for (size_t pos = 0; pos < size; ) {
+		const size_t n = Cut(data + pos, size - pos);
+		list.push_back(Insert(data + pos, n));
+		pos += n;
+	}
+	e.chunks = static_cast<uint32_t>(list.size());
+
+	const auto old = std::find_if(entries_.begin(), entries_.end(),
+		[name] (const CStoreEntry &x) { return !strcmp(x.name, name); });
+	if (old != entries_.end()) {
+		auto &oldList = lists_[old - entries_.begin()];
+		Release(oldList);
+		*old = e;
+		oldList = std::move(list);
+	}
+	else {
+		entries_.push_back(e);
+		lists_.push_back(std::move(list));
+	}
+}
+
+uint32_t CChunkWriter::Insert(const uint8_t *data, size_t size) {
+	const uint64_t hash = Hash(data, size);
+	const auto range = byHash_.equal_range(hash);
+	for (auto p = range.first; p != range.second; ++p) {
+		CChunk &c = chunks_[p->second];
+		if (c.rawSize != size)
+			continue;
+		// equal hashes are compared in full
+		Decompress(c.data.data(), c.data.size(), c.rawSize, scratch_);
+		if (!memcmp(scratch_.data(), data, size)) {
+			++c.refs;
+			return p->second;
+		}
+	}
+	CChunk c {hash, static_cast<uint32_t>(size), { }, 1u};
+	Compress(data, size, c.data);
+	chunks_.push_back(std::move(c));
+	byHash_.emplace(hash, static_cast<uint32_t>(chunks_.size() - 1u));
+	return static_cast<uint32_t>(chunks_.size() - 1u);
+}
+
+void CChunkWriter::Release(const std::vector<uint32_t> &chunks) {
+	for (uint32_t i : chunks)
+		--chunks_[i].refs;
+}
+
+void CChunkWriter::Save() {
+	// chunks that are still used, renumbered
+	std::vector<uint32_t> index(chunks_.size(), 0xFFFFFFFFu);
+	std::vector<CChunkStore::CChunk> table;
+	uint64_t offset = 0u;
+	for (size_t i = 0; i < chunks_.size(); ++i) {
+		const CChunk &c = chunks_[i];
+		if (!c.refs)
+			continue;
+		index[i] = static_cast<uint32_t>(table.size());
+		table.push_back({offset, c.hash, static_cast<uint32_t>(c.data.size()), c.rawSize});
+		offset += c.data.size();
+	}
+	std::vector<uint32_t> refs;
+	std::vector<CStoreEntry> entries = entries_;
+	for (size_t i = 0; i < entries.size(); ++i) {
+		entries[i].firstRef = static_cast<uint32_t>(refs.size());
+		for (uint32_t x : lists_[i])
+			refs.push_back(index[x]);
+	}
+
+	CChunkStore::CHeader h;
+	memcpy(h.magic, "MM5S", 4);
+	h.version = VERSION;
+	h.entries = static_cast<uint32_t>(entries.size());
+	h.chunks = static_cast<uint32_t>(table.size());
+	h.refs = refs.size();
+	h.dataSize = offset;
+
+	const std::string tmp = fname_ + ".tmp";
+	FILE *f = fopen(tmp.c_str(), "wb");
+	if (!f)
+		throw std::runtime_error {"Cannot write " + tmp};
+	fwrite(&h, sizeof(h), 1, f);
+	fwrite(table.data(), sizeof(table[0]), table.size(), f);
+	fwrite(refs.data(), sizeof(uint32_t), refs.size(), f);
+	static const uint8_t PAD[8] = { };
+	fwrite(PAD, 1, Align8(refs.size() * sizeof(uint32_t)) - refs.size() * sizeof(uint32_t), f);
+	fwrite(entries.data(), sizeof(CStoreEntry), entries.size(), f);
+	for (const auto &c : chunks_)
+		if (c.refs)
+			fwrite(c.data.data(), 1, c.data.size(), f);
+	if (ferror(f) | fclose(f) || rename(tmp.c_str(), fname_.c_str()))
+		throw std::runtime_error {"Cannot write " + fname_};
+}
+
+} // namespace MM5Sound
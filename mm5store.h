@@ -0,0 +1,122 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace MM5Sound {
+
+class CTrace;
+
+struct CStoreEntry {
+	enum kind_t : uint8_t {
+		RAW,		// any bytes, e.g. a WAV file
+		TRACE,		// a binary trace as in CTrace::Save
+	};
+
+	char name[48];		// NUL-terminated
+	kind_t kind;
+	uint8_t track;		// traces only, for their INIT line
+	uint8_t region;
+	uint8_t reserved;
+	uint32_t firstRef;	// into the chunk list
+	uint32_t chunks;
+	uint64_t size;		// bytes once reassembled
+	uint64_t hash;		// FNV-1a of those bytes
+};
+
+struct CStoreStats {
+	uint32_t entries = 0u;
+	uint32_t chunks = 0u;		// unique
+	uint64_t refs = 0u;			// chunks over all entries
+	uint64_t logical = 0u;		// bytes of all entries
+	uint64_t unique = 0u;		// bytes of the unique chunks
+	uint64_t stored = 0u;		// the same, compressed
+	uint64_t file = 0u;			// archive size with all tables
+
+	double DedupRatio() const { return unique ? static_cast<double>(logical) / unique : 0.; }
+	double CompressionRatio() const { return stored ? static_cast<double>(unique) / stored : 0.; }
+};
+
+// archive of traces and renders, read-only and memory-mapped; entries are
+// cut into content-defined chunks, each unique chunk is stored once,
+// compressed, and an entry is a list of chunks decompressed one at a time
+class CChunkStore {
+public:
+	explicit CChunkStore(const char *fname);
+	~CChunkStore();
+	CChunkStore(const CChunkStore &) = delete;
+	CChunkStore &operator=(const CChunkStore &) = delete;
+
+	size_t Size() const;
+	const CStoreEntry *begin() const;
+	const CStoreEntry *end() const { return begin() + Size(); }
+	// nullptr if there is no such entry
+	const CStoreEntry *Find(const char *name) const;
+
+	// calls f(data, size) for each chunk of the entry in order; the data is
+	// valid until f returns
+	template <class F>
+	void Stream(const CStoreEntry &entry, F f) const {
+		std::vector<uint8_t> buf;
+		for (uint32_t i = 0; i < entry.chunks; ++i) {
+			Chunk(Ref(entry.firstRef + i), buf);
+			f(buf.data(), buf.size());
+		}
+	}
+	void Read(const CStoreEntry &entry, std::vector<uint8_t> &out) const;
+	void ReadTrace(const CStoreEntry &entry, CTrace &trace) const;
+	// reassembles every entry and checks its hash
+	bool Verify(const CStoreEntry &entry) const;
+
+	CStoreStats Stats() const;
+
+private:
+	struct CHeader;
+	struct CChunk;
+	friend class CChunkWriter;
+
+	uint32_t Ref(uint32_t i) const;
+	void Chunk(uint32_t i, std::vector<uint8_t> &out) const;
+	const CHeader &Header() const;
+	const CChunk *Chunks() const;
+
+	void *map_ = nullptr;
+	size_t size_ = 0u;
+};
+
+// builds an archive, starting from an existing one if the file exists, and
+// writes it out whole on Save; an entry added under an existing name
+// replaces it, and chunks no entry refers to any more are dropped
+class CChunkWriter {
+public:
+	explicit CChunkWriter(const char *fname);
+
+	void Add(const char *name, const uint8_t *data, size_t size);
+	void AddTrace(const char *name, const CTrace &trace, uint8_t track, uint8_t region);
+	void Save();
+
+private:
+	struct CChunk {
+		uint64_t hash;
+		uint32_t rawSize;
+		std::vector<uint8_t> data;		// compressed
+		uint32_t refs;
+	};
+
+	void Add(const char *name, CStoreEntry::kind_t kind, uint8_t track, uint8_t region,
+		const uint8_t *data, size_t size);
+	uint32_t Insert(const uint8_t *data, size_t size);
+	void Release(const std::vector<uint32_t> &chunks);
+
+	const std::string fname_;
+	std::vector<CChunk> chunks_;
+	std::unordered_multimap<uint64_t, uint32_t> byHash_;
+	std::vector<CStoreEntry> entries_;
+	std::vector<std::vector<uint32_t>> lists_;	// by entry
+	std::vector<uint8_t> scratch_;
+};
+
+} // namespace MM5Sound
@@ -0,0 +1,220 @@
+#include "mm5store.h"
+#include "mm5render.h"
+#include "mm5trace.h"
+#include "mm5rom.h"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+using namespace MM5Sound;
+
+namespace {
+
+const int TRACKS = 76;
+
+void Usage() {
+	fprintf(stderr,
+		"usage: mm5store add archive [-n prefix] file...\n"
+		"       mm5store render archive rom [-n prefix] [-t ticks] [-r regions] [-p]\n"
+		"       mm5store ls archive\n"
+		"       mm5store cat archive name\n"
+		"       mm5store check archive\n"
+		"       mm5store stats archive\n"
+		"  add imports register logs as mm5test and logs/splitter.lua write them,\n"
+		"  binary traces, and any other file as it is; render adds the trace of\n"
+		"  every track in each region, and with -p its samples; cat prints traces\n"
+		"  as register logs\n");
+}
+
+std::vector<uint8_t> ReadFile(const char *fname) {
+	FILE *f = fopen(fname, "rb");
+	if (!f)
+		throw std::runtime_error {std::string {"Cannot open "} + fname};
+	std::vector<uint8_t> data;
+	uint8_t buf[0x10000];
+	for (size_t n; (n = fread(buf, 1, sizeof(buf), f)) > 0; )
+		data.insert(data.end(), buf, buf + n);
+	fclose(f);
+	return data;
+}
+
+// a trace in either form, or false for anything else
+bool ParseTrace(std::vector<uint8_t> &data, CTrace &trace, uint8_t &track, uint8_t &region) {
+	const bool binary = data.size() >= 4u && !memcmp(data.data(), "MM5T", 4);
+	const bool text = data.size() >= 5u && (!memcmp(data.data(), "INIT(", 5) || !memcmp(data.data(), "PLAY(", 5));
+	if (!binary && !text)
+		return false;
+	FILE *f = fmemopen(data.data(), data.size(), "rb");
+	if (!f)
+		throw std::runtime_error {"Cannot read from memory"};
+	try {
+		if (binary)
+			trace.Load(f);
+		else
+			trace.LoadText(f, track, region);
+	}
+	catch (...) {
+		fclose(f);
+		throw;
+	}
+	fclose(f);
+	return true;
+}
+
+void PrintStats(const CStoreStats &s) {
+	printf("%u entries, %llu bytes in %llu chunks; %u unique chunks, %llu bytes, %llu compressed; "
+		"dedup %.2fx, compression %.2fx, %.2fx overall in a %llu-byte archive\n",
+		s.entries, static_cast<unsigned long long>(s.logical), static_cast<unsigned long long>(s.refs), s.chunks,
+		static_cast<unsigned long long>(s.unique), static_cast<unsigned long long>(s.stored),
+		s.DedupRatio(), s.CompressionRatio(), s.file ? static_cast<double>(s.logical) / s.file : 0.,
+		static_cast<unsigned long long>(s.file));
+}
+
+const char *Basename(const char *path) {
+	const char *p = strrchr(path, '/');
+	return p ? p + 1 : path;
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+	if (argc < 3) {
+		Usage();
+		return 1;
+	}
+	try {
+		const std::string cmd = argv[1];
+		const char *archive = argv[2];
+		if (cmd == "add" || cmd == "render") {
+			std::string prefix;
+			int ticks = 10800, regions = 1;
+			bool pcm = false;
+			std::vector<const char *> files;
+			for (int i = 3; i < argc; ++i) {
+				if (!strcmp(argv[i], "-p") && cmd == "render")
+					pcm = true;
+				else if (argv[i][0] == '-' && argv[i][1] && !argv[i][2] && i + 1 < argc) {
+					const char *value = argv[++i];
+					if (argv[i - 1][1] == 'n')
+						prefix = value;
+					else if (argv[i - 1][1] == 't' && cmd == "render")
+						ticks = atoi(value);
+					else if (argv[i - 1][1] == 'r' && cmd == "render")
+						regions = atoi(value);
+					else {
+						Usage();
+						return 1;
+					}
+				}
+				else
+					files.push_back(argv[i]);
+			}
+			if (files.empty() || (cmd == "render" && files.size() != 1u)) {
+				Usage();
+				return 1;
+			}
+
+			CChunkWriter writer {archive};
+			if (cmd == "add")
+				for (const char *fname : files) {
+					auto data = ReadFile(fname);
+					CTrace trace;
+					uint8_t track = 0u, region = 0u;
+					const std::string name = prefix + Basename(fname);
+					if (ParseTrace(data, trace, track, region))
+						writer.AddTrace(name.c_str(), trace, track, region);
+					else
+						writer.Add(name.c_str(), data.data(), data.size());
+				}
+			else {
+				const CSoundBank bank {files[0]};
+				const CSegmentRenderer renderer {bank};
+				for (int r = 0; r < regions; ++r)
+					for (int t = 0; t < TRACKS; ++t) {
+						// a driver error ends the trace there, samples are
+						// not kept for such tracks
+						CTrace trace {-1};
+						CTraceEngine engine {bank, &trace};
+						trace.NewFrame();
+						bool failed = false;
+						try {
+							engine.CallINIT(t, r);
+							for (int i = 0; i < ticks; ++i) {
+								trace.NewFrame();
+								engine.CallPLAY();
+							}
+						}
+						catch (std::runtime_error &) {
+							failed = true;
+						}
+						char name[48];
+						snprintf(name, sizeof(name), "%s%02X-%d.trace", prefix.c_str(), t, r);
+						writer.AddTrace(name, trace, t, r);
+						if (!pcm || failed)
+							continue;
+						CRenderJob job;
+						job.track = t;
+						job.region = r;
+						job.ticks = ticks;
+						job.pcm = true;
+						CRenderResult out;
+						renderer.RenderSerial(job, out);
+						snprintf(name, sizeof(name), "%s%02X-%d.pcm", prefix.c_str(), t, r);
+						writer.Add(name, reinterpret_cast<const uint8_t *>(out.pcm.data()), out.pcm.size() * sizeof(int16_t));
+					}
+			}
+			writer.Save();
+			PrintStats(CChunkStore {archive}.Stats());
+			return 0;
+		}
+
+		const CChunkStore store {archive};
+		if (cmd == "ls" && argc == 3) {
+			for (const auto &x : store)
+				printf("%-32s %-5s %10llu bytes in %u chunks\n", x.name, x.kind == CStoreEntry::TRACE ? "trace" : "raw",
+					static_cast<unsigned long long>(x.size), x.chunks);
+		}
+		else if (cmd == "cat" && argc == 4) {
+			const CStoreEntry *e = store.Find(argv[3]);
+			if (!e)
+				throw std::runtime_error {std::string {"No entry "} + argv[3]};
+			if (e->kind == CStoreEntry::TRACE) {
+				CTrace trace;
+				store.ReadTrace(*e, trace);
+				trace.WriteText(stdout, e->track, e->region);
+			}
+			else
+				store.Stream(*e, [] (const uint8_t *data, size_t size) {
+					fwrite(data, 1, size, stdout);
+				});
+		}
+		else if (cmd == "check" && argc == 3) {
+			size_t failed = 0u;
+			for (const auto &x : store)
+				if (!store.Verify(x)) {
+					printf("%s: corrupt\n", x.name);
+					++failed;
+				}
+			PrintStats(store.Stats());
+			if (failed) {
+				printf("%zu entries failed.\n", failed);
+				return 1;
+			}
+			printf("All entries verified.\n");
+		}
+		else if (cmd == "stats" && argc == 3)
+			PrintStats(store.Stats());
+		else {
+			Usage();
+			return 1;
+		}
+		return 0;
+	}
+	catch (std::exception &e) {
+		fprintf(stderr, "%s\n", e.what());
+		return 1;
+	}
+}
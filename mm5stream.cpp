@@ -0,0 +1,228 @@
+#include "mm5stream.h"
+#include "mm5ring.h"
+#include "mm5render.h"
+#include "mm5apu.h"
+#include "mm5trace.h"
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <deque>
+#include <exception>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+#include <unistd.h>
+
+namespace MM5Sound {
+
+namespace {
+	using clock = std::chrono::steady_clock;
+
+	void Idle() {
+		std::this_thread::sleep_for(std::chrono::microseconds {200});
+	}
+
+	// little-endian, as mm5render writes both formats
+	void WriteOut(int fd, const uint16_t *data, size_t count, std::vector<uint8_t> &bytes) {
+		bytes.resize(count * 2);
+		for (size_t i = 0; i < count; ++i) {
+			bytes[i * 2] = data[i] & 0xFF;
+			bytes[i * 2 + 1] = data[i] >> 8;
+		}
+		const uint8_t *p = bytes.data();
+		for (size_t left = bytes.size(); left; ) {
+			const ssize_t n = write(fd, p, left);
+			if (n < 0) {
+				if (errno == EINTR)
+					continue;
+				throw std::runtime_error {std::string {"Cannot write stream: "} + strerror(errno)};
+			}
+			p += n;
+			left -= n;
+		}
+	}
+}
+
+CStreamer::CStreamer(const CSoundBank &bank, const CStreamConfig &config) :
+	bank_(bank), config_(config)
+{
+}
+
+CStreamStats CStreamer::Run(int fd) {
+	const CStreamConfig &cfg = config_;
+	const unsigned ahead = std::max(cfg.latency, 1u);
+	const size_t frameSize = cfg.pcm ? cfg.sampleRate / 60u + 2u : 0x40u;
+	CSPSCRing<uint16_t> ring {ahead * frameSize * 2u};
+
+	CStreamStats stats;
+	std::atomic<bool> done {false};
+	std::atomic<bool> stop {false};
+	std::atomic<uint64_t> overruns {0u};
+	std::atomic<unsigned> maxAhead {0u};
+	std::exception_ptr error;
+
+	// engine thread: one frame per tick, never more than `ahead` frames that
+	// the output has not taken in full
+	std::thread producer {[&] {
+		try {
+			CTraceEngine engine {bank_};
+			CTrace frame;
+			CAPU apu {cfg.sampleRate};
+			std::vector<int16_t> pcm;
+			std::vector<uint16_t> out;
+			std::deque<uint64_t> ends;		// ring positions where queued frames end
+			uint64_t pushed = 0u;
+
+			engine.SetTrace(&frame);
+			for (int t = -1; t < cfg.ticks && !stop; ++t) {
+				while (!stop) {
+					const uint64_t popped = ring.Popped();
+					while (!ends.empty() && ends.front() <= popped)
+						ends.pop_front();
+					if (ends.size() < ahead)
+						break;
+					Idle();
+				}
+
+				frame.Clear(0);
+				frame.NewFrame();
+				if (t < 0)
+					engine.CallINIT(cfg.track, cfg.region);
+				else
+					engine.CallPLAY();
+				out.clear();
+				if (cfg.pcm) {
+					FeedAPU(apu, frame, 0);
+					if (t >= 0) {
+						pcm.clear();
+						apu.RunFrame(&pcm);
+						out.assign(pcm.begin(), pcm.end());
+					}
+				}
+				else {
+					out.push_back(static_cast<uint16_t>(frame.FrameSize(0)));
+					out.insert(out.end(), frame.FrameData(0), frame.FrameData(0) + frame.FrameSize(0));
+				}
+
+				size_t n = ring.Push(out.data(), out.size());
+				if (n < out.size())
+					++overruns;
+				while (n < out.size() && !stop) {
+					Idle();
+					n += ring.Push(out.data() + n, out.size() - n);
+				}
+				pushed += out.size();
+				ends.push_back(pushed);
+				if (ends.size() > maxAhead)
+					maxAhead = static_cast<unsigned>(ends.size());
+			}
+		}
+		catch (...) {
+			error = std::current_exception();
+		}
+		done = true;
+	}};
+
+	// output thread, this one
+	const auto drained = [&] {
+		return done && !ring.Size();
+	};
+	try {
+		std::vector<uint16_t> buf(0x400);
+		std::vector<uint8_t> bytes;
+		if (!cfg.pcm) {
+			const uint32_t frames = cfg.ticks + 1;
+			const uint8_t header[] = {'M', 'M', '5', 'T', 0xFF, 0xFF, 0xFF, 0xFF,
+				static_cast<uint8_t>(frames), static_cast<uint8_t>(frames >> 8),
+				static_cast<uint8_t>(frames >> 16), static_cast<uint8_t>(frames >> 24)};
+			if (write(fd, header, sizeof(header)) != static_cast<ssize_t>(sizeof(header)))
+				throw std::runtime_error {"Cannot write stream header"};
+			stats.bytes += sizeof(header);
+		}
+
+		// start the clock once the engine is the full latency ahead, as an
+		// audio device would
+		while (!done && maxAhead < ahead)
+			Idle();
+		const double rate = cfg.speed * (cfg.pcm ? cfg.sampleRate : static_cast<double>(CAPU::CPU_CLOCK) / CAPU::FRAME_CYCLES);
+		const auto t0 = clock::now();
+		const auto due = [&] {
+			return static_cast<uint64_t>(std::chrono::duration<double>(clock::now() - t0).count() * rate) + 1u;
+		};
+		uint64_t units = 0u;	// samples or frames written
+		bool late = false;
+		const auto wait = [&] {
+			if (rate > 0. && !late) {
+				++stats.underruns;
+				late = true;
+			}
+			Idle();
+		};
+
+		while (!drained()) {
+			size_t want = buf.size();
+			if (rate > 0.) {
+				const uint64_t limit = due();
+				if (units >= limit) {
+					late = false;
+					Idle();
+					continue;
+				}
+				want = std::min<uint64_t>(want, limit - units);
+			}
+			if (cfg.pcm) {
+				const size_t n = ring.Pop(buf.data(), want);
+				if (!n) {
+					if (!drained())
+						wait();
+					continue;
+				}
+				WriteOut(fd, buf.data(), n, bytes);
+				units += n;
+				stats.bytes += n * 2;
+			}
+			else {
+				if (!ring.Pop(buf.data(), 1)) {
+					if (!drained())
+						wait();
+					continue;
+				}
+				const size_t count = buf[0] + 1u;
+				if (buf.size() < count)
+					buf.resize(count);
+				for (size_t n = 1; n < count; ) {
+					const size_t got = ring.Pop(buf.data() + n, count - n);
+					if (!got && done && !ring.Size())
+						throw std::runtime_error {"Stream ended within a frame"};
+					if (!got)
+						wait();
+					n += got;
+				}
+				WriteOut(fd, buf.data(), count, bytes);
+				++units;
+				stats.bytes += count * 2;
+			}
+			late = false;
+		}
+		stats.seconds = std::chrono::duration<double>(clock::now() - t0).count();
+	}
+	catch (...) {
+		stop = true;
+		producer.join();
+		throw;
+	}
+
+	producer.join();
+	if (error)
+		std::rethrow_exception(error);
+	stats.frames = cfg.ticks + 1u;
+	stats.overruns = overruns;
+	stats.maxAhead = maxAhead;
+	return stats;
+}
+
+} // namespace MM5Sound
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+
+namespace MM5Sound {
+
+class CSoundBank;
+
+struct CStreamConfig {
+	uint8_t track = 0u;
+	uint8_t region = 0u;
+	int ticks = 10800;
+	bool pcm = true;			// raw 16-bit PCM, or a binary register trace
+	uint32_t sampleRate = 44100u;
+	unsigned latency = 6u;		// frames the engine runs ahead of the output
+	double speed = 1.;			// output pace relative to real time, 0 for as fast as possible
+};
+
+struct CStreamStats {
+	uint64_t frames = 0u;
+	uint64_t bytes = 0u;
+	uint64_t underruns = 0u;	// the output was due but the buffer was short
+	uint64_t overruns = 0u;		// a frame did not fit into the buffer at once
+	unsigned maxAhead = 0u;		// most frames the engine was ahead
+	double seconds = 0.;
+};
+
+// runs the engine on its own thread, at most `latency` frames ahead of the
+// output, and writes its frames to a file descriptor at the configured pace
+// through a lock-free ring buffer; the output matches mm5render's PCM or
+// binary trace of the same track from tick 0
+class CStreamer {
+public:
+	CStreamer(const CSoundBank &bank, const CStreamConfig &config);
+
+	CStreamStats Run(int fd);
+
+private:
+	const CSoundBank &bank_;
+	const CStreamConfig config_;
+};
+
+} // namespace MM5Sound
@@ -0,0 +1,79 @@
+#include "mm5stream.h"
+#include "mm5rom.h"
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <fcntl.h>
+#include <unistd.h>
+
+using namespace MM5Sound;
+
+namespace {
+
+void Usage() {
+	fprintf(stderr,
+		"usage: mm5stream rom track [ticks] [-t] [-r rate] [-l ms] [-x speed] [-o file]\n"
+		"  streams raw 16-bit PCM, or a binary register trace with -t, to stdout or\n"
+		"  a file at real-time pace; -l sets how far the engine runs ahead, 100 ms\n"
+		"  by default, and -x the pace, 0 for as fast as possible\n");
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+	if (argc < 3) {
+		Usage();
+		return 1;
+	}
+
+	CStreamConfig cfg;
+	cfg.track = static_cast<uint8_t>(strtol(argv[2], nullptr, 0));
+	double latency = 100.;
+	const char *fname = nullptr;
+	for (int i = 3; i < argc; ++i) {
+		const bool hasValue = i + 1 < argc;
+		if (!strcmp(argv[i], "-t"))
+			cfg.pcm = false;
+		else if (!strcmp(argv[i], "-r") && hasValue)
+			cfg.sampleRate = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "-l") && hasValue)
+			latency = atof(argv[++i]);
+		else if (!strcmp(argv[i], "-x") && hasValue)
+			cfg.speed = atof(argv[++i]);
+		else if (!strcmp(argv[i], "-o") && hasValue)
+			fname = argv[++i];
+		else if (argv[i][0] != '-' && i == 3)
+			cfg.ticks = atoi(argv[i]);
+		else {
+			Usage();
+			return 1;
+		}
+	}
+	cfg.latency = static_cast<unsigned>(std::max(1., std::ceil(latency * 60.0988 / 1000.)));
+
+	int fd = STDOUT_FILENO;
+	try {
+		const CSoundBank bank {argv[1]};
+		if (fname) {
+			fd = open(fname, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+			if (fd < 0)
+				throw std::runtime_error {std::string {"Cannot write "} + fname};
+		}
+		const CStreamStats stats = CStreamer {bank, cfg}.Run(fd);
+		if (fname && close(fd))
+			throw std::runtime_error {std::string {"Cannot write "} + fname};
+		fprintf(stderr, "%llu frames, %llu bytes in %.3f s, %u frames ahead at most, "
+			"%llu underruns, %llu overruns\n",
+			static_cast<unsigned long long>(stats.frames), static_cast<unsigned long long>(stats.bytes),
+			stats.seconds, stats.maxAhead,
+			static_cast<unsigned long long>(stats.underruns), static_cast<unsigned long long>(stats.overruns));
+	}
+	catch (std::exception &e) {
+		fprintf(stderr, "%s\n", e.what());
+		return 1;
+	}
+	return 0;
+}
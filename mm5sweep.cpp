@@ -0,0 +1,241 @@
+#include "mm5sweep.h"
+#include "mm5rt.h"
+#include "mm5rom.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+namespace MM5Sound {
+
+namespace {
+	// a fork's writes are hashed, its errors counted and recovered from
+	class CForkEngine : public CRealtimeEngine {
+	public:
+		using CRealtimeEngine::CRealtimeEngine;
+
+		static uint8_t Tracks() { return TRACK_COUNT; }
+		bool SFXActive() const {
+			return sfx_currentPtr || mem_[0xCF];
+		}
+		bool MusicActive() const {
+			return std::any_of(std::begin(mus_), std::end(mus_),
+				[] (const CMusicTrack *x) { return x->patternAdr != 0u; });
+		}
+
+		uint64_t hash = 0u;
+
+	private:
+		void Output(uint16_t adr, uint8_t value) override {
+			hash = (hash ^ (adr & 0xFF)) * 0x100000001B3ull;
+			hash = (hash ^ value) * 0x100000001B3ull;
+		}
+	};
+
+	// what no later tick reads is cleared before comparing: the scratch bytes
+	// $C1 - $C4 and the registers, which every tick writes before reading,
+	// and, once no sound effect is playing, their channel memory ($0700 -
+	// $0727) and $D2 - $D5, which the next trigger resets
+	void ClearDead(CEngineState &state) {
+		memset(state.mem + 0xC1, 0, 4);
+		state.A = state.X = state.Y = 0u;
+		memset(state.mem + 0x700, 0, 0x28);
+		memset(state.mem + 0xD2, 0, 4);
+	}
+
+	bool SameState(const CEngineState &a, const CEngineState &b) {
+		if (memcmp(a.mem, b.mem, sizeof(a.mem)) || a.A != b.A || a.X != b.X || a.Y != b.Y ||
+			a.envelopePtr != b.envelopePtr || a.tickElapsed != b.tickElapsed || a.tickCounter != b.tickCounter ||
+			a.tempo != b.tempo || a.globalTrsp != b.globalTrsp || a.sfxPtr != b.sfxPtr)
+			return false;
+		for (int i = 0; i < 4; ++i) {
+			const auto &x = a.music[i], &y = b.music[i];
+			if (x.patternAdr != y.patternAdr || x.octaveFlag != y.octaveFlag || x.transpose != y.transpose ||
+				x.noteWait != y.noteWait || x.gateTime != y.gateTime || x.sustainWait != y.sustainWait ||
+				memcmp(x.loopCount, y.loopCount, sizeof(x.loopCount)))
+				return false;
+		}
+		return true;
+	}
+
+	// task indices split into one range per worker; a worker takes from the
+	// front of its own range and, once that is empty, steals the back half
+	// of another
+	class CStealQueue {
+	public:
+		CStealQueue(size_t tasks, unsigned workers) : workers_(workers), ranges_(workers) {
+			for (unsigned i = 0; i < workers; ++i) {
+				ranges_[i].begin = tasks * i / workers;
+				ranges_[i].end = tasks * (i + 1u) / workers;
+			}
+		}
+
+		bool Next(unsigned worker, size_t &task) {
+			CRange &own = ranges_[worker];
+			{
+				std::lock_guard<std::mutex> guard {own.lock};
+				if (own.begin < own.end) {
+					task = own.begin++;
+					return true;
+				}
+			}
+			for (unsigned i = 1; i < workers_; ++i) {
+				CRange &victim = ranges_[(worker + i) % workers_];
+				size_t begin, end;
+				{
+					std::lock_guard<std::mutex> guard {victim.lock};
+					if (victim.begin >= victim.end)
+						continue;
+					end = victim.end;
+					begin = victim.end -= (victim.end - victim.begin + 1u) / 2u;
+				}
+				++steals_;
+				std::lock_guard<std::mutex> guard {own.lock};
+				own.begin = begin + 1u;
+				own.end = end;
+				task = begin;
+				return true;
+			}
+			return false;
+		}
+
+		uint64_t Steals() const { return steals_; }
+
+	private:
+		struct CRange {
+			std::mutex lock;
+			size_t begin = 0u;
+			size_t end = 0u;
+			char pad[64];		// keeps workers off each other's cache lines
+		};
+
+		const unsigned workers_;
+		std::vector<CRange> ranges_;
+		std::atomic<uint64_t> steals_ {0u};
+	};
+}
+
+void CForkResult::Save(FILE *f) const {
+	uint8_t x[21];
+	for (int i = 0; i < 4; ++i)
+		x[i] = static_cast<uint8_t>(tick >> (i * 8));
+	x[4] = music;
+	x[5] = sfx;
+	x[6] = flags;
+	for (int i = 0; i < 4; ++i)
+		x[7 + i] = static_cast<uint8_t>(ticks >> (i * 8));
+	for (int i = 0; i < 8; ++i)
+		x[11 + i] = static_cast<uint8_t>(hash >> (i * 8));
+	x[19] = static_cast<uint8_t>(differs);
+	x[20] = static_cast<uint8_t>(differs >> 8);
+	fwrite(x, sizeof(x), 1, f);
+}
+
+std::vector<CForkResult> Sweep(const CSoundBank &bank, const CSweepConfig &config, CSweepStats *stats) {
+	const auto t0 = std::chrono::steady_clock::now();
+	const unsigned threads = std::max(config.threads, 1u);
+	const int every = std::max(config.every, 1);
+	const int limit = std::max(config.limit, 1);
+
+	// what each track starts, from a fresh engine
+	std::vector<uint8_t> music, sfx;
+	CEngineState fresh;
+	{
+		CForkEngine engine {bank};
+		engine.SaveState(fresh);
+		for (int t = 0; t < CForkEngine::Tracks(); ++t) {
+			engine.LoadState(fresh);
+			engine.CallINIT(t, config.region);
+			if (engine.SFXActive())
+				sfx.push_back(t);
+			else if (engine.MusicActive() && (config.music < 0 || config.music == t))
+				music.push_back(t);
+		}
+	}
+
+	std::vector<CForkResult> results;
+	std::vector<std::unique_ptr<CForkEngine>> engines;
+	for (unsigned i = 0; i < threads; ++i)
+		engines.emplace_back(new CForkEngine {bank});
+	CSweepStats s;
+	std::vector<CEngineState> states(config.ticks + limit + 1);
+	for (uint8_t m : music) {
+		// the state before every tick of the music alone
+		CForkEngine &base = *engines[0];
+		base.LoadState(fresh);
+		base.CallINIT(m, config.region);
+		for (auto &x : states) {
+			base.SaveState(x);
+			ClearDead(x);		// cleared like the forks below
+			base.CallPLAY();
+		}
+
+		const size_t forks = (config.ticks + every - 1) / every;
+		const size_t first = results.size();
+		results.resize(first + forks * sfx.size());
+		CStealQueue queue {forks * sfx.size(), threads};
+		std::atomic<uint64_t> ticks {0u};
+		const auto worker = [&] (unsigned w) {
+			CForkEngine &engine = *engines[w];
+			CEngineState now;
+			uint64_t n = 0u;
+			for (size_t i; queue.Next(w, i); ) {
+				CForkResult &r = results[first + i];
+				r.tick = static_cast<uint32_t>(i / sfx.size() * every);
+				r.music = m;
+				r.sfx = sfx[i % sfx.size()];
+				r.flags = 0u;
+				engine.LoadState(states[r.tick]);
+				engine.ClearFaults();
+				engine.hash = 0xCBF29CE484222325ull;
+				engine.CallINIT(r.sfx, config.region);
+				int t = 0;
+				while (t < limit) {
+					engine.CallPLAY();
+					++t;
+					if (!engine.SFXActive()) {
+						engine.SaveState(now);
+						ClearDead(now);
+						if (SameState(now, states[r.tick + t])) {
+							r.flags |= CForkResult::REJOINED;
+							break;
+						}
+					}
+				}
+				r.differs = 0xFFFFu;
+				if (!(r.flags & CForkResult::REJOINED)) {
+					engine.SaveState(now);
+					ClearDead(now);
+					const auto &x = states[r.tick + t].mem;
+					const auto p = std::mismatch(std::begin(now.mem), std::end(now.mem), std::begin(x));
+					if (p.first != std::end(now.mem))
+						r.differs = static_cast<uint16_t>(p.first - now.mem);
+				}
+				if (engine.Faults())
+					r.flags |= CForkResult::FAULT;
+				r.ticks = t;
+				r.hash = engine.hash;
+				n += t;
+			}
+			ticks += n;
+		};
+		std::vector<std::thread> pool;
+		for (unsigned i = 1; i < threads; ++i)
+			pool.emplace_back(worker, i);
+		worker(0u);
+		for (auto &x : pool)
+			x.join();
+		s.forks += forks * sfx.size();
+		s.ticks += ticks;
+		s.steals += queue.Steals();
+	}
+	s.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+	if (stats)
+		*stats = s;
+	return results;
+}
+
+} // namespace MM5Sound
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <vector>
+
+namespace MM5Sound {
+
+class CSoundBank;
+
+struct CSweepConfig {
+	int ticks = 3600;		// of each music track, forked over
+	int every = 8;			// ticks between forks
+	int limit = 1800;		// ticks a fork may run before it rejoins
+	unsigned threads = 1u;
+	uint8_t region = 0u;
+	int music = -1;			// one music track, or all of them
+};
+
+// one sound effect started over one music track at one tick
+struct CForkResult {
+	enum : uint8_t {
+		REJOINED = 0x01,	// back in the exact state of the music alone
+		FAULT = 0x02,		// a driver error, recovered from
+	};
+
+	uint32_t tick;
+	uint8_t music;
+	uint8_t sfx;
+	uint8_t flags;
+	uint32_t ticks;		// PLAY calls until it rejoined, or the limit
+	uint64_t hash;		// FNV-1a of the register writes from the INIT call on
+	uint16_t differs;	// unless rejoined, the first driver RAM address that
+						// differs at the limit, $FFFF for registers and variables
+
+	// 21 bytes, little-endian, in the order above
+	void Save(FILE *f) const;
+};
+
+struct CSweepStats {
+	uint64_t forks = 0u;
+	uint64_t ticks = 0u;	// PLAY calls in forks
+	uint64_t steals = 0u;	// work taken from other threads
+	double seconds = 0.;
+};
+
+// plays each music track once, keeps the driver state before every tick,
+// then for every `every`th tick and every sound effect copies that state
+// into a worker's engine, triggers the sound effect and runs it until the
+// state matches the music alone again; results come in (music, tick, sfx)
+// order whatever the thread count
+std::vector<CForkResult> Sweep(const CSoundBank &bank, const CSweepConfig &config, CSweepStats *stats = nullptr);
+
+} // namespace MM5Sound
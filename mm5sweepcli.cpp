@@ -0,0 +1,132 @@
+#include "mm5sweep.h"
+#include "mm5fingerprint.h"
+#include "mm5rom.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+using namespace MM5Sound;
+
+namespace {
+
+void Usage() {
+	fprintf(stderr,
+		"usage: mm5sweep rom [-t ticks] [-e every] [-l limit] [-j threads] [-m music] [-o file]\n"
+		"  forks each music track every -e ticks over its first -t ticks, starts\n"
+		"  every sound effect in every fork and runs it until the driver state is\n"
+		"  that of the music alone again, or for -l ticks; prints a line and a\n"
+		"  digest per music track, -o writes every fork as a 21-byte record\n");
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+	if (argc < 2) {
+		Usage();
+		return 1;
+	}
+	try {
+		CSweepConfig cfg;
+		cfg.threads = std::max(std::thread::hardware_concurrency(), 1u);
+		const char *fname = nullptr;
+		for (int i = 2; i < argc; ++i) {
+			if (i + 1 >= argc) {
+				Usage();
+				return 1;
+			}
+			const char *value = argv[++i];
+			if (!strcmp(argv[i - 1], "-t"))
+				cfg.ticks = atoi(value);
+			else if (!strcmp(argv[i - 1], "-e"))
+				cfg.every = atoi(value);
+			else if (!strcmp(argv[i - 1], "-l"))
+				cfg.limit = atoi(value);
+			else if (!strcmp(argv[i - 1], "-j"))
+				cfg.threads = std::max(atoi(value), 1);
+			else if (!strcmp(argv[i - 1], "-m"))
+				cfg.music = static_cast<int>(strtol(value, nullptr, 16));
+			else if (!strcmp(argv[i - 1], "-o"))
+				fname = value;
+			else {
+				Usage();
+				return 1;
+			}
+		}
+
+		const CSoundBank bank {argv[1]};
+		CSweepStats stats;
+		const auto results = Sweep(bank, cfg, &stats);
+
+		// per music track: how soon the forks rejoin, which never do, and a
+		// digest of every fork to compare engine builds by
+		CHash64 all;
+		uint64_t stuck = 0u, faults = 0u;
+		for (auto p = results.begin(); p != results.end(); ) {
+			const auto q = std::find_if(p, results.end(), [p] (const CForkResult &x) { return x.music != p->music; });
+			CHash64 digest;
+			uint64_t rejoined = 0u, sum = 0u, fault = 0u;
+			uint32_t most = 0u;
+			std::map<uint16_t, uint64_t> differs;
+			for (auto x = p; x != q; ++x) {
+				digest.Add(x->tick).Add(x->sfx).Add(x->flags).Add(x->ticks).Add(x->hash).Add(x->differs);
+				if (x->flags & CForkResult::REJOINED) {
+					++rejoined;
+					sum += x->ticks;
+					most = std::max(most, x->ticks);
+				}
+				else
+					++differs[x->differs];
+				fault += !!(x->flags & CForkResult::FAULT);
+			}
+			const uint64_t n = q - p;
+			printf("Music %02X: %llu forks, %llu rejoined after %.1f ticks on average, %u at most; "
+				"%llu not within %d ticks, %llu with driver errors; digest %016llX\n",
+				p->music, static_cast<unsigned long long>(n), static_cast<unsigned long long>(rejoined),
+				rejoined ? static_cast<double>(sum) / rejoined : 0., most,
+				static_cast<unsigned long long>(n - rejoined), cfg.limit, static_cast<unsigned long long>(fault),
+				static_cast<unsigned long long>(digest.Value()));
+			// where the forks that never rejoin differ, most often first
+			std::vector<std::pair<uint64_t, uint16_t>> top;
+			for (const auto &x : differs)
+				top.push_back({x.second, x.first});
+			std::sort(top.rbegin(), top.rend());
+			for (size_t i = 0; i < top.size() && i < 4u; ++i) {
+				if (top[i].second == 0xFFFFu)
+					printf("  %llu differ in registers or variables\n", static_cast<unsigned long long>(top[i].first));
+				else
+					printf("  %llu differ first at $%04X\n", static_cast<unsigned long long>(top[i].first), top[i].second);
+			}
+			all.Add(digest.Value());
+			stuck += n - rejoined;
+			faults += fault;
+			p = q;
+		}
+		printf("%llu forks, %llu ticks on %u threads in %.2f s: %.0f forks/s, %.0f ticks/s, %llu steals; "
+			"%llu not rejoined, %llu with driver errors; digest %016llX\n",
+			static_cast<unsigned long long>(stats.forks), static_cast<unsigned long long>(stats.ticks), cfg.threads,
+			stats.seconds, stats.forks / std::max(stats.seconds, 1e-9), stats.ticks / std::max(stats.seconds, 1e-9),
+			static_cast<unsigned long long>(stats.steals), static_cast<unsigned long long>(stuck),
+			static_cast<unsigned long long>(faults), static_cast<unsigned long long>(all.Value()));
+
+		if (fname) {
+			FILE *f = fopen(fname, "wb");
+			if (!f)
+				throw std::runtime_error {std::string {"Cannot write "} + fname};
+			for (const auto &x : results)
+				x.Save(f);
+			fclose(f);
+		}
+		return 0;
+	}
+	catch (std::exception &e) {
+		fprintf(stderr, "%s\n", e.what());
+		return 1;
+	}
+}
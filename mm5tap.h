@@ -0,0 +1,34 @@
+#pragma once
+
+#include "mm5sound.h"
+
+namespace MM5Sound {
+
+// engine that reports every command and note the pattern interpreter reads,
+// for the MIDI tap and the corpus index; the interpreter loop stays the
+// driver's own, so runaway patterns and halted channels end as they do there
+class CPatternTap : public CEngine {
+public:
+	using CEngine::CEngine;
+
+protected:
+	// after a pattern command has run
+	virtual void OnCommand(CMusicTrack *Chan, uint8_t cmd) { }
+	// after a note or rest, with the tie flag and note wait from before it
+	virtual void OnNote(CMusicTrack *Chan, uint8_t cmd, bool tied, uint8_t wait) { }
+
+private:
+	void CommandDispatch(uint8_t id, uint8_t fx) final {
+		CEngine::CommandDispatch(id, fx);
+		OnCommand(GetMusicTrack(id), fx);
+	}
+
+	void PlayNote(CMusicTrack *Chan, uint8_t cmd) final {
+		const bool tied = (Chan->octaveFlag & 0x80) != 0;
+		const uint8_t wait = Chan->noteWait;
+		CEngine::PlayNote(Chan, cmd);
+		OnNote(Chan, cmd, tied, wait);
+	}
+};
+
+} // namespace MM5Sound
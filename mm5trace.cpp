@@ -0,0 +1,123 @@
+#include "mm5trace.h"
+#include <stdexcept>
+#include <string>
+
+namespace MM5Sound {
+
+/*
+binary trace layout, all integers little-endian
+0	"MM5T"
+4	first tick, int32
+8	frame count, uint32
+12	frames, each a uint16 write count followed by that many value/register
+	byte pairs
+*/
+
+namespace {
+	void Put(FILE *f, uint32_t x, int bytes) {
+		for (int i = 0; i < bytes; ++i)
+			fputc((x >> (i * 8)) & 0xFF, f);
+	}
+
+	uint32_t Get(FILE *f, int bytes) {
+		uint32_t x = 0;
+		for (int i = 0; i < bytes; ++i) {
+			int c = fgetc(f);
+			if (c == EOF)
+				throw std::runtime_error {"Trace file truncated"};
+			x |= static_cast<uint32_t>(c) << (i * 8);
+		}
+		return x;
+	}
+}
+
+void CTrace::Clear(int firstTick) {
+	firstTick_ = firstTick;
+	writes_.clear();
+	ends_.clear();
+}
+
+void CTrace::Append(const CTrace &other) {
+	const size_t base = writes_.size();
+	writes_.insert(writes_.end(), other.writes_.begin(), other.writes_.end());
+	for (auto x : other.ends_)
+		ends_.push_back(base + x);
+}
+
+void CTrace::WriteText(FILE *f, uint8_t track, uint8_t region) const {
+	for (size_t i = 0; i < Frames(); ++i) {
+		const int tick = firstTick_ + static_cast<int>(i);
+		if (tick < 0)
+			fprintf(f, "INIT(%02X,%02X)\n", track, region);
+		else
+			fprintf(f, "PLAY(%d)\n", tick);
+		const uint16_t *x = FrameData(i);
+		for (size_t j = FrameSize(i); j; --j, ++x)
+			fprintf(f, "WRITE(%04X,%02X)\n", 0x4000 + (*x >> 8), *x & 0xFF);
+	}
+}
+
+void CTrace::LoadText(FILE *f, uint8_t &track, uint8_t &region) {
+	Clear(0);
+	char line[256];
+	while (fgets(line, sizeof(line), f)) {
+		unsigned x, y;
+		int tick;
+		if (sscanf(line, "INIT(%x,%x)", &x, &y) == 2) {
+			if (Frames())
+				throw std::runtime_error {"INIT after the first frame of a register log"};
+			Clear(-1);
+			NewFrame();
+			track = static_cast<uint8_t>(x);
+			region = static_cast<uint8_t>(y);
+		}
+		else if (sscanf(line, "PLAY(%d)", &tick) == 1) {
+			if (!Frames())
+				Clear(tick);
+			NewFrame();
+		}
+		else if (sscanf(line, "WRITE(%x,%x)", &x, &y) == 2) {
+			if (!Frames() || x < 0x4000u || x > 0x40FFu)
+				throw std::runtime_error {"Malformed register log"};
+			Write(static_cast<uint16_t>(x), static_cast<uint8_t>(y));
+		}
+	}
+	if (!Frames())
+		throw std::runtime_error {"Not a register log"};
+}
+
+void CTrace::Save(FILE *f) const {
+	SaveHeader(f, firstTick_, Frames());
+	SaveFrames(f);
+}
+
+void CTrace::SaveHeader(FILE *f, int firstTick, size_t frames) {
+	fputs("MM5T", f);
+	Put(f, static_cast<uint32_t>(firstTick), 4);
+	Put(f, static_cast<uint32_t>(frames), 4);
+}
+
+void CTrace::SaveFrames(FILE *f) const {
+	for (size_t i = 0; i < Frames(); ++i) {
+		Put(f, static_cast<uint32_t>(FrameSize(i)), 2);
+		const uint16_t *x = FrameData(i);
+		for (size_t j = FrameSize(i); j; --j, ++x)
+			Put(f, *x, 2);
+	}
+}
+
+void CTrace::Load(FILE *f) {
+	char magic[4];
+	if (fread(magic, 1, 4, f) != 4 || std::string(magic, 4) != "MM5T")
+		throw std::runtime_error {"Not a trace file"};
+	Clear(static_cast<int32_t>(Get(f, 4)));
+	for (uint32_t frames = Get(f, 4); frames; --frames) {
+		NewFrame();
+		for (uint32_t n = Get(f, 2); n; --n) {
+			const uint16_t x = Get(f, 2);
+			Write(0x4000 + (x >> 8), x & 0xFF);
+		}
+	}
+}
+
+} // namespace MM5Sound
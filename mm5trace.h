@@ -0,0 +1,83 @@
+#pragma once
+
+#include "mm5sound.h"
+#include <cstdio>
+#include <vector>
+
+namespace MM5Sound {
+
+// 2A03 register writes grouped by engine tick; each write is stored as
+// ((adr - $4000) << 8) | value
+class CTrace {
+public:
+	// a first tick of -1 means frame 0 holds the writes from CallINIT
+	explicit CTrace(int firstTick = 0) : firstTick_(firstTick) { }
+
+	void Clear(int firstTick);
+	void NewFrame() {
+		ends_.push_back(writes_.size());
+	}
+	void Write(uint16_t adr, uint8_t value) {
+		writes_.push_back(((adr - 0x4000) << 8) | value);
+		ends_.back() = writes_.size();
+	}
+	void Append(const CTrace &other);
+	// keeps the first frames, drops the rest
+	void Truncate(size_t frames) {
+		ends_.resize(frames);
+		writes_.resize(frames ? ends_.back() : 0u);
+	}
+
+	int FirstTick() const { return firstTick_; }
+	size_t Frames() const { return ends_.size(); }
+	size_t Writes() const { return writes_.size(); }
+	size_t FrameSize(size_t frame) const {
+		return ends_[frame] - (frame ? ends_[frame - 1] : 0);
+	}
+	const uint16_t *FrameData(size_t frame) const {
+		return writes_.data() + (frame ? ends_[frame - 1] : 0);
+	}
+	bool operator==(const CTrace &other) const {
+		return firstTick_ == other.firstTick_ && ends_ == other.ends_ && writes_ == other.writes_;
+	}
+
+	// same text as mm5test and the NSFPlay logs
+	void WriteText(FILE *f, uint8_t track, uint8_t region) const;
+	// the same text back; other lines are skipped, and the track and region
+	// of the INIT line are kept if there is one
+	void LoadText(FILE *f, uint8_t &track, uint8_t &region);
+	// binary trace, see mm5trace.cpp for the layout
+	void Save(FILE *f) const;
+	// the same in pieces, for traces streamed out a block of frames at a time
+	static void SaveHeader(FILE *f, int firstTick, size_t frames);
+	void SaveFrames(FILE *f) const;
+	void Load(FILE *f);
+
+private:
+	int firstTick_;
+	std::vector<uint16_t> writes_;
+	std::vector<size_t> ends_;
+};
+
+// engine that records its register writes into a trace
+class CTraceEngine : public CEngine {
+public:
+	explicit CTraceEngine(const CSoundBank &bank, CTrace *trace = nullptr) :
+		CEngine(bank), trace_(trace) { }
+
+	using CEngine::CallINIT;
+	using CEngine::CallPLAY;
+
+	void SetTrace(CTrace *trace) { trace_ = trace; }
+
+protected:
+	void WriteCallback(uint16_t adr, uint8_t value) override {
+		if (trace_)
+			trace_->Write(adr, value);
+	}
+
+private:
+	CTrace *trace_;
+};
+
+} // namespace MM5Sound
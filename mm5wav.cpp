@@ -0,0 +1,45 @@
+#include "mm5wav.h"
+#include <cstdio>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace MM5Sound {
+
+namespace {
+	void Put(FILE *f, uint32_t x, int bytes) {
+		for (int i = 0; i < bytes; ++i)
+			fputc((x >> (i * 8)) & 0xFF, f);
+	}
+}
+
+void WriteWAV(const char *fname, const int16_t *samples, size_t count,
+	uint32_t sampleRate, uint16_t channels)
+{
+	FILE *f = fopen(fname, "wb");
+	if (!f)
+		throw std::runtime_error {std::string {"Cannot write "} + fname};
+	const uint32_t bytes = count * 2u;
+	fputs("RIFF", f);
+	Put(f, 36u + bytes, 4);
+	fputs("WAVEfmt ", f);
+	Put(f, 16u, 4);
+	Put(f, 1u, 2); // PCM
+	Put(f, channels, 2);
+	Put(f, sampleRate, 4);
+	Put(f, sampleRate * channels * 2u, 4);
+	Put(f, channels * 2u, 2);
+	Put(f, 16u, 2);
+	fputs("data", f);
+	Put(f, bytes, 4);
+	std::vector<uint8_t> buf(bytes);
+	for (size_t i = 0; i < count; ++i) {
+		buf[i * 2] = static_cast<uint16_t>(samples[i]) & 0xFF;
+		buf[i * 2 + 1] = static_cast<uint16_t>(samples[i]) >> 8;
+	}
+	fwrite(buf.data(), 1, buf.size(), f);
+	if (fclose(f))
+		throw std::runtime_error {std::string {"Cannot write "} + fname};
+}
+
+} // namespace MM5Sound
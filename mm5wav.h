@@ -0,0 +1,12 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+
+namespace MM5Sound {
+
+// writes 16-bit PCM, interleaved if there is more than one channel
+void WriteWAV(const char *fname, const int16_t *samples, size_t count,
+	uint32_t sampleRate, uint16_t channels = 1u);
+
+} // namespace MM5Sound